@@ -0,0 +1,59 @@
+#pragma once
+#include "int.h"
+#include "entities.h"
+#include "jobs.h"
+
+//Bodies are hashed by the cell holding their centre, so cellSize must be
+//at least twice the largest body radius for neighbouring cells to cover every overlap.
+#define BROADPHASE_CHUNKS_PER_WORKER 4
+#define BROADPHASE_RADIX_BITS 8
+#define BROADPHASE_RADIX_BUCKETS (1 << BROADPHASE_RADIX_BITS)
+
+typedef struct {
+    u32 a;
+    u32 b;//Always a < b
+} BodyPair;
+
+typedef struct {
+    u32 a;
+    u32 b;
+    float depth;
+    vec3 normal;//Points from a towards b
+} BodyContact;
+
+typedef struct {
+    BodyPair *pairs;
+    u32 count;
+    u32 capacity;
+} BodyPairList;
+
+typedef struct {
+    float cellSize;
+    u32 capacity;
+
+    //Radix sorted (cell key, body) entries, double buffered for the scatter passes
+    u64 *keys;
+    u32 *bodyIdxs;
+    u64 *sortKeys;
+    u32 *sortBodyIdxs;
+    u32 *histograms;//BROADPHASE_RADIX_BUCKETS per chunk
+
+    //Open-addressed table from cell key to its run in the sorted arrays
+    u32 cellsCount;
+    u32 tableSize;
+    u64 *tableKeys;
+    u32 *tableStarts;
+    u32 *tableCounts;
+    u32 *cellStarts;//Start of each run, in sorted order
+
+    u32 chunksCount;
+    BodyPairList *chunkPairs;//Gathered per chunk, so the output order is deterministic
+
+    BodyPairList pairs;//Candidate pairs of the last update
+} BroadPhase;
+
+BroadPhase createBroadPhase(u32 capacity, float cellSize, const JobPool *jobs);
+void destroyBroadPhase(BroadPhase *bp);
+void updateBroadPhase(BroadPhase *bp, JobPool *jobs, const DynamicBodies *bodies);
+//Writes the overlapping pairs to contacts, which must hold pairsCount entries. Returns the contact count.
+u32 narrowPhaseSpheres(const DynamicBodies *bodies, const BodyPair *pairs, u32 pairsCount, BodyContact *contacts);
@@ -0,0 +1,83 @@
+#pragma once
+#include "int.h"
+#include "cglm/cglm.h"
+#include "physics.h"
+#include "sdf.h"
+
+#define COLLISION_BVH_LEAF_SIZE 2
+#define COLLISION_BVH_STACK_SIZE 64
+#define COLLISION_NO_INSTANCE UINT32_MAX
+#define COLLISION_MAX_OVERLAP_TRIANGLES 64//Per instance a sphere overlaps
+#define COLLISION_CHARACTER_RADIUS 0.5f
+#define COLLISION_SDF_CELLS_PER_VOXEL 2//Along the voxels' longest side
+#define COLLISION_SDF_BAND_CELLS 8
+
+typedef struct {
+    Box bounds;
+    u32 first;//Left child for inner nodes, the right child follows it. First entry of instanceOrder for leaves
+    u32 count;//Instances in a leaf, 0 for inner nodes
+} BvhNode;
+
+typedef struct {
+    u32 meshIdx;
+    mat4 transform;//Model to world
+    mat4 invTransform;
+    float minScale;//Shortest axis of the transform
+    Box bounds;//World space
+} CollisionInstance;
+
+//Two level structure: meshes are voxelised once in model space, and a BVH over
+//the world bounds of their instances is refitted as instances move.
+typedef struct {
+    Voxels *meshes;
+    Box *meshBounds;
+    OverlapScratch *meshScratches;//Only for queries on the main thread
+    SdfVolume *meshSdfs;
+    u32 meshesCount;
+    u32 meshesCapacity;
+
+    CollisionInstance *instances;
+    u32 instancesCount;
+    u32 instancesCapacity;
+
+    u32 *instanceOrder;//Instances grouped by leaf
+    BvhNode *nodes;//Children always come after their parent
+    u32 nodesCount;
+    bool dirty;//An instance has moved since the last build or refit
+} CollisionWorld;
+
+typedef struct {
+    RayHit hit;//Normal is in world space
+    u32 instanceIdx;
+} WorldRayHit;
+
+CollisionWorld createCollisionWorld(u32 meshesCapacity, u32 instancesCapacity);
+void destroyCollisionWorld(CollisionWorld *world);
+//The world takes ownership of the voxel data, and bakes the mesh's SDF
+u32 addCollisionMesh(CollisionWorld *world, JobPool *jobs, Voxels meshVoxels);
+u32 addCollisionInstance(CollisionWorld *world, u32 meshIdx, mat4 transform);
+//Call refitCollisionWorld once all moved instances have been updated. An unchanged
+//transform leaves the world as it was.
+void setCollisionInstanceTransform(CollisionWorld *world, u32 instanceIdx, mat4 transform);
+void buildCollisionWorld(CollisionWorld *world);
+//Does nothing unless an instance has moved
+void refitCollisionWorld(CollisionWorld *world);
+//Casts count rays, each through raycastBatch in the model space of the instances it
+//reaches. skipInstanceIdx is never hit, so a body can cast from inside its own instance.
+//COLLISION_NO_INSTANCE tests every instance.
+void raycastCollisionWorld(
+    JobPool *jobs,
+    const CollisionWorld *world,
+    u32 count,
+    const vec3 origins[],
+    const vec3 dirs[],
+    const float maxDists[],
+    u32 skipInstanceIdx,
+    WorldRayHit outHits[]);
+//Writes the offset moving the sphere out of the triangles it overlaps, of every instance
+//but skipInstanceIdx. Instances the SDF shows to be clear are skipped, and a centre
+//behind an instance's surface leaves along its gradient. Returns false if it overlaps none.
+bool separateSphereFromCollisionWorld(CollisionWorld *world, const vec3 center, float radius, u32 skipInstanceIdx, vec3 push);
+//Moves the character by its velocity, stopping it at the first instance in the way,
+//then keeps its sphere clear of the triangles around it
+void applyCharacterWorldCollision(Character *character, JobPool *jobs, CollisionWorld *world, u32 characterInstanceIdx);
@@ -7,7 +7,8 @@ extern const char* VALIDATION_LAYERS[VALIDATION_LAYERS_COUNT];
 #define DEVICE_EXTENSIONS_COUNT 1
 extern const char* DEVICE_EXTENSIONS[DEVICE_EXTENSIONS_COUNT];
 
-#define MAX_FRAMES_IN_FLIGHT 2
+#define MAX_FRAMES_IN_FLIGHT 4//Upper bound of the frames_in_flight setting
+#define DEFAULT_FRAMES_IN_FLIGHT 2
 #define TEXTURES_DIR  "./textures/"
 #define MODELS_DIR "./models/"
 #define SHADERS_DIR "./shaders/"
@@ -21,6 +22,12 @@ typedef struct{
         u32 width;
         u32 height;
     } window;
+    struct {
+        u32 framesInFlight;//More trades latency for throughput
+        bool pipelineStatistics;//Counts the main pass' vertices, primitives and fragments
+        bool cpuCulling;//Culls with AVX on the host instead of in a compute pass
+        bool occlusionCulling;//Also culls what last frame's depth hides, on the GPU
+    } renderer;
 } UserConfig;
 
 bool loadUserConfig(const char* configFilePath, UserConfig *userConfig);
\ No newline at end of file
@@ -0,0 +1,173 @@
+#pragma once
+#include <stdio.h>
+#include <vulkan/vulkan.h>
+#include "vk_mem_alloc.h"
+#include "int.h"
+#include "config.h"
+#include "vkstate.h"
+#include "vkmemory.h"
+#include "instances.h"
+#include "model.h"
+#include "profiler.h"
+#include "hiz.h"
+
+#define CULL_WORKGROUP_SIZE 64//Matches cull.comp
+#define CULL_BATCH_MAX_COMMANDS 256//Matches cull.comp and occlude.comp
+#define CULL_BOUNDS_LANES 8//Boxes per AVX iteration
+#define CULL_BENCHMARK_INSTANCES 100000
+#define CULL_BENCHMARK_ITERATIONS 200
+#define CULL_BENCHMARK_MESHES 16
+
+typedef struct {//std430, matches CullLod in cull.comp
+    u32 indexCount;
+    u32 firstIndex;//From the start of the block
+    float error;//In model units
+} CullLod;
+
+typedef struct {//std430, matches CullMesh in cull.comp
+    s32 vertexOffset;
+    u32 firstBatch;
+    u32 firstInstance;//Its instances are contiguous
+    u32 commandsBase;//First of its first batch's commands
+    u32 lodsCount;
+    CullLod lods[MESH_MAX_LODS];
+} CullMesh;
+
+//A run of up to CULL_BATCH_MAX_COMMANDS of one mesh's instances, which are counted and
+//drawn together. Splitting meshes this finely gives the draws enough units to be
+//recorded in parallel. Batches are ordered by block, so neighbours share buffers.
+typedef struct {
+    u32 block;
+    u32 commandsBase;
+    u32 commandsCount;//Instances it covers, so the most commands it can get
+} CullBatch;
+
+//World space bounding boxes of instances as centres and half extents, with one array
+//per component so AVX tests 8 boxes at a time. The arrays are padded to a multiple
+//of 8 with boxes of no mesh.
+typedef struct {
+    float *centres[3];
+    float *extents[3];
+    float *scales;//Largest of the model's axes, which LOD errors grow by
+    u32 *meshIdxs;
+    u32 count;//Rounded up to a multiple of CULL_BOUNDS_LANES
+    u32 capacity;
+} CullBounds;
+
+//With occlusion culling, what was visible last frame gets drawn first, then the rest
+//is tested against the depth pyramid that leaves and drawn in a later pass. Each
+//phase has its own commands and counts.
+typedef enum {
+    CULL_PHASE_EARLY,//The only phase without occlusion culling
+    CULL_PHASE_LATE,
+    CULL_PHASES_COUNT
+} CullPhase;
+
+typedef enum {
+    CULLING_GPU,//In a compute pass ahead of the main pass
+    CULLING_CPU,//With AVX while the frame is built, for weak or software devices
+} CullingMode;
+
+//Frustum culls every instance, appending an indirect command for each visible one
+//to its batch's range and counting them per batch. Each frame in flight has its own commands
+//and counts. The GPU path writes them from a compute pass and draws them with
+//vkCmdDrawIndexedIndirectCount. The CPU path writes the commands straight into host
+//visible memory from the instances' bounds, and zeroes the rest of each batch's
+//range so every batch is a plain indirect draw of all its commands. It needs no
+//drawIndirectCount, and its recorded draws don't change with what is visible.
+//Occlusion culling is GPU only.
+typedef struct {
+    CullingMode mode;
+    VkDevice device;
+    VmaAllocator allocator;
+    VkDescriptorSetLayout setLayout;
+    VkDescriptorPool descriptorPool;
+    VkDescriptorSet sets[MAX_FRAMES_IN_FLIGHT][CULL_PHASES_COUNT];
+    PipelineDetails pipeline;
+    PipelineDetails occlusionPipeline;//Late phase, with the pyramid in set 1
+
+    Buffer meshes;
+    Buffer commands;
+    Buffer counts;
+    Buffer visibility;//Per instance, written by the late phase for the next frame's early one
+    VkDeviceSize commandsRegionSize;
+    VkDeviceSize countsRegionSize;
+    u32 framesCount;
+    u32 phasesCount;
+    u32 capacity;
+
+    u32 meshesCount;
+    u32 meshesCapacity;
+    u32 instancesCount;//Covered by the meshes
+    CullBatch *batches;
+    u32 batchesCount;
+    u32 batchesCapacity;//Enough for every mesh's instances to be split
+
+    CullMesh *hostMeshes;//Copy the CPU path reads
+    CullBounds bounds;//CPU path only
+    u32 *hostCounts;//CPU path only, per batch
+    u32 drawsGenerations[MAX_FRAMES_IN_FLIGHT];//Bumped when the meshes change, as recorded draws hold the old batches
+} Culling;
+
+Culling createCulling(
+    CullingMode mode,
+    VkDevice device,
+    VmaAllocator allocator,
+    const UniformRing *uniformRing,
+    const InstanceBuffer *instances,
+    u32 meshesCapacity,
+    VkDeviceSize minStorageBufferOffsetAlignment,
+    const DepthPyramid *pyramid);//Occlusion culls when given
+void destroyCulling(Culling *culling);
+//Each model is a mesh whose instances get culled and drawn. Points the instances at
+//their mesh, so call again whenever the models or their buffers change, once no
+//frame that reads the meshes is in flight.
+void setCullingMeshes(Culling *culling, const ModelInfo *models[], u32 modelsCount, InstanceBuffer *instances);
+//CPU path only. Call once the frame's slot has been waited on, with the frame's
+//planes and LOD camera, and before its instances are uploaded as their changes are
+//picked up from it.
+void cullInstances(
+    Culling *culling,
+    const InstanceBuffer *instances,
+    u32 frame,
+    const vec4 frustumPlanes[6],
+    const vec4 lodCamera);
+//GPU path only. Outside a render pass, after the frame's uniforms and instances
+//have been written. The late phase needs the pyramid built from the early draws.
+void recordCulling(
+    const Culling *culling,
+    VkCommandBuffer cmdBuffer,
+    u32 frame,
+    CullPhase phase,
+    u32 frameUniformsOffset,
+    const DepthPyramid *pyramid,
+    Profiler *profiler);
+//Inside the render pass, with the block's vertex and index buffers bound
+void recordCulledDraws(const Culling *culling, VkCommandBuffer cmdBuffer, u32 frame, CullPhase phase, u32 batch);
+
+CullBounds createCullBounds(u32 capacity);
+void destroyCullBounds(CullBounds *bounds);
+void setCullBounds(CullBounds *bounds, u32 idx, mat4 model, const vec4 boundingSphere, u32 meshIdx);
+//Appends a command for every box inside all six planes to its batch's range, at the
+//LOD lodCamera picks, counting them on from counts, which hold one per batch. A box's
+//index is its instance's. Returns the commands written.
+u32 cullBoundsAvx(
+    const CullBounds *bounds,
+    const vec4 frustumPlanes[6],
+    const vec4 lodCamera,
+    const CullMesh *meshes,
+    u32 meshesCount,
+    VkDrawIndexedIndirectCommand *commands,
+    u32 *counts);
+//One box at a time, as a reference for the AVX kernel
+u32 cullBoundsScalar(
+    const CullBounds *bounds,
+    const vec4 frustumPlanes[6],
+    const vec4 lodCamera,
+    const CullMesh *meshes,
+    u32 meshesCount,
+    VkDrawIndexedIndirectCommand *commands,
+    u32 *counts);
+//Times both kernels over instancesCount boxes scattered around a camera, and writes
+//their average per cull as a JSON line
+void benchmarkCpuCulling(u32 instancesCount, u32 iterations, FILE *out);
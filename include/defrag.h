@@ -0,0 +1,70 @@
+#pragma once
+#include <stdio.h>
+#include <vulkan/vulkan.h>
+#include "vk_mem_alloc.h"
+#include "int.h"
+#include "vkmemory.h"
+#include "residency.h"
+#include "deletion.h"
+
+#define DEFRAG_MAX_BYTES_PER_PASS (32 << 20)//Raised to the largest device buffer block
+#define DEFRAG_MAX_MOVES_PER_PASS 64
+#define DEFRAG_CHECK_INTERVAL 600//Frames between fragmentation checks while idle
+#define DEFRAG_FRAGMENTATION_THRESHOLD 0.5f
+#define DEFRAG_MIN_UNUSED_BYTES (16 << 20)//Not worth moving anything for less free space
+
+typedef enum {
+    DEFRAG_MOVE_NONE,//Owned by something that can't be moved, so ignored
+    DEFRAG_MOVE_TEXTURE,
+    DEFRAG_MOVE_BLOCK
+} DefragMoveType;
+
+//What a move replaced, destroyed once the pass's copies have completed
+typedef struct {
+    DefragMoveType type;
+    u32 owner;//Resident texture or device buffer block
+    VkImage oldImage;
+    VkImageView oldView;
+    u32 oldSlot;
+    VkBuffer oldBuffer;
+} DefragMove;
+
+//Incrementally compacts the default VMA pools. A pass is started at most once per
+//frame and its copies are submitted ahead of that frame's draws, which already use
+//the moved resources. The pass ends once that frame has completed, so the copies
+//never stall the CPU. Only resident textures and device buffer blocks are moved.
+typedef struct {
+    VkDevice device;
+    VmaAllocator allocator;
+    VkQueue queue;
+    VkCommandPool cmdPool;
+    VkCommandBuffer cmdBuffer;
+    TextureResidency *residency;
+    DeviceBufferPool *devicePool;
+    DeletionQueue *deletions;
+    FILE *out;//One JSON object per finished defragmentation
+
+    VmaDefragmentationContext context;//NULL while idle
+    VmaDefragmentationPassMoveInfo pass;
+    DefragMove moves[DEFRAG_MAX_MOVES_PER_PASS];
+    bool passPending;
+    u64 passFrame;//First frame using the moved resources
+    u32 passesCount;
+    float startFragmentation;
+    u64 lastCheckFrame;
+} Defragmenter;
+
+Defragmenter createDefragmenter(
+    VkDevice device,
+    VmaAllocator allocator,
+    VkQueue queue,
+    u32 queueFamilyIndex,
+    TextureResidency *residency,
+    DeviceBufferPool *devicePool,
+    DeletionQueue *deletions,
+    FILE *out);
+//Finishes any pending pass, so the device must be idle
+void destroyDefragmenter(Defragmenter *defrag);
+//Call once per frame after advancing the deletion queue, and before anything reads
+//texture slots or block buffers for the frame
+void updateDefragmenter(Defragmenter *defrag, u64 frame, u64 completedFrame);
@@ -0,0 +1,80 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include "vk_mem_alloc.h"
+#include "int.h"
+#include "vktextures.h"
+
+#define DELETION_QUEUE_CAPACITY 256//Initial, grows when full
+
+typedef enum {
+    DELETION_BUFFER,
+    DELETION_IMAGE,//Together with its VMA allocation
+    DELETION_UNBOUND_IMAGE,//Memory is released separately, like attachments
+    DELETION_IMAGE_VIEW,
+    DELETION_ALLOCATION,
+    DELETION_FRAMEBUFFER,
+    DELETION_PIPELINE,
+    DELETION_PIPELINE_LAYOUT,
+    DELETION_DESCRIPTOR_POOL,//Together with the sets allocated from it
+    DELETION_SWAPCHAIN,
+    DELETION_TABLE_TEXTURE
+} DeletionType;
+
+typedef struct {
+    DeletionType type;
+    u64 frame;//Last frame that may still use it
+    union {
+        struct {
+            VkBuffer handle;
+            VmaAllocation alloc;
+        } buffer;
+        struct {
+            VkImage handle;
+            VmaAllocation alloc;
+        } image;
+        VkImageView view;
+        VmaAllocation alloc;
+        VkFramebuffer framebuffer;
+        VkPipeline pipeline;
+        VkPipelineLayout pipelineLayout;
+        VkDescriptorPool descriptorPool;
+        VkSwapchainKHR swapchain;
+        u32 slot;
+    };
+} DeletionEntry;
+
+//Objects handed to the queue are tagged with the frame being recorded, and only
+//destroyed once that frame has completed on the GPU. Entries are appended in
+//frame order, so the completed ones are always at the front.
+typedef struct {
+    VkDevice device;
+    VmaAllocator allocator;
+    TextureTable *table;
+
+    DeletionEntry *entries;
+    u32 count;
+    u32 capacity;
+
+    u64 frame;
+    u64 completedFrame;
+    bool held;//Nothing is released while set, as VMA forbids freeing allocations in a defragmentation pass
+} DeletionQueue;
+
+DeletionQueue createDeletionQueue(VkDevice device, VmaAllocator allocator, TextureTable *table);
+//Releases everything still queued, so the device must be idle
+void destroyDeletionQueue(DeletionQueue *queue);
+//Call once per frame, after waiting for completedFrame. Frames are counted from 1,
+//so 0 means none have completed yet.
+void advanceDeletionQueue(DeletionQueue *queue, u64 frame, u64 completedFrame);
+
+void deferDestroyBuffer(DeletionQueue *queue, VkBuffer buffer, VmaAllocation alloc);
+void deferDestroyImage(DeletionQueue *queue, VkImage image, VmaAllocation alloc);
+void deferDestroyUnboundImage(DeletionQueue *queue, VkImage image);
+void deferDestroyImageView(DeletionQueue *queue, VkImageView view);
+void deferFreeAllocation(DeletionQueue *queue, VmaAllocation alloc);
+void deferDestroyFramebuffer(DeletionQueue *queue, VkFramebuffer framebuffer);
+void deferDestroyPipeline(DeletionQueue *queue, VkPipeline pipeline);
+void deferDestroyPipelineLayout(DeletionQueue *queue, VkPipelineLayout layout);
+void deferDestroyDescriptorPool(DeletionQueue *queue, VkDescriptorPool pool);
+void deferDestroySwapchain(DeletionQueue *queue, VkSwapchainKHR swapchain);
+void deferRemoveTableTexture(DeletionQueue *queue, u32 slot);
@@ -1,7 +1,21 @@
 #pragma once
 #include "cglm/cglm.h"
+#include "int.h"
 
 typedef struct {
     vec3 pos;
     vec3 vel_m_s;
-} Character;
\ No newline at end of file
+} Character;
+
+//Structure-of-arrays storage, so the broad phase can stream one axis at a time
+typedef struct {
+    u32 count;
+    u32 capacity;
+    float *posX;
+    float *posY;
+    float *posZ;
+    float *velX;
+    float *velY;
+    float *velZ;
+    float *radius;
+} DynamicBodies;
@@ -0,0 +1,53 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include "vk_mem_alloc.h"
+#include "int.h"
+#include "vkstate.h"
+#include "deletion.h"
+
+#define DEPTH_PYRAMID_WORKGROUP_SIZE 8//Matches pyramid.comp, in both dimensions
+#define DEPTH_PYRAMID_MAX_LEVELS 16
+
+//The farthest depth of ever coarser tiles of the depth attachment. Level 0 is the
+//power of two below the attachment's extent, so each level halves the last and a
+//bounding rectangle never covers more than 2x2 texels of the level picked for it.
+//Depth is cleared to 1 and tested with LESS, so the farthest is the largest.
+typedef struct {
+    VkDevice device;
+    VmaAllocator allocator;
+    VkSampler sampler;//Nearest, as texels are maxima that mustn't be blended
+    VkDescriptorSetLayout reduceLayout;
+    VkDescriptorSetLayout sampleLayout;//Set that tests against the pyramid bind
+    PipelineDetails reducePipeline;
+
+    //Recreated along with the depth attachment
+    VkImage image;
+    VmaAllocation alloc;
+    VkImageView levelViews[DEPTH_PYRAMID_MAX_LEVELS];//Stored to by the reduction
+    VkImageView view;//Every level, for sampling
+    VkDescriptorPool descriptorPool;
+    VkDescriptorSet reduceSets[DEPTH_PYRAMID_MAX_LEVELS];
+    VkDescriptorSet sampleSet;
+    VkExtent2D extent;//Of level 0
+    VkExtent2D depthExtent;
+    u32 levelsCount;
+    u32 depthSamples;
+} DepthPyramid;
+
+//The depth attachment must be multisampled and not transient
+DepthPyramid createDepthPyramid(
+    VkDevice device,
+    VmaAllocator allocator,
+    const DeviceImage *depthImage,
+    VkSampleCountFlagBits samplingCount);
+//Call whenever the depth attachment has been recreated. Frames in flight may still
+//read the old pyramid, so it is handed to deletions.
+void resizeDepthPyramid(
+    DepthPyramid *pyramid,
+    const DeviceImage *depthImage,
+    VkSampleCountFlagBits samplingCount,
+    DeletionQueue *deletions);
+void destroyDepthPyramid(DepthPyramid *pyramid);
+//Outside a render pass, once the depth attachment is in DEPTH_STENCIL_READ_ONLY_OPTIMAL
+//and visible to compute. Leaves the pyramid in GENERAL and visible to compute reads.
+void recordDepthPyramid(const DepthPyramid *pyramid, VkCommandBuffer cmdBuffer);
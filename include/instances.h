@@ -0,0 +1,46 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include "vk_mem_alloc.h"
+#include "cglm/cglm.h"
+#include "int.h"
+#include "config.h"
+#include "vkmemory.h"
+
+#define MAX_INSTANCES (1 << 17)
+#define INSTANCE_NO_MESH UINT32_MAX//Never drawn by GPU culling
+
+typedef struct {//std430, matches InstanceData in shader.vert
+    mat4 model;
+    vec4 boundingSphere;//Model space centre and radius
+    u32 textureIdx;
+    u32 meshIdx;//Into the culling meshes
+    u32 padding[2];
+} InstanceData;
+
+//Per instance data read by gl_InstanceIndex. The CPU copy is the source of truth,
+//and each frame in flight has its own region of the mapped buffer, which only
+//gets the instances changed since that region was last written.
+typedef struct {
+    Buffer buffer;
+    VkDeviceSize regionSize;
+    u32 capacity;
+    u32 framesCount;
+
+    InstanceData *instances;
+    u32 instancesCount;
+    u32 dirtyStart[MAX_FRAMES_IN_FLIGHT];
+    u32 dirtyEnd[MAX_FRAMES_IN_FLIGHT];
+} InstanceBuffer;
+
+InstanceBuffer createInstanceBuffer(
+    VmaAllocator allocator,
+    u32 capacity,
+    u32 framesCount,
+    VkDeviceSize minOffsetAlignment);
+void destroyInstanceBuffer(VmaAllocator allocator, InstanceBuffer *instances);
+//Instances of one mesh must be contiguous to be drawn together. Returns the first.
+u32 reserveInstances(InstanceBuffer *instances, u32 count);
+void setInstance(InstanceBuffer *instances, u32 instanceIdx, const InstanceData *data);
+void setInstanceTransform(InstanceBuffer *instances, u32 instanceIdx, mat4 model);
+//Call once the frame's slot has been waited on, before submitting its draws
+void uploadInstances(InstanceBuffer *instances, u32 frame);
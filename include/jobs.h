@@ -0,0 +1,37 @@
+#pragma once
+#include <pthread.h>
+#include "int.h"
+
+#define MAX_JOB_WORKERS 32
+
+//Processes the items [start, end) of a dispatch. workerIdx is in [0, workersCount)
+//and is stable for the duration of the call, so it can index per-worker scratch.
+typedef void (*JobFn)(void *ctx, u32 start, u32 end, u32 workerIdx);
+
+typedef struct JobWorker{
+    struct JobPool *pool;
+    u32 idx;
+    pthread_t thread;
+} JobWorker;
+
+typedef struct JobPool{
+    JobWorker workers[MAX_JOB_WORKERS];
+    u32 workersCount;//Includes the calling thread as worker 0
+    pthread_mutex_t mutex;
+    pthread_cond_t workReady;
+    pthread_cond_t workDone;
+    u64 generation;//Incremented for every dispatch
+    u32 busyWorkers;
+    bool quit;
+
+    JobFn fn;
+    void *ctx;
+    u32 count;
+    u32 batchSize;
+    u32 nextIdx;//Atomically claimed in batchSize steps
+} JobPool;
+
+JobPool* createJobPool(u32 workersCount);//0 picks the number of online CPUs
+void destroyJobPool(JobPool *pool);
+//Blocks until fn has been called over all of [0, count). The calling thread participates.
+void parallelFor(JobPool *pool, u32 count, u32 batchSize, JobFn fn, void *ctx);
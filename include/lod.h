@@ -0,0 +1,40 @@
+#pragma once
+#include <cglm/cglm.h>
+#include "int.h"
+
+#define MESH_MAX_LODS 4//Including the full mesh
+#define MESH_LOD_REDUCTION 0.5f//Triangles each level aims to keep of the last
+#define MESH_LOD_MIN_REDUCTION 0.85f//Levels that keep more than this aren't worth having
+#define MESH_LOD_ERROR_PIXELS 1.0f//Most a level may move the surface on screen
+
+typedef struct {
+    u32 firstIndex;//Into the mesh's indices
+    u32 indicesCount;
+    float error;//Furthest the surface may have moved from the full mesh, in model units
+} MeshLod;
+
+//Every level indexes the same vertices, so they only differ in their indices, which
+//are stored one level after another
+typedef struct {
+    u16 *indices;//free
+    u32 indicesCount;
+    MeshLod lods[MESH_MAX_LODS];
+    u32 lodsCount;
+} MeshLods;
+
+//Quadric error edge collapses towards targetIndicesCount, each moving a vertex onto
+//a neighbour so no vertices are added. Vertices sharing a position with another,
+//which is how UV seams are split, and those on open borders are never moved.
+//outIndices needs room for indicesCount. Returns the indices written, and the
+//largest error of a collapse, in model units.
+u32 simplifyMesh(
+    const vec3 *positions,
+    u32 verticesCount,
+    const u16 *indices,
+    u32 indicesCount,
+    u32 targetIndicesCount,
+    u16 *outIndices,
+    float *outError);
+//The full mesh and successively simplified levels, until one can't be reduced enough
+MeshLods generateMeshLods(const vec3 *positions, u32 verticesCount, const u16 *indices, u32 indicesCount);
+void freeMeshLods(MeshLods *lods);
@@ -3,6 +3,7 @@
 #include "vertex.h"
 #include "cgltf.h"
 #include "vkmemory.h"
+#include "lod.h"
 
 typedef struct{
     size_t elementCount;
@@ -15,14 +16,33 @@ typedef struct{
     u32 channels;
 } TextureInfo;
 
+//A model's vertices and indices share one device buffer range, laid out in that order.
+//The indices are every LOD's, one after another.
+typedef struct{
+    DeviceBufferRange range;
+    VkDeviceSize vtxOffset;//Within the range's block buffer
+    VkDeviceSize idxOffset;
+    u32 verticesCount;
+    u32 indicesCount;
+    MeshLod lods[MESH_MAX_LODS];//Indices relative to idxOffset
+    u32 lodsCount;
+} ModelBuffers;
+
 typedef struct{
     mat4 modelMatrix;
-    DeviceImage tex;
+    u32 texture;//TextureResidency handle
+    ModelBuffers buffers;
+    u32 firstInstance;//Into the scene's instance buffer
+    u32 instancesCount;
 } ModelInfo;
 
 cgltf_data* loadglTFData(const char *glbFilepath);
 //ModelInfo stageModelData(const char *glbFilePath, u8 *mappedStagingBuffer);
 ModelAttributeInfo stageModelVertexAttributes(cgltf_data *modelData, u8* stagingBuffer);
 ModelAttributeInfo stageModelIndices(cgltf_data* modelData, u8* stagingBuffer);
+//Decoded RGBA8 base color texture, to be released with stbi_image_free
+u8* loadModelTexture(cgltf_data *modelData, TextureInfo *info);
 TextureInfo stageModelTexture(cgltf_data *modelData, u8* stagingBuffer);
-void getModelMatrix(mat4 outModelMatrix, cgltf_data *modelData);
\ No newline at end of file
+void getModelMatrix(mat4 outModelMatrix, cgltf_data *modelData);
+ModelBuffers allocateModelBuffers(DeviceBufferPool *pool, u32 verticesCount, u32 indicesCount);
+void freeModelBuffers(DeviceBufferPool *pool, ModelBuffers *buffers);
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+#include "int.h"
+
+//Two level segregated fit allocator over an abstract range of offsets, so it can
+//manage memory it cannot touch, like device buffers. Sizes map to 256 bins through
+//a small float with a 3 bit mantissa, and two levels of bitmasks find the first
+//non empty bin in O(1). Freed ranges merge with free neighbours in O(1).
+//https://github.com/sebbbi/OffsetAllocator
+#define OFFSET_ALLOC_NO_SPACE UINT32_MAX
+#define OFFSET_ALLOC_MANTISSA_BITS 3
+#define OFFSET_ALLOC_MANTISSA_VALUE (1 << OFFSET_ALLOC_MANTISSA_BITS)
+#define OFFSET_ALLOC_MANTISSA_MASK (OFFSET_ALLOC_MANTISSA_VALUE - 1)
+#define OFFSET_ALLOC_TOP_BINS 32
+#define OFFSET_ALLOC_BINS_PER_LEAF 8
+#define OFFSET_ALLOC_LEAF_BINS (OFFSET_ALLOC_TOP_BINS*OFFSET_ALLOC_BINS_PER_LEAF)
+
+typedef struct {
+    u32 offset;//OFFSET_ALLOC_NO_SPACE if the allocation failed
+    u32 node;
+} OffsetAllocation;
+
+typedef struct {
+    u32 dataOffset;
+    u32 dataSize;
+    u32 binListPrev;
+    u32 binListNext;
+    u32 neighbourPrev;
+    u32 neighbourNext;
+    bool used;
+} OffsetAllocNode;
+
+typedef struct {
+    u32 size;
+    u32 freeStorage;
+
+    u32 usedBinsTop;
+    u8 usedBins[OFFSET_ALLOC_TOP_BINS];
+    u32 binIndices[OFFSET_ALLOC_LEAF_BINS];//Head node of each bin's free list
+
+    u32 maxAllocs;
+    OffsetAllocNode *nodes;
+    u32 *freeNodes;//Stack of unused node slots
+    u32 freeNodesCount;
+} OffsetAllocator;
+
+OffsetAllocator createOffsetAllocator(u32 size, u32 maxAllocs);
+void destroyOffsetAllocator(OffsetAllocator *allocator);
+OffsetAllocation offsetAlloc(OffsetAllocator *allocator, u32 size);
+void offsetFree(OffsetAllocator *allocator, OffsetAllocation allocation);
+u32 offsetAllocSize(const OffsetAllocator *allocator, OffsetAllocation allocation);
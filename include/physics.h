@@ -1,14 +1,21 @@
 #pragma once
+#include <stdio.h>
 #include "int.h"
 #include "cglm/cglm.h"
 #include "entities.h"
+#include "jobs.h"
+#include "broadphase.h"
+#include "timing.h"
 
 typedef struct{
     u8* data;
     size_t dataSize;
     size_t transformedVerticesIdx;
+    size_t triangleIdsIdx;//u32 source triangle of every stored index triplet
+    size_t trianglesIdx;//u16 source indices, three per triangle
     
     u32 storedIndicesCount;
+    u32 trianglesCount;
 
     u32 cols;
     u32 rows;
@@ -30,7 +37,98 @@ typedef struct {
     vec3 corners[2];
 } Box;
 
+#define RAYCAST_MISS UINT32_MAX
+#define RAYCAST_BATCH_SIZE 64
+
+typedef struct {
+    float dist;//In multiples of the ray direction
+    u32 triangleId;//RAYCAST_MISS if nothing was hit
+    vec3 normal;//Faces back against the ray
+} RayHit;
+
+//Where on a triangle a closest point lies. Edges run from the vertex of the same
+//index minus TRIANGLE_FEATURE_AB to the next one.
+typedef enum {
+    TRIANGLE_FEATURE_A,
+    TRIANGLE_FEATURE_B,
+    TRIANGLE_FEATURE_C,
+    TRIANGLE_FEATURE_AB,
+    TRIANGLE_FEATURE_BC,
+    TRIANGLE_FEATURE_CA,
+    TRIANGLE_FEATURE_FACE
+} TriangleFeature;
+
+#define OVERLAP_LANES 8
+
+//Per-thread dedup state for overlap queries. A triangle has been reported
+//by the current query when its stamp equals currentStamp.
+typedef struct {
+    u32 *stamps;
+    u32 trianglesCount;
+    u32 currentStamp;
+} OverlapScratch;
+
+#define BODY_STEP_HZ 60
+#define BODY_STEP_NS (SEC_TO_NS(1LL)/BODY_STEP_HZ)
+#define BODY_RESTITUTION 0.3f
+#define BODY_BENCHMARK_COUNT 10000
+#define BODY_BENCHMARK_STEPS 600
+
+//Dynamic bodies stepped at a fixed rate, colliding with each other and kept inside bounds
+typedef struct {
+    DynamicBodies bodies;
+    BroadPhase broadPhase;
+    BodyContact *contacts;//Grown to the broad phase's pairs
+    u32 contactsCapacity;
+    u32 contactsCount;//Of the last step
+    Box bounds;
+} BodySimulation;
+
+DynamicBodies createDynamicBodies(u32 capacity);
+void destroyDynamicBodies(DynamicBodies *bodies);
+u32 addDynamicBody(DynamicBodies *bodies, vec3 pos, float radius);
+void updateDynamicBodiesPhysics(DynamicBodies *bodies, s64 timeDiff_ns);
+//Pushes overlapping pairs apart and removes the velocity closing them
+void resolveBodyContacts(DynamicBodies *bodies, const BodyContact *contacts, u32 contactsCount);
+//Clamps bodies inside the box and bounces those that were leaving it
+void containDynamicBodies(DynamicBodies *bodies, const Box *bounds);
+//Adds count bodies at random inside bounds, with radii in [minRadius, maxRadius]
+void scatterDynamicBodies(DynamicBodies *bodies, u32 count, const Box *bounds, float minRadius, float maxRadius, u32 *seed);
+BodySimulation createBodySimulation(u32 capacity, float maxRadius, const Box *bounds, const JobPool *jobs);
+void destroyBodySimulation(BodySimulation *sim);
+//One BODY_STEP_NS step of integration, broad phase, narrow phase and resolution
+void stepBodySimulation(BodySimulation *sim, JobPool *jobs);
+//Steps bodiesCount bodies piling up in a box, and writes the average time of each
+//phase per step as a JSON line
+void benchmarkBodySimulation(u32 bodiesCount, u32 steps, JobPool *jobs, FILE *out);
 void updateCharacterPhysics(Character *character, s64 timeDiff_ns);
-void applyCharacterSurfaceCollision(Character *character, const Voxels *surface);
 void rayAABBIntersections(const Ray *ray, size_t nboxes, const Box boxes[], float ts[]);
-void rayAABBVoxelIntersections(const Ray *ray, const Voxels *voxels, float ts[]);
\ No newline at end of file
+void rayAABBVoxelIntersections(const Ray *ray, const Voxels *voxels, float ts[]);
+RayHit raycastVoxels(const Voxels *voxels, const vec3 origin, const vec3 dir, float maxDist);
+TriangleFeature closestPointOnTriangleFeature(const vec3 p, const vec3 a, const vec3 b, const vec3 c, vec3 closest);
+OverlapScratch createOverlapScratch(const Voxels *voxels);
+void destroyOverlapScratch(OverlapScratch *scratch);
+//Both return the number of triangle ids written, at most maxTriangles
+u32 overlapSphere(
+    const Voxels *voxels,
+    OverlapScratch *scratch,
+    const vec3 center,
+    float radius,
+    u32 outTriangleIds[],
+    u32 maxTriangles);
+u32 overlapBox(
+    const Voxels *voxels,
+    OverlapScratch *scratch,
+    const Box *box,
+    u32 outTriangleIds[],
+    u32 maxTriangles);
+void raycastBatch(
+    JobPool *jobs,
+    const Voxels *voxels,
+    u32 count,
+    const vec3 origins[],
+    const vec3 dirs[],
+    const float maxDists[],
+    float outDists[],
+    u32 outTriangleIds[],
+    vec3 outNormals[]);
\ No newline at end of file
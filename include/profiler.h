@@ -0,0 +1,90 @@
+#pragma once
+#include <stdio.h>
+#include <vulkan/vulkan.h>
+#include "int.h"
+#include "config.h"
+
+#define PROFILER_INTERVAL 300//Frames between samples
+#define PROFILER_HISTORY 256//Samples per series that averages and percentiles cover
+#define PROFILER_MAX_SCOPES 8
+#define PROFILER_MAX_SCOPES_PER_FRAME 16
+#define PROFILER_NO_SCOPE UINT32_MAX
+#define PROFILER_PIPELINE_STATISTICS (\
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |\
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |\
+    VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |\
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |\
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |\
+    VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT)
+
+//In the order the query writes them, which is by increasing flag bit
+typedef enum {
+    PIPELINE_STAT_VERTICES,
+    PIPELINE_STAT_PRIMITIVES,
+    PIPELINE_STAT_VERTEX_INVOCATIONS,
+    PIPELINE_STAT_CLIPPING_INVOCATIONS,
+    PIPELINE_STAT_CLIPPING_PRIMITIVES,//Output by clipping, so those culled aren't counted
+    PIPELINE_STAT_FRAGMENT_INVOCATIONS,
+    PIPELINE_STATS_COUNT
+} PipelineStat;
+
+//Rolling window of the latest samples, in milliseconds
+typedef struct {
+    const char *name;
+    float samples[PROFILER_HISTORY];
+    u64 samplesCount;//Including those since overwritten
+} TimingSeries;
+
+//Times the CPU frame and named GPU passes. Every pass is bracketed by timestamps in
+//the frame slot's query pool, which are read back once the slot is waited on again,
+//so never stall the frame that wrote them.
+typedef struct {
+    VkDevice device;
+    FILE *out;//One JSON object per line
+    u32 interval;
+    u64 frame;
+
+    bool gpuEnabled;//False if the queue can't write timestamps
+    float timestampPeriod;//Nanoseconds per tick
+    u64 timestampMask;//Valid bits of a timestamp
+    u32 framesCount;
+    VkQueryPool queryPools[MAX_FRAMES_IN_FLIGHT];
+    u32 scopesWritten[MAX_FRAMES_IN_FLIGHT][PROFILER_MAX_SCOPES_PER_FRAME];//Series of each query pair
+    u32 scopesWrittenCounts[MAX_FRAMES_IN_FLIGHT];
+    u32 currentSlot;
+
+    VkQueryPipelineStatisticFlags statisticFlags;//0 while disabled
+    VkQueryPool statsPools[MAX_FRAMES_IN_FLIGHT];
+    bool statsWritten[MAX_FRAMES_IN_FLIGHT];
+    u64 lastStats[PIPELINE_STATS_COUNT];//Of the latest frame read back
+    u64 statsSums[PIPELINE_STATS_COUNT];//Since the last write
+    u32 statsFrames;
+
+    TimingSeries cpuFrame;
+    TimingSeries gpuScopes[PROFILER_MAX_SCOPES];
+    u32 gpuScopesCount;
+} Profiler;
+
+Profiler createProfiler(
+    VkDevice device,
+    VkPhysicalDevice physicalDevice,
+    u32 queueFamilyIndex,
+    u32 framesCount,
+    VkQueryPipelineStatisticFlags statisticFlags,//Needs pipelineStatisticsQuery and inheritedQueries
+    FILE *out,
+    u32 interval);
+//The device must be idle
+void destroyProfiler(Profiler *profiler);
+//Call once per frame after its slot has been waited on, and before recording its
+//scopes. Collects the timestamps the slot's previous frame wrote, and every interval
+//frames writes each series' average and percentiles.
+void beginProfilerFrame(Profiler *profiler, u32 frameSlot, float cpuFrame_ms);
+//Scopes may nest, but not span command buffers submitted out of order. name must
+//outlive the profiler, and passes are told apart by it.
+u32 beginGpuScope(Profiler *profiler, VkCommandBuffer cmdBuffer, const char *name);
+void endGpuScope(Profiler *profiler, VkCommandBuffer cmdBuffer, u32 scope);
+//At most once per frame, outside a render pass. Secondaries executed in between must
+//inherit the profiler's statisticFlags.
+void beginPipelineStatistics(Profiler *profiler, VkCommandBuffer cmdBuffer);
+void endPipelineStatistics(Profiler *profiler, VkCommandBuffer cmdBuffer);
+void writeProfilerTimings(Profiler *profiler);
@@ -0,0 +1,70 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include "vk_mem_alloc.h"
+#include "int.h"
+#include "config.h"
+#include "vkmemory.h"
+#include "vktextures.h"
+#include "deletion.h"
+#include "upload.h"
+
+#define MAX_RESIDENT_TEXTURES 1024
+#define TEXTURE_MAX_MIPS 16
+#define TEXTURE_TAIL_SIZE 64//Mips this size and smaller always stay resident
+#define TEXTURE_STREAM_UPLOADS_PER_FRAME 2
+#define TEXTURE_RESIDENCY_BUDGET_FRACTION 0.9f//Of the device local heap budgets
+
+//A texture whose full RGBA8 mip chain is kept in host memory, with only the levels
+//from residentMip downwards on the device. Changing residentMip rebuilds the device
+//image in a new TextureTable slot, as frames in flight may still read the old one.
+typedef struct {
+    u8 *pixels;//Finest mip first
+    size_t mipOffsets[TEXTURE_MAX_MIPS + 1];//Last one is the total size
+    u32 width;
+    u32 height;
+    u32 mipsCount;
+    u32 tailMip;//Coarsest level residentMip can be dropped to
+    u32 residentMip;
+    u32 wantedMip;
+
+    DeviceImage image;
+    u32 slot;
+    bool moving;//Being copied by defragmentation, so its image must not be rebuilt
+
+    float footprint;//Largest on screen diameter in pixels noted this frame
+    u64 lastUsedFrame;
+} ResidentTexture;
+
+typedef struct {
+    VkDevice device;
+    VmaAllocator allocator;
+    UploadContext *uploads;
+    TextureTable *table;
+    DeletionQueue *deletions;//Replaced images and slots wait here for frames in flight
+
+    ResidentTexture *textures;
+    u32 texturesCount;
+    u32 capacity;
+
+    u64 frame;
+} TextureResidency;
+
+TextureResidency createTextureResidency(
+    VkDevice device,
+    VmaAllocator allocator,
+    UploadContext *uploads,
+    TextureTable *table,
+    DeletionQueue *deletions,
+    u32 capacity);
+void destroyTextureResidency(TextureResidency *residency);
+//Copies the pixels and records the upload of the mip tail, to be submitted by the
+//caller. Returns the texture's handle.
+u32 addResidentTexture(TextureResidency *residency, const u8 *pixels, u32 width, u32 height);
+//Changes whenever the texture's resident mips do
+u32 getResidentTextureSlot(const TextureResidency *residency, u32 texture);
+//Call for every visible user of the texture before the next update
+void noteTextureFootprint(TextureResidency *residency, u32 texture, float diameterPixels);
+//Call once per frame, after its slot has been waited on. Drops fine mips of the least
+//recently used textures while over budget, otherwise streams in the mips that last
+//frame's footprints asked for. Submits the uploads ahead of the frame's draws.
+void updateTextureResidency(TextureResidency *residency);
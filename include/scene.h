@@ -1,27 +1,46 @@
 #pragma once
 #include "model.h"
 #include "physics.h"
+#include "collision.h"
+#include "instances.h"
+#include "residency.h"
+#include "upload.h"
 
-typedef struct{
-    size_t vtxBufOffset;
-    size_t idxBufOffset;
-    size_t drawCmdsOffset;
-    size_t drawCmdsCount;
+#define MESH_VOXELS_TRIANGLES_PER_VOXEL 8
+#define MESH_VOXELS_MAX_PER_AXIS 32
+#define MESH_VOXELS_MIN_THICKNESS 0.01f//Relative to the largest extent
 
+typedef struct{
     ModelInfo surfaceModelInfo;
     ModelInfo characterModelInfo;
 
-    Voxels surfaceVoxels;
+    InstanceBuffer instances;
+    u32 characterInstance;
+
+    CollisionWorld collisionWorld;
+    u32 characterCollisionInstance;
 } SceneInfo;
 
 SceneInfo loadSceneToDevice(
     const char *surfaceFilepath, 
     const char *characterFilepath, 
-    Buffer stagingBuffer, Buffer deviceBuffer,
-    VkDevice device,
+    UploadContext *uploads, 
+    DeviceBufferPool *devicePool,
     VmaAllocator allocator,
-    VkCommandPool cmdPool,
-    VkQueue queue);
+    VkDeviceSize minStorageBufferOffsetAlignment,
+    u32 framesInFlight,
+    TextureResidency *residency,
+    JobPool *jobs);
 
-void freeSceneInfo(SceneInfo *info);
-Voxels calcSurfaceVoxels(cgltf_data *surfaceData, mat4 modelMatrix);
\ No newline at end of file
+void freeSceneInfo(SceneInfo *info, DeviceBufferPool *devicePool, VmaAllocator allocator);
+//Notes the on screen size of every instance against its model's texture
+void noteSceneTextureFootprints(
+    const SceneInfo *scene, 
+    TextureResidency *residency, 
+    mat4 view, 
+    mat4 projection, 
+    VkExtent2D extent);
+//Points instances at their textures' current slots, after residency changes
+void updateSceneTextureSlots(SceneInfo *scene, const TextureResidency *residency);
+//Model space voxels fitted to the bounds of the mesh, for use as a collision mesh
+Voxels calcMeshVoxels(cgltf_data *meshData);
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+#include "int.h"
+#include "cglm/cglm.h"
+#include "physics.h"
+#include "jobs.h"
+
+//Cells per brick edge. Bricks store their own boundary samples so
+//trilinear lookups never cross into a neighbouring brick.
+#define SDF_BRICK_SIZE 8
+#define SDF_BRICK_SAMPLES (SDF_BRICK_SIZE + 1)
+#define SDF_BRICK_SAMPLES_COUNT (SDF_BRICK_SAMPLES*SDF_BRICK_SAMPLES*SDF_BRICK_SAMPLES)
+#define SDF_EMPTY_BRICK UINT32_MAX
+
+//Sparse signed distance field. Only bricks within band of the surface are stored,
+//everything else reads as +band. Distances are negative behind the triangle faces.
+typedef struct {
+    vec3 origin;//Minimum corner
+    float cellSize;
+    float band;
+
+    u32 bricksX;
+    u32 bricksY;
+    u32 bricksZ;
+    u32 *brickIdxs;//Per brick cell, x fastest. SDF_EMPTY_BRICK if not stored
+
+    u32 bricksCount;
+    float *samples;//SDF_BRICK_SAMPLES_COUNT per stored brick, x fastest
+} SdfVolume;
+
+SdfVolume bakeSdf(JobPool *jobs, const Voxels *voxels, float cellSize, float band);
+void destroySdf(SdfVolume *sdf);
+float sampleSdf(const SdfVolume *sdf, const vec3 p);
+//Returns the distance as well, the gradient is not normalised
+float sampleSdfGradient(const SdfVolume *sdf, const vec3 p, vec3 gradient);
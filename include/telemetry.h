@@ -0,0 +1,39 @@
+#pragma once
+#include <stdio.h>
+#include <vulkan/vulkan.h>
+#include "vk_mem_alloc.h"
+#include "int.h"
+
+#define MEMORY_TELEMETRY_INTERVAL 300//Frames between samples
+
+//Stored as VMA user data, so every allocation knows what it is for
+typedef enum {
+    MEMORY_CATEGORY_MESH,
+    MEMORY_CATEGORY_TEXTURE,
+    MEMORY_CATEGORY_ATTACHMENT,
+    MEMORY_CATEGORY_STAGING,
+    MEMORY_CATEGORY_UNIFORM,
+    MEMORY_CATEGORY_STORAGE,//Shader storage, like instances, and indirect draw buffers
+    MEMORY_CATEGORIES_COUNT
+} MemoryCategory;
+
+typedef struct {
+    FILE *out;//One JSON object per line
+    u32 interval;
+    u64 frame;
+    bool budgetEnabled;//Otherwise budgets are VMA's estimates from the heap sizes
+} MemoryTelemetry;
+
+//Tags an allocation with its category and counts it towards the category's total
+void trackAllocation(VmaAllocator allocator, VmaAllocation alloc, MemoryCategory category);
+//Call before destroying a tracked allocation
+void untrackAllocation(VmaAllocator allocator, VmaAllocation alloc);
+
+//0 when all free space within blocks is one range, approaching 1 as it splits up
+float getFragmentation(const VmaDetailedStatistics *stats);
+
+MemoryTelemetry createMemoryTelemetry(FILE *out, u32 interval, bool budgetEnabled);
+//Call once per frame. Every interval frames, writes the per heap usage and budget,
+//the allocator's block statistics and the per category totals.
+void updateMemoryTelemetry(MemoryTelemetry *telemetry, VmaAllocator allocator);
+void writeMemoryTelemetry(MemoryTelemetry *telemetry, VmaAllocator allocator);
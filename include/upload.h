@@ -0,0 +1,63 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include "vk_mem_alloc.h"
+#include "int.h"
+#include "vkmemory.h"
+
+#define UPLOAD_CONTEXT_BATCHES 4//Submitted command buffers that can be pending at once
+
+typedef u64 UploadToken;//Timeline value signalled by its submit. 0 is complete from the start.
+
+typedef struct {
+    VkCommandBuffer cmdBuffer;
+    UploadToken token;//Of its last submit
+} UploadBatch;
+
+//Accumulates staging copies and their barriers into one command buffer, which is
+//submitted with a timeline signal instead of idling the queue. Staging space is
+//handed out linearly and only rewinds once every submitted batch has completed.
+//Uploads get a timeline of their own rather than the frame timeline, as they're
+//also submitted and waited on while loading, before any frame has been.
+typedef struct {
+    VkDevice device;
+    VkQueue queue;
+    VkCommandPool cmdPool;
+    VkSemaphore timeline;
+    Buffer stagingBuffer;
+    VkDeviceSize stagingHead;
+
+    UploadBatch batches[UPLOAD_CONTEXT_BATCHES];
+    u32 nextBatch;
+    bool recording;//batches[nextBatch] has commands that haven't been submitted
+    UploadToken lastToken;
+    UploadToken completedToken;
+} UploadContext;
+
+UploadContext createUploadContext(VkDevice device, VkQueue queue, u32 queueFamilyIndex, Buffer stagingBuffer);
+//Waits for all submitted uploads
+void destroyUploadContext(UploadContext *uploads);
+//Returns staging memory for the caller to fill. Its copy must be recorded before the
+//next allocation, which may submit and wait to make room.
+u8* allocateUploadStaging(UploadContext *uploads, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *stagingOffset);
+//The batch being recorded, for callers adding their own barriers and copies
+VkCommandBuffer getUploadCommandBuffer(UploadContext *uploads);
+void recordUploadBufferCopy(
+    UploadContext *uploads,
+    VkDeviceSize stagingOffset,
+    VkBuffer dstBuffer,
+    VkDeviceSize dstOffset,
+    VkDeviceSize size);
+//Copies the regions, whose buffer offsets are into the staging buffer, and leaves
+//all levels shader readable
+void recordUploadImageCopy(
+    UploadContext *uploads,
+    VkImage image,
+    u32 mipLevels,
+    const VkBufferImageCopy *regions,
+    u32 regionsCount);
+void uploadToBuffer(UploadContext *uploads, const void *data, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset);
+//Work submitted to the same queue afterwards sees the uploads without waiting.
+//Returns the last token if nothing was recorded.
+UploadToken submitUploads(UploadContext *uploads);
+bool isUploadComplete(UploadContext *uploads, UploadToken token);
+void waitForUpload(UploadContext *uploads, UploadToken token);
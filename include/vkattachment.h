@@ -1,23 +1,37 @@
 #pragma once
 #include <vulkan/vulkan.h>
 #include "vkstate.h"
+#include "deletion.h"
 
+//Memory the new image doesn't fit in is handed to deletions, or freed at once if it is NULL.
+//Attachments that aren't transient are kept after the render pass, and depth can be sampled.
 DeviceImage createDepthImage(
     VmaAllocator allocator,
     VkDevice device,
     VkPhysicalDevice physicalDevice,
     VkExtent2D extent,
-    VkSampleCountFlagBits samplingCount);
+    VkSampleCountFlagBits samplingCount,
+    bool transient,
+    AttachmentMemory *memory,
+    DeletionQueue *deletions);
 DeviceImage createSamplingImage(
     VmaAllocator allocator, 
     VkDevice device, 
     VkFormat format, 
     VkExtent2D extent,
-    VkSampleCountFlagBits samplingCount);
+    VkSampleCountFlagBits samplingCount,
+    bool transient,
+    AttachmentMemory *memory,
+    DeletionQueue *deletions);
+//Leaves the image's memory to its AttachmentMemory
+void destroyAttachmentImage(VkDevice device, DeviceImage *image);
+void retireAttachmentImage(DeletionQueue *deletions, DeviceImage *image);
+void destroyAttachmentMemory(VmaAllocator allocator, AttachmentMemory *memory);
 Framebuffers createFramebuffers(
     VkDevice device, 
     VkRenderPass renderPass, 
     const SwapchainDetails *swapchainDetails,
     VkImageView depthBufferView,
     VkImageView samplingImageView);
-void destroyFramebuffers(VkDevice device, Framebuffers *framebuffers);
\ No newline at end of file
+void destroyFramebuffers(VkDevice device, Framebuffers *framebuffers);
+void retireFramebuffers(DeletionQueue *deletions, Framebuffers *framebuffers);
\ No newline at end of file
@@ -3,37 +3,100 @@
 #include "vkstate.h"
 #include "int.h"
 #include "vkshader.h"
+#include "jobs.h"
+#include "profiler.h"
+#include "culling.h"
 
 VkCommandPool createCommandPool(VkDevice device, uint32_t queueIndex, VkCommandPoolCreateFlags createFlags);
+#define DRAW_CACHE_MAX_SLICES 64
+
+//Secondaries from one worker's pool for one frame in flight. Only that worker
+//records into them, so the pool needs no locking.
+typedef struct {
+    VkCommandPool cmdPool;
+    VkCommandBuffer cmdBuffers[DRAW_CACHE_MAX_SLICES];
+    u32 allocatedCount;
+    u32 usedCount;
+} DrawCachePool;
+
+//The culling's batches split into slices, each recorded into a secondary command buffer
+//by whichever job worker picks it up and executed in slice order. Every frame in
+//flight has its own set as each binds its frame's descriptor set. A frame's set is
+//only re-recorded once the extent, its uniforms offset, the device pool's blocks or
+//the culling's draws generation change.
+typedef struct {
+    DrawCachePool pools[MAX_FRAMES_IN_FLIGHT][MAX_JOB_WORKERS];
+    u32 framesCount;
+    u32 workersCount;
+    VkQueryPipelineStatisticFlags pipelineStatistics;//Inherited from the primary
+    VkCommandBuffer slices[MAX_FRAMES_IN_FLIGHT][DRAW_CACHE_MAX_SLICES];
+    u32 slicesCounts[MAX_FRAMES_IN_FLIGHT];
+    bool valid[MAX_FRAMES_IN_FLIGHT];
+    VkExtent2D extents[MAX_FRAMES_IN_FLIGHT];
+    u32 frameUniformsOffsets[MAX_FRAMES_IN_FLIGHT];
+    u32 poolGenerations[MAX_FRAMES_IN_FLIGHT];
+    u32 cullGenerations[MAX_FRAMES_IN_FLIGHT];
+} DrawCache;
+
+DrawCache* createDrawCache(
+    VkDevice device,
+    u32 queueFamilyIndex,
+    const JobPool *jobs,
+    u32 framesCount,
+    VkQueryPipelineStatisticFlags pipelineStatistics);
+void destroyDrawCache(VkDevice device, DrawCache *cache);
+//Slices batchesCount batches are recorded in, one per worker where there are enough
+u32 getDrawSlicesCount(u32 batchesCount, u32 workersCount);
+//Call once the frame's slot has been waited on, as that may re-record its slices.
+//Returns the slices to execute in order.
+u32 getModelDrawCommands(
+    DrawCache *cache,
+    JobPool *jobs,
+    VkDevice device,
+    u32 frame,
+    VkRenderPass renderPass,
+    PipelineDetails graphicsPipeline,
+    VkExtent2D renderArea,
+    VkDescriptorSet descriptorSet,
+    u32 frameUniformsOffset,
+    VkDescriptorSet textureSet,
+    const DeviceBufferPool *devicePool,
+    const Culling *culling,
+    CullPhase phase,
+    const VkCommandBuffer **drawCommands);
+//Culls the frame's instances, then runs the cached draws inside the render pass on
+//the framebuffer. With occlusion culling the pyramid is then built from that depth,
+//and the late phase's draws run in the later render pass. The passes are timed, and
+//the draws' pipeline statistics counted, when a profiler is given.
 void recordModelDrawCommand(
     VkCommandBuffer cmdBuffer, 
     VkRenderPass renderPass, 
+    VkRenderPass lateRenderPass,
     VkFramebuffer framebuffer, 
-    PipelineDetails graphicsPipeline,
     VkExtent2D renderArea,
-    PushConstant pushConstant,
-    VkDescriptorSet descriptorSet,
-    VkBuffer deviceBuffer,
-    size_t vertexBufferOffset,
-    size_t indexBufferOffset,
-    size_t drawCmdsOffset,
-    size_t drawCmdsCount);
+    const Culling *culling,
+    const DepthPyramid *pyramid,
+    u32 frame,
+    u32 frameUniformsOffset,
+    const VkCommandBuffer *drawCommands,
+    u32 drawCommandsCount,
+    const VkCommandBuffer *lateDrawCommands,
+    u32 lateDrawCommandsCount,
+    Profiler *profiler);
 void submitDrawCommand(
     VkQueue queue, 
     VkCommandBuffer commandBuffer, 
     VkSemaphore waitSemaphore,
     VkSemaphore signalSemaphore,
-    VkFence hostFence);
+    VkSemaphore frameTimeline,
+    u64 frame);
 VkResult presentSwapchain(
     VkQueue presentQueue, 
     VkSemaphore waitSemaphore,
     VkSwapchainKHR swapchain,
     uint32_t swapchainImageIndex);
-VkCommandBuffer beginSingleTimeCommandBuffer(VkDevice device, VkCommandPool cmdPool);
-void submitSingleTimeCommandBuffer(
-    VkDevice device, 
-    VkCommandPool cmdPool, 
-    VkCommandBuffer cmdBuffer, 
-    VkQueue queue);
 FrameSynchroniser createFrameSynchroniser(VkDevice device);
+VkSemaphore createTimelineSemaphore(VkDevice device, u64 initialValue);
+u64 getTimelineValue(VkDevice device, VkSemaphore timeline);
+void waitForTimeline(VkDevice device, VkSemaphore timeline, u64 value);
 VkCommandBuffer createPrimaryCommandBuffer(VkDevice device, VkCommandPool cmdPool);
\ No newline at end of file
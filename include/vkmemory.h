@@ -2,6 +2,11 @@
 #include <vulkan/vulkan.h>
 #include "vk_mem_alloc.h"
 #include "int.h"
+#include "offsetalloc.h"
+
+#define DEVICE_BUFFER_POOL_MAX_BLOCKS 16
+#define DEVICE_BUFFER_BLOCK_MAX_ALLOCS 4096
+#define UNIFORM_RING_FRAME_SIZE (1 << 16)
 
 typedef struct {
     VkBuffer handle;
@@ -18,42 +23,83 @@ typedef struct {
     VkFormat format;
 } DeviceImage;
 
-typedef struct MemoryTransferEssentials {
-    VkDevice device;
-    VkCommandPool cmdPool;
-    VkQueue queue;
-} MemoryTransferEssentials;
+typedef struct {
+    Buffer buffer;
+    OffsetAllocator allocator;
+    VkDeviceSize size;
+    u8 *mapped;//Set when the block landed in host visible device memory, as with ReBAR or UMA
+    bool moving;//Being copied elsewhere by defragmentation, so no new ranges go in it
+} DeviceBufferBlock;
+
+//Device buffers sub-allocated by an offset allocator, with another block
+//created whenever a request fits in none of the existing ones
+typedef struct {
+    VmaAllocator allocator;
+    VkDeviceSize blockSize;
+    u32 blocksCount;
+    DeviceBufferBlock blocks[DEVICE_BUFFER_POOL_MAX_BLOCKS];
+    u32 generation;//Changes whenever a block is added or its buffer replaced
+} DeviceBufferPool;
+
+typedef struct {
+    u32 block;
+    OffsetAllocation alloc;
+    VkDeviceSize offset;//Aligned start within the block's buffer
+    VkDeviceSize size;
+} DeviceBufferRange;
+
+//Persistently mapped uniform memory split into one region per frame in flight.
+//Chunks are handed out linearly and bound through dynamic offsets, so the
+//region can be reused as soon as its frame's slot has been waited on.
+typedef struct {
+    Buffer buffer;
+    VkDeviceSize alignment;
+    VkDeviceSize frameSize;
+    u32 framesCount;
+    u32 frame;
+    VkDeviceSize head;//Next free byte in the current frame's region
+} UniformRing;
 
-VmaAllocator createAllocator(VkDevice device, VkInstance instance, VkPhysicalDevice physicalDevice);
+VmaAllocator createAllocator(VkDevice device, VkInstance instance, VkPhysicalDevice physicalDevice, bool memoryBudget);
 VkSampler createSampler(VkDevice device, float maxAnisotropy);
+//Defragmentation recreates textures and buffers from the same create infos
+VkImageCreateInfo getDeviceTextureInfo(u32 texWidth, u32 texHeight, u32 mipLevels);
+VkImageView createDeviceTextureView(VkDevice device, VkImage image, u32 mipLevels);
 DeviceImage createDeviceTexture(
     VkDevice device, 
     VmaAllocator allocator, 
-    u32 texWidth, u32 texHeight);
+    u32 texWidth, u32 texHeight,
+    u32 mipLevels);
+VkBufferCreateInfo getDeviceBufferInfo(VkDeviceSize bufferSize);
 Buffer createDeviceBuffer(
     VmaAllocator allocator,
     VkDeviceSize bufferSize);
+DeviceBufferPool createDeviceBufferPool(
+    VmaAllocator allocator,
+    VkDeviceSize blockSize);
+void destroyDeviceBufferPool(DeviceBufferPool *pool);
+//Alignment need not be a power of two, so vertex strides can be used directly
+DeviceBufferRange allocateDeviceBufferRange(
+    DeviceBufferPool *pool,
+    VkDeviceSize size,
+    VkDeviceSize alignment);
+void freeDeviceBufferRange(DeviceBufferPool *pool, DeviceBufferRange *range);
+//Start of the range in mapped memory, or NULL if it must be written through a staging copy
+u8* mapDeviceBufferRange(const DeviceBufferPool *pool, const DeviceBufferRange *range);
+//Makes direct writes to a mapped range visible to the device
+void flushDeviceBufferRange(const DeviceBufferPool *pool, const DeviceBufferRange *range);
 Buffer createStagingBuffer(
     VmaAllocator allocator,
     VkDeviceSize bufferSize);
 Buffer createUniformBuffer(
     VmaAllocator allocator,
     VkDeviceSize bufferSize);
-void copyToDeviceBuffer(
-    size_t bytesCount,
-    VkBuffer srcBuffer,
-    size_t srcOffset,
-    VkBuffer dstBuffer,
-    size_t dstOffset,
-    VkDevice device,
-    VkCommandPool transferCmdPool,
-    VkQueue transferQueue);
-void copyToDeviceTexture(
-    VkDevice device,
-    VkImage deviceTexture,
-    VkBuffer stagingBuffer,
-    VkDeviceSize stagingBufferOffset,
-    u32 textureWidth,
-    u32 textureHeight,
-    VkCommandPool transferCmdPool,
-    VkQueue transferQueue);
\ No newline at end of file
+UniformRing createUniformRing(
+    VmaAllocator allocator,
+    VkDeviceSize frameSize,
+    u32 framesCount,
+    VkDeviceSize minOffsetAlignment);
+void destroyUniformRing(VmaAllocator allocator, UniformRing *ring);
+void beginUniformRingFrame(UniformRing *ring, u32 frame);
+//Returns the mapped chunk, and its offset from the start of the buffer for binding
+void* allocateUniformRing(UniformRing *ring, VkDeviceSize size, u32 *dynamicOffset);
\ No newline at end of file
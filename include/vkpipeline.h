@@ -2,14 +2,23 @@
 #include <vulkan/vulkan.h>
 #include "vkstate.h"
 
+//Where a pass sits in the frame. All of them are compatible, so share framebuffers and pipelines.
+typedef enum {
+    RENDER_PASS_ONLY,//Clears, and only keeps the resolve
+    RENDER_PASS_FIRST,//Clears, and keeps colour and depth for compute and a later pass
+    RENDER_PASS_LATER,//Loads what the first pass kept
+} RenderPassOrder;
+
 VkRenderPass createRenderPass(
     VkDevice device, 
     VkFormat swapchainFormat,
     VkFormat depthImageFormat,
     VkFormat samplingImageFormat,
-    VkSampleCountFlagBits samplingCount);
+    VkSampleCountFlagBits samplingCount,
+    RenderPassOrder order);
 PipelineDetails createGraphicsPipeline(
     VkDevice device, 
     VkRenderPass renderPass, 
     VkDescriptorSetLayout setLayout,
+    VkDescriptorSetLayout textureSetLayout,
     VkSampleCountFlagBits samplingCount);
\ No newline at end of file
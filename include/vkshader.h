@@ -20,10 +20,11 @@ typedef struct UniformBufferData{
     mat4 projection;
 } UniformBufferData;
 
-typedef struct PushConstant{//Max 128 bytes
-    mat4 viewProjection;//64 bytes
-    u32 textureIndex;
-} PushConstant;
+typedef struct FrameUniforms{//Matches FrameUniforms in the vertex and culling shaders
+    mat4 viewProjection;
+    vec4 frustumPlanes[6];//World space, facing inwards
+    vec4 lodCamera;//World space camera position, then on screen LOD error per unit of error over distance
+} FrameUniforms;
 
 typedef struct Matrix4{
     mat4 matrix;
@@ -37,6 +38,6 @@ typedef struct DescriptorSets{
 VkShaderModule createShaderModule(VkDevice device, uint32_t *code, size_t numBytes);
 VkDescriptorSetLayout createDescriptorSetLayout(VkDevice device);
 VkDescriptorPool createDescriptorPool(VkDevice device);
-DescriptorSets allocateDescriptorSets(VkDevice device, VkDescriptorSetLayout layout, VkDescriptorPool pool);
+DescriptorSets allocateDescriptorSets(VkDevice device, VkDescriptorSetLayout layout, VkDescriptorPool pool, u32 count);
 void updateUniformBuffer(Buffer *uniformBuffer, VkDeviceSize offset, ModelInfo *model);
 void updateUniformBuffer(Buffer *uniformBuffer, VkDeviceSize offset, mat4 worldMatrix);
\ No newline at end of file
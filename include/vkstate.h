@@ -5,6 +5,8 @@
 #include "window.h"
 #include "config.h"
 #include "vkmemory.h"
+#include "vktextures.h"
+#include "upload.h"
 
 typedef struct {
     u32 queueFamilyCount;
@@ -35,14 +37,22 @@ typedef struct {
 typedef struct {
     VkSemaphore imageAvailable;
     VkSemaphore renderFinished;
-    VkFence inFlight;
 } FrameSynchroniser;
 
+//Backs one attachment image at a time, and is kept across swapchain
+//recreations for as long as the new image still fits
+typedef struct {
+    VmaAllocation alloc;
+} AttachmentMemory;
+
 typedef struct {
     VkPhysicalDevice handle;
     VkPhysicalDeviceProperties properties;
     QueueFamilyIndices queueFamilyIndices;
     VkSampleCountFlagBits maxSamplingCount;
+    bool memoryBudgetSupported;//VK_EXT_memory_budget, enabled when present
+    bool pipelineStatisticsSupported;//Including inherited by secondaries, enabled when present
+    bool drawIndirectCountSupported;//Needed by GPU culling, enabled when present
 } PhysicalDeviceDetails;
 
 typedef struct {
@@ -57,19 +67,27 @@ typedef struct {
     SwapchainDetails swapchain;
     DeviceImage depthImage;
     DeviceImage samplingImage;
+    AttachmentMemory depthMemory;
+    AttachmentMemory samplingMemory;
     VkRenderPass renderPass;
+    VkRenderPass lateRenderPass;//Loads what renderPass kept, only while occlusion culling
+    bool cpuCulling;
+    bool occlusionCulling;//Draws in two passes either side of a depth pyramid
     Framebuffers framebuffers;
     VkDescriptorSetLayout descriptorSetLayout;
     VkDescriptorPool descriptorPool;
     PipelineDetails graphicsPipeline;
     VkCommandPool graphicsCmdPools[MAX_FRAMES_IN_FLIGHT];
-    VkCommandPool transferCommandPool;
     FrameSynchroniser frameSyncers[MAX_FRAMES_IN_FLIGHT];
+    u32 framesInFlight;
+    VkSemaphore frameTimeline;//Frame N signals N once it completes
     VkSampler sampler;
+    TextureTable textures;
 
-    Buffer deviceBuffer;
+    DeviceBufferPool devicePool;
     Buffer stagingBuffer;
-    Buffer uniformBuffer;
+    UploadContext uploads;//Owns the staging buffer's contents
+    UniformRing uniformRing;
 } VulkanState;
 
 VulkanState initVulkanState(Window *window, const UserConfig *config);
@@ -2,6 +2,7 @@
 #include <vulkan/vulkan.h>
 #include <GLFW/glfw3.h>
 #include "vkstate.h"
+#include "deletion.h"
 
 typedef struct {
     VkSurfaceCapabilitiesKHR capabilities;
@@ -18,8 +19,10 @@ SwapchainDetails createSwapchain(
     VkDevice device, 
     const PhysicalDeviceDetails *physicalDevice, 
     VkSurfaceKHR surface, 
-    GLFWwindow *window);
+    GLFWwindow *window,
+    VkSwapchainKHR oldSwapchain);
 void destroySwapchain(VkDevice device, SwapchainDetails *swapchain);
+void retireSwapchain(DeletionQueue *deletions, SwapchainDetails *swapchain);
 void recreateSwapchain(
     VmaAllocator allocator,
     VkDevice device,
@@ -28,7 +31,11 @@ void recreateSwapchain(
     GLFWwindow *window,
     VkRenderPass renderPass,
     VkSampleCountFlagBits samplingCount,
+    bool transientAttachments,
     SwapchainDetails *swapchain,
     DeviceImage *depthImage,
     DeviceImage *samplingImage,
-    Framebuffers *framebuffers);
\ No newline at end of file
+    AttachmentMemory *depthMemory,
+    AttachmentMemory *samplingMemory,
+    Framebuffers *framebuffers,
+    DeletionQueue *deletions);
\ No newline at end of file
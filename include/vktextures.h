@@ -0,0 +1,25 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include "int.h"
+
+#define TEXTURE_TABLE_CAPACITY 4096
+
+//Every sampled texture lives in one partially bound, update after bind array in
+//its own descriptor set, which stays bound for the whole frame. Shaders index it
+//with the slot handed out when the texture was added.
+typedef struct {
+    VkDescriptorSetLayout layout;
+    VkDescriptorPool pool;
+    VkDescriptorSet set;
+    VkSampler sampler;
+    u32 capacity;
+    u32 *freeSlots;//Stack, so recently freed slots get reused first
+    u32 freeCount;
+} TextureTable;
+
+TextureTable createTextureTable(VkDevice device, VkSampler sampler, u32 capacity);
+void destroyTextureTable(VkDevice device, TextureTable *table);
+//Returns the slot the view was written to
+u32 addTableTexture(VkDevice device, TextureTable *table, VkImageView view);
+//The slot must not be read by any frame still in flight
+void removeTableTexture(TextureTable *table, u32 slot);
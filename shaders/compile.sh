@@ -1,3 +1,6 @@
 #! /bin/sh
 glslc shader.vert -o vert.spv
-glslc shader.frag -o frag.spv
\ No newline at end of file
+glslc shader.frag -o frag.spv
+glslc cull.comp -o cull.spv
+glslc occlude.comp -o occlude.spv
+glslc pyramid.comp -o pyramid.spv
\ No newline at end of file
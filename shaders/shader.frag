@@ -1,13 +1,14 @@
 #version 460
+#extension GL_EXT_nonuniform_qualifier : require
 
-layout(location = 0) flat in uint baseInstance;
+layout(location = 0) flat in uint textureIdx;
 layout(location = 1) in vec2 fragTexCoord;
 
 layout(location = 0) out vec4 outColor;
 
-layout(binding = 1) uniform sampler2D texSampler[2];
+layout(set = 1, binding = 0) uniform sampler2D textures[];
 
 void main() {
-    outColor = texture(texSampler[baseInstance], fragTexCoord);//vec4(fragColor, 1.0);//
+    outColor = texture(textures[nonuniformEXT(textureIdx)], fragTexCoord);//Instances of one draw may differ
     //outColor = vec4(fragTexCoord, 0.0f, 1.0f);
 }
\ No newline at end of file
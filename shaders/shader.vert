@@ -3,19 +3,29 @@
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec2 inTexCoord;
 
-layout(location = 0) out uint baseInstance;
+layout(location = 0) out uint textureIdx;
 layout(location = 1) out vec2 fragTexCoord;
 
-layout(push_constant, std430) uniform pc{
+layout(binding = 0) uniform FrameUniforms{
     mat4 viewProjection;
+    vec4 frustumPlanes[6];
+    vec4 lodCamera;
 };
 
-layout(binding = 0) uniform UniformBuffer{
-    mat4 model[2];
-} ub;
+struct InstanceData{
+    mat4 model;
+    vec4 boundingSphere;
+    uint textureIdx;
+    uint meshIdx;
+};
+
+layout(std430, binding = 2) readonly buffer Instances{
+    InstanceData instances[];
+};
 
 void main() {
-    gl_Position = viewProjection * ub.model[gl_BaseInstance] * vec4(inPosition, 1.0);
-    baseInstance = gl_BaseInstance;
+    InstanceData instance = instances[gl_InstanceIndex];//Includes the draw's first instance
+    gl_Position = viewProjection * instance.model * vec4(inPosition, 1.0);
+    textureIdx = instance.textureIdx;
     fragTexCoord = inTexCoord;
 }
\ No newline at end of file
@@ -0,0 +1,479 @@
+#include "broadphase.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <immintrin.h>
+
+typedef __m256 v256f;
+
+#define CELL_COORD_BITS 21
+#define CELL_COORD_MASK ((1ull << CELL_COORD_BITS) - 1)
+#define CELL_COORD_BIAS (1 << (CELL_COORD_BITS - 1))
+#define KEY_BITS (3 * CELL_COORD_BITS)
+
+//Half of the 26 neighbours, so every pair of neighbouring cells is visited once
+static const int FORWARD_NEIGHBOURS[13][3] = {
+    {1, -1, -1}, {1, -1, 0}, {1, -1, 1},
+    {1, 0, -1}, {1, 0, 0}, {1, 0, 1},
+    {1, 1, -1}, {1, 1, 0}, {1, 1, 1},
+    {0, 1, -1}, {0, 1, 0}, {0, 1, 1},
+    {0, 0, 1}
+};
+
+static void* checkedAlloc(size_t size)
+{
+    void *mem = malloc(size);
+    if (!mem)
+    {
+        fprintf(stderr, "Failed to allocate Broad Phase memory\n");
+        abort();
+    }
+    return mem;
+}
+
+static u32 nextPowerOfTwo(u32 x)
+{
+    u32 p = 1;
+    while (p < x)
+        p <<= 1;
+    return p;
+}
+
+static inline u64 packCellKey(s64 x, s64 y, s64 z)
+{
+    return (((u64)(x + CELL_COORD_BIAS) & CELL_COORD_MASK) << (2 * CELL_COORD_BITS)) |
+        (((u64)(y + CELL_COORD_BIAS) & CELL_COORD_MASK) << CELL_COORD_BITS) |
+        ((u64)(z + CELL_COORD_BIAS) & CELL_COORD_MASK);
+}
+
+static inline void unpackCellKey(u64 key, s64 *x, s64 *y, s64 *z)
+{
+    *x = (s64)((key >> (2 * CELL_COORD_BITS)) & CELL_COORD_MASK) - CELL_COORD_BIAS;
+    *y = (s64)((key >> CELL_COORD_BITS) & CELL_COORD_MASK) - CELL_COORD_BIAS;
+    *z = (s64)(key & CELL_COORD_MASK) - CELL_COORD_BIAS;
+}
+
+static inline u32 hashCellKey(u64 key, u32 tableMask)
+{
+    return (u32)((key * 0x9E3779B97F4A7C15ull) >> 32) & tableMask;
+}
+
+static void pushPair(BodyPairList *list, u32 a, u32 b)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? list->capacity * 2 : 256;
+        list->pairs = (BodyPair*)realloc(list->pairs, sizeof(BodyPair) * list->capacity);
+        if (!list->pairs)
+        {
+            fprintf(stderr, "Failed to grow Body Pair List\n");
+            abort();
+        }
+    }
+
+    list->pairs[list->count++] = a < b ? BodyPair{a, b} : BodyPair{b, a};
+}
+
+BroadPhase createBroadPhase(u32 capacity, float cellSize, const JobPool *jobs)
+{
+    BroadPhase bp = {};
+    bp.cellSize = cellSize;
+    bp.capacity = capacity;
+    bp.chunksCount = jobs->workersCount * BROADPHASE_CHUNKS_PER_WORKER;
+
+    bp.keys = (u64*)checkedAlloc(sizeof(u64) * capacity);
+    bp.bodyIdxs = (u32*)checkedAlloc(sizeof(u32) * capacity);
+    bp.sortKeys = (u64*)checkedAlloc(sizeof(u64) * capacity);
+    bp.sortBodyIdxs = (u32*)checkedAlloc(sizeof(u32) * capacity);
+    bp.histograms = (u32*)checkedAlloc(sizeof(u32) * BROADPHASE_RADIX_BUCKETS * bp.chunksCount);
+
+    bp.tableSize = nextPowerOfTwo(2 * capacity);
+    bp.tableKeys = (u64*)checkedAlloc(sizeof(u64) * bp.tableSize);
+    bp.tableStarts = (u32*)checkedAlloc(sizeof(u32) * bp.tableSize);
+    bp.tableCounts = (u32*)checkedAlloc(sizeof(u32) * bp.tableSize);
+    bp.cellStarts = (u32*)checkedAlloc(sizeof(u32) * (capacity + 1));
+
+    bp.chunkPairs = (BodyPairList*)calloc(bp.chunksCount, sizeof(BodyPairList));
+    if (!bp.chunkPairs)
+    {
+        fprintf(stderr, "Failed to allocate Broad Phase memory\n");
+        abort();
+    }
+
+    return bp;
+}
+
+void destroyBroadPhase(BroadPhase *bp)
+{
+    for (u32 i = 0; i < bp->chunksCount; i++)
+        free(bp->chunkPairs[i].pairs);
+    free(bp->chunkPairs);
+    free(bp->pairs.pairs);
+    free(bp->cellStarts);
+    free(bp->tableCounts);
+    free(bp->tableStarts);
+    free(bp->tableKeys);
+    free(bp->histograms);
+    free(bp->sortBodyIdxs);
+    free(bp->sortKeys);
+    free(bp->bodyIdxs);
+    free(bp->keys);
+}
+
+typedef struct {
+    BroadPhase *bp;
+    const DynamicBodies *bodies;
+    u32 chunkLen;
+    u32 shift;
+} BroadPhaseJob;
+
+static void computeCellKeys(void *ctx, u32 start, u32 end, u32 workerIdx)
+{
+    BroadPhaseJob *job = (BroadPhaseJob*)ctx;
+    const DynamicBodies *bodies = job->bodies;
+    float invCellSize = 1.0f / job->bp->cellSize;
+
+    for (u32 i = start; i < end; i++)
+    {
+        job->bp->keys[i] = packCellKey(
+            (s64)floorf(bodies->posX[i] * invCellSize),
+            (s64)floorf(bodies->posY[i] * invCellSize),
+            (s64)floorf(bodies->posZ[i] * invCellSize));
+        job->bp->bodyIdxs[i] = i;
+    }
+}
+
+static void countRadixDigits(void *ctx, u32 start, u32 end, u32 workerIdx)
+{
+    BroadPhaseJob *job = (BroadPhaseJob*)ctx;
+    BroadPhase *bp = job->bp;
+
+    for (u32 chunk = start; chunk < end; chunk++)
+    {
+        u32 *histogram = bp->histograms + chunk * BROADPHASE_RADIX_BUCKETS;
+        memset(histogram, 0, sizeof(u32) * BROADPHASE_RADIX_BUCKETS);
+
+        u32 first = chunk * job->chunkLen;
+        u32 last = first + job->chunkLen < job->bodies->count ? first + job->chunkLen : job->bodies->count;
+        for (u32 i = first; i < last; i++)
+            histogram[(bp->keys[i] >> job->shift) & (BROADPHASE_RADIX_BUCKETS - 1)]++;
+    }
+}
+
+static void scatterRadixDigits(void *ctx, u32 start, u32 end, u32 workerIdx)
+{
+    BroadPhaseJob *job = (BroadPhaseJob*)ctx;
+    BroadPhase *bp = job->bp;
+
+    for (u32 chunk = start; chunk < end; chunk++)
+    {
+        u32 *offsets = bp->histograms + chunk * BROADPHASE_RADIX_BUCKETS;
+
+        u32 first = chunk * job->chunkLen;
+        u32 last = first + job->chunkLen < job->bodies->count ? first + job->chunkLen : job->bodies->count;
+        for (u32 i = first; i < last; i++)
+        {
+            u32 dst = offsets[(bp->keys[i] >> job->shift) & (BROADPHASE_RADIX_BUCKETS - 1)]++;
+            bp->sortKeys[dst] = bp->keys[i];
+            bp->sortBodyIdxs[dst] = bp->bodyIdxs[i];
+        }
+    }
+}
+
+//Parallel LSD radix sort. Each chunk histograms and scatters its own slice,
+//so the sort stays stable and does not need any atomics.
+static void sortCellKeys(BroadPhase *bp, JobPool *jobs, BroadPhaseJob *job)
+{
+    u32 count = job->bodies->count;
+
+    for (u32 shift = 0; shift < KEY_BITS; shift += BROADPHASE_RADIX_BITS)
+    {
+        job->shift = shift;
+        parallelFor(jobs, bp->chunksCount, 1, countRadixDigits, job);
+
+        //Exclusive prefix sum ordered by digit, then chunk
+        bool singleDigit = false;
+        u32 offset = 0;
+        for (u32 digit = 0; digit < BROADPHASE_RADIX_BUCKETS; digit++)
+        {
+            u32 digitStart = offset;
+            for (u32 chunk = 0; chunk < bp->chunksCount; chunk++)
+            {
+                u32 *bucket = bp->histograms + chunk * BROADPHASE_RADIX_BUCKETS + digit;
+                u32 bucketCount = *bucket;
+                *bucket = offset;
+                offset += bucketCount;
+            }
+
+            if (offset - digitStart == count)
+                singleDigit = true;
+        }
+
+        if (singleDigit)//Every key shares this digit, typical of the high bits
+            continue;
+
+        parallelFor(jobs, bp->chunksCount, 1, scatterRadixDigits, job);
+
+        u64 *tmpKeys = bp->keys;
+        bp->keys = bp->sortKeys;
+        bp->sortKeys = tmpKeys;
+
+        u32 *tmpIdxs = bp->bodyIdxs;
+        bp->bodyIdxs = bp->sortBodyIdxs;
+        bp->sortBodyIdxs = tmpIdxs;
+    }
+}
+
+static void buildCellTable(BroadPhase *bp, u32 count)
+{
+    bp->cellsCount = 0;
+    for (u32 i = 0; i < count; i++)
+    {
+        if (!i || bp->keys[i] != bp->keys[i-1])
+            bp->cellStarts[bp->cellsCount++] = i;
+    }
+    bp->cellStarts[bp->cellsCount] = count;
+
+    u32 tableMask = bp->tableSize - 1;
+    memset(bp->tableCounts, 0, sizeof(u32) * bp->tableSize);
+
+    for (u32 cell = 0; cell < bp->cellsCount; cell++)
+    {
+        u32 start = bp->cellStarts[cell];
+        u64 key = bp->keys[start];
+
+        u32 slot = hashCellKey(key, tableMask);
+        while (bp->tableCounts[slot])
+            slot = (slot + 1) & tableMask;
+
+        bp->tableKeys[slot] = key;
+        bp->tableStarts[slot] = start;
+        bp->tableCounts[slot] = bp->cellStarts[cell + 1] - start;
+    }
+}
+
+static bool findCell(const BroadPhase *bp, u64 key, u32 *start, u32 *count)
+{
+    u32 tableMask = bp->tableSize - 1;
+    u32 slot = hashCellKey(key, tableMask);
+
+    while (bp->tableCounts[slot])
+    {
+        if (bp->tableKeys[slot] == key)
+        {
+            *start = bp->tableStarts[slot];
+            *count = bp->tableCounts[slot];
+            return true;
+        }
+        slot = (slot + 1) & tableMask;
+    }
+
+    return false;
+}
+
+static inline bool boundsOverlap(const DynamicBodies *bodies, u32 a, u32 b)
+{
+    float reach = bodies->radius[a] + bodies->radius[b];
+    return fabsf(bodies->posX[a] - bodies->posX[b]) <= reach &&
+        fabsf(bodies->posY[a] - bodies->posY[b]) <= reach &&
+        fabsf(bodies->posZ[a] - bodies->posZ[b]) <= reach;
+}
+
+static void gatherCellPairs(void *ctx, u32 start, u32 end, u32 workerIdx)
+{
+    BroadPhaseJob *job = (BroadPhaseJob*)ctx;
+    BroadPhase *bp = job->bp;
+    const DynamicBodies *bodies = job->bodies;
+    u32 cellsPerChunk = (bp->cellsCount + bp->chunksCount - 1) / bp->chunksCount;
+
+    for (u32 chunk = start; chunk < end; chunk++)
+    {
+        BodyPairList *list = &bp->chunkPairs[chunk];
+        list->count = 0;
+
+        u32 firstCell = chunk * cellsPerChunk;
+        u32 lastCell = firstCell + cellsPerChunk < bp->cellsCount ? firstCell + cellsPerChunk : bp->cellsCount;
+
+        for (u32 cell = firstCell; cell < lastCell; cell++)
+        {
+            u32 cellStart = bp->cellStarts[cell];
+            u32 cellEnd = bp->cellStarts[cell + 1];
+
+            for (u32 i = cellStart; i < cellEnd; i++)
+            {
+                for (u32 j = i + 1; j < cellEnd; j++)
+                {
+                    if (boundsOverlap(bodies, bp->bodyIdxs[i], bp->bodyIdxs[j]))
+                        pushPair(list, bp->bodyIdxs[i], bp->bodyIdxs[j]);
+                }
+            }
+
+            s64 x, y, z;
+            unpackCellKey(bp->keys[cellStart], &x, &y, &z);
+
+            for (u32 n = 0; n < NUM_ELEMENTS(FORWARD_NEIGHBOURS); n++)
+            {
+                u64 neighbourKey = packCellKey(
+                    x + FORWARD_NEIGHBOURS[n][0],
+                    y + FORWARD_NEIGHBOURS[n][1],
+                    z + FORWARD_NEIGHBOURS[n][2]);
+
+                u32 neighbourStart = 0, neighbourCount = 0;
+                if (!findCell(bp, neighbourKey, &neighbourStart, &neighbourCount))
+                    continue;
+
+                for (u32 i = cellStart; i < cellEnd; i++)
+                {
+                    for (u32 j = neighbourStart; j < neighbourStart + neighbourCount; j++)
+                    {
+                        if (boundsOverlap(bodies, bp->bodyIdxs[i], bp->bodyIdxs[j]))
+                            pushPair(list, bp->bodyIdxs[i], bp->bodyIdxs[j]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void updateBroadPhase(BroadPhase *bp, JobPool *jobs, const DynamicBodies *bodies)
+{
+    assert(bodies->count <= bp->capacity);
+
+    bp->pairs.count = 0;
+    if (!bodies->count)
+        return;
+
+    BroadPhaseJob job = {
+        .bp = bp,
+        .bodies = bodies,
+        .chunkLen = (bodies->count + bp->chunksCount - 1) / bp->chunksCount
+    };
+
+    parallelFor(jobs, bodies->count, 1024, computeCellKeys, &job);
+    sortCellKeys(bp, jobs, &job);
+    buildCellTable(bp, bodies->count);
+    parallelFor(jobs, bp->chunksCount, 1, gatherCellPairs, &job);
+
+    u32 pairsCount = 0;
+    for (u32 chunk = 0; chunk < bp->chunksCount; chunk++)
+        pairsCount += bp->chunkPairs[chunk].count;
+
+    if (pairsCount > bp->pairs.capacity)
+    {
+        bp->pairs.capacity = pairsCount;
+        bp->pairs.pairs = (BodyPair*)realloc(bp->pairs.pairs, sizeof(BodyPair) * pairsCount);
+        if (!bp->pairs.pairs)
+        {
+            fprintf(stderr, "Failed to grow Body Pair List\n");
+            abort();
+        }
+    }
+
+    for (u32 chunk = 0; chunk < bp->chunksCount; chunk++)
+    {
+        memcpy(
+            bp->pairs.pairs + bp->pairs.count,
+            bp->chunkPairs[chunk].pairs,
+            sizeof(BodyPair) * bp->chunkPairs[chunk].count);
+        bp->pairs.count += bp->chunkPairs[chunk].count;
+    }
+}
+
+static void writeContact(const DynamicBodies *bodies, BodyPair pair, float dist2, float reach, BodyContact *contact)
+{
+    float dist = sqrtf(dist2);
+
+    contact->a = pair.a;
+    contact->b = pair.b;
+    contact->depth = reach - dist;
+
+    if (dist > 0.0f)
+    {
+        contact->normal[0] = (bodies->posX[pair.b] - bodies->posX[pair.a]) / dist;
+        contact->normal[1] = (bodies->posY[pair.b] - bodies->posY[pair.a]) / dist;
+        contact->normal[2] = (bodies->posZ[pair.b] - bodies->posZ[pair.a]) / dist;
+    }
+    else//Coincident centres, push apart vertically
+    {
+        contact->normal[0] = 0.0f;
+        contact->normal[1] = 1.0f;
+        contact->normal[2] = 0.0f;
+    }
+}
+
+u32 narrowPhaseSpheres(const DynamicBodies *bodies, const BodyPair *pairs, u32 pairsCount, BodyContact *contacts)
+{
+    u32 contactsCount = 0;
+    u32 i = 0;
+
+    alignas(32) float dist2s[8];
+    alignas(32) float reaches[8];
+
+    for (; i + 8 <= pairsCount; i += 8)
+    {
+        const BodyPair *p = pairs + i;
+
+        v256f ax = _mm256_setr_ps(
+            bodies->posX[p[0].a], bodies->posX[p[1].a], bodies->posX[p[2].a], bodies->posX[p[3].a],
+            bodies->posX[p[4].a], bodies->posX[p[5].a], bodies->posX[p[6].a], bodies->posX[p[7].a]);
+        v256f ay = _mm256_setr_ps(
+            bodies->posY[p[0].a], bodies->posY[p[1].a], bodies->posY[p[2].a], bodies->posY[p[3].a],
+            bodies->posY[p[4].a], bodies->posY[p[5].a], bodies->posY[p[6].a], bodies->posY[p[7].a]);
+        v256f az = _mm256_setr_ps(
+            bodies->posZ[p[0].a], bodies->posZ[p[1].a], bodies->posZ[p[2].a], bodies->posZ[p[3].a],
+            bodies->posZ[p[4].a], bodies->posZ[p[5].a], bodies->posZ[p[6].a], bodies->posZ[p[7].a]);
+        v256f ar = _mm256_setr_ps(
+            bodies->radius[p[0].a], bodies->radius[p[1].a], bodies->radius[p[2].a], bodies->radius[p[3].a],
+            bodies->radius[p[4].a], bodies->radius[p[5].a], bodies->radius[p[6].a], bodies->radius[p[7].a]);
+
+        v256f bx = _mm256_setr_ps(
+            bodies->posX[p[0].b], bodies->posX[p[1].b], bodies->posX[p[2].b], bodies->posX[p[3].b],
+            bodies->posX[p[4].b], bodies->posX[p[5].b], bodies->posX[p[6].b], bodies->posX[p[7].b]);
+        v256f by = _mm256_setr_ps(
+            bodies->posY[p[0].b], bodies->posY[p[1].b], bodies->posY[p[2].b], bodies->posY[p[3].b],
+            bodies->posY[p[4].b], bodies->posY[p[5].b], bodies->posY[p[6].b], bodies->posY[p[7].b]);
+        v256f bz = _mm256_setr_ps(
+            bodies->posZ[p[0].b], bodies->posZ[p[1].b], bodies->posZ[p[2].b], bodies->posZ[p[3].b],
+            bodies->posZ[p[4].b], bodies->posZ[p[5].b], bodies->posZ[p[6].b], bodies->posZ[p[7].b]);
+        v256f br = _mm256_setr_ps(
+            bodies->radius[p[0].b], bodies->radius[p[1].b], bodies->radius[p[2].b], bodies->radius[p[3].b],
+            bodies->radius[p[4].b], bodies->radius[p[5].b], bodies->radius[p[6].b], bodies->radius[p[7].b]);
+
+        v256f dx = _mm256_sub_ps(bx, ax);
+        v256f dy = _mm256_sub_ps(by, ay);
+        v256f dz = _mm256_sub_ps(bz, az);
+        v256f dist2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_add_ps(_mm256_mul_ps(dy, dy), _mm256_mul_ps(dz, dz)));
+        v256f reach = _mm256_add_ps(ar, br);
+
+        int hits = _mm256_movemask_ps(_mm256_cmp_ps(dist2, _mm256_mul_ps(reach, reach), _CMP_LT_OQ));
+        if (!hits)
+            continue;
+
+        _mm256_store_ps(dist2s, dist2);
+        _mm256_store_ps(reaches, reach);
+
+        while (hits)
+        {
+            int lane = __builtin_ctz(hits);
+            hits &= hits - 1;
+            writeContact(bodies, p[lane], dist2s[lane], reaches[lane], &contacts[contactsCount++]);
+        }
+    }
+
+    for (; i < pairsCount; i++)
+    {
+        BodyPair pair = pairs[i];
+        float dx = bodies->posX[pair.b] - bodies->posX[pair.a];
+        float dy = bodies->posY[pair.b] - bodies->posY[pair.a];
+        float dz = bodies->posZ[pair.b] - bodies->posZ[pair.a];
+        float dist2 = dx*dx + dy*dy + dz*dz;
+        float reach = bodies->radius[pair.a] + bodies->radius[pair.b];
+
+        if (dist2 < reach*reach)
+            writeContact(bodies, pair, dist2, reach, &contacts[contactsCount++]);
+    }
+
+    return contactsCount;
+}
@@ -0,0 +1,536 @@
+#include "collision.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <algorithm>
+
+CollisionWorld createCollisionWorld(u32 meshesCapacity, u32 instancesCapacity)
+{
+    CollisionWorld world = {.meshesCapacity = meshesCapacity, .instancesCapacity = instancesCapacity};
+
+    world.meshes = (Voxels*)calloc(meshesCapacity, sizeof(Voxels));
+    world.meshBounds = (Box*)calloc(meshesCapacity, sizeof(Box));
+    world.meshScratches = (OverlapScratch*)calloc(meshesCapacity, sizeof(OverlapScratch));
+    world.meshSdfs = (SdfVolume*)calloc(meshesCapacity, sizeof(SdfVolume));
+    //mat4 is over-aligned when cglm uses SIMD
+    size_t instancesSize = (sizeof(CollisionInstance)*(instancesCapacity ? instancesCapacity : 1) + alignof(CollisionInstance) - 1) & ~(alignof(CollisionInstance) - 1);
+    world.instances = (CollisionInstance*)aligned_alloc(alignof(CollisionInstance), instancesSize);
+    world.instanceOrder = (u32*)calloc(instancesCapacity, sizeof(u32));
+    world.nodes = (BvhNode*)calloc(2*instancesCapacity, sizeof(BvhNode));//A binary tree over n leaves has under 2n nodes
+
+    if (!world.meshes || !world.meshBounds || !world.meshScratches || !world.meshSdfs || !world.instances || !world.instanceOrder || !world.nodes)
+    {
+        fprintf(stderr, "Failed to allocate Collision World\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(world.instances, 0, instancesSize);
+
+    return world;
+}
+
+void destroyCollisionWorld(CollisionWorld *world)
+{
+    for (u32 i = 0; i < world->meshesCount; i++)
+    {
+        free(world->meshes[i].data);
+        destroyOverlapScratch(&world->meshScratches[i]);
+        destroySdf(&world->meshSdfs[i]);
+    }
+
+    free(world->meshes);
+    free(world->meshBounds);
+    free(world->meshScratches);
+    free(world->meshSdfs);
+    free(world->instances);
+    free(world->instanceOrder);
+    free(world->nodes);
+    *world = {};
+}
+
+u32 addCollisionMesh(CollisionWorld *world, JobPool *jobs, Voxels meshVoxels)
+{
+    assert(world->meshesCount < world->meshesCapacity);
+
+    u32 idx = world->meshesCount++;
+    world->meshes[idx] = meshVoxels;
+    world->meshScratches[idx] = createOverlapScratch(&world->meshes[idx]);
+
+    float cellSize = glm_max(meshVoxels.voxWidth, glm_max(meshVoxels.voxHeight, meshVoxels.voxLength)) / COLLISION_SDF_CELLS_PER_VOXEL;
+    world->meshSdfs[idx] = bakeSdf(jobs, &world->meshes[idx], cellSize, cellSize*COLLISION_SDF_BAND_CELLS);
+
+    //The voxel origin is the top corner, rows run downwards
+    Box *bounds = &world->meshBounds[idx];
+    bounds->corners[0][0] = meshVoxels.origin[0];
+    bounds->corners[0][1] = meshVoxels.origin[1] - meshVoxels.voxHeight*meshVoxels.rows;
+    bounds->corners[0][2] = meshVoxels.origin[2];
+    bounds->corners[1][0] = meshVoxels.origin[0] + meshVoxels.voxWidth*meshVoxels.cols;
+    bounds->corners[1][1] = meshVoxels.origin[1];
+    bounds->corners[1][2] = meshVoxels.origin[2] + meshVoxels.voxLength*meshVoxels.depth;
+
+    return idx;
+}
+
+static void transformBounds(const Box *bounds, mat4 transform, Box *out)
+{
+    glm_vec3_fill(out->corners[0], INFINITY);
+    glm_vec3_fill(out->corners[1], -INFINITY);
+
+    for (u32 i = 0; i < 8; i++)
+    {
+        vec3 corner = {
+            bounds->corners[i & 1][0],
+            bounds->corners[(i >> 1) & 1][1],
+            bounds->corners[i >> 2][2]};
+        glm_mat4_mulv3(transform, corner, 1.0f, corner);
+        glm_vec3_minv(out->corners[0], corner, out->corners[0]);
+        glm_vec3_maxv(out->corners[1], corner, out->corners[1]);
+    }
+}
+
+static void mergeBounds(const Box *a, const Box *b, Box *out)
+{
+    glm_vec3_minv((float*)a->corners[0], (float*)b->corners[0], out->corners[0]);
+    glm_vec3_maxv((float*)a->corners[1], (float*)b->corners[1], out->corners[1]);
+}
+
+static void placeCollisionInstance(const CollisionWorld *world, CollisionInstance *instance, mat4 transform)
+{
+    glm_mat4_copy(transform, instance->transform);
+    glm_mat4_inv(transform, instance->invTransform);
+    instance->minScale = glm_min(glm_vec3_norm(transform[0]), glm_min(glm_vec3_norm(transform[1]), glm_vec3_norm(transform[2])));
+    transformBounds(&world->meshBounds[instance->meshIdx], transform, &instance->bounds);
+}
+
+u32 addCollisionInstance(CollisionWorld *world, u32 meshIdx, mat4 transform)
+{
+    assert(world->instancesCount < world->instancesCapacity);
+    assert(meshIdx < world->meshesCount);
+
+    u32 idx = world->instancesCount++;
+    world->instances[idx].meshIdx = meshIdx;
+    placeCollisionInstance(world, &world->instances[idx], transform);
+
+    return idx;
+}
+
+void setCollisionInstanceTransform(CollisionWorld *world, u32 instanceIdx, mat4 transform)
+{
+    CollisionInstance *instance = &world->instances[instanceIdx];
+    if (!memcmp(instance->transform, transform, sizeof(mat4)))
+        return;
+
+    placeCollisionInstance(world, instance, transform);
+    world->dirty = true;
+}
+
+//Median split along the longest axis of the instance centres
+static void buildBvhNode(CollisionWorld *world, u32 nodeIdx, u32 first, u32 count)
+{
+    BvhNode *node = &world->nodes[nodeIdx];
+    node->bounds = world->instances[world->instanceOrder[first]].bounds;
+    Box centres = {};
+    for (u32 i = first; i < first + count; i++)
+    {
+        const Box *bounds = &world->instances[world->instanceOrder[i]].bounds;
+        vec3 centre = {};
+        glm_vec3_center((float*)bounds->corners[0], (float*)bounds->corners[1], centre);
+        if (i == first)
+        {
+            glm_vec3_copy(centre, centres.corners[0]);
+            glm_vec3_copy(centre, centres.corners[1]);
+        }
+        glm_vec3_minv(centres.corners[0], centre, centres.corners[0]);
+        glm_vec3_maxv(centres.corners[1], centre, centres.corners[1]);
+        mergeBounds(&node->bounds, bounds, &node->bounds);
+    }
+
+    if (count <= COLLISION_BVH_LEAF_SIZE)
+    {
+        node->first = first;
+        node->count = count;
+        return;
+    }
+
+    vec3 extent = {};
+    glm_vec3_sub(centres.corners[1], centres.corners[0], extent);
+    int axis = extent[0] > extent[1] ? (extent[0] > extent[2] ? 0 : 2) : (extent[1] > extent[2] ? 1 : 2);
+
+    u32 *order = world->instanceOrder + first;
+    u32 half = count / 2;
+    const CollisionInstance *instances = world->instances;
+    std::nth_element(order, order + half, order + count, [instances, axis](u32 a, u32 b) {
+        return instances[a].bounds.corners[0][axis] + instances[a].bounds.corners[1][axis] <
+            instances[b].bounds.corners[0][axis] + instances[b].bounds.corners[1][axis];
+    });
+
+    u32 left = world->nodesCount;
+    world->nodesCount += 2;
+    node->first = left;
+    node->count = 0;
+
+    buildBvhNode(world, left, first, half);
+    buildBvhNode(world, left + 1, first + half, count - half);
+}
+
+void buildCollisionWorld(CollisionWorld *world)
+{
+    world->nodesCount = 0;
+    world->dirty = false;
+    if (!world->instancesCount)
+        return;
+
+    for (u32 i = 0; i < world->instancesCount; i++)
+        world->instanceOrder[i] = i;
+
+    world->nodesCount = 1;
+    buildBvhNode(world, 0, 0, world->instancesCount);
+}
+
+void refitCollisionWorld(CollisionWorld *world)
+{
+    if (!world->dirty)
+        return;
+    world->dirty = false;
+
+    //Children are stored after their parents, so a reverse walk visits them first
+    for (u32 n = world->nodesCount; n-- > 0;)
+    {
+        BvhNode *node = &world->nodes[n];
+        if (node->count)
+        {
+            node->bounds = world->instances[world->instanceOrder[node->first]].bounds;
+            for (u32 i = node->first + 1; i < node->first + node->count; i++)
+                mergeBounds(&node->bounds, &world->instances[world->instanceOrder[i]].bounds, &node->bounds);
+        }
+        else
+        {
+            mergeBounds(&world->nodes[node->first].bounds, &world->nodes[node->first + 1].bounds, &node->bounds);
+        }
+    }
+}
+
+static bool rayHitsBounds(const Box *bounds, const vec3 origin, const vec3 dirRcp, float maxDist)
+{
+    float tEnter = 0.0f, tExit = maxDist;
+    for (int d = 0; d < 3; d++)
+    {
+        float t0 = (bounds->corners[0][d] - origin[d]) * dirRcp[d];
+        float t1 = (bounds->corners[1][d] - origin[d]) * dirRcp[d];
+        tEnter = glm_max(tEnter, glm_min(t0, t1));
+        tExit = glm_min(tExit, glm_max(t0, t1));
+    }
+
+    return tEnter <= tExit;
+}
+
+static bool boundsOverlap(const Box *a, const Box *b)
+{
+    for (int d = 0; d < 3; d++)
+    {
+        if (a->corners[1][d] < b->corners[0][d] || b->corners[1][d] < a->corners[0][d])
+            return false;
+    }
+
+    return true;
+}
+
+//One instance's share of a batch, in its model space
+typedef struct {
+    u32 *rays;//Index into the batch
+    vec3 *origins;
+    vec3 *dirs;
+    float *maxDists;
+    float *dists;
+    u32 *triangleIds;
+    vec3 *normals;
+} InstanceRays;
+
+static void raycastInstance(
+    JobPool *jobs,
+    const CollisionWorld *world,
+    u32 instanceIdx,
+    u32 count,
+    const vec3 origins[],
+    const vec3 dirs[],
+    InstanceRays *local,
+    WorldRayHit outHits[])
+{
+    const CollisionInstance *instance = &world->instances[instanceIdx];
+
+    //Only the rays reaching the instance before their closest hit so far
+    u32 localCount = 0;
+    for (u32 i = 0; i < count; i++)
+    {
+        vec3 dirRcp = {1.0f/dirs[i][0], 1.0f/dirs[i][1], 1.0f/dirs[i][2]};
+        if (!rayHitsBounds(&instance->bounds, origins[i], dirRcp, outHits[i].hit.dist))
+            continue;
+
+        //The direction is left unnormalised, so distances stay in multiples of the world direction
+        u32 ray = localCount++;
+        local->rays[ray] = i;
+        glm_mat4_mulv3((vec4*)instance->invTransform, (float*)origins[i], 1.0f, local->origins[ray]);
+        glm_mat4_mulv3((vec4*)instance->invTransform, (float*)dirs[i], 0.0f, local->dirs[ray]);
+        local->maxDists[ray] = outHits[i].hit.dist;
+    }
+
+    raycastBatch(
+        jobs,
+        &world->meshes[instance->meshIdx],
+        localCount,
+        local->origins,
+        local->dirs,
+        local->maxDists,
+        local->dists,
+        local->triangleIds,
+        local->normals);
+
+    for (u32 ray = 0; ray < localCount; ray++)
+    {
+        if (local->triangleIds[ray] == RAYCAST_MISS)
+            continue;
+
+        //Normals go back to world space by the inverse transpose
+        WorldRayHit *result = &outHits[local->rays[ray]];
+        result->hit.dist = local->dists[ray];
+        result->hit.triangleId = local->triangleIds[ray];
+        result->instanceIdx = instanceIdx;
+        for (int d = 0; d < 3; d++)
+            result->hit.normal[d] = glm_vec3_dot((float*)instance->invTransform[d], local->normals[ray]);
+        glm_vec3_normalize(result->hit.normal);
+    }
+}
+
+void raycastCollisionWorld(
+    JobPool *jobs,
+    const CollisionWorld *world,
+    u32 count,
+    const vec3 origins[],
+    const vec3 dirs[],
+    const float maxDists[],
+    u32 skipInstanceIdx,
+    WorldRayHit outHits[])
+{
+    for (u32 i = 0; i < count; i++)
+        outHits[i] = {.hit = {.dist = maxDists[i], .triangleId = RAYCAST_MISS, .normal = GLM_VEC3_ZERO_INIT}, .instanceIdx = COLLISION_NO_INSTANCE};
+
+    if (!count || !world->nodesCount)
+        return;
+
+    //Everything the batch's segments can reach
+    Box batchBounds = {};
+    glm_vec3_fill(batchBounds.corners[0], INFINITY);
+    glm_vec3_fill(batchBounds.corners[1], -INFINITY);
+    for (u32 i = 0; i < count; i++)
+    {
+        vec3 end = {};
+        glm_vec3_scale((float*)dirs[i], maxDists[i], end);
+        glm_vec3_add(end, (float*)origins[i], end);
+        glm_vec3_minv(batchBounds.corners[0], (float*)origins[i], batchBounds.corners[0]);
+        glm_vec3_maxv(batchBounds.corners[1], (float*)origins[i], batchBounds.corners[1]);
+        glm_vec3_minv(batchBounds.corners[0], end, batchBounds.corners[0]);
+        glm_vec3_maxv(batchBounds.corners[1], end, batchBounds.corners[1]);
+    }
+
+    InstanceRays local = {};
+    local.rays = (u32*)malloc(sizeof(u32)*count);
+    local.origins = (vec3*)malloc(sizeof(vec3)*count);
+    local.dirs = (vec3*)malloc(sizeof(vec3)*count);
+    local.maxDists = (float*)malloc(sizeof(float)*count);
+    local.dists = (float*)malloc(sizeof(float)*count);
+    local.triangleIds = (u32*)malloc(sizeof(u32)*count);
+    local.normals = (vec3*)malloc(sizeof(vec3)*count);
+    if (!local.rays || !local.origins || !local.dirs || !local.maxDists || !local.dists || !local.triangleIds || !local.normals)
+    {
+        fprintf(stderr, "Failed to allocate Collision World Raycast\n");
+        exit(EXIT_FAILURE);
+    }
+
+    u32 stack[COLLISION_BVH_STACK_SIZE];
+    u32 stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize)
+    {
+        const BvhNode *node = &world->nodes[stack[--stackSize]];
+        if (!boundsOverlap(&node->bounds, &batchBounds))
+            continue;
+
+        if (!node->count)
+        {
+            assert(stackSize + 2 <= COLLISION_BVH_STACK_SIZE);
+            stack[stackSize++] = node->first + 1;
+            stack[stackSize++] = node->first;
+            continue;
+        }
+
+        for (u32 i = node->first; i < node->first + node->count; i++)
+        {
+            u32 instanceIdx = world->instanceOrder[i];
+            if (instanceIdx == skipInstanceIdx || !boundsOverlap(&world->instances[instanceIdx].bounds, &batchBounds))
+                continue;
+
+            raycastInstance(jobs, world, instanceIdx, count, origins, dirs, &local, outHits);
+        }
+    }
+
+    free(local.normals);
+    free(local.triangleIds);
+    free(local.dists);
+    free(local.maxDists);
+    free(local.dirs);
+    free(local.origins);
+    free(local.rays);
+}
+
+//Pushes center out of each overlapped triangle in turn, in world space
+static bool separateSphereFromInstance(CollisionWorld *world, u32 instanceIdx, vec3 center, float radius)
+{
+    const CollisionInstance *instance = &world->instances[instanceIdx];
+    const Voxels *mesh = &world->meshes[instance->meshIdx];
+
+    //Gathered in model space, with the radius the shortest axis needs to still cover the sphere
+    vec3 localCenter = {};
+    glm_mat4_mulv3((vec4*)instance->invTransform, center, 1.0f, localCenter);
+
+    //Interpolation overestimates the distance by at most a cell's diagonal
+    const SdfVolume *sdf = &world->meshSdfs[instance->meshIdx];
+    float surfaceDist = sampleSdf(sdf, localCenter);
+    if ((surfaceDist - sdf->cellSize*sqrtf(3.0f))*instance->minScale >= radius)
+        return false;
+
+    //Behind the surface, where pushing off the nearest triangles could go either way
+    if (surfaceDist < 0.0f)
+    {
+        vec3 gradient = {}, normal = {};
+        sampleSdfGradient(sdf, localCenter, gradient);
+        for (int d = 0; d < 3; d++)
+            normal[d] = glm_vec3_dot((float*)instance->invTransform[d], gradient);
+
+        if (glm_vec3_norm2(normal) > 0.0f)
+        {
+            glm_vec3_normalize(normal);
+            glm_vec3_muladds(normal, radius - surfaceDist*instance->minScale, center);
+            return true;
+        }
+    }
+
+    u32 triangleIds[COLLISION_MAX_OVERLAP_TRIANGLES];
+    u32 trianglesCount = overlapSphere(
+        mesh,
+        &world->meshScratches[instance->meshIdx],
+        localCenter,
+        radius/instance->minScale,
+        triangleIds,
+        COLLISION_MAX_OVERLAP_TRIANGLES);
+
+    const vec3 *vertices = (const vec3*)(mesh->data + mesh->transformedVerticesIdx);
+    const u16 *triangles = (const u16*)(mesh->data + mesh->trianglesIdx);
+    bool separated = false;
+    for (u32 i = 0; i < trianglesCount; i++)
+    {
+        const u16 *triangle = &triangles[3*triangleIds[i]];
+        vec3 corners[3] = {};
+        for (u32 vtx = 0; vtx < 3; vtx++)
+            glm_mat4_mulv3((vec4*)instance->transform, (float*)vertices[triangle[vtx]], 1.0f, corners[vtx]);
+
+        vec3 closest = {}, away = {};
+        closestPointOnTriangleFeature(center, corners[0], corners[1], corners[2], closest);
+        glm_vec3_sub(center, closest, away);
+        float dist = glm_vec3_norm(away);
+
+        //A centre on the triangle has no side to leave by
+        if (dist >= radius || dist == 0.0f)
+            continue;
+
+        glm_vec3_scale(away, (radius - dist)/dist, away);
+        glm_vec3_add(center, away, center);
+        separated = true;
+    }
+
+    return separated;
+}
+
+bool separateSphereFromCollisionWorld(CollisionWorld *world, const vec3 center, float radius, u32 skipInstanceIdx, vec3 push)
+{
+    glm_vec3_zero(push);
+    if (!world->nodesCount)
+        return false;
+
+    vec3 moved = {center[0], center[1], center[2]};
+    Box sphereBounds = {.corners = {
+        {center[0] - radius, center[1] - radius, center[2] - radius},
+        {center[0] + radius, center[1] + radius, center[2] + radius}}};
+
+    u32 stack[COLLISION_BVH_STACK_SIZE];
+    u32 stackSize = 0;
+    stack[stackSize++] = 0;
+
+    bool separated = false;
+    while (stackSize)
+    {
+        const BvhNode *node = &world->nodes[stack[--stackSize]];
+        if (!boundsOverlap(&node->bounds, &sphereBounds))
+            continue;
+
+        if (!node->count)
+        {
+            assert(stackSize + 2 <= COLLISION_BVH_STACK_SIZE);
+            stack[stackSize++] = node->first + 1;
+            stack[stackSize++] = node->first;
+            continue;
+        }
+
+        for (u32 i = node->first; i < node->first + node->count; i++)
+        {
+            u32 instanceIdx = world->instanceOrder[i];
+            if (instanceIdx == skipInstanceIdx || !boundsOverlap(&world->instances[instanceIdx].bounds, &sphereBounds))
+                continue;
+
+            if (separateSphereFromInstance(world, instanceIdx, moved, radius))
+                separated = true;
+        }
+    }
+
+    glm_vec3_sub(moved, (float*)center, push);
+    return separated;
+}
+
+void applyCharacterWorldCollision(Character *character, JobPool *jobs, CollisionWorld *world, u32 characterInstanceIdx)
+{
+    float magnitude = glm_vec3_norm(character->vel_m_s);
+    if (magnitude > 0.0f)
+    {
+        vec3 dir = {};
+        glm_vec3_scale(character->vel_m_s, 1.0f/magnitude, dir);
+
+        WorldRayHit hit = {};
+        raycastCollisionWorld(jobs, world, 1, &character->pos, &dir, &magnitude, characterInstanceIdx, &hit);
+
+        if (hit.hit.triangleId != RAYCAST_MISS)//Collided, so stop the sphere against it
+        {
+            glm_vec3_scale(dir, glm_max(hit.hit.dist - COLLISION_CHARACTER_RADIUS, 0.0f), dir);
+            glm_vec3_add(character->pos, dir, character->pos);
+            glm_vec3_zero(character->vel_m_s);
+        }
+        else
+        {
+            glm_vec3_add(character->pos, character->vel_m_s, character->pos);
+        }
+    }
+
+    //The ray only keeps the way ahead clear. Whatever velocity heads back into the push is dropped.
+    vec3 push = {};
+    if (!separateSphereFromCollisionWorld(world, character->pos, COLLISION_CHARACTER_RADIUS, characterInstanceIdx, push))
+        return;
+
+    glm_vec3_add(character->pos, push, character->pos);
+    glm_vec3_normalize(push);
+    float into = glm_vec3_dot(character->vel_m_s, push);
+    if (into < 0.0f)
+    {
+        glm_vec3_scale(push, into, push);
+        glm_vec3_sub(character->vel_m_s, push, character->vel_m_s);
+    }
+}
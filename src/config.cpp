@@ -59,6 +59,38 @@ bool loadUserConfig(const char* configFilePath, UserConfig *userConfig)
         userConfig->window.height = heightVal.u.i;
     }
 
+    //Optional, as the default suits most deployments
+    userConfig->renderer.framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+    userConfig->renderer.pipelineStatistics = false;
+    userConfig->renderer.cpuCulling = false;
+    userConfig->renderer.occlusionCulling = false;
+    toml_table_t *rendererTable = toml_table_in(confToml, "renderer");
+    if (rendererTable){
+        toml_datum_t statsVal = toml_bool_in(rendererTable, "pipeline_statistics");
+        if (statsVal.ok){
+            userConfig->renderer.pipelineStatistics = statsVal.u.b;
+        }
+
+        toml_datum_t cullingVal = toml_bool_in(rendererTable, "cpu_culling");
+        if (cullingVal.ok){
+            userConfig->renderer.cpuCulling = cullingVal.u.b;
+        }
+
+        toml_datum_t occlusionVal = toml_bool_in(rendererTable, "occlusion_culling");
+        if (occlusionVal.ok){
+            userConfig->renderer.occlusionCulling = occlusionVal.u.b;
+        }
+
+        toml_datum_t framesVal = toml_int_in(rendererTable, "frames_in_flight");
+        if (framesVal.ok && framesVal.u.i >= 1 && framesVal.u.i <= MAX_FRAMES_IN_FLIGHT){
+            userConfig->renderer.framesInFlight = framesVal.u.i;
+        }
+        else if (framesVal.ok){
+            fprintf(stderr, "frames_in_flight must be between 1 and %d in renderer conf\n", MAX_FRAMES_IN_FLIGHT);
+            errorFree = false;
+        }
+    }
+
     toml_free(confToml);
 
     return errorFree;
@@ -0,0 +1,870 @@
+#include "culling.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <immintrin.h>
+#include "load.h"
+#include "vkshader.h"
+#include "vertex.h"
+#include "telemetry.h"
+#include "timing.h"
+
+typedef struct {//Matches the compute shader's push constants
+    u32 instancesCount;
+    u32 meshesCount;
+    u32 occlusion;
+} CullPushConstants;
+
+static VkDescriptorSetLayout createCullingSetLayout(VkDevice device)
+{
+    VkDescriptorSetLayoutBinding bindings[6] = {};
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;//Frame uniforms
+    bindings[0].descriptorCount = 1;
+    bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    //Instances, meshes, commands, counts and visibility
+    for (u32 i = 1; i < NUM_ELEMENTS(bindings); i++)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+    layoutInfo.bindingCount = NUM_ELEMENTS(bindings);
+    layoutInfo.pBindings = bindings;
+
+    VkDescriptorSetLayout layout = {};
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, NULL, &layout)){
+        fprintf(stderr, "Failed to create Culling Descriptor Set Layout\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return layout;
+}
+
+static VkDescriptorPool createCullingDescriptorPool(VkDevice device)
+{
+    u32 setsCount = MAX_FRAMES_IN_FLIGHT*CULL_PHASES_COUNT;
+    VkDescriptorPoolSize poolSizes[2] = {};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    poolSizes[0].descriptorCount = setsCount;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = 5*setsCount;
+
+    VkDescriptorPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+    poolInfo.poolSizeCount = NUM_ELEMENTS(poolSizes);
+    poolInfo.pPoolSizes = poolSizes;
+    poolInfo.maxSets = setsCount;
+
+    VkDescriptorPool descriptorPool = NULL;
+    if (vkCreateDescriptorPool(device, &poolInfo, NULL, &descriptorPool)){
+        fprintf(stderr, "Failed to create Culling Descriptor Pool\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return descriptorPool;
+}
+
+static PipelineDetails createCullingPipeline(
+    VkDevice device,
+    const VkDescriptorSetLayout *setLayouts,
+    u32 setLayoutsCount,
+    const char *shaderName)
+{
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.size = sizeof(CullPushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    pipelineLayoutInfo.setLayoutCount = setLayoutsCount;
+    pipelineLayoutInfo.pSetLayouts = setLayouts;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    VkPipelineLayout pipelineLayout;
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &pipelineLayout)){
+        fprintf(stderr, "Failed to create Culling Pipeline Layout\n");
+        exit(EXIT_FAILURE);
+    }
+
+    FilePath cullShaderPath = createFilePath(SHADERS_DIR, shaderName);
+    FileContents cullShader = readFileContents(cullShaderPath.str);
+    if (!cullShader.bytes){
+        fprintf(stderr, "Failed to find the Culling Shader binary\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkShaderModule cullShaderModule = createShaderModule(device, (uint32_t*)cullShader.bytes, cullShader.len);
+
+    VkComputePipelineCreateInfo pipelineInfo = {VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = cullShaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = pipelineLayout;
+
+    VkPipeline pipeline;
+    if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &pipeline)){
+        fprintf(stderr, "Failed to create Culling Pipeline\n");
+        exit(EXIT_FAILURE);
+    }
+
+    free(cullShader.bytes);
+    vkDestroyShaderModule(device, cullShaderModule, NULL);
+
+    return {.handle = pipeline, .layout = pipelineLayout};
+}
+
+static Buffer createCullingBuffer(
+    VmaAllocator allocator,
+    VkDeviceSize size,
+    VkBufferUsageFlags usage,
+    bool mapped)
+{
+    VkBufferCreateInfo bufferInfo = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+
+    VmaAllocationCreateInfo allocInfo = {};
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+    if (mapped)
+        allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    Buffer buffer = {};
+    if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &buffer.handle, &buffer.alloc, &buffer.info))
+    {
+        fprintf(stderr, "Failed to allocate Culling Buffer\n");
+        exit(EXIT_FAILURE);
+    }
+    trackAllocation(allocator, buffer.alloc, MEMORY_CATEGORY_STORAGE);
+
+    return buffer;
+}
+
+static void destroyCullingBuffer(VmaAllocator allocator, Buffer *buffer)
+{
+    untrackAllocation(allocator, buffer->alloc);
+    vmaDestroyBuffer(allocator, buffer->handle, buffer->alloc);
+    *buffer = {};
+}
+
+Culling createCulling(
+    CullingMode mode,
+    VkDevice device,
+    VmaAllocator allocator,
+    const UniformRing *uniformRing,
+    const InstanceBuffer *instances,
+    u32 meshesCapacity,
+    VkDeviceSize minStorageBufferOffsetAlignment,
+    const DepthPyramid *pyramid)
+{
+    Culling culling = {};
+    culling.mode = mode;
+    culling.device = device;
+    culling.allocator = allocator;
+    culling.framesCount = instances->framesCount;
+    culling.capacity = instances->capacity;
+    culling.meshesCapacity = meshesCapacity;
+    culling.phasesCount = pyramid && mode == CULLING_GPU ? CULL_PHASES_COUNT : 1;
+    //Each mesh's last batch may be partial
+    culling.batchesCapacity = culling.capacity/CULL_BATCH_MAX_COMMANDS + meshesCapacity;
+    culling.batches = (CullBatch*)calloc(culling.batchesCapacity, sizeof(CullBatch));
+    if (!culling.batches)
+    {
+        fprintf(stderr, "Failed to allocate Culling Batches\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkDeviceSize alignment = minStorageBufferOffsetAlignment ? minStorageBufferOffsetAlignment : 1;
+    culling.commandsRegionSize =
+        (sizeof(VkDrawIndexedIndirectCommand)*culling.capacity + alignment - 1) / alignment * alignment;
+    culling.countsRegionSize = (sizeof(u32)*culling.batchesCapacity + alignment - 1) / alignment * alignment;
+
+    if (mode == CULLING_CPU)
+    {
+        //Written by the host each frame, and only ever read as draw parameters.
+        //The counts stay on the host.
+        culling.commands = createCullingBuffer(
+            allocator,
+            culling.commandsRegionSize*culling.framesCount,
+            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+            true);
+
+        culling.hostMeshes = (CullMesh*)calloc(meshesCapacity, sizeof(CullMesh));
+        culling.hostCounts = (u32*)calloc(culling.batchesCapacity, sizeof(u32));
+        if (!culling.hostMeshes || !culling.hostCounts)
+        {
+            fprintf(stderr, "Failed to allocate Culling Meshes\n");
+            exit(EXIT_FAILURE);
+        }
+        culling.bounds = createCullBounds(culling.capacity);
+
+        return culling;
+    }
+
+    culling.meshes = createCullingBuffer(
+        allocator,
+        sizeof(CullMesh)*meshesCapacity,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        true);
+    //Regions are ordered by frame, then phase
+    u32 regionsCount = culling.framesCount*culling.phasesCount;
+    culling.commands = createCullingBuffer(
+        allocator,
+        culling.commandsRegionSize*regionsCount,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        false);
+    culling.counts = createCullingBuffer(
+        allocator,
+        culling.countsRegionSize*regionsCount,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        false);
+    //Starts out undefined, which only decides which pass something is first drawn in
+    culling.visibility = createCullingBuffer(
+        allocator,
+        sizeof(u32)*culling.capacity,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        false);
+
+    culling.setLayout = createCullingSetLayout(device);
+    culling.descriptorPool = createCullingDescriptorPool(device);
+    culling.pipeline = createCullingPipeline(device, &culling.setLayout, 1, "cull.spv");
+    if (culling.phasesCount > 1)
+    {
+        VkDescriptorSetLayout occlusionLayouts[] = {culling.setLayout, pyramid->sampleLayout};
+        culling.occlusionPipeline = createCullingPipeline(device, occlusionLayouts, NUM_ELEMENTS(occlusionLayouts), "occlude.spv");
+    }
+
+    VkDescriptorSetLayout layouts[MAX_FRAMES_IN_FLIGHT*CULL_PHASES_COUNT] = {};
+    for (u32 i = 0; i < regionsCount; i++)
+        layouts[i] = culling.setLayout;
+
+    VkDescriptorSetAllocateInfo setAllocInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+    setAllocInfo.descriptorPool = culling.descriptorPool;
+    setAllocInfo.descriptorSetCount = culling.phasesCount;
+    setAllocInfo.pSetLayouts = layouts;
+
+    for (u32 i = 0; i < culling.framesCount; i++)
+    {
+        if (vkAllocateDescriptorSets(device, &setAllocInfo, culling.sets[i])){
+            fprintf(stderr, "Failed to allocate Culling Descriptor Sets\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (u32 region = 0; region < regionsCount; region++)
+    {
+        u32 i = region / culling.phasesCount;
+        u32 phase = region % culling.phasesCount;
+
+        VkDescriptorBufferInfo bufferInfos[6] = {};
+        bufferInfos[0].buffer = uniformRing->buffer.handle;
+        bufferInfos[0].offset = 0;//Picked by dynamic offset
+        bufferInfos[0].range = sizeof(FrameUniforms);
+        bufferInfos[1].buffer = instances->buffer.handle;
+        bufferInfos[1].offset = i*instances->regionSize;
+        bufferInfos[1].range = instances->regionSize;
+        bufferInfos[2].buffer = culling.meshes.handle;
+        bufferInfos[2].offset = 0;
+        bufferInfos[2].range = VK_WHOLE_SIZE;
+        bufferInfos[3].buffer = culling.commands.handle;
+        bufferInfos[3].offset = region*culling.commandsRegionSize;
+        bufferInfos[3].range = culling.commandsRegionSize;
+        bufferInfos[4].buffer = culling.counts.handle;
+        bufferInfos[4].offset = region*culling.countsRegionSize;
+        bufferInfos[4].range = culling.countsRegionSize;
+        bufferInfos[5].buffer = culling.visibility.handle;
+        bufferInfos[5].offset = 0;
+        bufferInfos[5].range = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet descriptorWrites[6] = {};
+        for (u32 binding = 0; binding < NUM_ELEMENTS(descriptorWrites); binding++)
+        {
+            descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[binding].dstSet = culling.sets[i][phase];
+            descriptorWrites[binding].dstBinding = binding;
+            descriptorWrites[binding].descriptorType =
+                binding ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+            descriptorWrites[binding].descriptorCount = 1;
+            descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+        }
+
+        vkUpdateDescriptorSets(device, NUM_ELEMENTS(descriptorWrites), descriptorWrites, 0, NULL);
+    }
+
+    return culling;
+}
+
+void destroyCulling(Culling *culling)
+{
+    if (culling->mode == CULLING_CPU)
+    {
+        free(culling->hostMeshes);
+        free(culling->hostCounts);
+        destroyCullBounds(&culling->bounds);
+    }
+    else
+    {
+        vkDestroyPipeline(culling->device, culling->pipeline.handle, NULL);
+        vkDestroyPipelineLayout(culling->device, culling->pipeline.layout, NULL);
+        if (culling->occlusionPipeline.handle)
+        {
+            vkDestroyPipeline(culling->device, culling->occlusionPipeline.handle, NULL);
+            vkDestroyPipelineLayout(culling->device, culling->occlusionPipeline.layout, NULL);
+        }
+        vkDestroyDescriptorPool(culling->device, culling->descriptorPool, NULL);
+        vkDestroyDescriptorSetLayout(culling->device, culling->setLayout, NULL);
+        destroyCullingBuffer(culling->allocator, &culling->meshes);
+        destroyCullingBuffer(culling->allocator, &culling->visibility);
+    }
+
+    free(culling->batches);
+    destroyCullingBuffer(culling->allocator, &culling->commands);
+    if (culling->counts.handle)
+        destroyCullingBuffer(culling->allocator, &culling->counts);
+    *culling = {};
+}
+
+void setCullingMeshes(Culling *culling, const ModelInfo *models[], u32 modelsCount, InstanceBuffer *instances)
+{
+    if (modelsCount > culling->meshesCapacity)
+    {
+        fprintf(stderr, "Too many Culling Meshes\n");
+        abort();
+    }
+
+    culling->meshesCount = modelsCount;
+    culling->instancesCount = 0;
+    culling->batchesCount = 0;
+
+    //Ordered by block, with each batch's commands following the last's
+    CullMesh *meshes = culling->mode == CULLING_CPU ? culling->hostMeshes : (CullMesh*)culling->meshes.info.pMappedData;
+    u32 commandsCount = 0;
+    for (u32 block = 0; block < DEVICE_BUFFER_POOL_MAX_BLOCKS; block++)
+    {
+        for (u32 i = 0; i < modelsCount; i++)
+        {
+            const ModelInfo *model = models[i];
+            if (model->buffers.range.block != block)
+                continue;
+
+            //Vertex and index buffers get bound at the start of the block
+            meshes[i].vertexOffset = model->buffers.vtxOffset / sizeof(VertexAttributes);
+            meshes[i].lodsCount = model->buffers.lodsCount;
+            for (u32 lod = 0; lod < model->buffers.lodsCount; lod++)
+            {
+                meshes[i].lods[lod].indexCount = model->buffers.lods[lod].indicesCount;
+                meshes[i].lods[lod].firstIndex = model->buffers.idxOffset / sizeof(u16) + model->buffers.lods[lod].firstIndex;
+                meshes[i].lods[lod].error = model->buffers.lods[lod].error;
+            }
+            meshes[i].firstBatch = culling->batchesCount;
+            meshes[i].firstInstance = model->firstInstance;
+            meshes[i].commandsBase = commandsCount;
+
+            for (u32 first = 0; first < model->instancesCount; first += CULL_BATCH_MAX_COMMANDS)
+            {
+                assert(culling->batchesCount < culling->batchesCapacity);
+                CullBatch *batch = &culling->batches[culling->batchesCount++];
+                batch->block = block;
+                batch->commandsBase = commandsCount;
+                batch->commandsCount = model->instancesCount - first < CULL_BATCH_MAX_COMMANDS ?
+                    model->instancesCount - first : CULL_BATCH_MAX_COMMANDS;
+                commandsCount += batch->commandsCount;
+            }
+
+            for (u32 j = model->firstInstance; j < model->firstInstance + model->instancesCount; j++)
+            {
+                InstanceData data = instances->instances[j];
+                data.meshIdx = i;
+                setInstance(instances, j, &data);
+            }
+
+            if (model->firstInstance + model->instancesCount > culling->instancesCount)
+                culling->instancesCount = model->firstInstance + model->instancesCount;
+        }
+    }
+
+    assert(commandsCount <= culling->capacity);
+
+    //Recorded draws hold the old batches
+    for (u32 frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++)
+        culling->drawsGenerations[frame]++;
+
+    if (culling->mode == CULLING_GPU)
+        vmaFlushAllocation(culling->allocator, culling->meshes.alloc, 0, VK_WHOLE_SIZE);
+}
+
+void recordCulling(
+    const Culling *culling,
+    VkCommandBuffer cmdBuffer,
+    u32 frame,
+    CullPhase phase,
+    u32 frameUniformsOffset,
+    const DepthPyramid *pyramid,
+    Profiler *profiler)
+{
+    if (culling->mode != CULLING_GPU || phase >= culling->phasesCount)
+        return;
+
+    u32 scope = beginGpuScope(profiler, cmdBuffer, phase == CULL_PHASE_EARLY ? "culling" : "occlusion");
+
+    VkMemoryBarrier2 barrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+
+    VkDependencyInfo dependencyInfo = {VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    dependencyInfo.memoryBarrierCount = 1;
+    dependencyInfo.pMemoryBarriers = &barrier;
+
+    if (phase == CULL_PHASE_EARLY)
+    {
+        //Every phase's counts at once, as they're contiguous
+        vkCmdFillBuffer(
+            cmdBuffer, 
+            culling->counts.handle, 
+            frame*culling->phasesCount*culling->countsRegionSize, 
+            culling->phasesCount*culling->countsRegionSize, 
+            0);
+
+        //Also orders the last frame's late phase before this reads its visibility
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_CLEAR_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+        barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+    }
+    else
+    {
+        //The early phase's reads of visibility come before it is rewritten
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+        barrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+    }
+
+    vkCmdPipelineBarrier2(cmdBuffer, &dependencyInfo);
+
+    if (culling->instancesCount)
+    {
+        const PipelineDetails *pipeline = phase == CULL_PHASE_EARLY ? &culling->pipeline : &culling->occlusionPipeline;
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->handle);
+        vkCmdBindDescriptorSets(
+            cmdBuffer,
+            VK_PIPELINE_BIND_POINT_COMPUTE,
+            pipeline->layout,
+            0, 1, &culling->sets[frame][phase],
+            1, &frameUniformsOffset);
+        if (phase == CULL_PHASE_LATE)
+        {
+            vkCmdBindDescriptorSets(
+                cmdBuffer,
+                VK_PIPELINE_BIND_POINT_COMPUTE,
+                pipeline->layout,
+                1, 1, &pyramid->sampleSet,
+                0, NULL);
+        }
+
+        CullPushConstants pushConstants = {culling->instancesCount, culling->meshesCount, culling->phasesCount > 1};
+        vkCmdPushConstants(
+            cmdBuffer,
+            pipeline->layout,
+            VK_SHADER_STAGE_COMPUTE_BIT,
+            0, sizeof(pushConstants), &pushConstants);
+
+        vkCmdDispatch(cmdBuffer, (culling->instancesCount + CULL_WORKGROUP_SIZE - 1)/CULL_WORKGROUP_SIZE, 1, 1);
+    }
+
+    //The commands and counts are read as the draws' parameters
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT;
+
+    vkCmdPipelineBarrier2(cmdBuffer, &dependencyInfo);
+
+    endGpuScope(profiler, cmdBuffer, scope);
+}
+
+void recordCulledDraws(const Culling *culling, VkCommandBuffer cmdBuffer, u32 frame, CullPhase phase, u32 batch)
+{
+    const CullBatch *cullBatch = &culling->batches[batch];
+    u32 region = frame*culling->phasesCount + phase;
+
+    if (culling->mode == CULLING_CPU)
+    {
+        vkCmdDrawIndexedIndirect(
+            cmdBuffer,
+            culling->commands.handle,
+            region*culling->commandsRegionSize + cullBatch->commandsBase*sizeof(VkDrawIndexedIndirectCommand),
+            cullBatch->commandsCount,
+            sizeof(VkDrawIndexedIndirectCommand));
+        return;
+    }
+
+    vkCmdDrawIndexedIndirectCount(
+        cmdBuffer,
+        culling->commands.handle,
+        region*culling->commandsRegionSize + cullBatch->commandsBase*sizeof(VkDrawIndexedIndirectCommand),
+        culling->counts.handle,
+        region*culling->countsRegionSize + batch*sizeof(u32),
+        cullBatch->commandsCount,
+        sizeof(VkDrawIndexedIndirectCommand));
+}
+
+CullBounds createCullBounds(u32 capacity)
+{
+    CullBounds bounds = {};
+    bounds.capacity = (capacity + CULL_BOUNDS_LANES - 1)/CULL_BOUNDS_LANES*CULL_BOUNDS_LANES;
+
+    //Whole lanes, so the arrays stay aligned for AVX loads
+    size_t floatsSize = sizeof(float)*bounds.capacity;
+    for (u32 axis = 0; axis < 3; axis++)
+    {
+        bounds.centres[axis] = (float*)aligned_alloc(32, floatsSize);
+        bounds.extents[axis] = (float*)aligned_alloc(32, floatsSize);
+        if (!bounds.centres[axis] || !bounds.extents[axis])
+        {
+            fprintf(stderr, "Failed to allocate Culling Bounds\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(bounds.centres[axis], 0, floatsSize);
+        memset(bounds.extents[axis], 0, floatsSize);
+    }
+
+    bounds.scales = (float*)aligned_alloc(32, floatsSize);
+    if (!bounds.scales)
+    {
+        fprintf(stderr, "Failed to allocate Culling Bounds\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(bounds.scales, 0, floatsSize);
+
+    bounds.meshIdxs = (u32*)aligned_alloc(32, sizeof(u32)*bounds.capacity);
+    if (!bounds.meshIdxs)
+    {
+        fprintf(stderr, "Failed to allocate Culling Bounds\n");
+        exit(EXIT_FAILURE);
+    }
+    for (u32 i = 0; i < bounds.capacity; i++)
+        bounds.meshIdxs[i] = INSTANCE_NO_MESH;
+
+    return bounds;
+}
+
+void destroyCullBounds(CullBounds *bounds)
+{
+    for (u32 axis = 0; axis < 3; axis++)
+    {
+        free(bounds->centres[axis]);
+        free(bounds->extents[axis]);
+    }
+    free(bounds->scales);
+    free(bounds->meshIdxs);
+    *bounds = {};
+}
+
+void setCullBounds(CullBounds *bounds, u32 idx, mat4 model, const vec4 boundingSphere, u32 meshIdx)
+{
+    assert(idx < bounds->capacity);
+
+    //The box around the world space sphere, which is looser than transforming the
+    //mesh's own box but needs nothing more than the instance has
+    vec3 centre = {};
+    glm_mat4_mulv3(model, (float*)boundingSphere, 1.0f, centre);
+    float scale = glm_max(glm_vec3_norm(model[0]), glm_max(glm_vec3_norm(model[1]), glm_vec3_norm(model[2])));
+    float radius = boundingSphere[3]*scale;
+
+    for (u32 axis = 0; axis < 3; axis++)
+    {
+        bounds->centres[axis][idx] = centre[axis];
+        bounds->extents[axis][idx] = radius;
+    }
+    bounds->scales[idx] = scale;
+    bounds->meshIdxs[idx] = meshIdx;
+
+    u32 count = (idx + CULL_BOUNDS_LANES)/CULL_BOUNDS_LANES*CULL_BOUNDS_LANES;
+    if (count > bounds->count)
+        bounds->count = count;
+}
+
+//The coarsest LOD whose error still looks under MESH_LOD_ERROR_PIXELS from the nearest
+//point of the bounds, as cull.comp picks it
+static inline const CullLod* selectCullLod(const CullBounds *bounds, u32 idx, const CullMesh *mesh, const vec4 lodCamera)
+{
+    vec3 toCamera = {
+        bounds->centres[0][idx] - lodCamera[0],
+        bounds->centres[1][idx] - lodCamera[1],
+        bounds->centres[2][idx] - lodCamera[2]};
+    float nearest = glm_max(glm_vec3_norm(toCamera) - bounds->extents[0][idx], 0.0f);
+
+    u32 lod = 0;
+    while (lod + 1 < mesh->lodsCount && mesh->lods[lod + 1].error*bounds->scales[idx]*lodCamera[3] <= nearest)
+        lod++;
+
+    return &mesh->lods[lod];
+}
+
+static inline bool appendCulledCommand(
+    const CullBounds *bounds,
+    u32 idx,
+    const vec4 lodCamera,
+    const CullMesh *meshes,
+    u32 meshesCount,
+    VkDrawIndexedIndirectCommand *commands,
+    u32 *counts)
+{
+    u32 meshIdx = bounds->meshIdxs[idx];
+    if (meshIdx >= meshesCount)
+        return false;
+
+    const CullMesh *mesh = &meshes[meshIdx];
+    const CullLod *lod = selectCullLod(bounds, idx, mesh, lodCamera);
+    u32 meshBatch = (idx - mesh->firstInstance)/CULL_BATCH_MAX_COMMANDS;
+    u32 slot = counts[mesh->firstBatch + meshBatch]++;
+    VkDrawIndexedIndirectCommand *command = &commands[mesh->commandsBase + meshBatch*CULL_BATCH_MAX_COMMANDS + slot];
+    command->indexCount = lod->indexCount;
+    command->instanceCount = 1;
+    command->firstIndex = lod->firstIndex;
+    command->vertexOffset = mesh->vertexOffset;
+    command->firstInstance = idx;//Comes through as gl_InstanceIndex
+
+    return true;
+}
+
+u32 cullBoundsAvx(
+    const CullBounds *bounds,
+    const vec4 frustumPlanes[6],
+    const vec4 lodCamera,
+    const CullMesh *meshes,
+    u32 meshesCount,
+    VkDrawIndexedIndirectCommand *commands,
+    u32 *counts)
+{
+    //A box is outside a plane when even its corner furthest along the normal is
+    //behind it, which is its centre's distance plus its extents along |normal|
+    __m256 normals[6][3], absNormals[6][3], offsets[6];
+    for (u32 plane = 0; plane < 6; plane++)
+    {
+        for (u32 axis = 0; axis < 3; axis++)
+        {
+            normals[plane][axis] = _mm256_set1_ps(frustumPlanes[plane][axis]);
+            absNormals[plane][axis] = _mm256_set1_ps(fabsf(frustumPlanes[plane][axis]));
+        }
+        offsets[plane] = _mm256_set1_ps(frustumPlanes[plane][3]);
+    }
+
+    const __m256 zero = _mm256_setzero_ps();
+    u32 written = 0;
+    for (u32 i = 0; i < bounds->count; i += CULL_BOUNDS_LANES)
+    {
+        __m256 cx = _mm256_load_ps(bounds->centres[0] + i);
+        __m256 cy = _mm256_load_ps(bounds->centres[1] + i);
+        __m256 cz = _mm256_load_ps(bounds->centres[2] + i);
+        __m256 ex = _mm256_load_ps(bounds->extents[0] + i);
+        __m256 ey = _mm256_load_ps(bounds->extents[1] + i);
+        __m256 ez = _mm256_load_ps(bounds->extents[2] + i);
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (u32 plane = 0; plane < 6; plane++)
+        {
+            __m256 dist = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(normals[plane][0], cx), _mm256_mul_ps(normals[plane][1], cy)),
+                _mm256_add_ps(_mm256_mul_ps(normals[plane][2], cz), offsets[plane]));
+            __m256 reach = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(absNormals[plane][0], ex), _mm256_mul_ps(absNormals[plane][1], ey)),
+                _mm256_mul_ps(absNormals[plane][2], ez));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(dist, reach), zero, _CMP_GE_OQ));
+        }
+
+        u32 mask = (u32)_mm256_movemask_ps(inside);
+        while (mask)
+        {
+            u32 lane = (u32)__builtin_ctz(mask);
+            mask &= mask - 1;
+            written += appendCulledCommand(bounds, i + lane, lodCamera, meshes, meshesCount, commands, counts);
+        }
+    }
+
+    return written;
+}
+
+u32 cullBoundsScalar(
+    const CullBounds *bounds,
+    const vec4 frustumPlanes[6],
+    const vec4 lodCamera,
+    const CullMesh *meshes,
+    u32 meshesCount,
+    VkDrawIndexedIndirectCommand *commands,
+    u32 *counts)
+{
+    u32 written = 0;
+    for (u32 i = 0; i < bounds->count; i++)
+    {
+        bool inside = true;
+        for (u32 plane = 0; plane < 6 && inside; plane++)
+        {
+            const float *p = frustumPlanes[plane];
+            //Summed in the same order as the AVX kernel, so both round alike
+            float dist = (p[0]*bounds->centres[0][i] + p[1]*bounds->centres[1][i]) + (p[2]*bounds->centres[2][i] + p[3]);
+            float reach = fabsf(p[0])*bounds->extents[0][i] + fabsf(p[1])*bounds->extents[1][i] + fabsf(p[2])*bounds->extents[2][i];
+            inside = dist + reach >= 0.0f;
+        }
+
+        if (inside)
+            written += appendCulledCommand(bounds, i, lodCamera, meshes, meshesCount, commands, counts);
+    }
+
+    return written;
+}
+
+void cullInstances(
+    Culling *culling,
+    const InstanceBuffer *instances,
+    u32 frame,
+    const vec4 frustumPlanes[6],
+    const vec4 lodCamera)
+{
+    if (culling->mode != CULLING_CPU)
+        return;
+
+    //Everything changed since the frame's region was last uploaded, so at least
+    //everything changed since the last cull
+    for (u32 i = instances->dirtyStart[frame]; i < instances->dirtyEnd[frame]; i++)
+    {
+        InstanceData *instance = &instances->instances[i];
+        setCullBounds(&culling->bounds, i, instance->model, instance->boundingSphere, instance->meshIdx);
+    }
+
+    u32 *counts = culling->hostCounts;
+    memset(counts, 0, sizeof(u32)*culling->batchesCount);
+    VkDrawIndexedIndirectCommand *commands = (VkDrawIndexedIndirectCommand*)(
+        (u8*)culling->commands.info.pMappedData + frame*culling->commandsRegionSize);
+    cullBoundsAvx(&culling->bounds, frustumPlanes, lodCamera, culling->hostMeshes, culling->meshesCount, commands, counts);
+
+    //Every batch is drawn in full so the recorded draws never depend on the counts,
+    //with what's left after its visible commands drawing nothing
+    for (u32 batch = 0; batch < culling->batchesCount; batch++)
+    {
+        const CullBatch *cullBatch = &culling->batches[batch];
+        memset(
+            commands + cullBatch->commandsBase + counts[batch],
+            0,
+            sizeof(VkDrawIndexedIndirectCommand)*(cullBatch->commandsCount - counts[batch]));
+    }
+
+    //No-op on coherent memory
+    vmaFlushAllocation(culling->allocator, culling->commands.alloc, frame*culling->commandsRegionSize, culling->commandsRegionSize);
+}
+
+static float randomUnit(u32 *state)
+{
+    *state = *state*1664525u + 1013904223u;
+    return (*state >> 8)*(1.0f/16777216.0f);
+}
+
+void benchmarkCpuCulling(u32 instancesCount, u32 iterations, FILE *out)
+{
+    //Each mesh's instances are contiguous, as the scene's are
+    const u32 meshesCount = CULL_BENCHMARK_MESHES;
+    u32 meshCapacity = (instancesCount + meshesCount - 1)/meshesCount;
+    u32 meshBatches = (meshCapacity + CULL_BATCH_MAX_COMMANDS - 1)/CULL_BATCH_MAX_COMMANDS;
+    CullMesh meshes[CULL_BENCHMARK_MESHES] = {};
+    for (u32 i = 0; i < meshesCount; i++)
+    {
+        meshes[i].firstBatch = i*meshBatches;
+        meshes[i].firstInstance = i*meshCapacity;
+        meshes[i].commandsBase = i*meshCapacity;
+        meshes[i].lodsCount = MESH_MAX_LODS;
+        for (u32 lod = 0; lod < MESH_MAX_LODS; lod++)
+            meshes[i].lods[lod] = {.indexCount = 3*(i + 1) << (MESH_MAX_LODS - lod), .firstIndex = 0, .error = 0.002f*(1 << lod)};
+    }
+
+    //Kept apart, so both kernels' output can be compared
+    u32 commandsCount = meshCapacity*meshesCount, batchesCount = meshBatches*meshesCount;
+    VkDrawIndexedIndirectCommand *avxCommands =
+        (VkDrawIndexedIndirectCommand*)calloc(commandsCount, sizeof(VkDrawIndexedIndirectCommand));
+    VkDrawIndexedIndirectCommand *scalarCommands =
+        (VkDrawIndexedIndirectCommand*)calloc(commandsCount, sizeof(VkDrawIndexedIndirectCommand));
+    u32 *avxCounts = (u32*)malloc(sizeof(u32)*batchesCount);
+    u32 *scalarCounts = (u32*)malloc(sizeof(u32)*batchesCount);
+    if (!avxCommands || !scalarCommands || !avxCounts || !scalarCounts)
+    {
+        fprintf(stderr, "Failed to allocate Culling Benchmark Commands\n");
+        exit(EXIT_FAILURE);
+    }
+
+    //Scattered all around the camera, so most fall outside the frustum
+    CullBounds bounds = createCullBounds(instancesCount);
+    u32 seed = 1;
+    for (u32 i = 0; i < instancesCount; i++)
+    {
+        mat4 model = GLM_MAT4_IDENTITY_INIT;
+        vec3 pos = {
+            (randomUnit(&seed) - 0.5f)*400.0f,
+            (randomUnit(&seed) - 0.5f)*400.0f,
+            (randomUnit(&seed) - 0.5f)*400.0f};
+        glm_translate(model, pos);
+        vec4 sphere = {0.0f, 0.0f, 0.0f, 0.5f + 2.0f*randomUnit(&seed)};
+        setCullBounds(&bounds, i, model, sphere, i/meshCapacity);
+    }
+
+    mat4 view = {}, projection = {}, viewProjection = {};
+    vec3 eye = {0.0f, 0.0f, 0.0f}, centre = {0.0f, 0.0f, -1.0f}, up = {0.0f, 1.0f, 0.0f};
+    glm_lookat(eye, centre, up, view);
+    glm_perspective(glm_rad(60.0f), 16.0f/9.0f, 0.1f, 150.0f, projection);
+    glm_mat4_mul(projection, view, viewProjection);
+    vec4 frustumPlanes[6] = {};
+    glm_frustum_planes(viewProjection, frustumPlanes);
+    vec4 lodCamera = {eye[0], eye[1], eye[2], projection[1][1]*1080.0f*0.5f/MESH_LOD_ERROR_PIXELS};
+
+    u32 avxVisible = 0, scalarVisible = 0;
+    s64 avxTime_ns = 0, scalarTime_ns = 0;
+    for (u32 i = 0; i <= iterations; i++)
+    {
+        //The first of each only warms the caches
+        memset(avxCounts, 0, sizeof(u32)*batchesCount);
+        s64 start_ns = getCurrentTime_ns();
+        avxVisible = cullBoundsAvx(&bounds, frustumPlanes, lodCamera, meshes, meshesCount, avxCommands, avxCounts);
+        if (i)
+            avxTime_ns += getCurrentTime_ns() - start_ns;
+
+        memset(scalarCounts, 0, sizeof(u32)*batchesCount);
+        start_ns = getCurrentTime_ns();
+        scalarVisible = cullBoundsScalar(&bounds, frustumPlanes, lodCamera, meshes, meshesCount, scalarCommands, scalarCounts);
+        if (i)
+            scalarTime_ns += getCurrentTime_ns() - start_ns;
+    }
+
+    if (avxVisible != scalarVisible)
+    {
+        fprintf(stderr, "AVX culling kept %u boxes where scalar kept %u\n", avxVisible, scalarVisible);
+        abort();
+    }
+
+    //Both append in instance order, so each batch's commands must match exactly,
+    //which catches a wrong LOD or instance as well as a wrong count
+    for (u32 batch = 0; batch < batchesCount; batch++)
+    {
+        u32 mesh = batch/meshBatches;
+        u32 base = meshes[mesh].commandsBase + (batch - meshes[mesh].firstBatch)*CULL_BATCH_MAX_COMMANDS;
+        if (avxCounts[batch] != scalarCounts[batch] ||
+            memcmp(avxCommands + base, scalarCommands + base, sizeof(VkDrawIndexedIndirectCommand)*avxCounts[batch]))
+        {
+            fprintf(stderr, "AVX culling wrote different commands to batch %u than scalar\n", batch);
+            abort();
+        }
+    }
+
+    fprintf(out, "{\"type\":\"cullingBenchmark\",\"instances\":%u,\"visible\":%u,\"avx_ms\":%.4f,\"scalar_ms\":%.4f}\n",
+        instancesCount,
+        avxVisible,
+        NS_TO_MS((double)avxTime_ns)/iterations,
+        NS_TO_MS((double)scalarTime_ns)/iterations);
+    fflush(out);
+
+    destroyCullBounds(&bounds);
+    free(avxCommands);
+    free(scalarCommands);
+    free(avxCounts);
+    free(scalarCounts);
+}
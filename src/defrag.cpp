@@ -0,0 +1,436 @@
+#include "defrag.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "vkcommand.h"
+#include "vktextures.h"
+#include "telemetry.h"
+
+static float getTotalFragmentation(VmaAllocator allocator, VkDeviceSize *unused)
+{
+    VmaTotalStatistics stats = {};
+    vmaCalculateStatistics(allocator, &stats);
+
+    if (unused)
+        *unused = stats.total.statistics.blockBytes - stats.total.statistics.allocationBytes;
+
+    return getFragmentation(&stats.total);
+}
+
+static bool moveTexture(Defragmenter *defrag, VmaDefragmentationMove *vmaMove, DefragMove *move)
+{
+    TextureResidency *residency = defrag->residency;
+    ResidentTexture *tex = NULL;
+    for (u32 i = 0; i < residency->texturesCount; i++)
+    {
+        if (residency->textures[i].image.alloc == vmaMove->srcAllocation)
+        {
+            tex = &residency->textures[i];
+            move->owner = i;
+            break;
+        }
+    }
+
+    if (!tex)
+        return false;
+
+    u32 levels = tex->mipsCount - tex->residentMip;
+    VkImageCreateInfo imageInfo = getDeviceTextureInfo(tex->image.extent.width, tex->image.extent.height, levels);
+
+    VkImage image = VK_NULL_HANDLE;
+    if (vkCreateImage(defrag->device, &imageInfo, NULL, &image))
+    {
+        fprintf(stderr, "Failed to create Image for defragmentation\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (vmaBindImageMemory(defrag->allocator, vmaMove->dstTmpAllocation, image))
+    {
+        fprintf(stderr, "Failed to bind Image for defragmentation\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkImageMemoryBarrier2 barriers[2] = {};
+    for (u32 i = 0; i < NUM_ELEMENTS(barriers); i++)
+    {
+        barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+        barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barriers[i].subresourceRange.baseMipLevel = 0;
+        barriers[i].subresourceRange.levelCount = levels;
+        barriers[i].subresourceRange.baseArrayLayer = 0;
+        barriers[i].subresourceRange.layerCount = 1;
+        barriers[i].dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+    }
+
+    //Frames already submitted may still be sampling the old image
+    barriers[0].image = tex->image.handle;
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[0].srcStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+    barriers[0].srcAccessMask = VK_ACCESS_2_NONE;
+    barriers[0].dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT;
+
+    barriers[1].image = image;
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].srcStageMask = VK_PIPELINE_STAGE_2_NONE_KHR;
+    barriers[1].srcAccessMask = VK_ACCESS_2_NONE;
+    barriers[1].dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+
+    VkDependencyInfo dependencyInfo = {VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    dependencyInfo.imageMemoryBarrierCount = NUM_ELEMENTS(barriers);
+    dependencyInfo.pImageMemoryBarriers = barriers;
+
+    vkCmdPipelineBarrier2(defrag->cmdBuffer, &dependencyInfo);
+
+    VkImageCopy copies[TEXTURE_MAX_MIPS] = {};
+    for (u32 level = 0; level < levels; level++)
+    {
+        u32 width = tex->image.extent.width >> level, height = tex->image.extent.height >> level;
+        copies[level].srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        copies[level].srcSubresource.mipLevel = level;
+        copies[level].srcSubresource.baseArrayLayer = 0;
+        copies[level].srcSubresource.layerCount = 1;
+        copies[level].dstSubresource = copies[level].srcSubresource;
+        copies[level].extent = {width ? width : 1, height ? height : 1, 1};
+    }
+
+    vkCmdCopyImage(
+        defrag->cmdBuffer,
+        tex->image.handle,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        levels, copies);
+
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barriers[1].srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+    barriers[1].srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    barriers[1].dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+    barriers[1].dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT;
+
+    dependencyInfo.imageMemoryBarrierCount = 1;
+    dependencyInfo.pImageMemoryBarriers = &barriers[1];
+
+    vkCmdPipelineBarrier2(defrag->cmdBuffer, &dependencyInfo);
+
+    move->type = DEFRAG_MOVE_TEXTURE;
+    move->oldImage = tex->image.handle;
+    move->oldView = tex->image.view;
+    move->oldSlot = tex->slot;
+
+    //This frame's draws already sample the new image
+    tex->image.handle = image;
+    tex->image.view = createDeviceTextureView(defrag->device, image, levels);
+    tex->slot = addTableTexture(defrag->device, residency->table, tex->image.view);
+    tex->moving = true;
+
+    return true;
+}
+
+static bool moveBlock(Defragmenter *defrag, VmaDefragmentationMove *vmaMove, DefragMove *move)
+{
+    DeviceBufferPool *pool = defrag->devicePool;
+    DeviceBufferBlock *block = NULL;
+    for (u32 i = 0; i < pool->blocksCount; i++)
+    {
+        if (pool->blocks[i].buffer.alloc == vmaMove->srcAllocation)
+        {
+            block = &pool->blocks[i];
+            move->owner = i;
+            break;
+        }
+    }
+
+    if (!block)
+        return false;
+
+    VkBufferCreateInfo bufferInfo = getDeviceBufferInfo(block->size);
+
+    VkBuffer buffer = VK_NULL_HANDLE;
+    if (vkCreateBuffer(defrag->device, &bufferInfo, NULL, &buffer))
+    {
+        fprintf(stderr, "Failed to create Buffer for defragmentation\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (vmaBindBufferMemory(defrag->allocator, vmaMove->dstTmpAllocation, buffer))
+    {
+        fprintf(stderr, "Failed to bind Buffer for defragmentation\n");
+        exit(EXIT_FAILURE);
+    }
+
+    //Frames already submitted may still be reading the old buffer
+    VkMemoryBarrier2 barrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_NONE;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT;
+
+    VkDependencyInfo dependencyInfo = {VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    dependencyInfo.memoryBarrierCount = 1;
+    dependencyInfo.pMemoryBarriers = &barrier;
+
+    vkCmdPipelineBarrier2(defrag->cmdBuffer, &dependencyInfo);
+
+    VkBufferCopy copy = {};
+    copy.size = block->size;
+    vkCmdCopyBuffer(defrag->cmdBuffer, block->buffer.handle, buffer, 1, &copy);
+
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT |
+        VK_ACCESS_2_INDEX_READ_BIT |
+        VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT;
+
+    vkCmdPipelineBarrier2(defrag->cmdBuffer, &dependencyInfo);
+
+    move->type = DEFRAG_MOVE_BLOCK;
+    move->oldBuffer = block->buffer.handle;
+
+    //Ranges keep their offsets, so only the block's handle changes
+    block->buffer.handle = buffer;
+    block->moving = true;
+    pool->generation++;
+
+    return true;
+}
+
+static void endDefragmentation(Defragmenter *defrag, u64 frame)
+{
+    VmaDefragmentationStats stats = {};
+    vmaEndDefragmentation(defrag->allocator, defrag->context, &stats);
+    defrag->context = NULL;
+
+    //It only starts past the threshold, so a pool left as fragmented means every move was refused
+    float fragmentation = getTotalFragmentation(defrag->allocator, NULL);
+    bool compacted = fragmentation < defrag->startFragmentation;
+    if (!compacted)
+    {
+        fprintf(stderr, "Defragmentation left fragmentation at %.3f after moving %u allocations\n",
+            fragmentation, stats.allocationsMoved);
+    }
+
+    if (!defrag->out)
+        return;
+
+    fprintf(defrag->out,
+        "{\"type\":\"defrag\",\"frame\":%lu,\"passes\":%u,\"bytesMoved\":%lu,\"allocationsMoved\":%u,"
+        "\"bytesFreed\":%lu,\"blocksFreed\":%u,\"fragmentationBefore\":%.3f,\"fragmentationAfter\":%.3f,"
+        "\"compacted\":%s}\n",
+        (unsigned long)frame,
+        defrag->passesCount,
+        (unsigned long)stats.bytesMoved,
+        stats.allocationsMoved,
+        (unsigned long)stats.bytesFreed,
+        stats.deviceMemoryBlocksFreed,
+        defrag->startFragmentation,
+        fragmentation,
+        compacted ? "true" : "false");
+    fflush(defrag->out);
+}
+
+static void finishPass(Defragmenter *defrag, u64 frame, u64 completedFrame)
+{
+    //Every frame that used the old resources has completed
+    for (u32 i = 0; i < defrag->pass.moveCount; i++)
+    {
+        DefragMove *move = &defrag->moves[i];
+        if (move->type == DEFRAG_MOVE_TEXTURE)
+        {
+            vkDestroyImageView(defrag->device, move->oldView, NULL);
+            vkDestroyImage(defrag->device, move->oldImage, NULL);
+            removeTableTexture(defrag->residency->table, move->oldSlot);
+        }
+        else if (move->type == DEFRAG_MOVE_BLOCK)
+        {
+            vkDestroyBuffer(defrag->device, move->oldBuffer, NULL);
+        }
+    }
+
+    VkResult result = vmaEndDefragmentationPass(defrag->allocator, defrag->context, &defrag->pass);
+
+    //The moved allocations now describe their new place, including its mapping
+    for (u32 i = 0; i < defrag->pass.moveCount; i++)
+    {
+        DefragMove *move = &defrag->moves[i];
+        if (move->type == DEFRAG_MOVE_TEXTURE)
+        {
+            ResidentTexture *tex = &defrag->residency->textures[move->owner];
+            vmaGetAllocationInfo(defrag->allocator, tex->image.alloc, &tex->image.info);
+            tex->moving = false;
+        }
+        else if (move->type == DEFRAG_MOVE_BLOCK)
+        {
+            DeviceBufferBlock *block = &defrag->devicePool->blocks[move->owner];
+            vmaGetAllocationInfo(defrag->allocator, block->buffer.alloc, &block->buffer.info);
+            block->mapped = (u8*)block->buffer.info.pMappedData;
+            block->moving = false;
+        }
+    }
+
+    defrag->pass = {};
+    defrag->passPending = false;
+
+    //Catch up on what was held back during the pass
+    defrag->deletions->held = false;
+    advanceDeletionQueue(defrag->deletions, frame, completedFrame);
+
+    if (result != VK_INCOMPLETE)
+        endDefragmentation(defrag, frame);
+}
+
+static void beginPass(Defragmenter *defrag, u64 frame, u64 completedFrame)
+{
+    VkResult result = vmaBeginDefragmentationPass(defrag->allocator, defrag->context, &defrag->pass);
+    if (result != VK_INCOMPLETE)
+    {
+        if (result != VK_SUCCESS)
+            fprintf(stderr, "Failed to begin defragmentation pass: %d\n", result);
+
+        defrag->pass = {};
+        endDefragmentation(defrag, frame);
+        return;
+    }
+
+    vkResetCommandPool(defrag->device, defrag->cmdPool, 0);
+
+    VkCommandBufferBeginInfo beginInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (vkBeginCommandBuffer(defrag->cmdBuffer, &beginInfo))
+    {
+        fprintf(stderr, "Failed to begin defragmentation command buffer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    u32 copiesCount = 0;
+    for (u32 i = 0; i < defrag->pass.moveCount; i++)
+    {
+        VmaDefragmentationMove *vmaMove = &defrag->pass.pMoves[i];
+        DefragMove *move = &defrag->moves[i];
+        *move = {};
+
+        if (moveTexture(defrag, vmaMove, move) || moveBlock(defrag, vmaMove, move))
+            copiesCount++;
+        else
+            vmaMove->operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+    }
+
+    if (vkEndCommandBuffer(defrag->cmdBuffer))
+    {
+        fprintf(stderr, "Failed to end defragmentation command buffer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    defrag->passesCount++;
+    defrag->passFrame = frame;
+    defrag->passPending = true;
+    defrag->deletions->held = true;
+
+    if (!copiesCount)
+    {
+        finishPass(defrag, frame, completedFrame);
+        return;
+    }
+
+    //Ahead of this frame's draws on the same queue, so its timeline signal covers the copies too
+    VkSubmitInfo submitInfo = {VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &defrag->cmdBuffer;
+
+    if (vkQueueSubmit(defrag->queue, 1, &submitInfo, VK_NULL_HANDLE))
+    {
+        fprintf(stderr, "Failed to submit defragmentation copies\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+Defragmenter createDefragmenter(
+    VkDevice device,
+    VmaAllocator allocator,
+    VkQueue queue,
+    u32 queueFamilyIndex,
+    TextureResidency *residency,
+    DeviceBufferPool *devicePool,
+    DeletionQueue *deletions,
+    FILE *out)
+{
+    Defragmenter defrag = {};
+    defrag.device = device;
+    defrag.allocator = allocator;
+    defrag.queue = queue;
+    defrag.cmdPool = createCommandPool(device, queueFamilyIndex, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+    defrag.cmdBuffer = createPrimaryCommandBuffer(device, defrag.cmdPool);
+    defrag.residency = residency;
+    defrag.devicePool = devicePool;
+    defrag.deletions = deletions;
+    defrag.out = out;
+
+    return defrag;
+}
+
+void destroyDefragmenter(Defragmenter *defrag)
+{
+    if (defrag->passPending)
+        finishPass(defrag, defrag->passFrame, defrag->passFrame);
+
+    if (defrag->context)
+    {
+        vmaEndDefragmentation(defrag->allocator, defrag->context, NULL);
+        defrag->context = NULL;
+    }
+
+    vkDestroyCommandPool(defrag->device, defrag->cmdPool, NULL);
+    *defrag = {};
+}
+
+void updateDefragmenter(Defragmenter *defrag, u64 frame, u64 completedFrame)
+{
+    if (defrag->passPending)
+    {
+        if (completedFrame < defrag->passFrame)
+            return;
+
+        finishPass(defrag, frame, completedFrame);
+    }
+
+    if (!defrag->context)
+    {
+        if (frame - defrag->lastCheckFrame < DEFRAG_CHECK_INTERVAL)
+            return;
+        defrag->lastCheckFrame = frame;
+
+        VkDeviceSize unused = 0;
+        float fragmentation = getTotalFragmentation(defrag->allocator, &unused);
+        if (fragmentation < DEFRAG_FRAGMENTATION_THRESHOLD || unused < DEFRAG_MIN_UNUSED_BYTES)
+            return;
+
+        //Blocks only move whole, so a pass must fit the largest one or it never moves
+        VkDeviceSize maxBytesPerPass = DEFRAG_MAX_BYTES_PER_PASS;
+        for (u32 i = 0; i < defrag->devicePool->blocksCount; i++)
+        {
+            if (defrag->devicePool->blocks[i].size > maxBytesPerPass)
+                maxBytesPerPass = defrag->devicePool->blocks[i].size;
+        }
+
+        VmaDefragmentationInfo info = {};
+        info.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT;
+        info.maxBytesPerPass = maxBytesPerPass;
+        info.maxAllocationsPerPass = DEFRAG_MAX_MOVES_PER_PASS;
+
+        if (vmaBeginDefragmentation(defrag->allocator, &info, &defrag->context))
+        {
+            fprintf(stderr, "Failed to begin defragmentation\n");
+            defrag->context = NULL;
+            return;
+        }
+
+        defrag->startFragmentation = fragmentation;
+        defrag->passesCount = 0;
+    }
+
+    beginPass(defrag, frame, completedFrame);
+}
@@ -0,0 +1,179 @@
+#include "deletion.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "telemetry.h"
+
+static void releaseEntry(DeletionQueue *queue, DeletionEntry *entry)
+{
+    switch (entry->type)
+    {
+    case DELETION_BUFFER:
+        untrackAllocation(queue->allocator, entry->buffer.alloc);
+        vmaDestroyBuffer(queue->allocator, entry->buffer.handle, entry->buffer.alloc);
+        break;
+    case DELETION_IMAGE:
+        untrackAllocation(queue->allocator, entry->image.alloc);
+        vmaDestroyImage(queue->allocator, entry->image.handle, entry->image.alloc);
+        break;
+    case DELETION_UNBOUND_IMAGE:
+        vkDestroyImage(queue->device, entry->image.handle, NULL);
+        break;
+    case DELETION_IMAGE_VIEW:
+        vkDestroyImageView(queue->device, entry->view, NULL);
+        break;
+    case DELETION_ALLOCATION:
+        untrackAllocation(queue->allocator, entry->alloc);
+        vmaFreeMemory(queue->allocator, entry->alloc);
+        break;
+    case DELETION_FRAMEBUFFER:
+        vkDestroyFramebuffer(queue->device, entry->framebuffer, NULL);
+        break;
+    case DELETION_PIPELINE:
+        vkDestroyPipeline(queue->device, entry->pipeline, NULL);
+        break;
+    case DELETION_PIPELINE_LAYOUT:
+        vkDestroyPipelineLayout(queue->device, entry->pipelineLayout, NULL);
+        break;
+    case DELETION_DESCRIPTOR_POOL:
+        vkDestroyDescriptorPool(queue->device, entry->descriptorPool, NULL);
+        break;
+    case DELETION_SWAPCHAIN:
+        vkDestroySwapchainKHR(queue->device, entry->swapchain, NULL);
+        break;
+    case DELETION_TABLE_TEXTURE:
+        removeTableTexture(queue->table, entry->slot);
+        break;
+    }
+}
+
+static DeletionEntry* pushEntry(DeletionQueue *queue, DeletionType type)
+{
+    if (queue->count == queue->capacity)
+    {
+        u32 capacity = queue->capacity ? queue->capacity*2 : DELETION_QUEUE_CAPACITY;
+        DeletionEntry *entries = (DeletionEntry*)realloc(queue->entries, sizeof(DeletionEntry)*capacity);
+        if (!entries)
+        {
+            fprintf(stderr, "Failed to grow Deletion Queue\n");
+            exit(EXIT_FAILURE);
+        }
+        queue->entries = entries;
+        queue->capacity = capacity;
+    }
+
+    DeletionEntry *entry = &queue->entries[queue->count++];
+    entry->type = type;
+    entry->frame = queue->frame;
+    return entry;
+}
+
+DeletionQueue createDeletionQueue(VkDevice device, VmaAllocator allocator, TextureTable *table)
+{
+    DeletionQueue queue = {};
+    queue.device = device;
+    queue.allocator = allocator;
+    queue.table = table;
+
+    queue.capacity = DELETION_QUEUE_CAPACITY;
+    queue.entries = (DeletionEntry*)malloc(sizeof(DeletionEntry)*queue.capacity);
+    if (!queue.entries)
+    {
+        fprintf(stderr, "Failed to allocate Deletion Queue\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return queue;
+}
+
+void destroyDeletionQueue(DeletionQueue *queue)
+{
+    for (u32 i = 0; i < queue->count; i++)
+        releaseEntry(queue, &queue->entries[i]);
+
+    free(queue->entries);
+    *queue = {};
+}
+
+void advanceDeletionQueue(DeletionQueue *queue, u64 frame, u64 completedFrame)
+{
+    queue->frame = frame;
+    queue->completedFrame = completedFrame;
+
+    if (queue->held)
+        return;
+
+    u32 released = 0;
+    while (released < queue->count && queue->entries[released].frame <= completedFrame)
+    {
+        releaseEntry(queue, &queue->entries[released]);
+        released++;
+    }
+
+    if (!released)
+        return;
+
+    queue->count -= released;
+    memmove(queue->entries, queue->entries + released, sizeof(DeletionEntry)*queue->count);
+}
+
+void deferDestroyBuffer(DeletionQueue *queue, VkBuffer buffer, VmaAllocation alloc)
+{
+    DeletionEntry *entry = pushEntry(queue, DELETION_BUFFER);
+    entry->buffer.handle = buffer;
+    entry->buffer.alloc = alloc;
+}
+
+void deferDestroyImage(DeletionQueue *queue, VkImage image, VmaAllocation alloc)
+{
+    DeletionEntry *entry = pushEntry(queue, DELETION_IMAGE);
+    entry->image.handle = image;
+    entry->image.alloc = alloc;
+}
+
+void deferDestroyUnboundImage(DeletionQueue *queue, VkImage image)
+{
+    DeletionEntry *entry = pushEntry(queue, DELETION_UNBOUND_IMAGE);
+    entry->image.handle = image;
+    entry->image.alloc = NULL;
+}
+
+void deferDestroyImageView(DeletionQueue *queue, VkImageView view)
+{
+    pushEntry(queue, DELETION_IMAGE_VIEW)->view = view;
+}
+
+void deferFreeAllocation(DeletionQueue *queue, VmaAllocation alloc)
+{
+    pushEntry(queue, DELETION_ALLOCATION)->alloc = alloc;
+}
+
+void deferDestroyFramebuffer(DeletionQueue *queue, VkFramebuffer framebuffer)
+{
+    pushEntry(queue, DELETION_FRAMEBUFFER)->framebuffer = framebuffer;
+}
+
+void deferDestroyPipeline(DeletionQueue *queue, VkPipeline pipeline)
+{
+    pushEntry(queue, DELETION_PIPELINE)->pipeline = pipeline;
+}
+
+void deferDestroyPipelineLayout(DeletionQueue *queue, VkPipelineLayout layout)
+{
+    pushEntry(queue, DELETION_PIPELINE_LAYOUT)->pipelineLayout = layout;
+}
+
+void deferDestroyDescriptorPool(DeletionQueue *queue, VkDescriptorPool pool)
+{
+    pushEntry(queue, DELETION_DESCRIPTOR_POOL)->descriptorPool = pool;
+}
+
+void deferDestroySwapchain(DeletionQueue *queue, VkSwapchainKHR swapchain)
+{
+    pushEntry(queue, DELETION_SWAPCHAIN)->swapchain = swapchain;
+}
+
+void deferRemoveTableTexture(DeletionQueue *queue, u32 slot)
+{
+    pushEntry(queue, DELETION_TABLE_TEXTURE)->slot = slot;
+}
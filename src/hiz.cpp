@@ -0,0 +1,423 @@
+#include "hiz.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "load.h"
+#include "vkshader.h"
+#include "telemetry.h"
+
+typedef struct {//Matches the reduction shader's push constants
+    u32 srcWidth;
+    u32 srcHeight;
+    u32 dstWidth;
+    u32 dstHeight;
+    u32 level;
+    u32 samples;
+} PyramidPushConstants;
+
+static VkDescriptorSetLayout createReduceSetLayout(VkDevice device)
+{
+    VkDescriptorSetLayoutBinding bindings[3] = {};
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;//Depth attachment
+    bindings[0].descriptorCount = 1;
+    bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    //Level above and the level being reduced into
+    for (u32 i = 1; i < NUM_ELEMENTS(bindings); i++)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+    layoutInfo.bindingCount = NUM_ELEMENTS(bindings);
+    layoutInfo.pBindings = bindings;
+
+    VkDescriptorSetLayout layout = {};
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, NULL, &layout)){
+        fprintf(stderr, "Failed to create Depth Pyramid Descriptor Set Layout\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return layout;
+}
+
+static VkDescriptorSetLayout createSampleSetLayout(VkDevice device)
+{
+    VkDescriptorSetLayoutBinding binding = {};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    binding.descriptorCount = 1;
+    binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+    layoutInfo.bindingCount = 1;
+    layoutInfo.pBindings = &binding;
+
+    VkDescriptorSetLayout layout = {};
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, NULL, &layout)){
+        fprintf(stderr, "Failed to create Depth Pyramid Descriptor Set Layout\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return layout;
+}
+
+static VkSampler createPyramidSampler(VkDevice device)
+{
+    VkSamplerCreateInfo samplerInfo = {VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+    VkSampler sampler = NULL;
+    if (vkCreateSampler(device, &samplerInfo, NULL, &sampler)){
+        fprintf(stderr, "Failed to create Depth Pyramid Sampler\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return sampler;
+}
+
+static PipelineDetails createReducePipeline(VkDevice device, VkDescriptorSetLayout setLayout)
+{
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.size = sizeof(PyramidPushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    VkPipelineLayout pipelineLayout;
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &pipelineLayout)){
+        fprintf(stderr, "Failed to create Depth Pyramid Pipeline Layout\n");
+        exit(EXIT_FAILURE);
+    }
+
+    FilePath shaderPath = createFilePath(SHADERS_DIR, "pyramid.spv");
+    FileContents shader = readFileContents(shaderPath.str);
+    if (!shader.bytes){
+        fprintf(stderr, "Failed to find the Depth Pyramid Shader binary\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkShaderModule shaderModule = createShaderModule(device, (uint32_t*)shader.bytes, shader.len);
+
+    VkComputePipelineCreateInfo pipelineInfo = {VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = shaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = pipelineLayout;
+
+    VkPipeline pipeline;
+    if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &pipeline)){
+        fprintf(stderr, "Failed to create Depth Pyramid Pipeline\n");
+        exit(EXIT_FAILURE);
+    }
+
+    free(shader.bytes);
+    vkDestroyShaderModule(device, shaderModule, NULL);
+
+    return {.handle = pipeline, .layout = pipelineLayout};
+}
+
+static u32 previousPowerOfTwo(u32 x)
+{
+    u32 p = 1;
+    while (p*2 <= x)
+        p *= 2;
+    return p;
+}
+
+static VkImageView createPyramidView(VkDevice device, VkImage image, u32 baseLevel, u32 levelsCount)
+{
+    VkImageViewCreateInfo viewInfo = {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+    viewInfo.image = image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = VK_FORMAT_R32_SFLOAT;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = baseLevel;
+    viewInfo.subresourceRange.levelCount = levelsCount;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    VkImageView view = NULL;
+    if (vkCreateImageView(device, &viewInfo, NULL, &view)){
+        fprintf(stderr, "Failed to create Depth Pyramid View\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return view;
+}
+
+//Everything sized by the depth attachment
+static void createPyramidImage(DepthPyramid *pyramid, const DeviceImage *depthImage, VkSampleCountFlagBits samplingCount)
+{
+    pyramid->depthExtent = depthImage->extent;
+    pyramid->depthSamples = (u32)samplingCount;
+    pyramid->extent.width = previousPowerOfTwo(depthImage->extent.width);
+    pyramid->extent.height = previousPowerOfTwo(depthImage->extent.height);
+
+    u32 largest = pyramid->extent.width > pyramid->extent.height ? pyramid->extent.width : pyramid->extent.height;
+    pyramid->levelsCount = 1;
+    while ((1u << pyramid->levelsCount) <= largest && pyramid->levelsCount < DEPTH_PYRAMID_MAX_LEVELS)
+        pyramid->levelsCount++;
+
+    VkImageCreateInfo imageInfo = {VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent.width = pyramid->extent.width;
+    imageInfo.extent.height = pyramid->extent.height;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = pyramid->levelsCount;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = VK_FORMAT_R32_SFLOAT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+    VmaAllocationCreateInfo allocInfo = {};
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+
+    if (vmaCreateImage(pyramid->allocator, &imageInfo, &allocInfo, &pyramid->image, &pyramid->alloc, NULL)){
+        fprintf(stderr, "Failed to create Depth Pyramid Image\n");
+        exit(EXIT_FAILURE);
+    }
+    trackAllocation(pyramid->allocator, pyramid->alloc, MEMORY_CATEGORY_ATTACHMENT);
+
+    for (u32 level = 0; level < pyramid->levelsCount; level++)
+        pyramid->levelViews[level] = createPyramidView(pyramid->device, pyramid->image, level, 1);
+    pyramid->view = createPyramidView(pyramid->device, pyramid->image, 0, pyramid->levelsCount);
+
+    VkDescriptorPoolSize poolSizes[2] = {};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[0].descriptorCount = pyramid->levelsCount + 1;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[1].descriptorCount = 2*pyramid->levelsCount;
+
+    VkDescriptorPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+    poolInfo.poolSizeCount = NUM_ELEMENTS(poolSizes);
+    poolInfo.pPoolSizes = poolSizes;
+    poolInfo.maxSets = pyramid->levelsCount + 1;
+
+    if (vkCreateDescriptorPool(pyramid->device, &poolInfo, NULL, &pyramid->descriptorPool)){
+        fprintf(stderr, "Failed to create Depth Pyramid Descriptor Pool\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkDescriptorSetLayout layouts[DEPTH_PYRAMID_MAX_LEVELS] = {};
+    for (u32 level = 0; level < pyramid->levelsCount; level++)
+        layouts[level] = pyramid->reduceLayout;
+
+    VkDescriptorSetAllocateInfo setAllocInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+    setAllocInfo.descriptorPool = pyramid->descriptorPool;
+    setAllocInfo.descriptorSetCount = pyramid->levelsCount;
+    setAllocInfo.pSetLayouts = layouts;
+
+    if (vkAllocateDescriptorSets(pyramid->device, &setAllocInfo, pyramid->reduceSets)){
+        fprintf(stderr, "Failed to allocate Depth Pyramid Descriptor Sets\n");
+        exit(EXIT_FAILURE);
+    }
+
+    setAllocInfo.descriptorSetCount = 1;
+    setAllocInfo.pSetLayouts = &pyramid->sampleLayout;
+
+    if (vkAllocateDescriptorSets(pyramid->device, &setAllocInfo, &pyramid->sampleSet)){
+        fprintf(stderr, "Failed to allocate Depth Pyramid Descriptor Sets\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (u32 level = 0; level < pyramid->levelsCount; level++)
+    {
+        VkDescriptorImageInfo imageInfos[3] = {};
+        imageInfos[0].sampler = pyramid->sampler;
+        imageInfos[0].imageView = depthImage->view;
+        imageInfos[0].imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+        //Level 0 reads the attachment instead, but every binding needs something valid
+        imageInfos[1].imageView = pyramid->levelViews[level ? level - 1 : 0];
+        imageInfos[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        imageInfos[2].imageView = pyramid->levelViews[level];
+        imageInfos[2].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        VkWriteDescriptorSet descriptorWrites[3] = {};
+        for (u32 binding = 0; binding < NUM_ELEMENTS(descriptorWrites); binding++)
+        {
+            descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[binding].dstSet = pyramid->reduceSets[level];
+            descriptorWrites[binding].dstBinding = binding;
+            descriptorWrites[binding].descriptorType =
+                binding ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            descriptorWrites[binding].descriptorCount = 1;
+            descriptorWrites[binding].pImageInfo = &imageInfos[binding];
+        }
+
+        vkUpdateDescriptorSets(pyramid->device, NUM_ELEMENTS(descriptorWrites), descriptorWrites, 0, NULL);
+    }
+
+    VkDescriptorImageInfo sampleInfo = {};
+    sampleInfo.sampler = pyramid->sampler;
+    sampleInfo.imageView = pyramid->view;
+    sampleInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkWriteDescriptorSet sampleWrite = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+    sampleWrite.dstSet = pyramid->sampleSet;
+    sampleWrite.dstBinding = 0;
+    sampleWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    sampleWrite.descriptorCount = 1;
+    sampleWrite.pImageInfo = &sampleInfo;
+
+    vkUpdateDescriptorSets(pyramid->device, 1, &sampleWrite, 0, NULL);
+}
+
+static void destroyPyramidImage(DepthPyramid *pyramid, DeletionQueue *deletions)
+{
+    if (deletions)
+    {
+        for (u32 level = 0; level < pyramid->levelsCount; level++)
+            deferDestroyImageView(deletions, pyramid->levelViews[level]);
+        deferDestroyImageView(deletions, pyramid->view);
+        deferDestroyDescriptorPool(deletions, pyramid->descriptorPool);
+        deferDestroyImage(deletions, pyramid->image, pyramid->alloc);
+    }
+    else
+    {
+        for (u32 level = 0; level < pyramid->levelsCount; level++)
+            vkDestroyImageView(pyramid->device, pyramid->levelViews[level], NULL);
+        vkDestroyImageView(pyramid->device, pyramid->view, NULL);
+        vkDestroyDescriptorPool(pyramid->device, pyramid->descriptorPool, NULL);
+        untrackAllocation(pyramid->allocator, pyramid->alloc);
+        vmaDestroyImage(pyramid->allocator, pyramid->image, pyramid->alloc);
+    }
+
+    pyramid->image = NULL;
+    pyramid->alloc = NULL;
+    pyramid->view = NULL;
+    pyramid->descriptorPool = NULL;
+    pyramid->sampleSet = NULL;
+    pyramid->levelsCount = 0;
+}
+
+DepthPyramid createDepthPyramid(
+    VkDevice device,
+    VmaAllocator allocator,
+    const DeviceImage *depthImage,
+    VkSampleCountFlagBits samplingCount)
+{
+    DepthPyramid pyramid = {};
+    pyramid.device = device;
+    pyramid.allocator = allocator;
+    pyramid.sampler = createPyramidSampler(device);
+    pyramid.reduceLayout = createReduceSetLayout(device);
+    pyramid.sampleLayout = createSampleSetLayout(device);
+    pyramid.reducePipeline = createReducePipeline(device, pyramid.reduceLayout);
+
+    createPyramidImage(&pyramid, depthImage, samplingCount);
+
+    return pyramid;
+}
+
+void resizeDepthPyramid(
+    DepthPyramid *pyramid,
+    const DeviceImage *depthImage,
+    VkSampleCountFlagBits samplingCount,
+    DeletionQueue *deletions)
+{
+    //The attachment's view changes even when its extent doesn't
+    destroyPyramidImage(pyramid, deletions);
+    createPyramidImage(pyramid, depthImage, samplingCount);
+}
+
+void destroyDepthPyramid(DepthPyramid *pyramid)
+{
+    destroyPyramidImage(pyramid, NULL);
+    vkDestroyPipeline(pyramid->device, pyramid->reducePipeline.handle, NULL);
+    vkDestroyPipelineLayout(pyramid->device, pyramid->reducePipeline.layout, NULL);
+    vkDestroyDescriptorSetLayout(pyramid->device, pyramid->sampleLayout, NULL);
+    vkDestroyDescriptorSetLayout(pyramid->device, pyramid->reduceLayout, NULL);
+    vkDestroySampler(pyramid->device, pyramid->sampler, NULL);
+    *pyramid = {};
+}
+
+void recordDepthPyramid(const DepthPyramid *pyramid, VkCommandBuffer cmdBuffer)
+{
+    //Every level gets rewritten, so last frame's contents are discarded. Waiting on
+    //compute covers the tests that sampled it.
+    VkImageMemoryBarrier2 imageBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+    imageBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    imageBarrier.srcAccessMask = 0;
+    imageBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    imageBarrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image = pyramid->image;
+    imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageBarrier.subresourceRange.baseMipLevel = 0;
+    imageBarrier.subresourceRange.levelCount = pyramid->levelsCount;
+    imageBarrier.subresourceRange.baseArrayLayer = 0;
+    imageBarrier.subresourceRange.layerCount = 1;
+
+    VkDependencyInfo dependencyInfo = {VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    dependencyInfo.imageMemoryBarrierCount = 1;
+    dependencyInfo.pImageMemoryBarriers = &imageBarrier;
+
+    vkCmdPipelineBarrier2(cmdBuffer, &dependencyInfo);
+
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pyramid->reducePipeline.handle);
+
+    //Each level reads the one before it
+    VkMemoryBarrier2 barrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+
+    VkDependencyInfo levelDependencyInfo = {VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    levelDependencyInfo.memoryBarrierCount = 1;
+    levelDependencyInfo.pMemoryBarriers = &barrier;
+
+    u32 srcWidth = pyramid->depthExtent.width, srcHeight = pyramid->depthExtent.height;
+    for (u32 level = 0; level < pyramid->levelsCount; level++)
+    {
+        u32 dstWidth = pyramid->extent.width >> level ? pyramid->extent.width >> level : 1;
+        u32 dstHeight = pyramid->extent.height >> level ? pyramid->extent.height >> level : 1;
+
+        vkCmdBindDescriptorSets(
+            cmdBuffer,
+            VK_PIPELINE_BIND_POINT_COMPUTE,
+            pyramid->reducePipeline.layout,
+            0, 1, &pyramid->reduceSets[level],
+            0, NULL);
+
+        PyramidPushConstants pushConstants = {srcWidth, srcHeight, dstWidth, dstHeight, level, pyramid->depthSamples};
+        vkCmdPushConstants(
+            cmdBuffer,
+            pyramid->reducePipeline.layout,
+            VK_SHADER_STAGE_COMPUTE_BIT,
+            0, sizeof(pushConstants), &pushConstants);
+
+        vkCmdDispatch(
+            cmdBuffer,
+            (dstWidth + DEPTH_PYRAMID_WORKGROUP_SIZE - 1)/DEPTH_PYRAMID_WORKGROUP_SIZE,
+            (dstHeight + DEPTH_PYRAMID_WORKGROUP_SIZE - 1)/DEPTH_PYRAMID_WORKGROUP_SIZE,
+            1);
+
+        vkCmdPipelineBarrier2(cmdBuffer, &levelDependencyInfo);
+
+        srcWidth = dstWidth;
+        srcHeight = dstHeight;
+    }
+}
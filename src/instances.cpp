@@ -0,0 +1,121 @@
+#include "instances.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "telemetry.h"
+
+InstanceBuffer createInstanceBuffer(
+    VmaAllocator allocator,
+    u32 capacity,
+    u32 framesCount,
+    VkDeviceSize minOffsetAlignment)
+{
+    assert(framesCount <= MAX_FRAMES_IN_FLIGHT);
+
+    InstanceBuffer instances = {.capacity = capacity, .framesCount = framesCount};
+
+    VkDeviceSize alignment = minOffsetAlignment ? minOffsetAlignment : 1;
+    instances.regionSize = (sizeof(InstanceData)*capacity + alignment - 1) / alignment * alignment;
+
+    VkBufferCreateInfo bufferInfo = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    bufferInfo.size = instances.regionSize*framesCount;
+    bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+    VmaAllocationCreateInfo allocInfo = {};
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+    allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+        VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    if (vmaCreateBuffer(
+        allocator, 
+        &bufferInfo, 
+        &allocInfo, 
+        &instances.buffer.handle, 
+        &instances.buffer.alloc, 
+        &instances.buffer.info))
+    {
+        fprintf(stderr, "Failed to allocate Instance Buffer\n");
+        exit(EXIT_FAILURE);
+    }
+    trackAllocation(allocator, instances.buffer.alloc, MEMORY_CATEGORY_STORAGE);
+
+    instances.instances = (InstanceData*)aligned_alloc(alignof(InstanceData), sizeof(InstanceData)*capacity);
+    if (!instances.instances)
+    {
+        fprintf(stderr, "Failed to allocate Instance Data\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return instances;
+}
+
+void destroyInstanceBuffer(VmaAllocator allocator, InstanceBuffer *instances)
+{
+    untrackAllocation(allocator, instances->buffer.alloc);
+    vmaDestroyBuffer(allocator, instances->buffer.handle, instances->buffer.alloc);
+    free(instances->instances);
+    *instances = {};
+}
+
+static void markInstancesDirty(InstanceBuffer *instances, u32 start, u32 end)
+{
+    for (u32 i = 0; i < instances->framesCount; i++)
+    {
+        if (instances->dirtyStart[i] == instances->dirtyEnd[i])
+        {
+            instances->dirtyStart[i] = start;
+            instances->dirtyEnd[i] = end;
+            continue;
+        }
+
+        instances->dirtyStart[i] = start < instances->dirtyStart[i] ? start : instances->dirtyStart[i];
+        instances->dirtyEnd[i] = end > instances->dirtyEnd[i] ? end : instances->dirtyEnd[i];
+    }
+}
+
+u32 reserveInstances(InstanceBuffer *instances, u32 count)
+{
+    if (instances->instancesCount + count > instances->capacity)
+    {
+        fprintf(stderr, "Out of Instance slots\n");
+        abort();
+    }
+
+    u32 first = instances->instancesCount;
+    instances->instancesCount += count;
+    memset(&instances->instances[first], 0, sizeof(InstanceData)*count);
+    for (u32 i = first; i < first + count; i++)
+        instances->instances[i].meshIdx = INSTANCE_NO_MESH;
+    markInstancesDirty(instances, first, first + count);
+
+    return first;
+}
+
+void setInstance(InstanceBuffer *instances, u32 instanceIdx, const InstanceData *data)
+{
+    assert(instanceIdx < instances->instancesCount);
+    memcpy(&instances->instances[instanceIdx], data, sizeof(InstanceData));
+    markInstancesDirty(instances, instanceIdx, instanceIdx + 1);
+}
+
+void setInstanceTransform(InstanceBuffer *instances, u32 instanceIdx, mat4 model)
+{
+    assert(instanceIdx < instances->instancesCount);
+    glm_mat4_copy(model, instances->instances[instanceIdx].model);
+    markInstancesDirty(instances, instanceIdx, instanceIdx + 1);
+}
+
+void uploadInstances(InstanceBuffer *instances, u32 frame)
+{
+    u32 start = instances->dirtyStart[frame];
+    u32 end = instances->dirtyEnd[frame];
+    if (start == end)
+        return;
+
+    u8 *region = (u8*)instances->buffer.info.pMappedData + frame*instances->regionSize;
+    memcpy(region + sizeof(InstanceData)*start, &instances->instances[start], sizeof(InstanceData)*(end - start));
+
+    instances->dirtyStart[frame] = 0;
+    instances->dirtyEnd[frame] = 0;
+}
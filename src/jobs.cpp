@@ -0,0 +1,142 @@
+#include "jobs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static void runBatches(JobPool *pool, JobFn fn, void *ctx, u32 count, u32 batchSize, u32 workerIdx)
+{
+    while (true)
+    {
+        u32 start = __atomic_fetch_add(&pool->nextIdx, batchSize, __ATOMIC_RELAXED);
+        if (start >= count)
+            break;
+
+        u32 end = start + batchSize < count ? start + batchSize : count;
+        fn(ctx, start, end, workerIdx);
+    }
+}
+
+static void* workerLoop(void *arg)
+{
+    JobWorker *worker = (JobWorker*)arg;
+    JobPool *pool = worker->pool;
+    u64 seenGeneration = 0;
+
+    while (true)
+    {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->generation == seenGeneration && !pool->quit)
+            pthread_cond_wait(&pool->workReady, &pool->mutex);
+
+        if (pool->quit)
+        {
+            pthread_mutex_unlock(&pool->mutex);
+            break;
+        }
+
+        seenGeneration = pool->generation;
+        JobFn fn = pool->fn;
+        void *ctx = pool->ctx;
+        u32 count = pool->count;
+        u32 batchSize = pool->batchSize;
+        pthread_mutex_unlock(&pool->mutex);
+
+        runBatches(pool, fn, ctx, count, batchSize, worker->idx);
+
+        pthread_mutex_lock(&pool->mutex);
+        pool->busyWorkers--;
+        if (!pool->busyWorkers)
+            pthread_cond_signal(&pool->workDone);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    return NULL;
+}
+
+JobPool* createJobPool(u32 workersCount)
+{
+    if (!workersCount)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workersCount = cpus > 0 ? cpus : 1;
+    }
+
+    if (workersCount > MAX_JOB_WORKERS)
+        workersCount = MAX_JOB_WORKERS;
+
+    JobPool *pool = (JobPool*)calloc(1, sizeof(JobPool));
+    if (!pool)
+    {
+        fprintf(stderr, "Failed to allocate Job Pool\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pool->workersCount = workersCount;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->workReady, NULL);
+    pthread_cond_init(&pool->workDone, NULL);
+
+    for (u32 i = 1; i < workersCount; i++)
+    {
+        JobWorker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->idx = i;
+        if (pthread_create(&worker->thread, NULL, workerLoop, worker))
+        {
+            fprintf(stderr, "Failed to create Job Worker thread %d\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return pool;
+}
+
+void destroyJobPool(JobPool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->workReady);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (u32 i = 1; i < pool->workersCount; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+
+    pthread_cond_destroy(&pool->workDone);
+    pthread_cond_destroy(&pool->workReady);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+void parallelFor(JobPool *pool, u32 count, u32 batchSize, JobFn fn, void *ctx)
+{
+    if (!count)
+        return;
+
+    if (!batchSize)
+        batchSize = 1;
+
+    //Not worth waking anyone up
+    if (pool->workersCount == 1 || count <= batchSize)
+    {
+        fn(ctx, 0, count, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pool->count = count;
+    pool->batchSize = batchSize;
+    pool->nextIdx = 0;
+    pool->busyWorkers = pool->workersCount - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->workReady);
+    pthread_mutex_unlock(&pool->mutex);
+
+    runBatches(pool, fn, ctx, count, batchSize, 0);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->busyWorkers)
+        pthread_cond_wait(&pool->workDone, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+}
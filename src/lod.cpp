@@ -0,0 +1,309 @@
+#include "lod.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+//Symmetric 4x4 sum of plane equations' outer products, so the sum of squared
+//distances to every plane is a quadratic in the position
+typedef struct {
+    double xx, xy, xz, xw;
+    double yy, yz, yw;
+    double zz, zw;
+    double ww;
+} Quadric;
+
+typedef struct {
+    float cost;
+    u16 from;
+    u16 to;
+} Collapse;
+
+static void addPlaneQuadric(Quadric *q, const double plane[4])
+{
+    q->xx += plane[0]*plane[0]; q->xy += plane[0]*plane[1]; q->xz += plane[0]*plane[2]; q->xw += plane[0]*plane[3];
+    q->yy += plane[1]*plane[1]; q->yz += plane[1]*plane[2]; q->yw += plane[1]*plane[3];
+    q->zz += plane[2]*plane[2]; q->zw += plane[2]*plane[3];
+    q->ww += plane[3]*plane[3];
+}
+
+static void addQuadric(Quadric *q, const Quadric *other)
+{
+    q->xx += other->xx; q->xy += other->xy; q->xz += other->xz; q->xw += other->xw;
+    q->yy += other->yy; q->yz += other->yz; q->yw += other->yw;
+    q->zz += other->zz; q->zw += other->zw;
+    q->ww += other->ww;
+}
+
+static double evaluateQuadric(const Quadric *q, const vec3 p)
+{
+    double x = p[0], y = p[1], z = p[2];
+    double error =
+        q->xx*x*x + 2.0*q->xy*x*y + 2.0*q->xz*x*z + 2.0*q->xw*x +
+        q->yy*y*y + 2.0*q->yz*y*z + 2.0*q->yw*y +
+        q->zz*z*z + 2.0*q->zw*z +
+        q->ww;
+    return error > 0.0 ? error : 0.0;
+}
+
+static int compareCollapses(const void *a, const void *b)
+{
+    float costA = ((const Collapse*)a)->cost, costB = ((const Collapse*)b)->cost;
+    return (costA > costB) - (costA < costB);
+}
+
+static const vec3 *sortedPositions;//qsort has no context argument
+
+static int comparePositions(const void *a, const void *b)
+{
+    const float *pa = sortedPositions[*(const u16*)a], *pb = sortedPositions[*(const u16*)b];
+    for (u32 axis = 0; axis < 3; axis++)
+    {
+        if (pa[axis] != pb[axis])
+            return pa[axis] < pb[axis] ? -1 : 1;
+    }
+    return 0;
+}
+
+static void triangleNormal(const vec3 a, const vec3 b, const vec3 c, vec3 normal)
+{
+    vec3 ab = {}, ac = {};
+    glm_vec3_sub((float*)b, (float*)a, ab);
+    glm_vec3_sub((float*)c, (float*)a, ac);
+    glm_vec3_cross(ab, ac, normal);
+}
+
+u32 simplifyMesh(
+    const vec3 *positions,
+    u32 verticesCount,
+    const u16 *indices,
+    u32 indicesCount,
+    u32 targetIndicesCount,
+    u16 *outIndices,
+    float *outError)
+{
+    memcpy(outIndices, indices, sizeof(u16)*indicesCount);
+    *outError = 0.0f;
+    if (indicesCount <= targetIndicesCount)
+        return indicesCount;
+
+    Quadric *quadrics = (Quadric*)calloc(verticesCount, sizeof(Quadric));
+    bool *locked = (bool*)calloc(verticesCount, sizeof(bool));
+    bool *touched = (bool*)calloc(verticesCount, sizeof(bool));
+    u16 *remap = (u16*)malloc(sizeof(u16)*verticesCount);
+    u16 *order = (u16*)malloc(sizeof(u16)*verticesCount);
+    u32 *trianglesStart = (u32*)malloc(sizeof(u32)*(verticesCount + 1));
+    u32 *vertexTriangles = (u32*)malloc(sizeof(u32)*indicesCount);
+    Collapse *collapses = (Collapse*)malloc(sizeof(Collapse)*indicesCount*2);
+    if (!quadrics || !locked || !touched || !remap || !order || !trianglesStart || !vertexTriangles || !collapses)
+    {
+        fprintf(stderr, "Failed to allocate Mesh Simplification\n");
+        exit(EXIT_FAILURE);
+    }
+
+    //Vertices split where attributes differ, like UV seams, would tear apart if
+    //either side moved on its own
+    for (u32 i = 0; i < verticesCount; i++)
+        order[i] = (u16)i;
+    sortedPositions = positions;
+    qsort(order, verticesCount, sizeof(u16), comparePositions);
+    for (u32 i = 1; i < verticesCount; i++)
+    {
+        if (!comparePositions(&order[i - 1], &order[i]))
+            locked[order[i - 1]] = locked[order[i]] = true;
+    }
+
+    //Unit normal planes, so an error is a sum of squared distances
+    for (u32 i = 0; i < indicesCount; i += 3)
+    {
+        vec3 normal = {};
+        triangleNormal(positions[outIndices[i]], positions[outIndices[i + 1]], positions[outIndices[i + 2]], normal);
+        float length = glm_vec3_norm(normal);
+        if (length == 0.0f)
+            continue;
+
+        glm_vec3_scale(normal, 1.0f/length, normal);
+        double plane[4] = {normal[0], normal[1], normal[2], -glm_vec3_dot(normal, (float*)positions[outIndices[i]])};
+        for (u32 corner = 0; corner < 3; corner++)
+            addPlaneQuadric(&quadrics[outIndices[i + corner]], plane);
+    }
+
+    double maxCost = 0.0;
+    u32 count = indicesCount;
+    while (count > targetIndicesCount)
+    {
+        //Triangles around each vertex
+        memset(trianglesStart, 0, sizeof(u32)*(verticesCount + 1));
+        for (u32 i = 0; i < count; i++)
+            trianglesStart[outIndices[i] + 1]++;
+        for (u32 v = 0; v < verticesCount; v++)
+            trianglesStart[v + 1] += trianglesStart[v];
+        for (u32 i = 0; i < count; i++)
+            vertexTriangles[trianglesStart[outIndices[i]]++] = i/3;
+        for (u32 v = verticesCount; v > 0; v--)
+            trianglesStart[v] = trianglesStart[v - 1];
+        trianglesStart[0] = 0;
+
+        //An edge only one triangle has is on an open border, whose outline must stay
+        for (u32 i = 0; i < count; i++)
+        {
+            u16 a = outIndices[i], b = outIndices[i - i % 3 + (i + 1) % 3];
+            u32 sharing = 0;
+            for (u32 t = trianglesStart[a]; t < trianglesStart[a + 1]; t++)
+            {
+                const u16 *tri = &outIndices[vertexTriangles[t]*3];
+                sharing += tri[0] == b || tri[1] == b || tri[2] == b;
+            }
+            if (sharing < 2)
+                locked[a] = locked[b] = true;
+        }
+
+        u32 collapsesCount = 0;
+        for (u32 i = 0; i < count; i++)
+        {
+            u16 a = outIndices[i], b = outIndices[i - i % 3 + (i + 1) % 3];
+            Quadric q = quadrics[a];
+            addQuadric(&q, &quadrics[b]);
+            if (!locked[a])
+                collapses[collapsesCount++] = {(float)evaluateQuadric(&q, positions[b]), a, b};
+            if (!locked[b])
+                collapses[collapsesCount++] = {(float)evaluateQuadric(&q, positions[a]), b, a};
+        }
+        if (!collapsesCount)
+            break;
+
+        qsort(collapses, collapsesCount, sizeof(Collapse), compareCollapses);
+
+        //Each collapse takes two triangles with it, and the cheapest half of those
+        //needed go per pass so costs are recomputed as the mesh changes
+        u32 trianglesToRemove = (count - targetIndicesCount)/3;
+        u32 collapsesLimit = trianglesToRemove/4 > 1 ? trianglesToRemove/4 : 1;
+        u32 applied = 0;
+
+        for (u32 v = 0; v < verticesCount; v++)
+            remap[v] = (u16)v;
+        memset(touched, 0, sizeof(bool)*verticesCount);
+
+        for (u32 c = 0; c < collapsesCount && applied < collapsesLimit; c++)
+        {
+            const Collapse *collapse = &collapses[c];
+            if (touched[collapse->from] || touched[collapse->to])
+                continue;
+
+            //Triangles that would turn over are a fold in the surface
+            bool flips = false;
+            for (u32 t = trianglesStart[collapse->from]; t < trianglesStart[collapse->from + 1] && !flips; t++)
+            {
+                const u16 *tri = &outIndices[vertexTriangles[t]*3];
+                if (tri[0] == collapse->to || tri[1] == collapse->to || tri[2] == collapse->to)
+                    continue;
+
+                vec3 before = {}, after = {};
+                triangleNormal(positions[tri[0]], positions[tri[1]], positions[tri[2]], before);
+                triangleNormal(
+                    positions[tri[0] == collapse->from ? collapse->to : tri[0]],
+                    positions[tri[1] == collapse->from ? collapse->to : tri[1]],
+                    positions[tri[2] == collapse->from ? collapse->to : tri[2]],
+                    after);
+                flips = glm_vec3_dot(before, after) <= 0.0f;
+            }
+            if (flips)
+                continue;
+
+            //Neighbours' costs and flip tests are stale until the next pass
+            for (u32 t = trianglesStart[collapse->from]; t < trianglesStart[collapse->from + 1]; t++)
+            {
+                const u16 *tri = &outIndices[vertexTriangles[t]*3];
+                touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+            }
+
+            remap[collapse->from] = collapse->to;
+            addQuadric(&quadrics[collapse->to], &quadrics[collapse->from]);
+            if (collapse->cost > maxCost)
+                maxCost = collapse->cost;
+            applied++;
+        }
+        if (!applied)
+            break;
+
+        //Dropping the triangles the collapses left without area
+        u32 kept = 0;
+        for (u32 i = 0; i < count; i += 3)
+        {
+            u16 a = remap[outIndices[i]], b = remap[outIndices[i + 1]], c = remap[outIndices[i + 2]];
+            if (a == b || b == c || a == c)
+                continue;
+
+            outIndices[kept++] = a;
+            outIndices[kept++] = b;
+            outIndices[kept++] = c;
+        }
+        count = kept;
+    }
+
+    *outError = (float)sqrt(maxCost);
+
+    free(quadrics);
+    free(locked);
+    free(touched);
+    free(remap);
+    free(order);
+    free(trianglesStart);
+    free(vertexTriangles);
+    free(collapses);
+
+    return count;
+}
+
+MeshLods generateMeshLods(const vec3 *positions, u32 verticesCount, const u16 *indices, u32 indicesCount)
+{
+    MeshLods lods = {};
+
+    //Room for every level, trimmed once the levels are known
+    lods.indices = (u16*)malloc(sizeof(u16)*indicesCount*MESH_MAX_LODS);
+    if (!lods.indices)
+    {
+        fprintf(stderr, "Failed to allocate Mesh LODs\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(lods.indices, indices, sizeof(u16)*indicesCount);
+    lods.lods[0] = {.firstIndex = 0, .indicesCount = indicesCount, .error = 0.0f};
+    lods.lodsCount = 1;
+    lods.indicesCount = indicesCount;
+
+    while (lods.lodsCount < MESH_MAX_LODS)
+    {
+        const MeshLod *last = &lods.lods[lods.lodsCount - 1];
+        u32 target = (u32)(last->indicesCount*MESH_LOD_REDUCTION)/3*3;
+
+        float error = 0.0f;
+        u32 count = simplifyMesh(
+            positions,
+            verticesCount,
+            lods.indices + last->firstIndex,
+            last->indicesCount,
+            target,
+            lods.indices + lods.indicesCount,
+            &error);
+        if (!count || count > last->indicesCount*MESH_LOD_MIN_REDUCTION)
+            break;
+
+        //Each level is simplified from the last, so their errors add up
+        lods.lods[lods.lodsCount++] = {.firstIndex = lods.indicesCount, .indicesCount = count, .error = last->error + error};
+        lods.indicesCount += count;
+    }
+
+    u16 *trimmed = (u16*)realloc(lods.indices, sizeof(u16)*lods.indicesCount);
+    if (trimmed)
+        lods.indices = trimmed;
+
+    return lods;
+}
+
+void freeMeshLods(MeshLods *lods)
+{
+    free(lods->indices);
+    *lods = {};
+}
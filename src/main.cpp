@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <assert.h>
 #include "window.h"
 #include "config.h"
 #include "vkstate.h"
@@ -13,9 +15,28 @@
 #include "controls.h"
 #include "scene.h"
 #include "timing.h"
+#include "telemetry.h"
+#include "deletion.h"
+#include "defrag.h"
+#include "profiler.h"
+#include "culling.h"
 
-int main(int, char**)
+int main(int argc, char **argv)
 {
+    if (argc > 1 && !strcmp(argv[1], "--bench-culling"))
+    {
+        benchmarkCpuCulling(CULL_BENCHMARK_INSTANCES, CULL_BENCHMARK_ITERATIONS, stdout);
+        return 0;
+    }
+
+    if (argc > 1 && !strcmp(argv[1], "--bench-bodies"))
+    {
+        JobPool *jobs = createJobPool(0);
+        benchmarkBodySimulation(BODY_BENCHMARK_COUNT, BODY_BENCHMARK_STEPS, jobs, stdout);
+        destroyJobPool(jobs);
+        return 0;
+    }
+
     UserConfig userConfig = {};
     if (!loadUserConfig(CONFIG_FILE, &userConfig))
     {
@@ -36,71 +57,129 @@ int main(int, char**)
 
     VulkanState vk = initVulkanState(&window, &userConfig);
 
+    DeletionQueue deletions = createDeletionQueue(vk.device, vk.allocator, &vk.textures);
+
+    TextureResidency residency = createTextureResidency(
+        vk.device, 
+        vk.allocator, 
+        &vk.uploads, 
+        &vk.textures, 
+        &deletions,
+        MAX_RESIDENT_TEXTURES);
+
+    JobPool *jobs = createJobPool(0);
+
     SceneInfo scene = loadSceneToDevice(
         "./models/surface.glb",
         "./models/pompeii.glb",
-        vk.stagingBuffer,
-        vk.deviceBuffer,
-        vk.device,
+        &vk.uploads,
+        &vk.devicePool,
         vk.allocator,
-        *vk.graphicsCmdPools,
-        vk.graphicsQueue);
+        vk.physicalDevice.properties.limits.minStorageBufferOffsetAlignment,
+        vk.framesInFlight,
+        &residency,
+        jobs);
 
-    size_t uniformBufferOffset = vk.physicalDevice.properties.limits.minUniformBufferOffsetAlignment;
-    DescriptorSets descriptorSets = allocateDescriptorSets(vk.device, vk.descriptorSetLayout, vk.descriptorPool);
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    DescriptorSets descriptorSets = allocateDescriptorSets(vk.device, vk.descriptorSetLayout, vk.descriptorPool, vk.framesInFlight);
+    for (size_t i = 0; i < vk.framesInFlight; i++)
     {
         VkDescriptorBufferInfo uniformBufferInfo = {};
-        uniformBufferInfo.buffer = vk.uniformBuffer.handle;
-        uniformBufferInfo.offset = i*uniformBufferOffset;
-        uniformBufferInfo.range = sizeof(mat4);
+        uniformBufferInfo.buffer = vk.uniformRing.buffer.handle;
+        uniformBufferInfo.offset = 0;//Chunks from the ring are picked by dynamic offset
+        uniformBufferInfo.range = sizeof(FrameUniforms);
 
         VkWriteDescriptorSet ubDescriptorWrite = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
         ubDescriptorWrite.dstSet = descriptorSets.handles[i];
         ubDescriptorWrite.dstBinding = 0;
-        ubDescriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        ubDescriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
         ubDescriptorWrite.dstArrayElement = 0;
         ubDescriptorWrite.descriptorCount = 1;
         ubDescriptorWrite.pBufferInfo = &uniformBufferInfo;
 
-        VkDescriptorImageInfo surfaceTexDesc = {};
-        surfaceTexDesc.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        surfaceTexDesc.imageView = scene.surfaceModelInfo.tex.view;
-        surfaceTexDesc.sampler = vk.sampler;
-
-        VkDescriptorImageInfo characterTexDesc = surfaceTexDesc;
-        characterTexDesc.imageView = scene.characterModelInfo.tex.view;
+        VkDescriptorBufferInfo instancesBufferInfo = {};
+        instancesBufferInfo.buffer = scene.instances.buffer.handle;
+        instancesBufferInfo.offset = i*scene.instances.regionSize;
+        instancesBufferInfo.range = scene.instances.regionSize;
 
-        VkDescriptorImageInfo texDescriptors[] = {surfaceTexDesc, characterTexDesc};
-        VkWriteDescriptorSet texDescriptorWrite = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
-        texDescriptorWrite.dstSet = descriptorSets.handles[i];
-        texDescriptorWrite.dstBinding = 1;
-        texDescriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        texDescriptorWrite.dstArrayElement = 0;
-        texDescriptorWrite.descriptorCount = NUM_ELEMENTS(texDescriptors);
-        texDescriptorWrite.pImageInfo = texDescriptors;
+        VkWriteDescriptorSet instancesDescriptorWrite = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+        instancesDescriptorWrite.dstSet = descriptorSets.handles[i];
+        instancesDescriptorWrite.dstBinding = 2;
+        instancesDescriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        instancesDescriptorWrite.dstArrayElement = 0;
+        instancesDescriptorWrite.descriptorCount = 1;
+        instancesDescriptorWrite.pBufferInfo = &instancesBufferInfo;
 
-        VkWriteDescriptorSet descriptorWrites[] = {ubDescriptorWrite, texDescriptorWrite};
+        VkWriteDescriptorSet descriptorWrites[] = {ubDescriptorWrite, instancesDescriptorWrite};
 
         vkUpdateDescriptorSets(vk.device, NUM_ELEMENTS(descriptorWrites), descriptorWrites, 0, NULL);
     }
 
     VkCommandBuffer graphicsCmdBuffers[MAX_FRAMES_IN_FLIGHT] = {};
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    for (size_t i = 0; i < vk.framesInFlight; i++)
     {
         graphicsCmdBuffers[i] = createPrimaryCommandBuffer(vk.device, vk.graphicsCmdPools[i]);
     }
 
+    const ModelInfo *drawnModels[] = {&scene.surfaceModelInfo, &scene.characterModelInfo};
+
+    DepthPyramid pyramid = {};
+    if (vk.occlusionCulling)
+        pyramid = createDepthPyramid(vk.device, vk.allocator, &vk.depthImage, vk.physicalDevice.maxSamplingCount);
+
+    Culling culling = createCulling(
+        vk.cpuCulling ? CULLING_CPU : CULLING_GPU,
+        vk.device,
+        vk.allocator,
+        &vk.uniformRing,
+        &scene.instances,
+        NUM_ELEMENTS(drawnModels),
+        vk.physicalDevice.properties.limits.minStorageBufferOffsetAlignment,
+        vk.occlusionCulling ? &pyramid : NULL);
+    setCullingMeshes(&culling, drawnModels, NUM_ELEMENTS(drawnModels), &scene.instances);
+
     CameraControls cam = cam_createControls();
     cam_setInputHandler(&cam, &window.inputHandler);
 
-    PushConstant pushConstant = {};
     Matrix4 projection = cam_genProjectionMatrix(&cam, vk.swapchain.extent);
     s64 prevTime_ns = getCurrentTime_ns();
 
     Character character = {.pos = {0.0f, 3.0f, 0.0f}, .vel_m_s = GLM_VEC3_ZERO_INIT};
 
+    MemoryTelemetry memTelemetry = createMemoryTelemetry(stdout, MEMORY_TELEMETRY_INTERVAL, vk.physicalDevice.memoryBudgetSupported);
+    //Only counted when asked for, as the queries aren't free
+    VkQueryPipelineStatisticFlags statisticFlags = 
+        userConfig.renderer.pipelineStatistics && vk.physicalDevice.pipelineStatisticsSupported ? PROFILER_PIPELINE_STATISTICS : 0;
+    if (userConfig.renderer.pipelineStatistics && !statisticFlags)
+        fprintf(stderr, "Pipeline statistics queries aren't supported\n");
+
+    Profiler profiler = createProfiler(
+        vk.device,
+        vk.physicalDevice.handle,
+        vk.physicalDevice.queueFamilyIndices.graphicsQueue,
+        vk.framesInFlight,
+        statisticFlags,
+        stdout,
+        PROFILER_INTERVAL);
+
+    DrawCache *drawCache = createDrawCache(vk.device, vk.physicalDevice.queueFamilyIndices.graphicsQueue, jobs, vk.framesInFlight, statisticFlags);
+    DrawCache *lateDrawCache = NULL;
+    if (vk.occlusionCulling)
+        lateDrawCache = createDrawCache(vk.device, vk.physicalDevice.queueFamilyIndices.graphicsQueue, jobs, vk.framesInFlight, statisticFlags);
+    //Every mesh is at least one batch, so the scene's draws are recorded in parallel
+    assert(jobs->workersCount < 2 || culling.batchesCount < 2 || getDrawSlicesCount(culling.batchesCount, jobs->workersCount) > 1);
+
+    Defragmenter defrag = createDefragmenter(
+        vk.device,
+        vk.allocator,
+        vk.graphicsQueue,
+        vk.physicalDevice.queueFamilyIndices.graphicsQueue,
+        &residency,
+        &vk.devicePool,
+        &deletions,
+        stdout);
+
     u32 currentFrame = 0;
+    u64 frameNumber = 1;
     while (!glfwWindowShouldClose(window.handle))
     {
         s64 currentTime_ns = getCurrentTime_ns();
@@ -108,7 +187,20 @@ int main(int, char**)
 
         cam_processInput(&window);
 
-        vkWaitForFences(vk.device, 1, &vk.frameSyncers[currentFrame].inFlight, VK_TRUE, UINT64_MAX);
+        //Until the frame that last used this slot has completed
+        if (frameNumber > vk.framesInFlight)
+            waitForTimeline(vk.device, vk.frameTimeline, frameNumber - vk.framesInFlight);
+
+        //Later frames may have completed too
+        u64 completedFrame = getTimelineValue(vk.device, vk.frameTimeline);
+        advanceDeletionQueue(&deletions, frameNumber, completedFrame);
+        updateDefragmenter(&defrag, frameNumber, completedFrame);
+
+        updateMemoryTelemetry(&memTelemetry, vk.allocator);
+
+        //Driven by the footprints noted last frame
+        updateTextureResidency(&residency);
+        updateSceneTextureSlots(&scene, &residency);
 
         uint32_t imageIndex = 0;//Will refer to a VkImage in our swapchain images array
         VkResult result = vkAcquireNextImageKHR(
@@ -128,10 +220,16 @@ int main(int, char**)
                 window.handle,
                 vk.renderPass,
                 vk.physicalDevice.maxSamplingCount,
+                !vk.occlusionCulling,
                 &vk.swapchain,
                 &vk.depthImage,
                 &vk.samplingImage,
-                &vk.framebuffers);
+                &vk.depthMemory,
+                &vk.samplingMemory,
+                &vk.framebuffers,
+                &deletions);
+            if (vk.occlusionCulling)
+                resizeDepthPyramid(&pyramid, &vk.depthImage, vk.physicalDevice.maxSamplingCount, &deletions);
             
             projection = cam_genProjectionMatrix(&cam, vk.swapchain.extent);
             continue;
@@ -141,48 +239,107 @@ int main(int, char**)
             exit(EXIT_FAILURE);
         }
 
-        vkResetFences(vk.device, 1, &vk.frameSyncers[currentFrame].inFlight);
-        vkResetCommandPool(vk.device, vk.graphicsCmdPools[currentFrame], 0);
+        //Only once the frame will be submitted, as an abandoned one is never ended
+        beginProfilerFrame(&profiler, currentFrame, NS_TO_MS(timeDiff_ns));
 
-        Matrix4 view = cam_genViewMatrix(&cam);
-        glm_mat4_mul_avx(projection.matrix, view.matrix, pushConstant.viewProjection);
+        vkResetCommandPool(vk.device, vk.graphicsCmdPools[currentFrame], 0);
 
         updateCharacterPhysics(&character, timeDiff_ns);
-        applyCharacterSurfaceCollision(&character, &scene.surfaceVoxels);
+        applyCharacterWorldCollision(&character, jobs, &scene.collisionWorld, scene.characterCollisionInstance);
 
-        updateUniformBuffer(
-            &vk.uniformBuffer, 
-            currentFrame*uniformBufferOffset, 
-            &scene.surfaceModelInfo);
+        //Allocated first, so it always sits at the start of the frame's region
+        beginUniformRingFrame(&vk.uniformRing, currentFrame);
+        u32 frameUniformsOffset = 0;
+        FrameUniforms *frameUniforms = (FrameUniforms*)allocateUniformRing(&vk.uniformRing, sizeof(FrameUniforms), &frameUniformsOffset);
+
+        //Built locally, as the ring's mapped memory is slow to read back
+        Matrix4 view = cam_genViewMatrix(&cam);
+        mat4 viewProjection = {};
+        vec4 frustumPlanes[6] = {};
+        glm_mat4_mul_avx(projection.matrix, view.matrix, viewProjection);
+        glm_frustum_planes(viewProjection, frustumPlanes);
+        //An error of one unit at one unit away covers this many of the allowed pixels
+        vec4 lodCamera = {
+            cam.position[0], cam.position[1], cam.position[2], 
+            fabsf(projection.matrix[1][1])*vk.swapchain.extent.height*0.5f/MESH_LOD_ERROR_PIXELS};
+        glm_mat4_copy(viewProjection, frameUniforms->viewProjection);
+        memcpy(frameUniforms->frustumPlanes, frustumPlanes, sizeof(frustumPlanes));
+        glm_vec4_copy(lodCamera, frameUniforms->lodCamera);
 
         mat4 characterWorldMatrix = {};
         glm_translate_make(characterWorldMatrix, character.pos);
         glm_mat4_mul_avx(scene.characterModelInfo.modelMatrix, characterWorldMatrix, characterWorldMatrix);
 
-        updateUniformBuffer(
-            &vk.uniformBuffer, 
-            currentFrame*uniformBufferOffset + sizeof(mat4), 
-            characterWorldMatrix);
+        setInstanceTransform(&scene.instances, scene.characterInstance, characterWorldMatrix);
+        cullInstances(&culling, &scene.instances, currentFrame, frustumPlanes, lodCamera);
+        uploadInstances(&scene.instances, currentFrame);
+
+        noteSceneTextureFootprints(&scene, &residency, view.matrix, projection.matrix, vk.swapchain.extent);
+
+        setCollisionInstanceTransform(&scene.collisionWorld, scene.characterCollisionInstance, characterWorldMatrix);
+        refitCollisionWorld(&scene.collisionWorld);
+
+        const VkCommandBuffer *drawCommands = NULL;
+        u32 drawCommandsCount = getModelDrawCommands(
+            drawCache,
+            jobs,
+            vk.device,
+            currentFrame,
+            vk.renderPass,
+            vk.graphicsPipeline,
+            vk.swapchain.extent,
+            descriptorSets.handles[currentFrame],
+            frameUniformsOffset,
+            vk.textures.set,
+            &vk.devicePool,
+            &culling,
+            CULL_PHASE_EARLY,
+            &drawCommands);
+
+        const VkCommandBuffer *lateDrawCommands = NULL;
+        u32 lateDrawCommandsCount = 0;
+        if (lateDrawCache)
+        {
+            lateDrawCommandsCount = getModelDrawCommands(
+                lateDrawCache,
+                jobs,
+                vk.device,
+                currentFrame,
+                vk.lateRenderPass,
+                vk.graphicsPipeline,
+                vk.swapchain.extent,
+                descriptorSets.handles[currentFrame],
+                frameUniformsOffset,
+                vk.textures.set,
+                &vk.devicePool,
+                &culling,
+                CULL_PHASE_LATE,
+                &lateDrawCommands);
+        }
 
         recordModelDrawCommand(
             graphicsCmdBuffers[currentFrame],
             vk.renderPass,
+            vk.lateRenderPass,
             vk.framebuffers.handles[imageIndex],
-            vk.graphicsPipeline,
             vk.swapchain.extent,
-            pushConstant,
-            descriptorSets.handles[currentFrame],
-            vk.deviceBuffer.handle,
-            scene.vtxBufOffset,
-            scene.idxBufOffset,
-            scene.drawCmdsOffset, scene.drawCmdsCount);
+            &culling,
+            &pyramid,
+            currentFrame,
+            frameUniformsOffset,
+            drawCommands,
+            drawCommandsCount,
+            lateDrawCommands,
+            lateDrawCommandsCount,
+            &profiler);
 
         submitDrawCommand(
             vk.graphicsQueue,
             graphicsCmdBuffers[currentFrame],
             vk.frameSyncers[currentFrame].imageAvailable,
             vk.frameSyncers[currentFrame].renderFinished,
-            vk.frameSyncers[currentFrame].inFlight);
+            vk.frameTimeline,
+            frameNumber);
 
         result = presentSwapchain(
             vk.presentQueue,
@@ -202,10 +359,16 @@ int main(int, char**)
                 window.handle,
                 vk.renderPass,
                 vk.physicalDevice.maxSamplingCount,
+                !vk.occlusionCulling,
                 &vk.swapchain,
                 &vk.depthImage,
                 &vk.samplingImage,
-                &vk.framebuffers);
+                &vk.depthMemory,
+                &vk.samplingMemory,
+                &vk.framebuffers,
+                &deletions);
+            if (vk.occlusionCulling)
+                resizeDepthPyramid(&pyramid, &vk.depthImage, vk.physicalDevice.maxSamplingCount, &deletions);
 
             projection = cam_genProjectionMatrix(&cam, vk.swapchain.extent);
             window.resizing = false;
@@ -218,22 +381,29 @@ int main(int, char**)
             
         prevTime_ns = currentTime_ns;
 
-        currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+        currentFrame = (currentFrame + 1) % vk.framesInFlight;
+        frameNumber++;
 
         glfwPollEvents();
     }
 
     vkDeviceWaitIdle(vk.device);
 
-    vkDestroyImageView(vk.device, scene.surfaceModelInfo.tex.view, NULL);
-    vmaDestroyImage(vk.allocator, scene.surfaceModelInfo.tex.handle, scene.surfaceModelInfo.tex.alloc);
-    vkDestroyImageView(vk.device, scene.characterModelInfo.tex.view, NULL);
-    vmaDestroyImage(vk.allocator, scene.characterModelInfo.tex.handle, scene.characterModelInfo.tex.alloc);
+    destroyDefragmenter(&defrag);
+    destroyProfiler(&profiler);
+    destroyDrawCache(vk.device, drawCache);
+    if (lateDrawCache)
+        destroyDrawCache(vk.device, lateDrawCache);
+    destroyJobPool(jobs);
+    destroyCulling(&culling);
+    if (vk.occlusionCulling)
+        destroyDepthPyramid(&pyramid);
+    freeSceneInfo(&scene, &vk.devicePool, vk.allocator);
+    destroyTextureResidency(&residency);
+    destroyDeletionQueue(&deletions);
 
     destroyWindow(&window);
     destroyVulkanState(&vk);
 
-    freeSceneInfo(&scene);
-
     return 0;
 }
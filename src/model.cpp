@@ -110,7 +110,7 @@ ModelAttributeInfo stageModelIndices(cgltf_data* modelData, u8* stagingBuffer)
     return attrInfo;
 }
 
-TextureInfo stageModelTexture(cgltf_data *modelData, u8* stagingBuffer)
+u8* loadModelTexture(cgltf_data *modelData, TextureInfo *info)
 {
     cgltf_mesh* mesh = modelData->scene->nodes[0]->mesh;
     cgltf_primitive primitive = mesh->primitives[0];
@@ -146,11 +146,19 @@ TextureInfo stageModelTexture(cgltf_data *modelData, u8* stagingBuffer)
         exit(EXIT_FAILURE);
     }
 
-    memcpy(stagingBuffer, decodedTexture, width * height * STBI_rgb_alpha);
+    *info = {.width = (u32)width, .height = (u32)height, .channels = STBI_rgb_alpha};
 
-    stbi_image_free(decodedTexture);
+    return decodedTexture;
+}
+
+TextureInfo stageModelTexture(cgltf_data *modelData, u8* stagingBuffer)
+{
+    TextureInfo texInfo = {};
+    u8 *decodedTexture = loadModelTexture(modelData, &texInfo);
 
-    TextureInfo texInfo = {.width = (u32)width, .height = (u32)height, .channels = STBI_rgb_alpha};
+    memcpy(stagingBuffer, decodedTexture, texInfo.width * texInfo.height * texInfo.channels);
+
+    stbi_image_free(decodedTexture);
 
     return texInfo;
 }
@@ -162,4 +170,29 @@ void getModelMatrix(mat4 outModelMatrix, cgltf_data *modelData)
     {
         glm_scale(outModelMatrix, node->scale);
     }
-}
\ No newline at end of file
+}
+
+ModelBuffers allocateModelBuffers(DeviceBufferPool *pool, u32 verticesCount, u32 indicesCount)
+{
+    //Vertex stride alignment keeps the vertex offset a whole number of vertices from
+    //the start of the block, and the stride is a multiple of 4 so the indices that
+    //follow stay aligned too
+    VkDeviceSize verticesSize = sizeof(VertexAttributes)*verticesCount;
+    VkDeviceSize indicesSize = sizeof(u16)*indicesCount;
+
+    ModelBuffers buffers = {.verticesCount = verticesCount, .indicesCount = indicesCount};
+    buffers.range = allocateDeviceBufferRange(
+        pool, 
+        verticesSize + indicesSize, 
+        sizeof(VertexAttributes));
+    buffers.vtxOffset = buffers.range.offset;
+    buffers.idxOffset = buffers.vtxOffset + verticesSize;
+
+    return buffers;
+}
+
+void freeModelBuffers(DeviceBufferPool *pool, ModelBuffers *buffers)
+{
+    freeDeviceBufferRange(pool, &buffers->range);
+    *buffers = {.range = buffers->range};
+}
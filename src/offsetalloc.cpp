@@ -0,0 +1,290 @@
+#include "offsetalloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#define NODE_UNUSED UINT32_MAX
+
+static u32 uintToFloatRoundUp(u32 size)
+{
+    u32 exp = 0;
+    u32 mantissa = 0;
+
+    if (size < OFFSET_ALLOC_MANTISSA_VALUE)
+    {
+        mantissa = size;//Denormal, exact
+    }
+    else
+    {
+        u32 highestSetBit = 31 - __builtin_clz(size);
+        u32 mantissaStartBit = highestSetBit - OFFSET_ALLOC_MANTISSA_BITS;
+        exp = mantissaStartBit + 1;
+        mantissa = (size >> mantissaStartBit) & OFFSET_ALLOC_MANTISSA_MASK;
+
+        u32 lowBitsMask = (1u << mantissaStartBit) - 1;
+        if (size & lowBitsMask)
+            mantissa++;//May carry into the exponent, which is still correct
+    }
+
+    return (exp << OFFSET_ALLOC_MANTISSA_BITS) + mantissa;
+}
+
+static u32 uintToFloatRoundDown(u32 size)
+{
+    u32 exp = 0;
+    u32 mantissa = 0;
+
+    if (size < OFFSET_ALLOC_MANTISSA_VALUE)
+    {
+        mantissa = size;
+    }
+    else
+    {
+        u32 highestSetBit = 31 - __builtin_clz(size);
+        u32 mantissaStartBit = highestSetBit - OFFSET_ALLOC_MANTISSA_BITS;
+        exp = mantissaStartBit + 1;
+        mantissa = (size >> mantissaStartBit) & OFFSET_ALLOC_MANTISSA_MASK;
+    }
+
+    return (exp << OFFSET_ALLOC_MANTISSA_BITS) | mantissa;
+}
+
+static u32 findLowestSetBitAfter(u32 bitMask, u32 startBitIndex)
+{
+    if (startBitIndex >= 32)
+        return OFFSET_ALLOC_NO_SPACE;
+
+    u32 bitsAfter = bitMask & ~((1u << startBitIndex) - 1);
+    if (!bitsAfter)
+        return OFFSET_ALLOC_NO_SPACE;
+
+    return __builtin_ctz(bitsAfter);
+}
+
+static u32 insertNodeIntoBin(OffsetAllocator *allocator, u32 size, u32 dataOffset)
+{
+    //Round down, so every node in a bin is at least as big as the bin
+    u32 binIndex = uintToFloatRoundDown(size);
+    u32 topBinIndex = binIndex >> 3;
+    u32 leafBinIndex = binIndex & (OFFSET_ALLOC_BINS_PER_LEAF - 1);
+
+    if (allocator->binIndices[binIndex] == NODE_UNUSED)
+    {
+        allocator->usedBins[topBinIndex] |= 1 << leafBinIndex;
+        allocator->usedBinsTop |= 1u << topBinIndex;
+    }
+
+    assert(allocator->freeNodesCount);
+    u32 topNodeIndex = allocator->binIndices[binIndex];
+    u32 nodeIndex = allocator->freeNodes[--allocator->freeNodesCount];
+
+    allocator->nodes[nodeIndex] = {
+        .dataOffset = dataOffset,
+        .dataSize = size,
+        .binListPrev = NODE_UNUSED,
+        .binListNext = topNodeIndex,
+        .neighbourPrev = NODE_UNUSED,
+        .neighbourNext = NODE_UNUSED,
+        .used = false};
+
+    if (topNodeIndex != NODE_UNUSED)
+        allocator->nodes[topNodeIndex].binListPrev = nodeIndex;
+    allocator->binIndices[binIndex] = nodeIndex;
+
+    allocator->freeStorage += size;
+
+    return nodeIndex;
+}
+
+static void removeNodeFromBin(OffsetAllocator *allocator, u32 nodeIndex)
+{
+    OffsetAllocNode *node = &allocator->nodes[nodeIndex];
+
+    if (node->binListPrev != NODE_UNUSED)
+    {
+        allocator->nodes[node->binListPrev].binListNext = node->binListNext;
+        if (node->binListNext != NODE_UNUSED)
+            allocator->nodes[node->binListNext].binListPrev = node->binListPrev;
+    }
+    else
+    {
+        //Head of its bin's list
+        u32 binIndex = uintToFloatRoundDown(node->dataSize);
+        u32 topBinIndex = binIndex >> 3;
+        u32 leafBinIndex = binIndex & (OFFSET_ALLOC_BINS_PER_LEAF - 1);
+
+        allocator->binIndices[binIndex] = node->binListNext;
+        if (node->binListNext != NODE_UNUSED)
+            allocator->nodes[node->binListNext].binListPrev = NODE_UNUSED;
+
+        if (allocator->binIndices[binIndex] == NODE_UNUSED)
+        {
+            allocator->usedBins[topBinIndex] &= ~(1 << leafBinIndex);
+            if (!allocator->usedBins[topBinIndex])
+                allocator->usedBinsTop &= ~(1u << topBinIndex);
+        }
+    }
+
+    allocator->freeNodes[allocator->freeNodesCount++] = nodeIndex;
+    allocator->freeStorage -= node->dataSize;
+}
+
+OffsetAllocator createOffsetAllocator(u32 size, u32 maxAllocs)
+{
+    OffsetAllocator allocator = {.size = size, .maxAllocs = maxAllocs};
+
+    allocator.nodes = (OffsetAllocNode*)malloc(sizeof(OffsetAllocNode)*maxAllocs);
+    allocator.freeNodes = (u32*)malloc(sizeof(u32)*maxAllocs);
+    if (!allocator.nodes || !allocator.freeNodes)
+    {
+        fprintf(stderr, "Failed to allocate Offset Allocator nodes\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (u32 i = 0; i < OFFSET_ALLOC_LEAF_BINS; i++)
+        allocator.binIndices[i] = NODE_UNUSED;
+
+    //Popped from the back, so node 0 gets used first
+    for (u32 i = 0; i < maxAllocs; i++)
+        allocator.freeNodes[i] = maxAllocs - i - 1;
+    allocator.freeNodesCount = maxAllocs;
+
+    insertNodeIntoBin(&allocator, size, 0);
+
+    return allocator;
+}
+
+void destroyOffsetAllocator(OffsetAllocator *allocator)
+{
+    free(allocator->nodes);
+    free(allocator->freeNodes);
+    *allocator = {};
+}
+
+OffsetAllocation offsetAlloc(OffsetAllocator *allocator, u32 size)
+{
+    OffsetAllocation allocation = {.offset = OFFSET_ALLOC_NO_SPACE, .node = NODE_UNUSED};
+
+    //A node is always needed for the remainder
+    if (!size || !allocator->freeNodesCount)
+        return allocation;
+
+    //Round up, so any node in the chosen bin fits
+    u32 minBinIndex = uintToFloatRoundUp(size);
+    u32 minTopBinIndex = minBinIndex >> 3;
+    u32 minLeafBinIndex = minBinIndex & (OFFSET_ALLOC_BINS_PER_LEAF - 1);
+
+    u32 topBinIndex = minTopBinIndex;
+    u32 leafBinIndex = OFFSET_ALLOC_NO_SPACE;
+
+    if (topBinIndex < OFFSET_ALLOC_TOP_BINS && (allocator->usedBinsTop & (1u << topBinIndex)))
+        leafBinIndex = findLowestSetBitAfter(allocator->usedBins[topBinIndex], minLeafBinIndex);
+
+    if (leafBinIndex == OFFSET_ALLOC_NO_SPACE)
+    {
+        topBinIndex = findLowestSetBitAfter(allocator->usedBinsTop, minTopBinIndex + 1);
+        if (topBinIndex == OFFSET_ALLOC_NO_SPACE)
+            return allocation;
+
+        leafBinIndex = __builtin_ctz(allocator->usedBins[topBinIndex]);
+    }
+
+    u32 binIndex = (topBinIndex << 3) | leafBinIndex;
+
+    //Pop the head of the bin
+    u32 nodeIndex = allocator->binIndices[binIndex];
+    OffsetAllocNode *node = &allocator->nodes[nodeIndex];
+    u32 nodeTotalSize = node->dataSize;
+    node->dataSize = size;
+    node->used = true;
+    allocator->binIndices[binIndex] = node->binListNext;
+    if (node->binListNext != NODE_UNUSED)
+        allocator->nodes[node->binListNext].binListPrev = NODE_UNUSED;
+    allocator->freeStorage -= nodeTotalSize;
+
+    if (allocator->binIndices[binIndex] == NODE_UNUSED)
+    {
+        allocator->usedBins[topBinIndex] &= ~(1 << leafBinIndex);
+        if (!allocator->usedBins[topBinIndex])
+            allocator->usedBinsTop &= ~(1u << topBinIndex);
+    }
+
+    //The remainder goes back into a bin as the next neighbour
+    u32 remainderSize = nodeTotalSize - size;
+    if (remainderSize > 0)
+    {
+        u32 newNodeIndex = insertNodeIntoBin(allocator, remainderSize, node->dataOffset + size);
+        node = &allocator->nodes[nodeIndex];
+
+        if (node->neighbourNext != NODE_UNUSED)
+            allocator->nodes[node->neighbourNext].neighbourPrev = newNodeIndex;
+        allocator->nodes[newNodeIndex].neighbourPrev = nodeIndex;
+        allocator->nodes[newNodeIndex].neighbourNext = node->neighbourNext;
+        node->neighbourNext = newNodeIndex;
+    }
+
+    allocation.offset = node->dataOffset;
+    allocation.node = nodeIndex;
+
+    return allocation;
+}
+
+void offsetFree(OffsetAllocator *allocator, OffsetAllocation allocation)
+{
+    if (allocation.node == NODE_UNUSED)
+        return;
+
+    u32 nodeIndex = allocation.node;
+    OffsetAllocNode *node = &allocator->nodes[nodeIndex];
+    assert(node->used);
+
+    u32 offset = node->dataOffset;
+    u32 size = node->dataSize;
+
+    if (node->neighbourPrev != NODE_UNUSED && !allocator->nodes[node->neighbourPrev].used)
+    {
+        OffsetAllocNode *prevNode = &allocator->nodes[node->neighbourPrev];
+        offset = prevNode->dataOffset;
+        size += prevNode->dataSize;
+
+        removeNodeFromBin(allocator, node->neighbourPrev);
+        assert(prevNode->neighbourNext == nodeIndex);
+        node->neighbourPrev = prevNode->neighbourPrev;
+    }
+
+    if (node->neighbourNext != NODE_UNUSED && !allocator->nodes[node->neighbourNext].used)
+    {
+        OffsetAllocNode *nextNode = &allocator->nodes[node->neighbourNext];
+        size += nextNode->dataSize;
+
+        removeNodeFromBin(allocator, node->neighbourNext);
+        assert(nextNode->neighbourPrev == nodeIndex);
+        node->neighbourNext = nextNode->neighbourNext;
+    }
+
+    u32 neighbourNext = node->neighbourNext;
+    u32 neighbourPrev = node->neighbourPrev;
+
+    allocator->freeNodes[allocator->freeNodesCount++] = nodeIndex;
+
+    u32 combinedNodeIndex = insertNodeIntoBin(allocator, size, offset);
+
+    if (neighbourNext != NODE_UNUSED)
+    {
+        allocator->nodes[combinedNodeIndex].neighbourNext = neighbourNext;
+        allocator->nodes[neighbourNext].neighbourPrev = combinedNodeIndex;
+    }
+    if (neighbourPrev != NODE_UNUSED)
+    {
+        allocator->nodes[combinedNodeIndex].neighbourPrev = neighbourPrev;
+        allocator->nodes[neighbourPrev].neighbourNext = combinedNodeIndex;
+    }
+}
+
+u32 offsetAllocSize(const OffsetAllocator *allocator, OffsetAllocation allocation)
+{
+    if (allocation.node == NODE_UNUSED)
+        return 0;
+
+    return allocator->nodes[allocation.node].dataSize;
+}
@@ -1,5 +1,10 @@
 #include "physics.h"
 #include <immintrin.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
 #include "timing.h"
 
 typedef __m256 v256f;
@@ -34,143 +39,491 @@ static int findIndexOfPointWithinVoxel(vec3 point, const Voxels *voxels)
         return -1;
 }
 
-void updateCharacterPhysics(Character *character, s64 timeDiff_ns)
+DynamicBodies createDynamicBodies(u32 capacity)
 {
-    vec3 fallingVelocity = {};
-    glm_vec3_scale(GRAVITY_DIR, GRAVITY_M_S_S*NS_TO_SEC(timeDiff_ns), fallingVelocity);
+    DynamicBodies bodies = {.count = 0, .capacity = capacity};
 
-    glm_vec3_add(character->vel_m_s, fallingVelocity, character->vel_m_s);
+    //Padded to a multiple of 8 so the update can always run whole AVX lanes
+    size_t arraySize = sizeof(float) * ((capacity + 7) & ~7u);
+    float **arrays[] = {
+        &bodies.posX, &bodies.posY, &bodies.posZ,
+        &bodies.velX, &bodies.velY, &bodies.velZ,
+        &bodies.radius};
+
+    for (size_t i = 0; i < NUM_ELEMENTS(arrays); i++)
+    {
+        *arrays[i] = (float*)aligned_alloc(32, arraySize);
+        if (!*arrays[i])
+        {
+            fprintf(stderr, "Failed to allocate Dynamic Bodies\n");
+            abort();
+        }
+        memset(*arrays[i], 0, arraySize);
+    }
+
+    return bodies;
 }
 
-void applyCharacterSurfaceCollision(Character *character, const Voxels *surface)
+void destroyDynamicBodies(DynamicBodies *bodies)
 {
-    float magnitude = glm_vec3_norm(character->vel_m_s);
-    vec3 dir = {};
-    glm_vec3_scale(character->vel_m_s, 1.0f/magnitude, dir);
+    free(bodies->posX);
+    free(bodies->posY);
+    free(bodies->posZ);
+    free(bodies->velX);
+    free(bodies->velY);
+    free(bodies->velZ);
+    free(bodies->radius);
+    *bodies = {};
+}
 
-    //Detect whether the starting position lies outside the voxel box
-    float boxWidth = surface->cols * surface->voxWidth;
-    float boxHeight = surface->rows * surface->voxHeight;
-    float boxLength = surface->depth * surface->voxLength;
-    
-    float boxOriginX = surface->origin[0];
-    float boxOriginY = surface->origin[1];
-    float boxOriginZ = surface->origin[2];
+u32 addDynamicBody(DynamicBodies *bodies, vec3 pos, float radius)
+{
+    assert(bodies->count < bodies->capacity);
 
-    //Use a ray tracing intersection algorithm
-    Box box = {{
-        {boxOriginX, boxOriginY, boxOriginZ},
-        {boxOriginX + boxWidth, boxOriginY + boxHeight, boxOriginZ + boxLength}
-    }};
+    u32 idx = bodies->count++;
+    bodies->posX[idx] = pos[0];
+    bodies->posY[idx] = pos[1];
+    bodies->posZ[idx] = pos[2];
+    bodies->velX[idx] = 0.0f;
+    bodies->velY[idx] = 0.0f;
+    bodies->velZ[idx] = 0.0f;
+    bodies->radius[idx] = radius;
 
-    Ray ray = {
-        {character->pos[0], character->pos[1], character->pos[2]},
-        {dir[0], dir[1], dir[2]},
-        {1.0f/dir[0], 1.0f/dir[1], 1.0f/dir[2]}
-    };
+    return idx;
+}
+
+void updateDynamicBodiesPhysics(DynamicBodies *bodies, s64 timeDiff_ns)
+{
+    float dt = NS_TO_SEC(timeDiff_ns);
+    const v256f vDt = _mm256_set1_ps(dt);
+    const v256f vGravityX = _mm256_set1_ps(GRAVITY_DIR[0] * GRAVITY_M_S_S * dt);
+    const v256f vGravityY = _mm256_set1_ps(GRAVITY_DIR[1] * GRAVITY_M_S_S * dt);
+    const v256f vGravityZ = _mm256_set1_ps(GRAVITY_DIR[2] * GRAVITY_M_S_S * dt);
+
+    for (u32 i = 0; i < bodies->count; i += 8)
+    {
+        v256f velX = _mm256_add_ps(_mm256_load_ps(bodies->velX + i), vGravityX);
+        v256f velY = _mm256_add_ps(_mm256_load_ps(bodies->velY + i), vGravityY);
+        v256f velZ = _mm256_add_ps(_mm256_load_ps(bodies->velZ + i), vGravityZ);
 
-    //ray = origin + t*dir
-    //A segment of the ray lies between tmin and tmax.
-    //If the test finds that tmin > tmax, then the ray
-    //lies outside the box
-    float tmin = magnitude;
+        _mm256_store_ps(bodies->velX + i, velX);
+        _mm256_store_ps(bodies->velY + i, velY);
+        _mm256_store_ps(bodies->velZ + i, velZ);
 
-    rayAABBIntersections(&ray, 1, &box, &tmin);
-    
-    if (tmin < magnitude)//Ray passes through AABB at point (origin + tmin*dir)
+        _mm256_store_ps(bodies->posX + i, _mm256_add_ps(_mm256_load_ps(bodies->posX + i), _mm256_mul_ps(velX, vDt)));
+        _mm256_store_ps(bodies->posY + i, _mm256_add_ps(_mm256_load_ps(bodies->posY + i), _mm256_mul_ps(velY, vDt)));
+        _mm256_store_ps(bodies->posZ + i, _mm256_add_ps(_mm256_load_ps(bodies->posZ + i), _mm256_mul_ps(velZ, vDt)));
+    }
+}
+
+void resolveBodyContacts(DynamicBodies *bodies, const BodyContact *contacts, u32 contactsCount)
+{
+    //Applied in order, so a body in several contacts sees the earlier corrections
+    for (u32 i = 0; i < contactsCount; i++)
     {
-        tmin = magnitude;//Reset for tests within the box
+        const BodyContact *contact = &contacts[i];
+        u32 a = contact->a, b = contact->b;
+        float nx = contact->normal[0], ny = contact->normal[1], nz = contact->normal[2];
 
-        vec3 projCharacterPos = {};
-        glm_vec3_add(character->pos, character->vel_m_s, projCharacterPos);
-        int originVoxelIdx = findIndexOfPointWithinVoxel(character->pos, surface);
-        int dstVoxelIdx = findIndexOfPointWithinVoxel(projCharacterPos, surface);
+        float push = 0.5f*contact->depth;
+        bodies->posX[a] -= nx*push;
+        bodies->posY[a] -= ny*push;
+        bodies->posZ[a] -= nz*push;
+        bodies->posX[b] += nx*push;
+        bodies->posY[b] += ny*push;
+        bodies->posZ[b] += nz*push;
 
-        u32 numVoxels = surface->cols * surface->rows * surface->depth;
+        float closing =
+            (bodies->velX[b] - bodies->velX[a])*nx +
+            (bodies->velY[b] - bodies->velY[a])*ny +
+            (bodies->velZ[b] - bodies->velZ[a])*nz;
+        if (closing >= 0.0f)
+            continue;
 
-        u16 *voxelIndexes = (u16*)surface->data;
-        u16 *indices = (u16*)(surface->data + sizeof(u16)*numVoxels);
-        vec3 *vertices = (vec3*)(surface->data + surface->transformedVerticesIdx);
+        //Equal masses, so the impulse is split evenly
+        float impulse = -0.5f*(1.0f + BODY_RESTITUTION)*closing;
+        bodies->velX[a] -= nx*impulse;
+        bodies->velY[a] -= ny*impulse;
+        bodies->velZ[a] -= nz*impulse;
+        bodies->velX[b] += nx*impulse;
+        bodies->velY[b] += ny*impulse;
+        bodies->velZ[b] += nz*impulse;
+    }
+}
 
-        if (originVoxelIdx == dstVoxelIdx)//Only need to test one voxel
-        {
-            u32 maxIndex = originVoxelIdx < numVoxels-1 ? voxelIndexes[originVoxelIdx+1] : surface->storedIndicesCount;
+void containDynamicBodies(DynamicBodies *bodies, const Box *bounds)
+{
+    float *positions[3] = {bodies->posX, bodies->posY, bodies->posZ};
+    float *velocities[3] = {bodies->velX, bodies->velY, bodies->velZ};
+    const v256f vZero = _mm256_setzero_ps();
+    const v256f vBounce = _mm256_set1_ps(-BODY_RESTITUTION);
 
-            u16 baseIndex = voxelIndexes[originVoxelIdx];
+    for (u32 axis = 0; axis < 3; axis++)
+    {
+        const v256f vMin = _mm256_set1_ps(bounds->corners[0][axis]);
+        const v256f vMax = _mm256_set1_ps(bounds->corners[1][axis]);
 
-            for (u32 i = baseIndex; i < maxIndex; i += 3)
-            {
-                vec3 v1 = {};
-                vec3 v2 = {};
-                vec3 v3 = {};
+        for (u32 i = 0; i < bodies->count; i += 8)
+        {
+            v256f radius = _mm256_load_ps(bodies->radius + i);
+            v256f pos = _mm256_load_ps(positions[axis] + i);
+            v256f vel = _mm256_load_ps(velocities[axis] + i);
+            v256f lo = _mm256_add_ps(vMin, radius);
+            v256f hi = _mm256_sub_ps(vMax, radius);
 
-                glm_vec3_copy(vertices[indices[i]], v1);
-                glm_vec3_copy(vertices[indices[i+1]], v2);
-                glm_vec3_copy(vertices[indices[i+2]], v3);
+            v256f leaving = _mm256_or_ps(
+                _mm256_and_ps(_mm256_cmp_ps(pos, lo, _CMP_LT_OQ), _mm256_cmp_ps(vel, vZero, _CMP_LT_OQ)),
+                _mm256_and_ps(_mm256_cmp_ps(pos, hi, _CMP_GT_OQ), _mm256_cmp_ps(vel, vZero, _CMP_GT_OQ)));
 
-                float intersectionDistance = 0;
-                if (glm_ray_triangle(character->pos, dir, v1, v2, v3, &intersectionDistance)
-                    && intersectionDistance < tmin)
-                {
-                    tmin = intersectionDistance;
-                }
-            }
+            _mm256_store_ps(positions[axis] + i, _mm256_min_ps(_mm256_max_ps(pos, lo), hi));
+            _mm256_store_ps(velocities[axis] + i, _mm256_blendv_ps(vel, _mm256_mul_ps(vel, vBounce), leaving));
         }
-        else//Test all voxels
+    }
+}
+
+static float randomUnit(u32 *state)
+{
+    *state = *state*1664525u + 1013904223u;
+    return (*state >> 8)*(1.0f/16777216.0f);
+}
+
+void scatterDynamicBodies(DynamicBodies *bodies, u32 count, const Box *bounds, float minRadius, float maxRadius, u32 *seed)
+{
+    for (u32 i = 0; i < count; i++)
+    {
+        vec3 pos = {};
+        for (u32 axis = 0; axis < 3; axis++)
+            pos[axis] = bounds->corners[0][axis] + randomUnit(seed)*(bounds->corners[1][axis] - bounds->corners[0][axis]);
+
+        addDynamicBody(bodies, pos, minRadius + randomUnit(seed)*(maxRadius - minRadius));
+    }
+}
+
+BodySimulation createBodySimulation(u32 capacity, float maxRadius, const Box *bounds, const JobPool *jobs)
+{
+    BodySimulation sim = {};
+    sim.bodies = createDynamicBodies(capacity);
+    sim.broadPhase = createBroadPhase(capacity, 2.0f*maxRadius, jobs);
+    glm_vec3_copy((float*)bounds->corners[0], sim.bounds.corners[0]);
+    glm_vec3_copy((float*)bounds->corners[1], sim.bounds.corners[1]);
+
+    return sim;
+}
+
+void destroyBodySimulation(BodySimulation *sim)
+{
+    destroyBroadPhase(&sim->broadPhase);
+    destroyDynamicBodies(&sim->bodies);
+    free(sim->contacts);
+    *sim = {};
+}
+
+static void collideBodySimulation(BodySimulation *sim)
+{
+    const BodyPairList *pairs = &sim->broadPhase.pairs;
+    if (pairs->count > sim->contactsCapacity)
+    {
+        sim->contactsCapacity = pairs->count;
+        sim->contacts = (BodyContact*)realloc(sim->contacts, sizeof(BodyContact)*pairs->count);
+        if (!sim->contacts)
         {
-            float intersections[4096] = {};
-            const v256f vMagnitudes = _mm256_set1_ps(magnitude);
-            for (u32 i = 0; i < numVoxels; i += 8)
-            {
-                _mm256_store_ps(intersections + i, vMagnitudes);
-            }
+            fprintf(stderr, "Failed to grow Body Contacts\n");
+            abort();
+        }
+    }
 
-            rayAABBVoxelIntersections(&ray, surface, intersections);
+    sim->contactsCount = narrowPhaseSpheres(&sim->bodies, pairs->pairs, pairs->count, sim->contacts);
+}
 
-            for (u32 i = 0; i < numVoxels; i++)
-            {
-                if (intersections[i] < magnitude)
-                {
-                    u32 maxIndex = i < numVoxels-1 ? voxelIndexes[i+1] : surface->storedIndicesCount;
+void stepBodySimulation(BodySimulation *sim, JobPool *jobs)
+{
+    updateDynamicBodiesPhysics(&sim->bodies, BODY_STEP_NS);
+    updateBroadPhase(&sim->broadPhase, jobs, &sim->bodies);
+    collideBodySimulation(sim);
+    resolveBodyContacts(&sim->bodies, sim->contacts, sim->contactsCount);
+    containDynamicBodies(&sim->bodies, &sim->bounds);
+}
 
-                    u16 baseIndex = voxelIndexes[i];
+void benchmarkBodySimulation(u32 bodiesCount, u32 steps, JobPool *jobs, FILE *out)
+{
+    //Roomy enough at first that the bodies are spread out, until they settle in a pile
+    const float minRadius = 0.2f, maxRadius = 0.5f;
+    float side = cbrtf((float)bodiesCount)*4.0f*maxRadius;
+    Box bounds = {.corners = {{-0.5f*side, 0.0f, -0.5f*side}, {0.5f*side, side, 0.5f*side}}};
 
-                    for (u32 j = baseIndex; j < maxIndex; j += 3)
-                    {
-                        vec3 v1 = {};
-                        vec3 v2 = {};
-                        vec3 v3 = {};
-
-                        glm_vec3_copy(vertices[indices[j]], v1);
-                        glm_vec3_copy(vertices[indices[j+1]], v2);
-                        glm_vec3_copy(vertices[indices[j+2]], v3);
-
-                        float intersectionDistance = 0;
-                        if (glm_ray_triangle(character->pos, dir, v1, v2, v3, &intersectionDistance)
-                            && intersectionDistance < tmin)
-                        {
-                            tmin = intersectionDistance;
-                        }
-                    }
-                }
-            }
+    BodySimulation sim = createBodySimulation(bodiesCount, maxRadius, &bounds, jobs);
+    u32 seed = 1;
+    scatterDynamicBodies(&sim.bodies, bodiesCount, &bounds, minRadius, maxRadius, &seed);
+
+    s64 integrateTime_ns = 0, broadTime_ns = 0, narrowTime_ns = 0, resolveTime_ns = 0, maxStepTime_ns = 0;
+    u64 pairsTotal = 0, contactsTotal = 0;
+    for (u32 i = 0; i < steps; i++)
+    {
+        s64 start_ns = getCurrentTime_ns();
+        updateDynamicBodiesPhysics(&sim.bodies, BODY_STEP_NS);
+        s64 integrated_ns = getCurrentTime_ns();
+        updateBroadPhase(&sim.broadPhase, jobs, &sim.bodies);
+        s64 broad_ns = getCurrentTime_ns();
+        collideBodySimulation(&sim);
+        s64 narrow_ns = getCurrentTime_ns();
+        resolveBodyContacts(&sim.bodies, sim.contacts, sim.contactsCount);
+        containDynamicBodies(&sim.bodies, &sim.bounds);
+        s64 end_ns = getCurrentTime_ns();
+
+        integrateTime_ns += integrated_ns - start_ns;
+        broadTime_ns += broad_ns - integrated_ns;
+        narrowTime_ns += narrow_ns - broad_ns;
+        resolveTime_ns += end_ns - narrow_ns;
+        if (end_ns - start_ns > maxStepTime_ns)
+            maxStepTime_ns = end_ns - start_ns;
+        pairsTotal += sim.broadPhase.pairs.count;
+        contactsTotal += sim.contactsCount;
+    }
+
+    fprintf(out,
+        "{\"type\":\"bodiesBenchmark\",\"bodies\":%u,\"steps\":%u,\"workers\":%u,\"pairs\":%llu,\"contacts\":%llu,"
+        "\"integrate_ms\":%.4f,\"broad_ms\":%.4f,\"narrow_ms\":%.4f,\"resolve_ms\":%.4f,\"step_ms\":%.4f,\"max_step_ms\":%.4f,\"budget_ms\":%.4f}\n",
+        bodiesCount,
+        steps,
+        jobs->workersCount,
+        (unsigned long long)(pairsTotal/steps),
+        (unsigned long long)(contactsTotal/steps),
+        NS_TO_MS((double)integrateTime_ns)/steps,
+        NS_TO_MS((double)broadTime_ns)/steps,
+        NS_TO_MS((double)narrowTime_ns)/steps,
+        NS_TO_MS((double)resolveTime_ns)/steps,
+        NS_TO_MS((double)(integrateTime_ns + broadTime_ns + narrowTime_ns + resolveTime_ns))/steps,
+        NS_TO_MS((double)maxStepTime_ns),
+        NS_TO_MS((double)BODY_STEP_NS));
+    fflush(out);
+
+    destroyBodySimulation(&sim);
+}
+
+void updateCharacterPhysics(Character *character, s64 timeDiff_ns)
+{
+    vec3 fallingVelocity = {};
+    glm_vec3_scale(GRAVITY_DIR, GRAVITY_M_S_S*NS_TO_SEC(timeDiff_ns), fallingVelocity);
+
+    glm_vec3_add(character->vel_m_s, fallingVelocity, character->vel_m_s);
+}
+
+//Walks the voxels along the ray with a 3D DDA. Voxel rows run downwards from the
+//origin, so the traversal happens in grid space where every voxel is a unit cube.
+//https://www.cs.yorku.ca/~amana/research/grid.pdf
+RayHit raycastVoxels(const Voxels *voxels, const vec3 origin, const vec3 dir, float maxDist)
+{
+    RayHit hit = {.dist = maxDist, .triangleId = RAYCAST_MISS, .normal = GLM_VEC3_ZERO_INIT};
+
+    vec3 rayOrigin = {origin[0], origin[1], origin[2]};
+    vec3 rayDir = {dir[0], dir[1], dir[2]};
+
+    const float gridOrigin[3] = {
+        (rayOrigin[0] - voxels->origin[0]) / voxels->voxWidth,
+        (voxels->origin[1] - rayOrigin[1]) / voxels->voxHeight,
+        (rayOrigin[2] - voxels->origin[2]) / voxels->voxLength};
+    const float gridDir[3] = {
+        rayDir[0] / voxels->voxWidth,
+        -rayDir[1] / voxels->voxHeight,
+        rayDir[2] / voxels->voxLength};
+    const s32 gridSize[3] = {(s32)voxels->cols, (s32)voxels->rows, (s32)voxels->depth};
+
+    //Clip the ray against the volume
+    float tEnter = 0.0f, tExit = maxDist;
+    for (int d = 0; d < 3; d++)
+    {
+        if (gridDir[d] == 0.0f)
+        {
+            if (gridOrigin[d] < 0.0f || gridOrigin[d] > gridSize[d])
+                return hit;
+            continue;
         }
 
-        if (tmin < magnitude)//Collided
+        float t0 = (0.0f - gridOrigin[d]) / gridDir[d];
+        float t1 = (gridSize[d] - gridOrigin[d]) / gridDir[d];
+        tEnter = max(tEnter, min(t0, t1));
+        tExit = min(tExit, max(t0, t1));
+    }
+
+    if (tEnter > tExit)
+        return hit;
+
+    s32 cell[3] = {};
+    s32 step[3] = {};
+    float tNext[3] = {};
+    float tDelta[3] = {};
+    for (int d = 0; d < 3; d++)
+    {
+        float p = gridOrigin[d] + gridDir[d]*tEnter;
+        cell[d] = glm_clamp((s32)floorf(p), 0, gridSize[d] - 1);
+
+        if (gridDir[d] > 0.0f)
+        {
+            step[d] = 1;
+            tNext[d] = (cell[d] + 1 - gridOrigin[d]) / gridDir[d];
+            tDelta[d] = 1.0f / gridDir[d];
+        }
+        else if (gridDir[d] < 0.0f)
         {
-            glm_vec3_scale(dir, tmin, dir);
-            glm_vec3_add(character->pos, dir, character->pos);
-            glm_vec3_zero(character->vel_m_s);
+            step[d] = -1;
+            tNext[d] = (cell[d] - gridOrigin[d]) / gridDir[d];
+            tDelta[d] = -1.0f / gridDir[d];
         }
         else
         {
-            glm_vec3_add(character->pos, character->vel_m_s, character->pos);
+            tNext[d] = INFINITY;
+            tDelta[d] = INFINITY;
         }
     }
-    else
+
+    u32 numVoxels = voxels->cols * voxels->rows * voxels->depth;
+    const u32 *voxelIndexes = (const u32*)voxels->data;
+    const u16 *indices = (const u16*)(voxels->data + sizeof(u32)*numVoxels);
+    const vec3 *vertices = (const vec3*)(voxels->data + voxels->transformedVerticesIdx);
+    const u32 *triangleIds = (const u32*)(voxels->data + voxels->triangleIdsIdx);
+    u32 hitTriplet = 0;
+
+    while (true)
     {
-        glm_vec3_add(character->pos, character->vel_m_s, character->pos);
+        u32 voxelIdx = cell[0]*(voxels->rows*voxels->depth) + cell[1]*(voxels->depth) + cell[2];
+        u32 maxIndex = voxelIdx < numVoxels-1 ? voxelIndexes[voxelIdx+1] : voxels->storedIndicesCount;
+
+        for (u32 i = voxelIndexes[voxelIdx]; i < maxIndex; i += 3)
+        {
+            vec3 v1 = {}, v2 = {}, v3 = {};
+            glm_vec3_copy((float*)vertices[indices[i]], v1);
+            glm_vec3_copy((float*)vertices[indices[i+1]], v2);
+            glm_vec3_copy((float*)vertices[indices[i+2]], v3);
+
+            float intersectionDistance = 0;
+            if (glm_ray_triangle(rayOrigin, rayDir, v1, v2, v3, &intersectionDistance) && 
+                intersectionDistance < hit.dist)
+            {
+                hit.dist = intersectionDistance;
+                hit.triangleId = triangleIds[i/3];
+                hitTriplet = i;
+            }
+        }
+
+        int axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+        float tCellExit = tNext[axis];
+
+        //Nothing in a later voxel can be nearer than a hit already found
+        if (hit.dist <= tCellExit || tCellExit > tExit)
+            break;
+
+        cell[axis] += step[axis];
+        if (cell[axis] < 0 || cell[axis] >= gridSize[axis])
+            break;
+        tNext[axis] += tDelta[axis];
     }
+
+    if (hit.triangleId != RAYCAST_MISS)
+    {
+        vec3 edge1 = {}, edge2 = {};
+        glm_vec3_sub((float*)vertices[indices[hitTriplet+1]], (float*)vertices[indices[hitTriplet]], edge1);
+        glm_vec3_sub((float*)vertices[indices[hitTriplet+2]], (float*)vertices[indices[hitTriplet]], edge2);
+        glm_vec3_crossn(edge1, edge2, hit.normal);
+
+        if (glm_vec3_dot(hit.normal, rayDir) > 0.0f)
+            glm_vec3_negate(hit.normal);
+    }
+
+    return hit;
+}
+
+typedef struct {
+    const Voxels *voxels;
+    const u32 *order;//NULL to cast in the given order
+    const vec3 *origins;
+    const vec3 *dirs;
+    const float *maxDists;
+    float *outDists;
+    u32 *outTriangleIds;
+    vec3 *outNormals;
+} RaycastBatchJob;
+
+static void raycastBatchRange(void *ctx, u32 start, u32 end, u32 workerIdx)
+{
+    RaycastBatchJob *job = (RaycastBatchJob*)ctx;
+
+    for (u32 i = start; i < end; i++)
+    {
+        u32 ray = job->order ? job->order[i] : i;
+        RayHit hit = raycastVoxels(job->voxels, job->origins[ray], job->dirs[ray], job->maxDists[ray]);
+
+        job->outDists[ray] = hit.dist;
+        job->outTriangleIds[ray] = hit.triangleId;
+        glm_vec3_copy(hit.normal, job->outNormals[ray]);
+    }
+}
+
+//Rays are counting sorted by the voxel holding their origin, so neighbouring
+//rays in a batch walk the same triangles while they are still in cache.
+void raycastBatch(
+    JobPool *jobs,
+    const Voxels *voxels,
+    u32 count,
+    const vec3 origins[],
+    const vec3 dirs[],
+    const float maxDists[],
+    float outDists[],
+    u32 outTriangleIds[],
+    vec3 outNormals[])
+{
+    if (!count)
+        return;
+
+    RaycastBatchJob job = {
+        .voxels = voxels,
+        .order = NULL,
+        .origins = origins,
+        .dirs = dirs,
+        .maxDists = maxDists,
+        .outDists = outDists,
+        .outTriangleIds = outTriangleIds,
+        .outNormals = outNormals
+    };
+
+    //A single batch runs on this thread anyway, so sorting it gains nothing
+    if (count <= RAYCAST_BATCH_SIZE)
+    {
+        raycastBatchRange(&job, 0, count, 0);
+        return;
+    }
+
+    u32 numVoxels = voxels->cols * voxels->rows * voxels->depth;
+    u32 bucketsCount = numVoxels + 1;//Last bucket holds rays starting outside the volume
+
+    u32 *buckets = (u32*)calloc(bucketsCount + 1, sizeof(u32));
+    u32 *rayCells = (u32*)malloc(sizeof(u32) * count);
+    u32 *order = (u32*)malloc(sizeof(u32) * count);
+    if (!buckets || !rayCells || !order)
+    {
+        fprintf(stderr, "Failed to allocate Raycast Batch\n");
+        abort();
+    }
+
+    for (u32 i = 0; i < count; i++)
+    {
+        vec3 origin = {origins[i][0], origins[i][1], origins[i][2]};
+        int voxelIdx = findIndexOfPointWithinVoxel(origin, voxels);
+        rayCells[i] = voxelIdx >= 0 ? voxelIdx : numVoxels;
+        buckets[rayCells[i] + 1]++;
+    }
+
+    for (u32 i = 1; i <= bucketsCount; i++)
+        buckets[i] += buckets[i-1];
+
+    for (u32 i = 0; i < count; i++)
+        order[buckets[rayCells[i]]++] = i;
+
+    job.order = order;
+    parallelFor(jobs, count, RAYCAST_BATCH_SIZE, raycastBatchRange, &job);
+
+    free(order);
+    free(rayCells);
+    free(buckets);
 }
 
 //Only designed to detect the point where a ray comes in contact with a box
@@ -245,4 +598,443 @@ void rayAABBVoxelIntersections(const Ray *ray, const Voxels *voxels, float ts[])
             }
         }
     }
-}
\ No newline at end of file
+}
+
+//Real-Time Collision Detection, 5.1.5
+TriangleFeature closestPointOnTriangleFeature(const vec3 p, const vec3 a, const vec3 b, const vec3 c, vec3 closest)
+{
+    vec3 ab, ac, ap;
+    glm_vec3_sub((float*)b, (float*)a, ab);
+    glm_vec3_sub((float*)c, (float*)a, ac);
+    glm_vec3_sub((float*)p, (float*)a, ap);
+
+    float d1 = glm_vec3_dot(ab, ap);
+    float d2 = glm_vec3_dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f)
+    {
+        glm_vec3_copy((float*)a, closest);
+        return TRIANGLE_FEATURE_A;
+    }
+
+    vec3 bp;
+    glm_vec3_sub((float*)p, (float*)b, bp);
+    float d3 = glm_vec3_dot(ab, bp);
+    float d4 = glm_vec3_dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3)
+    {
+        glm_vec3_copy((float*)b, closest);
+        return TRIANGLE_FEATURE_B;
+    }
+
+    float vc = d1*d4 - d3*d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+    {
+        glm_vec3_lerp((float*)a, (float*)b, d1 / (d1 - d3), closest);
+        return TRIANGLE_FEATURE_AB;
+    }
+
+    vec3 cp;
+    glm_vec3_sub((float*)p, (float*)c, cp);
+    float d5 = glm_vec3_dot(ab, cp);
+    float d6 = glm_vec3_dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6)
+    {
+        glm_vec3_copy((float*)c, closest);
+        return TRIANGLE_FEATURE_C;
+    }
+
+    float vb = d5*d2 - d1*d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+    {
+        glm_vec3_lerp((float*)a, (float*)c, d2 / (d2 - d6), closest);
+        return TRIANGLE_FEATURE_CA;
+    }
+
+    float va = d3*d6 - d5*d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+    {
+        glm_vec3_lerp((float*)b, (float*)c, (d4 - d3) / ((d4 - d3) + (d5 - d6)), closest);
+        return TRIANGLE_FEATURE_BC;
+    }
+
+    float denom = 1.0f / (va + vb + vc);
+    float v = vb * denom;
+    float w = vc * denom;
+    for (int d = 0; d < 3; d++)
+        closest[d] = a[d] + ab[d]*v + ac[d]*w;
+
+    return TRIANGLE_FEATURE_FACE;
+}
+
+OverlapScratch createOverlapScratch(const Voxels *voxels)
+{
+    OverlapScratch scratch = {.trianglesCount = voxels->trianglesCount, .currentStamp = 0};
+    scratch.stamps = (u32*)calloc(voxels->trianglesCount ? voxels->trianglesCount : 1, sizeof(u32));
+    if (!scratch.stamps)
+    {
+        fprintf(stderr, "Failed to allocate Overlap Scratch\n");
+        abort();
+    }
+    return scratch;
+}
+
+void destroyOverlapScratch(OverlapScratch *scratch)
+{
+    free(scratch->stamps);
+    *scratch = {};
+}
+
+static u32 nextOverlapStamp(OverlapScratch *scratch)
+{
+    scratch->currentStamp++;
+    if (!scratch->currentStamp)//Wrapped, so old stamps could alias the new query
+    {
+        memset(scratch->stamps, 0, sizeof(u32) * scratch->trianglesCount);
+        scratch->currentStamp = 1;
+    }
+    return scratch->currentStamp;
+}
+
+//Eight triangles in structure-of-arrays form
+typedef struct {
+    v256f ax, ay, az;
+    v256f bx, by, bz;
+    v256f cx, cy, cz;
+} TriangleLanes;
+
+typedef v256f (*OverlapTest)(const TriangleLanes *tris, const void *shape);
+
+typedef struct {
+    vec3 center;
+    float radius;
+} SphereShape;
+
+typedef struct {
+    vec3 center;
+    vec3 halfExtents;
+} BoxShape;
+
+static inline v256f dot8(v256f ax, v256f ay, v256f az, v256f bx, v256f by, v256f bz)
+{
+    return _mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_add_ps(_mm256_mul_ps(ay, by), _mm256_mul_ps(az, bz)));
+}
+
+static inline v256f abs8(v256f x)
+{
+    return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x);
+}
+
+//Closest point on each triangle to the sphere centre, by Voronoi region.
+//closestPointOnTriangleFeature returns from the first matching region, so the
+//blends here run in reverse priority order.
+static v256f sphereTrianglesOverlap(const TriangleLanes *t, const void *shape)
+{
+    const SphereShape *sphere = (const SphereShape*)shape;
+    const v256f zero = _mm256_setzero_ps();
+    const v256f px = _mm256_set1_ps(sphere->center[0]);
+    const v256f py = _mm256_set1_ps(sphere->center[1]);
+    const v256f pz = _mm256_set1_ps(sphere->center[2]);
+
+    v256f abx = _mm256_sub_ps(t->bx, t->ax), aby = _mm256_sub_ps(t->by, t->ay), abz = _mm256_sub_ps(t->bz, t->az);
+    v256f acx = _mm256_sub_ps(t->cx, t->ax), acy = _mm256_sub_ps(t->cy, t->ay), acz = _mm256_sub_ps(t->cz, t->az);
+    v256f apx = _mm256_sub_ps(px, t->ax), apy = _mm256_sub_ps(py, t->ay), apz = _mm256_sub_ps(pz, t->az);
+    v256f bpx = _mm256_sub_ps(px, t->bx), bpy = _mm256_sub_ps(py, t->by), bpz = _mm256_sub_ps(pz, t->bz);
+    v256f cpx = _mm256_sub_ps(px, t->cx), cpy = _mm256_sub_ps(py, t->cy), cpz = _mm256_sub_ps(pz, t->cz);
+
+    v256f d1 = dot8(abx, aby, abz, apx, apy, apz);
+    v256f d2 = dot8(acx, acy, acz, apx, apy, apz);
+    v256f d3 = dot8(abx, aby, abz, bpx, bpy, bpz);
+    v256f d4 = dot8(acx, acy, acz, bpx, bpy, bpz);
+    v256f d5 = dot8(abx, aby, abz, cpx, cpy, cpz);
+    v256f d6 = dot8(acx, acy, acz, cpx, cpy, cpz);
+
+    v256f va = _mm256_sub_ps(_mm256_mul_ps(d3, d6), _mm256_mul_ps(d5, d4));
+    v256f vb = _mm256_sub_ps(_mm256_mul_ps(d5, d2), _mm256_mul_ps(d1, d6));
+    v256f vc = _mm256_sub_ps(_mm256_mul_ps(d1, d4), _mm256_mul_ps(d3, d2));
+
+    //Inside the face
+    v256f denom = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_add_ps(va, _mm256_add_ps(vb, vc)));
+    v256f v = _mm256_mul_ps(vb, denom);
+    v256f w = _mm256_mul_ps(vc, denom);
+    v256f qx = _mm256_add_ps(t->ax, _mm256_add_ps(_mm256_mul_ps(abx, v), _mm256_mul_ps(acx, w)));
+    v256f qy = _mm256_add_ps(t->ay, _mm256_add_ps(_mm256_mul_ps(aby, v), _mm256_mul_ps(acy, w)));
+    v256f qz = _mm256_add_ps(t->az, _mm256_add_ps(_mm256_mul_ps(abz, v), _mm256_mul_ps(acz, w)));
+
+    //Edge BC
+    v256f d43 = _mm256_sub_ps(d4, d3);
+    v256f d56 = _mm256_sub_ps(d5, d6);
+    v256f inBC = _mm256_and_ps(_mm256_cmp_ps(va, zero, _CMP_LE_OQ),
+        _mm256_and_ps(_mm256_cmp_ps(d43, zero, _CMP_GE_OQ), _mm256_cmp_ps(d56, zero, _CMP_GE_OQ)));
+    w = _mm256_div_ps(d43, _mm256_add_ps(d43, d56));
+    qx = _mm256_blendv_ps(qx, _mm256_add_ps(t->bx, _mm256_mul_ps(_mm256_sub_ps(t->cx, t->bx), w)), inBC);
+    qy = _mm256_blendv_ps(qy, _mm256_add_ps(t->by, _mm256_mul_ps(_mm256_sub_ps(t->cy, t->by), w)), inBC);
+    qz = _mm256_blendv_ps(qz, _mm256_add_ps(t->bz, _mm256_mul_ps(_mm256_sub_ps(t->cz, t->bz), w)), inBC);
+
+    //Edge AC
+    v256f inAC = _mm256_and_ps(_mm256_cmp_ps(vb, zero, _CMP_LE_OQ),
+        _mm256_and_ps(_mm256_cmp_ps(d2, zero, _CMP_GE_OQ), _mm256_cmp_ps(d6, zero, _CMP_LE_OQ)));
+    w = _mm256_div_ps(d2, _mm256_sub_ps(d2, d6));
+    qx = _mm256_blendv_ps(qx, _mm256_add_ps(t->ax, _mm256_mul_ps(acx, w)), inAC);
+    qy = _mm256_blendv_ps(qy, _mm256_add_ps(t->ay, _mm256_mul_ps(acy, w)), inAC);
+    qz = _mm256_blendv_ps(qz, _mm256_add_ps(t->az, _mm256_mul_ps(acz, w)), inAC);
+
+    //Vertex C
+    v256f inC = _mm256_and_ps(_mm256_cmp_ps(d6, zero, _CMP_GE_OQ), _mm256_cmp_ps(d5, d6, _CMP_LE_OQ));
+    qx = _mm256_blendv_ps(qx, t->cx, inC);
+    qy = _mm256_blendv_ps(qy, t->cy, inC);
+    qz = _mm256_blendv_ps(qz, t->cz, inC);
+
+    //Edge AB
+    v256f inAB = _mm256_and_ps(_mm256_cmp_ps(vc, zero, _CMP_LE_OQ),
+        _mm256_and_ps(_mm256_cmp_ps(d1, zero, _CMP_GE_OQ), _mm256_cmp_ps(d3, zero, _CMP_LE_OQ)));
+    v = _mm256_div_ps(d1, _mm256_sub_ps(d1, d3));
+    qx = _mm256_blendv_ps(qx, _mm256_add_ps(t->ax, _mm256_mul_ps(abx, v)), inAB);
+    qy = _mm256_blendv_ps(qy, _mm256_add_ps(t->ay, _mm256_mul_ps(aby, v)), inAB);
+    qz = _mm256_blendv_ps(qz, _mm256_add_ps(t->az, _mm256_mul_ps(abz, v)), inAB);
+
+    //Vertex B
+    v256f inB = _mm256_and_ps(_mm256_cmp_ps(d3, zero, _CMP_GE_OQ), _mm256_cmp_ps(d4, d3, _CMP_LE_OQ));
+    qx = _mm256_blendv_ps(qx, t->bx, inB);
+    qy = _mm256_blendv_ps(qy, t->by, inB);
+    qz = _mm256_blendv_ps(qz, t->bz, inB);
+
+    //Vertex A
+    v256f inA = _mm256_and_ps(_mm256_cmp_ps(d1, zero, _CMP_LE_OQ), _mm256_cmp_ps(d2, zero, _CMP_LE_OQ));
+    qx = _mm256_blendv_ps(qx, t->ax, inA);
+    qy = _mm256_blendv_ps(qy, t->ay, inA);
+    qz = _mm256_blendv_ps(qz, t->az, inA);
+
+    v256f dx = _mm256_sub_ps(px, qx);
+    v256f dy = _mm256_sub_ps(py, qy);
+    v256f dz = _mm256_sub_ps(pz, qz);
+    v256f radius2 = _mm256_set1_ps(sphere->radius * sphere->radius);
+
+    return _mm256_cmp_ps(dot8(dx, dy, dz, dx, dy, dz), radius2, _CMP_LE_OQ);
+}
+
+static inline v256f separatedOnAxis(
+    v256f ax, v256f ay, v256f az,
+    const TriangleLanes *t,
+    v256f ex, v256f ey, v256f ez)
+{
+    v256f p0 = dot8(ax, ay, az, t->ax, t->ay, t->az);
+    v256f p1 = dot8(ax, ay, az, t->bx, t->by, t->bz);
+    v256f p2 = dot8(ax, ay, az, t->cx, t->cy, t->cz);
+    v256f r = dot8(ex, ey, ez, abs8(ax), abs8(ay), abs8(az));
+
+    v256f pmin = _mm256_min_ps(p0, _mm256_min_ps(p1, p2));
+    v256f pmax = _mm256_max_ps(p0, _mm256_max_ps(p1, p2));
+
+    return _mm256_or_ps(
+        _mm256_cmp_ps(pmin, r, _CMP_GT_OQ),
+        _mm256_cmp_ps(pmax, _mm256_sub_ps(_mm256_setzero_ps(), r), _CMP_LT_OQ));
+}
+
+//Separating axis test over the 3 box normals, the triangle normal and the 9 edge cross products.
+//Fast 3D Triangle-Box Overlap Testing, Akenine-Moller 2001.
+static v256f boxTrianglesOverlap(const TriangleLanes *tris, const void *shape)
+{
+    const BoxShape *box = (const BoxShape*)shape;
+    const v256f zero = _mm256_setzero_ps();
+    const v256f one = _mm256_set1_ps(1.0f);
+    const v256f ex = _mm256_set1_ps(box->halfExtents[0]);
+    const v256f ey = _mm256_set1_ps(box->halfExtents[1]);
+    const v256f ez = _mm256_set1_ps(box->halfExtents[2]);
+    const v256f cx = _mm256_set1_ps(box->center[0]);
+    const v256f cy = _mm256_set1_ps(box->center[1]);
+    const v256f cz = _mm256_set1_ps(box->center[2]);
+
+    //Move the box to the origin
+    TriangleLanes t = {
+        _mm256_sub_ps(tris->ax, cx), _mm256_sub_ps(tris->ay, cy), _mm256_sub_ps(tris->az, cz),
+        _mm256_sub_ps(tris->bx, cx), _mm256_sub_ps(tris->by, cy), _mm256_sub_ps(tris->bz, cz),
+        _mm256_sub_ps(tris->cx, cx), _mm256_sub_ps(tris->cy, cy), _mm256_sub_ps(tris->cz, cz)};
+
+    v256f edges[3][3] = {
+        {_mm256_sub_ps(t.bx, t.ax), _mm256_sub_ps(t.by, t.ay), _mm256_sub_ps(t.bz, t.az)},
+        {_mm256_sub_ps(t.cx, t.bx), _mm256_sub_ps(t.cy, t.by), _mm256_sub_ps(t.cz, t.bz)},
+        {_mm256_sub_ps(t.ax, t.cx), _mm256_sub_ps(t.ay, t.cy), _mm256_sub_ps(t.az, t.cz)}};
+
+    v256f separated = zero;
+
+    //Box normals
+    separated = _mm256_or_ps(separated, separatedOnAxis(one, zero, zero, &t, ex, ey, ez));
+    separated = _mm256_or_ps(separated, separatedOnAxis(zero, one, zero, &t, ex, ey, ez));
+    separated = _mm256_or_ps(separated, separatedOnAxis(zero, zero, one, &t, ex, ey, ez));
+
+    //Triangle normal
+    v256f nx = _mm256_sub_ps(_mm256_mul_ps(edges[0][1], edges[1][2]), _mm256_mul_ps(edges[0][2], edges[1][1]));
+    v256f ny = _mm256_sub_ps(_mm256_mul_ps(edges[0][2], edges[1][0]), _mm256_mul_ps(edges[0][0], edges[1][2]));
+    v256f nz = _mm256_sub_ps(_mm256_mul_ps(edges[0][0], edges[1][1]), _mm256_mul_ps(edges[0][1], edges[1][0]));
+    separated = _mm256_or_ps(separated, separatedOnAxis(nx, ny, nz, &t, ex, ey, ez));
+
+    //Box axis x edge, e.g. (1,0,0) x f = (0, -fz, fy)
+    for (int i = 0; i < 3; i++)
+    {
+        v256f fx = edges[i][0], fy = edges[i][1], fz = edges[i][2];
+        separated = _mm256_or_ps(separated, separatedOnAxis(zero, _mm256_sub_ps(zero, fz), fy, &t, ex, ey, ez));
+        separated = _mm256_or_ps(separated, separatedOnAxis(fz, zero, _mm256_sub_ps(zero, fx), &t, ex, ey, ez));
+        separated = _mm256_or_ps(separated, separatedOnAxis(_mm256_sub_ps(zero, fy), fx, zero, &t, ex, ey, ez));
+    }
+
+    return _mm256_andnot_ps(separated, _mm256_castsi256_ps(_mm256_set1_epi32(-1)));
+}
+
+typedef struct {
+    u32 count;
+    u32 ids[OVERLAP_LANES];
+    alignas(32) float coords[9][OVERLAP_LANES];
+} TriangleBatch;
+
+//Runs the exact test over the batched triangles and appends the overlapping ones
+static u32 flushTriangleBatch(
+    TriangleBatch *batch,
+    OverlapTest test,
+    const void *shape,
+    u32 outTriangleIds[],
+    u32 outCount,
+    u32 maxTriangles)
+{
+    //Pad the unused lanes with the first triangle, whose result gets masked off
+    for (u32 lane = batch->count; lane < OVERLAP_LANES; lane++)
+    {
+        for (u32 k = 0; k < 9; k++)
+            batch->coords[k][lane] = batch->coords[k][0];
+    }
+
+    TriangleLanes tris = {
+        _mm256_load_ps(batch->coords[0]), _mm256_load_ps(batch->coords[1]), _mm256_load_ps(batch->coords[2]),
+        _mm256_load_ps(batch->coords[3]), _mm256_load_ps(batch->coords[4]), _mm256_load_ps(batch->coords[5]),
+        _mm256_load_ps(batch->coords[6]), _mm256_load_ps(batch->coords[7]), _mm256_load_ps(batch->coords[8])};
+
+    int overlapping = _mm256_movemask_ps(test(&tris, shape)) & ((1 << batch->count) - 1);
+
+    while (overlapping && outCount < maxTriangles)
+    {
+        int lane = __builtin_ctz(overlapping);
+        overlapping &= overlapping - 1;
+        outTriangleIds[outCount++] = batch->ids[lane];
+    }
+
+    batch->count = 0;
+    return outCount;
+}
+
+//Gathers the triangles stored in every voxel the AABB touches, each once,
+//and runs the exact test over them OVERLAP_LANES at a time.
+static u32 overlapVoxels(
+    const Voxels *voxels,
+    OverlapScratch *scratch,
+    const vec3 aabbMin,
+    const vec3 aabbMax,
+    OverlapTest test,
+    const void *shape,
+    u32 outTriangleIds[],
+    u32 maxTriangles)
+{
+    assert(scratch->trianglesCount == voxels->trianglesCount);
+
+    //Voxel rows run downwards, so the row range comes from the top of the AABB
+    float colMin = (aabbMin[0] - voxels->origin[0]) / voxels->voxWidth;
+    float colMax = (aabbMax[0] - voxels->origin[0]) / voxels->voxWidth;
+    float rowMin = (voxels->origin[1] - aabbMax[1]) / voxels->voxHeight;
+    float rowMax = (voxels->origin[1] - aabbMin[1]) / voxels->voxHeight;
+    float depthMin = (aabbMin[2] - voxels->origin[2]) / voxels->voxLength;
+    float depthMax = (aabbMax[2] - voxels->origin[2]) / voxels->voxLength;
+
+    if (colMax < 0.0f || rowMax < 0.0f || depthMax < 0.0f ||
+        colMin >= voxels->cols || rowMin >= voxels->rows || depthMin >= voxels->depth)
+        return 0;
+
+    u32 col0 = colMin > 0.0f ? (u32)colMin : 0;
+    u32 row0 = rowMin > 0.0f ? (u32)rowMin : 0;
+    u32 depth0 = depthMin > 0.0f ? (u32)depthMin : 0;
+    u32 col1 = colMax < voxels->cols ? (u32)colMax : voxels->cols - 1;
+    u32 row1 = rowMax < voxels->rows ? (u32)rowMax : voxels->rows - 1;
+    u32 depth1 = depthMax < voxels->depth ? (u32)depthMax : voxels->depth - 1;
+
+    u32 numVoxels = voxels->cols * voxels->rows * voxels->depth;
+    const u32 *voxelIndexes = (const u32*)voxels->data;
+    const u16 *indices = (const u16*)(voxels->data + sizeof(u32)*numVoxels);
+    const vec3 *vertices = (const vec3*)(voxels->data + voxels->transformedVerticesIdx);
+    const u32 *triangleIds = (const u32*)(voxels->data + voxels->triangleIdsIdx);
+
+    u32 stamp = nextOverlapStamp(scratch);
+    u32 outCount = 0;
+    TriangleBatch batch = {};
+
+    for (u32 col = col0; col <= col1; col++)
+    {
+        for (u32 row = row0; row <= row1; row++)
+        {
+            for (u32 depth = depth0; depth <= depth1; depth++)
+            {
+                u32 voxelIdx = col*(voxels->rows*voxels->depth) + row*(voxels->depth) + depth;
+                u32 maxIndex = voxelIdx < numVoxels-1 ? voxelIndexes[voxelIdx+1] : voxels->storedIndicesCount;
+
+                for (u32 i = voxelIndexes[voxelIdx]; i < maxIndex; i += 3)
+                {
+                    u32 triangleId = triangleIds[i/3];
+                    if (scratch->stamps[triangleId] == stamp)
+                        continue;
+                    scratch->stamps[triangleId] = stamp;
+
+                    u32 lane = batch.count++;
+                    batch.ids[lane] = triangleId;
+                    for (u32 vtx = 0; vtx < 3; vtx++)
+                    {
+                        for (u32 d = 0; d < 3; d++)
+                            batch.coords[vtx*3 + d][lane] = vertices[indices[i + vtx]][d];
+                    }
+
+                    if (batch.count == OVERLAP_LANES)
+                    {
+                        outCount = flushTriangleBatch(&batch, test, shape, outTriangleIds, outCount, maxTriangles);
+                        if (outCount == maxTriangles)
+                            return outCount;
+                    }
+                }
+            }
+        }
+    }
+
+    if (batch.count)
+        outCount = flushTriangleBatch(&batch, test, shape, outTriangleIds, outCount, maxTriangles);
+
+    return outCount;
+}
+
+u32 overlapSphere(
+    const Voxels *voxels,
+    OverlapScratch *scratch,
+    const vec3 center,
+    float radius,
+    u32 outTriangleIds[],
+    u32 maxTriangles)
+{
+    SphereShape sphere = {.center = {center[0], center[1], center[2]}, .radius = radius};
+    vec3 aabbMin = {center[0] - radius, center[1] - radius, center[2] - radius};
+    vec3 aabbMax = {center[0] + radius, center[1] + radius, center[2] + radius};
+
+    return overlapVoxels(voxels, scratch, aabbMin, aabbMax, sphereTrianglesOverlap, &sphere, outTriangleIds, maxTriangles);
+}
+
+u32 overlapBox(
+    const Voxels *voxels,
+    OverlapScratch *scratch,
+    const Box *box,
+    u32 outTriangleIds[],
+    u32 maxTriangles)
+{
+    vec3 aabbMin = {}, aabbMax = {};
+    BoxShape shape = {};
+    for (int d = 0; d < 3; d++)
+    {
+        aabbMin[d] = min(box->corners[0][d], box->corners[1][d]);
+        aabbMax[d] = max(box->corners[0][d], box->corners[1][d]);
+        shape.center[d] = 0.5f * (aabbMin[d] + aabbMax[d]);
+        shape.halfExtents[d] = 0.5f * (aabbMax[d] - aabbMin[d]);
+    }
+
+    return overlapVoxels(voxels, scratch, aabbMin, aabbMax, boxTrianglesOverlap, &shape, outTriangleIds, maxTriangles);
+}
@@ -0,0 +1,329 @@
+#include "profiler.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "timing.h"
+
+static void addSample(TimingSeries *series, float sample_ms)
+{
+    series->samples[series->samplesCount % PROFILER_HISTORY] = sample_ms;
+    series->samplesCount++;
+}
+
+static int compareFloats(const void *a, const void *b)
+{
+    float x = *(const float*)a, y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+static void writeSeries(FILE *out, const TimingSeries *series, bool first)
+{
+    u32 count = series->samplesCount < PROFILER_HISTORY ? series->samplesCount : PROFILER_HISTORY;
+
+    float sorted[PROFILER_HISTORY] = {};
+    memcpy(sorted, series->samples, sizeof(float)*count);
+    qsort(sorted, count, sizeof(float), compareFloats);
+
+    float sum = 0.0f;
+    for (u32 i = 0; i < count; i++)
+        sum += sorted[i];
+
+    //Nearest rank
+    float p50 = 0.0f, p95 = 0.0f, p99 = 0.0f, max = 0.0f;
+    if (count)
+    {
+        p50 = sorted[(count - 1)*50/100];
+        p95 = sorted[(count - 1)*95/100];
+        p99 = sorted[(count - 1)*99/100];
+        max = sorted[count - 1];
+    }
+
+    fprintf(out,
+        "%s\"%s\":{\"samples\":%u,\"avgMs\":%.3f,\"p50Ms\":%.3f,\"p95Ms\":%.3f,\"p99Ms\":%.3f,\"maxMs\":%.3f}",
+        first ? "" : ",",
+        series->name,
+        count,
+        count ? sum/count : 0.0f,
+        p50, p95, p99, max);
+}
+
+static const char *PIPELINE_STAT_NAMES[PIPELINE_STATS_COUNT] = {
+    "vertices",
+    "primitives",
+    "vertexInvocations",
+    "clippingInvocations",
+    "clippingPrimitives",
+    "fragmentInvocations"
+};
+
+static void writeStats(FILE *out, const char *name, const u64 *stats, u32 divisor, bool first)
+{
+    fprintf(out, "%s\"%s\":{", first ? "" : ",", name);
+    for (u32 i = 0; i < PIPELINE_STATS_COUNT; i++)
+        fprintf(out, "%s\"%s\":%lu", i ? "," : "", PIPELINE_STAT_NAMES[i], (unsigned long)(stats[i]/divisor));
+    fprintf(out, "}");
+}
+
+static u32 findGpuSeries(Profiler *profiler, const char *name)
+{
+    for (u32 i = 0; i < profiler->gpuScopesCount; i++)
+    {
+        if (profiler->gpuScopes[i].name == name || !strcmp(profiler->gpuScopes[i].name, name))
+            return i;
+    }
+
+    if (profiler->gpuScopesCount == PROFILER_MAX_SCOPES)
+        return PROFILER_NO_SCOPE;
+
+    TimingSeries *series = &profiler->gpuScopes[profiler->gpuScopesCount];
+    series->name = name;
+    return profiler->gpuScopesCount++;
+}
+
+static void collectGpuTimestamps(Profiler *profiler, u32 slot)
+{
+    u32 scopesCount = profiler->scopesWrittenCounts[slot];
+    if (!scopesCount)
+        return;
+
+    //Each query's value followed by its availability
+    u64 results[PROFILER_MAX_SCOPES_PER_FRAME*2][2] = {};
+    VkResult result = vkGetQueryPoolResults(
+        profiler->device,
+        profiler->queryPools[slot],
+        0, scopesCount*2,
+        sizeof(results), results, sizeof(results[0]),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+    if (result != VK_SUCCESS && result != VK_NOT_READY)
+    {
+        fprintf(stderr, "Failed to get Timestamp Query results\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (u32 i = 0; i < scopesCount; i++)
+    {
+        u64 *begin = results[i*2], *end = results[i*2 + 1];
+        if (!begin[1] || !end[1])//Its frame was never submitted
+            continue;
+
+        u64 ticks = (end[0] - begin[0]) & profiler->timestampMask;
+        addSample(&profiler->gpuScopes[profiler->scopesWritten[slot][i]], NS_TO_MS(ticks*profiler->timestampPeriod));
+    }
+
+    vkResetQueryPool(profiler->device, profiler->queryPools[slot], 0, PROFILER_MAX_SCOPES_PER_FRAME*2);
+    profiler->scopesWrittenCounts[slot] = 0;
+}
+
+static void collectPipelineStatistics(Profiler *profiler, u32 slot)
+{
+    if (!profiler->statsWritten[slot])
+        return;
+
+    u64 results[PIPELINE_STATS_COUNT + 1] = {};//Availability last
+    VkResult result = vkGetQueryPoolResults(
+        profiler->device,
+        profiler->statsPools[slot],
+        0, 1,
+        sizeof(results), results, sizeof(results),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+    if (result != VK_SUCCESS && result != VK_NOT_READY)
+    {
+        fprintf(stderr, "Failed to get Pipeline Statistics Query results\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (results[PIPELINE_STATS_COUNT])
+    {
+        for (u32 i = 0; i < PIPELINE_STATS_COUNT; i++)
+        {
+            profiler->lastStats[i] = results[i];
+            profiler->statsSums[i] += results[i];
+        }
+        profiler->statsFrames++;
+    }
+
+    vkResetQueryPool(profiler->device, profiler->statsPools[slot], 0, 1);
+    profiler->statsWritten[slot] = false;
+}
+
+Profiler createProfiler(
+    VkDevice device,
+    VkPhysicalDevice physicalDevice,
+    u32 queueFamilyIndex,
+    u32 framesCount,
+    VkQueryPipelineStatisticFlags statisticFlags,
+    FILE *out,
+    u32 interval)
+{
+    Profiler profiler = {};
+    profiler.device = device;
+    profiler.out = out;
+    profiler.interval = interval ? interval : 1;
+    profiler.framesCount = framesCount;
+    profiler.cpuFrame.name = "frame";
+
+    //Collected by index, so only all of them or none are supported
+    assert(!statisticFlags || statisticFlags == PROFILER_PIPELINE_STATISTICS);
+    profiler.statisticFlags = statisticFlags;
+    if (statisticFlags)
+    {
+        VkQueryPoolCreateInfo statsPoolInfo = {VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+        statsPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        statsPoolInfo.queryCount = 1;
+        statsPoolInfo.pipelineStatistics = statisticFlags;
+
+        for (u32 i = 0; i < framesCount; i++)
+        {
+            if (vkCreateQueryPool(device, &statsPoolInfo, NULL, &profiler.statsPools[i]))
+            {
+                fprintf(stderr, "Failed to create Pipeline Statistics Query Pool\n");
+                exit(EXIT_FAILURE);
+            }
+
+            vkResetQueryPool(device, profiler.statsPools[i], 0, 1);
+        }
+    }
+
+    VkPhysicalDeviceProperties properties = {};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    u32 familiesCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familiesCount, NULL);
+    VkQueueFamilyProperties *families = (VkQueueFamilyProperties*)malloc(sizeof(VkQueueFamilyProperties)*familiesCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familiesCount, families);
+    u32 validBits = queueFamilyIndex < familiesCount ? families[queueFamilyIndex].timestampValidBits : 0;
+    free(families);
+
+    profiler.gpuEnabled = validBits > 0;
+    if (!profiler.gpuEnabled)
+    {
+        fprintf(stderr, "Queue family %u can't write timestamps, so GPU timings are disabled\n", queueFamilyIndex);
+        return profiler;
+    }
+
+    profiler.timestampPeriod = properties.limits.timestampPeriod;
+    profiler.timestampMask = validBits >= 64 ? UINT64_MAX : (1ull << validBits) - 1;
+
+    VkQueryPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = PROFILER_MAX_SCOPES_PER_FRAME*2;
+
+    for (u32 i = 0; i < framesCount; i++)
+    {
+        if (vkCreateQueryPool(device, &poolInfo, NULL, &profiler.queryPools[i]))
+        {
+            fprintf(stderr, "Failed to create Timestamp Query Pool\n");
+            exit(EXIT_FAILURE);
+        }
+
+        //Queries start out undefined
+        vkResetQueryPool(device, profiler.queryPools[i], 0, poolInfo.queryCount);
+    }
+
+    return profiler;
+}
+
+void destroyProfiler(Profiler *profiler)
+{
+    for (u32 i = 0; i < profiler->framesCount; i++)
+    {
+        if (profiler->queryPools[i])
+            vkDestroyQueryPool(profiler->device, profiler->queryPools[i], NULL);
+        if (profiler->statsPools[i])
+            vkDestroyQueryPool(profiler->device, profiler->statsPools[i], NULL);
+    }
+
+    *profiler = {};
+}
+
+void beginProfilerFrame(Profiler *profiler, u32 frameSlot, float cpuFrame_ms)
+{
+    profiler->currentSlot = frameSlot;
+    addSample(&profiler->cpuFrame, cpuFrame_ms);
+
+    if (profiler->gpuEnabled)
+        collectGpuTimestamps(profiler, frameSlot);
+    if (profiler->statisticFlags)
+        collectPipelineStatistics(profiler, frameSlot);
+
+    if (profiler->frame % profiler->interval == 0)
+        writeProfilerTimings(profiler);
+
+    profiler->frame++;
+}
+
+u32 beginGpuScope(Profiler *profiler, VkCommandBuffer cmdBuffer, const char *name)
+{
+    if (!profiler || !profiler->gpuEnabled)
+        return PROFILER_NO_SCOPE;
+
+    u32 slot = profiler->currentSlot;
+    u32 scope = profiler->scopesWrittenCounts[slot];
+    u32 series = findGpuSeries(profiler, name);
+    if (scope == PROFILER_MAX_SCOPES_PER_FRAME || series == PROFILER_NO_SCOPE)
+        return PROFILER_NO_SCOPE;
+
+    profiler->scopesWritten[slot][scope] = series;
+    profiler->scopesWrittenCounts[slot]++;
+
+    //Written once everything recorded before has completed
+    vkCmdWriteTimestamp2(cmdBuffer, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, profiler->queryPools[slot], scope*2);
+    return scope;
+}
+
+void endGpuScope(Profiler *profiler, VkCommandBuffer cmdBuffer, u32 scope)
+{
+    if (!profiler || scope == PROFILER_NO_SCOPE)
+        return;
+
+    vkCmdWriteTimestamp2(cmdBuffer, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, profiler->queryPools[profiler->currentSlot], scope*2 + 1);
+}
+
+void beginPipelineStatistics(Profiler *profiler, VkCommandBuffer cmdBuffer)
+{
+    if (!profiler || !profiler->statisticFlags || profiler->statsWritten[profiler->currentSlot])
+        return;
+
+    vkCmdBeginQuery(cmdBuffer, profiler->statsPools[profiler->currentSlot], 0, 0);
+}
+
+void endPipelineStatistics(Profiler *profiler, VkCommandBuffer cmdBuffer)
+{
+    if (!profiler || !profiler->statisticFlags || profiler->statsWritten[profiler->currentSlot])
+        return;
+
+    vkCmdEndQuery(cmdBuffer, profiler->statsPools[profiler->currentSlot], 0);
+    profiler->statsWritten[profiler->currentSlot] = true;
+}
+
+void writeProfilerTimings(Profiler *profiler)
+{
+    if (!profiler->out)
+        return;
+
+    FILE *out = profiler->out;
+    fprintf(out, "{\"type\":\"timings\",\"frame\":%lu,\"cpu\":{", (unsigned long)profiler->frame);
+    writeSeries(out, &profiler->cpuFrame, true);
+
+    fprintf(out, "},\"gpu\":{");
+    for (u32 i = 0; i < profiler->gpuScopesCount; i++)
+        writeSeries(out, &profiler->gpuScopes[i], i == 0);
+    fprintf(out, "}");
+
+    //Per frame counts, for the latest frame and on average since the last line
+    if (profiler->statisticFlags)
+    {
+        fprintf(out, ",\"pipelineStatistics\":{\"frames\":%u,", profiler->statsFrames);
+        writeStats(out, "last", profiler->lastStats, 1, true);
+        writeStats(out, "avg", profiler->statsSums, profiler->statsFrames ? profiler->statsFrames : 1, false);
+        fprintf(out, "}");
+
+        memset(profiler->statsSums, 0, sizeof(profiler->statsSums));
+        profiler->statsFrames = 0;
+    }
+
+    fprintf(out, "}\n");
+    fflush(out);
+}
@@ -0,0 +1,326 @@
+#include "residency.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "cglm/cglm.h"
+#include "telemetry.h"
+
+#define TEXEL_SIZE 4
+
+static u32 mipDimension(u32 size, u32 mip)
+{
+    u32 dim = size >> mip;
+    return dim ? dim : 1;
+}
+
+//Box filters each level from the one above it
+static void generateMips(ResidentTexture *tex, const u8 *pixels)
+{
+    u32 mipsCount = 1;
+    while (mipsCount < TEXTURE_MAX_MIPS && 
+        (mipDimension(tex->width, mipsCount - 1) > 1 || mipDimension(tex->height, mipsCount - 1) > 1))
+    {
+        mipsCount++;
+    }
+
+    size_t total = 0;
+    for (u32 mip = 0; mip < mipsCount; mip++)
+    {
+        tex->mipOffsets[mip] = total;
+        total += (size_t)mipDimension(tex->width, mip)*mipDimension(tex->height, mip)*TEXEL_SIZE;
+    }
+    tex->mipOffsets[mipsCount] = total;
+    tex->mipsCount = mipsCount;
+
+    tex->pixels = (u8*)malloc(total);
+    if (!tex->pixels)
+    {
+        fprintf(stderr, "Failed to allocate Texture mips\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(tex->pixels, pixels, tex->mipOffsets[1]);
+
+    for (u32 mip = 1; mip < mipsCount; mip++)
+    {
+        const u8 *src = tex->pixels + tex->mipOffsets[mip - 1];
+        u8 *dst = tex->pixels + tex->mipOffsets[mip];
+        u32 srcWidth = mipDimension(tex->width, mip - 1), srcHeight = mipDimension(tex->height, mip - 1);
+        u32 dstWidth = mipDimension(tex->width, mip), dstHeight = mipDimension(tex->height, mip);
+
+        for (u32 y = 0; y < dstHeight; y++)
+        {
+            u32 y0 = glm_min(y*2, srcHeight - 1), y1 = glm_min(y*2 + 1, srcHeight - 1);
+            for (u32 x = 0; x < dstWidth; x++)
+            {
+                u32 x0 = glm_min(x*2, srcWidth - 1), x1 = glm_min(x*2 + 1, srcWidth - 1);
+                for (u32 c = 0; c < TEXEL_SIZE; c++)
+                {
+                    u32 sum = src[(y0*srcWidth + x0)*TEXEL_SIZE + c] + 
+                        src[(y0*srcWidth + x1)*TEXEL_SIZE + c] +
+                        src[(y1*srcWidth + x0)*TEXEL_SIZE + c] + 
+                        src[(y1*srcWidth + x1)*TEXEL_SIZE + c];
+                    dst[(y*dstWidth + x)*TEXEL_SIZE + c] = (u8)((sum + 2) / 4);
+                }
+            }
+        }
+    }
+
+    tex->tailMip = 0;
+    while (tex->tailMip + 1 < mipsCount && 
+        glm_max(mipDimension(tex->width, tex->tailMip), mipDimension(tex->height, tex->tailMip)) > TEXTURE_TAIL_SIZE)
+    {
+        tex->tailMip++;
+    }
+}
+
+static VkDeviceSize residentSize(const ResidentTexture *tex, u32 residentMip)
+{
+    return tex->mipOffsets[tex->mipsCount] - tex->mipOffsets[residentMip];
+}
+
+static void destroyTextureImage(TextureResidency *residency, DeviceImage *image)
+{
+    vkDestroyImageView(residency->device, image->view, NULL);
+    untrackAllocation(residency->allocator, image->alloc);
+    vmaDestroyImage(residency->allocator, image->handle, image->alloc);
+    *image = {};
+}
+
+static void retireTexture(TextureResidency *residency, ResidentTexture *tex)
+{
+    if (!tex->image.handle)
+        return;
+
+    deferRemoveTableTexture(residency->deletions, tex->slot);
+    deferDestroyImageView(residency->deletions, tex->image.view);
+    deferDestroyImage(residency->deletions, tex->image.handle, tex->image.alloc);
+    tex->image = {};
+}
+
+//Records the upload of levels [residentMip, mipsCount) into a new image and slot.
+//Returns false if they don't fit in the staging buffer.
+static bool makeMipsResident(TextureResidency *residency, ResidentTexture *tex, u32 residentMip)
+{
+    VkDeviceSize size = residentSize(tex, residentMip);
+    if (size > residency->uploads->stagingBuffer.info.size)
+        return false;
+
+    u32 levels = tex->mipsCount - residentMip;
+    DeviceImage image = createDeviceTexture(
+        residency->device, 
+        residency->allocator, 
+        mipDimension(tex->width, residentMip), 
+        mipDimension(tex->height, residentMip),
+        levels);
+
+    VkDeviceSize stagingOffset = 0;
+    u8 *staging = allocateUploadStaging(residency->uploads, size, TEXEL_SIZE, &stagingOffset);
+    memcpy(staging, tex->pixels + tex->mipOffsets[residentMip], size);
+
+    VkBufferImageCopy copies[TEXTURE_MAX_MIPS] = {};
+    for (u32 level = 0; level < levels; level++)
+    {
+        u32 mip = residentMip + level;
+        copies[level].bufferOffset = stagingOffset + tex->mipOffsets[mip] - tex->mipOffsets[residentMip];
+        copies[level].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        copies[level].imageSubresource.mipLevel = level;
+        copies[level].imageSubresource.baseArrayLayer = 0;
+        copies[level].imageSubresource.layerCount = 1;
+        copies[level].imageExtent = {mipDimension(tex->width, mip), mipDimension(tex->height, mip), 1};
+    }
+
+    recordUploadImageCopy(residency->uploads, image.handle, levels, copies, levels);
+
+    retireTexture(residency, tex);
+    tex->image = image;
+    tex->slot = addTableTexture(residency->device, residency->table, image.view);
+    tex->residentMip = residentMip;
+
+    return true;
+}
+
+TextureResidency createTextureResidency(
+    VkDevice device,
+    VmaAllocator allocator,
+    UploadContext *uploads,
+    TextureTable *table,
+    DeletionQueue *deletions,
+    u32 capacity)
+{
+    TextureResidency residency = {};
+    residency.device = device;
+    residency.allocator = allocator;
+    residency.uploads = uploads;
+    residency.table = table;
+    residency.deletions = deletions;
+    residency.capacity = capacity;
+
+    residency.textures = (ResidentTexture*)calloc(capacity, sizeof(ResidentTexture));
+    if (!residency.textures)
+    {
+        fprintf(stderr, "Failed to allocate Resident Textures\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return residency;
+}
+
+void destroyTextureResidency(TextureResidency *residency)
+{
+    for (u32 i = 0; i < residency->texturesCount; i++)
+    {
+        ResidentTexture *tex = &residency->textures[i];
+        removeTableTexture(residency->table, tex->slot);
+        destroyTextureImage(residency, &tex->image);
+        free(tex->pixels);
+    }
+
+    free(residency->textures);
+    *residency = {};
+}
+
+u32 addResidentTexture(TextureResidency *residency, const u8 *pixels, u32 width, u32 height)
+{
+    if (residency->texturesCount == residency->capacity)
+    {
+        fprintf(stderr, "Out of Resident Texture slots\n");
+        abort();
+    }
+
+    u32 texture = residency->texturesCount++;
+    ResidentTexture *tex = &residency->textures[texture];
+    tex->width = width;
+    tex->height = height;
+    generateMips(tex, pixels);
+    tex->wantedMip = tex->tailMip;
+
+    if (!makeMipsResident(residency, tex, tex->tailMip))
+    {
+        fprintf(stderr, "Texture mip tail does not fit in the Staging Buffer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return texture;
+}
+
+u32 getResidentTextureSlot(const TextureResidency *residency, u32 texture)
+{
+    return residency->textures[texture].slot;
+}
+
+void noteTextureFootprint(TextureResidency *residency, u32 texture, float diameterPixels)
+{
+    ResidentTexture *tex = &residency->textures[texture];
+    tex->footprint = glm_max(tex->footprint, diameterPixels);
+}
+
+//Sums the device local heaps, which is where textures end up
+static void getDeviceLocalBudget(VmaAllocator allocator, VkDeviceSize *usage, VkDeviceSize *budget)
+{
+    const VkPhysicalDeviceMemoryProperties *memProperties = NULL;
+    vmaGetMemoryProperties(allocator, &memProperties);
+
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS] = {};
+    vmaGetHeapBudgets(allocator, budgets);
+
+    *usage = 0;
+    *budget = 0;
+    for (u32 i = 0; i < memProperties->memoryHeapCount; i++)
+    {
+        if (!(memProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+            continue;
+
+        *usage += budgets[i].usage;
+        *budget += budgets[i].budget;
+    }
+}
+
+void updateTextureResidency(TextureResidency *residency)
+{
+    residency->frame++;
+
+    for (u32 i = 0; i < residency->texturesCount; i++)
+    {
+        ResidentTexture *tex = &residency->textures[i];
+        if (tex->footprint <= 0.0f)
+        {
+            tex->wantedMip = tex->tailMip;
+            continue;
+        }
+
+        //Roughly one texel per pixel across the texture's largest dimension
+        float texelsPerPixel = glm_max(tex->width, tex->height) / tex->footprint;
+        float mip = texelsPerPixel > 1.0f ? floorf(log2f(texelsPerPixel)) : 0.0f;
+        tex->wantedMip = (u32)glm_min(mip, (float)tex->tailMip);
+        while (residentSize(tex, tex->wantedMip) > residency->uploads->stagingBuffer.info.size)
+            tex->wantedMip++;
+        tex->lastUsedFrame = residency->frame;
+        tex->footprint = 0.0f;
+    }
+
+    VkDeviceSize usage = 0, budget = 0;
+    getDeviceLocalBudget(residency->allocator, &usage, &budget);
+    VkDeviceSize limit = (VkDeviceSize)(budget*TEXTURE_RESIDENCY_BUDGET_FRACTION);
+
+    u32 uploads = 0;
+    while (uploads < TEXTURE_STREAM_UPLOADS_PER_FRAME)
+    {
+        ResidentTexture *chosen = NULL;
+
+        if (usage > limit)
+        {
+            //Textures holding more than they need go first, then least recently used
+            for (u32 i = 0; i < residency->texturesCount; i++)
+            {
+                ResidentTexture *tex = &residency->textures[i];
+                if (tex->residentMip >= tex->tailMip || tex->moving)
+                    continue;
+
+                bool surplus = tex->residentMip < tex->wantedMip;
+                bool chosenSurplus = chosen && chosen->residentMip < chosen->wantedMip;
+                if (!chosen || surplus > chosenSurplus || 
+                    (surplus == chosenSurplus && tex->lastUsedFrame < chosen->lastUsedFrame))
+                {
+                    chosen = tex;
+                }
+            }
+
+            if (!chosen)
+                break;
+
+            VkDeviceSize freed = residentSize(chosen, chosen->residentMip) - residentSize(chosen, chosen->residentMip + 1);
+            if (!makeMipsResident(residency, chosen, chosen->residentMip + 1))
+                break;
+
+            usage = usage > freed ? usage - freed : 0;//Once the retired image goes
+        }
+        else
+        {
+            //Most recently used first
+            for (u32 i = 0; i < residency->texturesCount; i++)
+            {
+                ResidentTexture *tex = &residency->textures[i];
+                if (tex->wantedMip >= tex->residentMip || tex->moving)
+                    continue;
+
+                if (!chosen || tex->lastUsedFrame > chosen->lastUsedFrame)
+                    chosen = tex;
+            }
+
+            if (!chosen)
+                break;
+
+            VkDeviceSize added = residentSize(chosen, chosen->wantedMip) - residentSize(chosen, chosen->residentMip);
+            if (usage + added > limit || !makeMipsResident(residency, chosen, chosen->wantedMip))
+                break;
+
+            usage += added;
+        }
+
+        uploads++;
+    }
+
+    submitUploads(residency->uploads);
+}
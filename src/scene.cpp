@@ -4,191 +4,216 @@
 #include "stb_image.h"
 #include "vkcommand.h"
 #include "cgltf.h"
-
-SceneInfo loadSceneToDevice(
-    const char *surfaceFilepath, 
-    const char *characterFilepath, 
-    Buffer stagingBuffer, Buffer deviceBuffer,
-    VkDevice device,
-    VmaAllocator allocator,
-    VkCommandPool cmdPool,
-    VkQueue queue)
+#include <assert.h>
+
+static void getMeshPositions(
+    cgltf_data *data, 
+    const vec3 **vertices, u32 *verticesCount, 
+    const u16 **indices, u32 *indicesCount);
+static void getMeshBoundingSphere(cgltf_data *data, vec4 sphere);
+
+//Writes the geometry of a model straight into its device range when that is
+//mapped. Otherwise stages it in the same layout and records the copy. Its LODs are
+//simplified from the full mesh as it loads.
+static ModelBuffers stageModelBuffers(
+    cgltf_data *modelData,
+    DeviceBufferPool *devicePool,
+    UploadContext *uploads)
 {
-    u8* mappedSB = (u8*)stagingBuffer.info.pMappedData;
-    size_t sbOffset = 0;
-
-    size_t vtxBufOffset = sbOffset;
+    const vec3 *vertices = NULL;
+    const u16 *indices = NULL;
+    u32 verticesCount = 0, indicesCount = 0;
+    getMeshPositions(modelData, &vertices, &verticesCount, &indices, &indicesCount);
 
-    cgltf_data* surfaceData = loadglTFData(surfaceFilepath);
-    ModelAttributeInfo surfaceVtxAttrInfo = stageModelVertexAttributes(surfaceData, mappedSB + sbOffset);
-    sbOffset += surfaceVtxAttrInfo.dataSize;
+    MeshLods lods = generateMeshLods(vertices, verticesCount, indices, indicesCount);
 
-    cgltf_data* characterData = loadglTFData(characterFilepath);
-    ModelAttributeInfo characterVtxAttrInfo = stageModelVertexAttributes(characterData, mappedSB + sbOffset);
-    sbOffset += characterVtxAttrInfo.dataSize;
+    ModelBuffers buffers = allocateModelBuffers(devicePool, verticesCount, lods.indicesCount);
+    memcpy(buffers.lods, lods.lods, sizeof(lods.lods));
+    buffers.lodsCount = lods.lodsCount;
 
-    size_t idxBufOffset = sbOffset;
+    VkDeviceSize stagingOffset = 0;
+    u8 *mappedRange = mapDeviceBufferRange(devicePool, &buffers.range);
+    u8 *dst = mappedRange ? mappedRange : allocateUploadStaging(uploads, buffers.range.size, 4, &stagingOffset);
 
-    ModelAttributeInfo surfaceIndicesInfo = stageModelIndices(surfaceData, mappedSB + sbOffset);
-    sbOffset += surfaceIndicesInfo.dataSize;
+    ModelAttributeInfo vtxAttrInfo = stageModelVertexAttributes(modelData, dst);
+    assert(buffers.idxOffset - buffers.vtxOffset == vtxAttrInfo.dataSize);
+    memcpy(dst + vtxAttrInfo.dataSize, lods.indices, sizeof(u16)*lods.indicesCount);
+    freeMeshLods(&lods);
 
-    ModelAttributeInfo characterIndicesInfo = stageModelIndices(characterData, mappedSB + sbOffset);
-    sbOffset += characterIndicesInfo.dataSize;
+    if (mappedRange)
+    {
+        flushDeviceBufferRange(devicePool, &buffers.range);
+        return buffers;
+    }
 
-    size_t drawCmdsOffset = sbOffset;
+    recordUploadBufferCopy(
+        uploads, 
+        stagingOffset, 
+        devicePool->blocks[buffers.range.block].buffer.handle, 
+        buffers.vtxOffset, 
+        buffers.range.size);
 
-    VkDrawIndexedIndirectCommand surfaceIndirectDrawCmd = {};
-    surfaceIndirectDrawCmd.firstIndex = 0;
-    surfaceIndirectDrawCmd.indexCount = surfaceIndicesInfo.elementCount;
-    surfaceIndirectDrawCmd.vertexOffset = 0;
-    surfaceIndirectDrawCmd.firstInstance = 0;
-    surfaceIndirectDrawCmd.instanceCount = 1;
+    return buffers;
+}
 
-    VkDrawIndexedIndirectCommand characterIndirectDrawCmd = {};
-    characterIndirectDrawCmd.firstIndex = surfaceIndicesInfo.elementCount;
-    characterIndirectDrawCmd.indexCount = characterIndicesInfo.elementCount;
-    characterIndirectDrawCmd.vertexOffset = surfaceVtxAttrInfo.elementCount;
-    characterIndirectDrawCmd.firstInstance = 1;
-    characterIndirectDrawCmd.instanceCount = 1;
+SceneInfo loadSceneToDevice(
+    const char *surfaceFilepath, 
+    const char *characterFilepath, 
+    UploadContext *uploads, 
+    DeviceBufferPool *devicePool,
+    VmaAllocator allocator,
+    VkDeviceSize minStorageBufferOffsetAlignment,
+    u32 framesInFlight,
+    TextureResidency *residency,
+    JobPool *jobs)
+{
+    SceneInfo sceneInfo = {};
+    sceneInfo.instances = createInstanceBuffer(allocator, MAX_INSTANCES, framesInFlight, minStorageBufferOffsetAlignment);
+    u32 surfaceInstance = reserveInstances(&sceneInfo.instances, 1);
+    sceneInfo.characterInstance = reserveInstances(&sceneInfo.instances, 1);
 
-    VkDrawIndexedIndirectCommand indirectDrawCmds[] = {surfaceIndirectDrawCmd, characterIndirectDrawCmd};
-    memcpy(mappedSB + sbOffset, indirectDrawCmds, sizeof(indirectDrawCmds));
-    sbOffset += sizeof(indirectDrawCmds);
+    cgltf_data* surfaceData = loadglTFData(surfaceFilepath);
+    ModelBuffers surfaceBuffers = stageModelBuffers(surfaceData, devicePool, uploads);
 
-    size_t texBufOffset = sbOffset;
+    cgltf_data* characterData = loadglTFData(characterFilepath);
+    ModelBuffers characterBuffers = stageModelBuffers(characterData, devicePool, uploads);
+
+    TextureInfo surfaceTexInfo = {};
+    u8 *surfacePixels = loadModelTexture(surfaceData, &surfaceTexInfo);
+    u32 surfaceTexture = addResidentTexture(residency, surfacePixels, surfaceTexInfo.width, surfaceTexInfo.height);
+    stbi_image_free(surfacePixels);
+
+    TextureInfo characterTexInfo = {};
+    u8 *characterPixels = loadModelTexture(characterData, &characterTexInfo);
+    u32 characterTexture = addResidentTexture(residency, characterPixels, characterTexInfo.width, characterTexInfo.height);
+    stbi_image_free(characterPixels);
+
+    //One submit for all the scene's geometry and textures, ordered before the first frame
+    submitUploads(uploads);
+
+    sceneInfo.surfaceModelInfo = {
+        .modelMatrix = GLM_MAT4_IDENTITY_INIT, 
+        .texture = surfaceTexture,
+        .buffers = surfaceBuffers,
+        .firstInstance = surfaceInstance,
+        .instancesCount = 1};
+    getModelMatrix(sceneInfo.surfaceModelInfo.modelMatrix, surfaceData);
+    sceneInfo.characterModelInfo = {
+        .modelMatrix = GLM_MAT4_IDENTITY_INIT, 
+        .texture = characterTexture,
+        .buffers = characterBuffers,
+        .firstInstance = sceneInfo.characterInstance,
+        .instancesCount = 1};
+    getModelMatrix(sceneInfo.characterModelInfo.modelMatrix, characterData);
 
-    TextureInfo surfaceTexInfo = stageModelTexture(surfaceData, mappedSB + sbOffset);
-    DeviceImage surfaceTex = createDeviceTexture(device, allocator, surfaceTexInfo.width, surfaceTexInfo.height);
-    size_t surfaceTexSize = surfaceTexInfo.width * surfaceTexInfo.height * surfaceTexInfo.channels;
-    sbOffset += surfaceTexSize;
+    InstanceData surfaceInstanceData = {
+        .textureIdx = getResidentTextureSlot(residency, surfaceTexture),
+        .meshIdx = INSTANCE_NO_MESH};
+    glm_mat4_copy(sceneInfo.surfaceModelInfo.modelMatrix, surfaceInstanceData.model);
+    getMeshBoundingSphere(surfaceData, surfaceInstanceData.boundingSphere);
+    setInstance(&sceneInfo.instances, surfaceInstance, &surfaceInstanceData);
+
+    InstanceData characterInstanceData = {
+        .textureIdx = getResidentTextureSlot(residency, characterTexture),
+        .meshIdx = INSTANCE_NO_MESH};
+    glm_mat4_copy(sceneInfo.characterModelInfo.modelMatrix, characterInstanceData.model);
+    getMeshBoundingSphere(characterData, characterInstanceData.boundingSphere);
+    setInstance(&sceneInfo.instances, sceneInfo.characterInstance, &characterInstanceData);
+
+    CollisionWorld *collisionWorld = &sceneInfo.collisionWorld;
+    //A mesh per model, and an instance for each of its instances
+    const ModelInfo *collisionModels[] = {&sceneInfo.surfaceModelInfo, &sceneInfo.characterModelInfo};
+    u32 collisionInstancesCount = 0;
+    for (size_t i = 0; i < NUM_ELEMENTS(collisionModels); i++)
+        collisionInstancesCount += collisionModels[i]->instancesCount;
+    *collisionWorld = createCollisionWorld(NUM_ELEMENTS(collisionModels), collisionInstancesCount);
+    u32 surfaceCollisionMesh = addCollisionMesh(collisionWorld, jobs, calcMeshVoxels(surfaceData));
+    addCollisionInstance(collisionWorld, surfaceCollisionMesh, sceneInfo.surfaceModelInfo.modelMatrix);
+    u32 characterCollisionMesh = addCollisionMesh(collisionWorld, jobs, calcMeshVoxels(characterData));
+    sceneInfo.characterCollisionInstance = addCollisionInstance(collisionWorld, characterCollisionMesh, sceneInfo.characterModelInfo.modelMatrix);
+    buildCollisionWorld(collisionWorld);
 
-    TextureInfo characterTexInfo = stageModelTexture(characterData, mappedSB + sbOffset);
-    DeviceImage characterTex = createDeviceTexture(device, allocator, characterTexInfo.width, characterTexInfo.height);
+    cgltf_free(surfaceData);
+    cgltf_free(characterData);
 
-    VkCommandBuffer cmdBuffer = beginSingleTimeCommandBuffer(device, cmdPool);
+    return sceneInfo;
+}
 
-    VkBufferCopy modelDetailsCopyRegion = {//Include Indirect Draw Commands
-        .srcOffset = 0,
-        .dstOffset = 0,
-        .size = texBufOffset
-    };
+void freeSceneInfo(SceneInfo *info, DeviceBufferPool *devicePool, VmaAllocator allocator)
+{
+    freeModelBuffers(devicePool, &info->surfaceModelInfo.buffers);
+    freeModelBuffers(devicePool, &info->characterModelInfo.buffers);
+    destroyInstanceBuffer(allocator, &info->instances);
+    destroyCollisionWorld(&info->collisionWorld);
+}
 
-    vkCmdCopyBuffer(cmdBuffer, stagingBuffer.handle, deviceBuffer.handle, 1, &modelDetailsCopyRegion);
-
-    // If there is a semaphore signal + wait between this being submitted and
-    // the vertex buffer being used, then skip this pipeline barrier.
-    /*VkMemoryBarrier2 meshTransferBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
-    meshTransferBarrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
-    meshTransferBarrier.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT;
-    meshTransferBarrier.dstStageMask = VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT;
-    meshTransferBarrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT;*/
-
-    VkImageMemoryBarrier2 surfaceTexTransitionBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
-    surfaceTexTransitionBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    surfaceTexTransitionBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    surfaceTexTransitionBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    surfaceTexTransitionBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    surfaceTexTransitionBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    surfaceTexTransitionBarrier.subresourceRange.baseMipLevel = 0;
-    surfaceTexTransitionBarrier.subresourceRange.levelCount = 1;
-    surfaceTexTransitionBarrier.subresourceRange.baseArrayLayer = 0;
-    surfaceTexTransitionBarrier.subresourceRange.layerCount = 1;
-    surfaceTexTransitionBarrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE_KHR;
-    surfaceTexTransitionBarrier.srcAccessMask = VK_ACCESS_2_NONE;
-    surfaceTexTransitionBarrier.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
-    surfaceTexTransitionBarrier.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
-    surfaceTexTransitionBarrier.image = surfaceTex.handle;
-
-    VkImageMemoryBarrier2 characterTexTransitionBarrier = surfaceTexTransitionBarrier;
-    characterTexTransitionBarrier.image = characterTex.handle;
-
-    VkImageMemoryBarrier2 texTransitionsBarriers[] = {surfaceTexTransitionBarrier, characterTexTransitionBarrier};
-
-    VkDependencyInfo texTransitionInfo = {};
-    texTransitionInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
-    texTransitionInfo.imageMemoryBarrierCount = NUM_ELEMENTS(texTransitionsBarriers);
-    texTransitionInfo.pImageMemoryBarriers = texTransitionsBarriers;
-
-    vkCmdPipelineBarrier2(cmdBuffer, &texTransitionInfo);
-
-    VkBufferImageCopy surfaceTexCopy = {};
-    surfaceTexCopy.bufferOffset = texBufOffset;
-    surfaceTexCopy.bufferRowLength = 0;
-    surfaceTexCopy.bufferImageHeight = 0;
-    surfaceTexCopy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    surfaceTexCopy.imageSubresource.mipLevel = 0;
-    surfaceTexCopy.imageSubresource.baseArrayLayer = 0;
-    surfaceTexCopy.imageSubresource.layerCount = 1;
-    surfaceTexCopy.imageOffset = {0, 0, 0};
-    surfaceTexCopy.imageExtent = {surfaceTexInfo.width, surfaceTexInfo.height, 1};
-
-    vkCmdCopyBufferToImage(
-        cmdBuffer,
-        stagingBuffer.handle,
-        surfaceTex.handle,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        1, &surfaceTexCopy
-    );
-
-    VkBufferImageCopy characterTexCopy = {};
-    characterTexCopy.bufferOffset = texBufOffset + surfaceTexSize;
-    characterTexCopy.bufferRowLength = 0;
-    characterTexCopy.bufferImageHeight = 0;
-    characterTexCopy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    characterTexCopy.imageSubresource.mipLevel = 0;
-    characterTexCopy.imageSubresource.baseArrayLayer = 0;
-    characterTexCopy.imageSubresource.layerCount = 1;
-    characterTexCopy.imageOffset = {0, 0, 0};
-    characterTexCopy.imageExtent = {characterTexInfo.width, characterTexInfo.height, 1};
-
-    vkCmdCopyBufferToImage(
-        cmdBuffer,
-        stagingBuffer.handle,
-        characterTex.handle,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        1, &characterTexCopy
-    );
-
-    for(size_t i = 0; i < NUM_ELEMENTS(texTransitionsBarriers); i++)
+static void noteModelTextureFootprint(
+    const ModelInfo *model,
+    const InstanceBuffer *instances,
+    TextureResidency *residency,
+    mat4 view,
+    float pixelsPerUnit)
+{
+    for (u32 i = model->firstInstance; i < model->firstInstance + model->instancesCount; i++)
     {
-        texTransitionsBarriers[i].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        texTransitionsBarriers[i].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        texTransitionsBarriers[i].srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
-        texTransitionsBarriers[i].srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
-        texTransitionsBarriers[i].dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
-        texTransitionsBarriers[i].dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT;
-    }
+        const InstanceData *instance = &instances->instances[i];
 
-    vkCmdPipelineBarrier2(cmdBuffer, &texTransitionInfo);
+        vec3 viewCentre = {};
+        mat4 modelView = {};
+        glm_mat4_mul((vec4*)view, (vec4*)instance->model, modelView);
+        glm_mat4_mulv3(modelView, (float*)instance->boundingSphere, 1.0f, viewCentre);
 
-    submitSingleTimeCommandBuffer(device, cmdPool, cmdBuffer, queue);
+        float scale = glm_max(glm_vec3_norm((float*)instance->model[0]), 
+            glm_max(glm_vec3_norm((float*)instance->model[1]), glm_vec3_norm((float*)instance->model[2])));
+        float radius = instance->boundingSphere[3]*scale;
+        float dist = -viewCentre[2];//The camera looks down -z
+        if (dist + radius <= 0.0f)
+            continue;
 
-    SceneInfo sceneInfo = {};
-    sceneInfo.vtxBufOffset = vtxBufOffset;
-    sceneInfo.idxBufOffset = idxBufOffset;
-    sceneInfo.drawCmdsOffset = drawCmdsOffset;
-    sceneInfo.drawCmdsCount = NUM_ELEMENTS(indirectDrawCmds);
-    sceneInfo.surfaceModelInfo = {.modelMatrix = GLM_MAT4_IDENTITY_INIT, .tex = surfaceTex};
-    getModelMatrix(sceneInfo.surfaceModelInfo.modelMatrix, surfaceData);
-    sceneInfo.characterModelInfo = {.modelMatrix = GLM_MAT4_IDENTITY_INIT, .tex = characterTex};
-    getModelMatrix(sceneInfo.characterModelInfo.modelMatrix, characterData);
+        noteTextureFootprint(residency, model->texture, 2.0f*radius*pixelsPerUnit / glm_max(dist, radius));
+    }
+}
 
-    sceneInfo.surfaceVoxels = calcSurfaceVoxels(surfaceData, sceneInfo.surfaceModelInfo.modelMatrix);
+void noteSceneTextureFootprints(
+    const SceneInfo *scene, 
+    TextureResidency *residency, 
+    mat4 view, 
+    mat4 projection, 
+    VkExtent2D extent)
+{
+    //Pixels covered by a unit length one unit in front of the camera
+    float pixelsPerUnit = fabsf(projection[1][1])*extent.height*0.5f;
 
-    cgltf_free(surfaceData);
-    cgltf_free(characterData);
+    noteModelTextureFootprint(&scene->surfaceModelInfo, &scene->instances, residency, view, pixelsPerUnit);
+    noteModelTextureFootprint(&scene->characterModelInfo, &scene->instances, residency, view, pixelsPerUnit);
+}
 
-    return sceneInfo;
+static void updateModelTextureSlots(const ModelInfo *model, InstanceBuffer *instances, const TextureResidency *residency)
+{
+    u32 slot = getResidentTextureSlot(residency, model->texture);
+    for (u32 i = model->firstInstance; i < model->firstInstance + model->instancesCount; i++)
+    {
+        if (instances->instances[i].textureIdx == slot)
+            continue;
+
+        InstanceData data = instances->instances[i];
+        data.textureIdx = slot;
+        setInstance(instances, i, &data);
+    }
 }
 
-void freeSceneInfo(SceneInfo *info)
+void updateSceneTextureSlots(SceneInfo *scene, const TextureResidency *residency)
 {
-    free(info->surfaceVoxels.data);
+    updateModelTextureSlots(&scene->surfaceModelInfo, &scene->instances, residency);
+    updateModelTextureSlots(&scene->characterModelInfo, &scene->instances, residency);
 }
 
-Voxels calcSurfaceVoxels(cgltf_data *surfaceData, mat4 modelMatrix)
+static void getMeshPositions(
+    cgltf_data *data, 
+    const vec3 **vertices, u32 *verticesCount, 
+    const u16 **indices, u32 *indicesCount)
 {
-    cgltf_mesh* mesh = surfaceData->scene->nodes[0]->mesh;
+    cgltf_mesh* mesh = data->scene->nodes[0]->mesh;
     cgltf_primitive primitive = mesh->primitives[0];
     cgltf_accessor* verticesAccess = NULL;
 
@@ -206,171 +231,236 @@ Voxels calcSurfaceVoxels(cgltf_data *surfaceData, mat4 modelMatrix)
         }
     }
 
-    u8 *binData = (u8*)surfaceData->bin;
-    vec3 *verticesData = (vec3*)(binData + verticesAccess->buffer_view->offset + verticesAccess->offset);
-    u16 *indicesData = (u16*)(binData + primitive.indices->buffer_view->offset + primitive.indices->offset);
-
-    Voxels voxels = {
-        .cols = 2,
-        .rows = 2,
-        .depth = 2,
-        .origin = {-8.0f, 8.0f, -8.0f},//Nearest upper left corner
-        .voxWidth = 8.0f,
-        .voxHeight = 8.0f,
-        .voxLength = 8.0f
-    };
-
-    u64 numVoxels = voxels.cols*voxels.rows*voxels.depth;
-    u64 storedIndicesMaxDataSize = 3 * 3 * primitive.indices->count * sizeof(u16);//A triangle can cross into three voxels max, and each triangle is three indices
+    u8 *binData = (u8*)data->bin;
+    *vertices = (const vec3*)(binData + verticesAccess->buffer_view->offset + verticesAccess->offset);
+    *verticesCount = verticesAccess->count;
+    *indices = (const u16*)(binData + primitive.indices->buffer_view->offset + primitive.indices->offset);
+    *indicesCount = primitive.indices->count;
+}
 
-    voxels.dataSize = numVoxels * sizeof(u16)//For the voxel indices into the data array 
-        + storedIndicesMaxDataSize
-        + verticesAccess->count * sizeof(vec3)//Store a copy of the transformed vertices, since we can't read them from the staging buffer
-        + numVoxels * sizeof(u16);//Temporary counter array
-    
-    voxels.data = (u8*)malloc(sizeof(u8)*voxels.dataSize);
-    if (!voxels.data)
+//Model space sphere around the centre of the mesh's bounds, as centre and radius
+static void getMeshBoundingSphere(cgltf_data *data, vec4 sphere)
+{
+    const vec3 *vertices = NULL;
+    const u16 *indices = NULL;
+    u32 verticesCount = 0, indicesCount = 0;
+    getMeshPositions(data, &vertices, &verticesCount, &indices, &indicesCount);
+
+    glm_vec4_zero(sphere);
+    if (!verticesCount)
+        return;
+
+    vec3 boundsMin = {}, boundsMax = {};
+    glm_vec3_copy((float*)vertices[0], boundsMin);
+    glm_vec3_copy((float*)vertices[0], boundsMax);
+    for (u32 i = 1; i < verticesCount; i++)
     {
-        fprintf(stderr, "Failed to allocate Surface Test Voxel Data");
-        abort();
+        glm_vec3_minv(boundsMin, (float*)vertices[i], boundsMin);
+        glm_vec3_maxv(boundsMax, (float*)vertices[i], boundsMax);
     }
 
-    memset(voxels.data, 0, voxels.dataSize);
+    vec3 centre = {};
+    glm_vec3_center(boundsMin, boundsMax, centre);
 
-    //Store the copy of the vertex buffer after the index array and stored indices
-    u64 transformedVerticesIdx = sizeof(u16)*numVoxels + storedIndicesMaxDataSize;
-    vec3 *transformedVertices = (vec3*)(voxels.data + transformedVerticesIdx);
-
-    //Pre-transform all vertices into model-space
-    for(u64 i = 0; i < verticesAccess->count; i++)
+    float radius2 = 0.0f;
+    for (u32 i = 0; i < verticesCount; i++)
     {
-        glm_mat4_mulv3(modelMatrix, verticesData[i], 0.0f, transformedVertices[i]);
+        radius2 = glm_max(radius2, glm_vec3_distance2(centre, (float*)vertices[i]));
     }
 
-    voxels.transformedVerticesIdx = transformedVerticesIdx;
-
-    u16 *voxelIndicesCounts = (u16*)voxels.data;
+    glm_vec4(centre, sqrtf(radius2), sphere);
+}
 
-    //Count how many indices fall into each voxel
-    for(u64 i = 0; i < primitive.indices->count; i += 3)
+//Range of voxels touched by the bounds of a triangle, clamped to the volume.
+//Returns false if the triangle lies entirely outside of it.
+static bool getTriangleVoxelRange(const Voxels *voxels, vec3 *vertices, const u16 triangle[3], s32 lo[3], s32 hi[3])
+{
+    vec3 boundsMin = {}, boundsMax = {};
+    glm_vec3_copy(vertices[triangle[0]], boundsMin);
+    glm_vec3_copy(vertices[triangle[0]], boundsMax);
+    for (int vtx = 1; vtx < 3; vtx++)
     {
-        //Used to avoid storing an indice in the same voxel
-        int prevVoxelIdxs[3] = {-1, -1, -1};
-
-        for(u64 vtx = 0; vtx < 3; vtx++)
-        {
-            float x = verticesData[indicesData[i + vtx]][0];
-            float y = verticesData[indicesData[i + vtx]][1];
-            float z = verticesData[indicesData[i + vtx]][2];
+        glm_vec3_minv(boundsMin, vertices[triangle[vtx]], boundsMin);
+        glm_vec3_maxv(boundsMax, vertices[triangle[vtx]], boundsMax);
+    }
 
-            int colIdx = -1, rowIdx = -1, depthIdx = -1;
+    //Rows run downwards from the origin, so the top of the bounds gives the first row
+    float first[3] = {
+        (boundsMin[0] - voxels->origin[0]) / voxels->voxWidth,
+        (voxels->origin[1] - boundsMax[1]) / voxels->voxHeight,
+        (boundsMin[2] - voxels->origin[2]) / voxels->voxLength};
+    float last[3] = {
+        (boundsMax[0] - voxels->origin[0]) / voxels->voxWidth,
+        (voxels->origin[1] - boundsMin[1]) / voxels->voxHeight,
+        (boundsMax[2] - voxels->origin[2]) / voxels->voxLength};
+    const s32 sizes[3] = {(s32)voxels->cols, (s32)voxels->rows, (s32)voxels->depth};
+
+    for (int d = 0; d < 3; d++)
+    {
+        if (last[d] < 0.0f || first[d] >= (float)sizes[d])
+            return false;
 
-            if (x >= voxels.origin[0] && x < (voxels.origin[0] + voxels.voxWidth*voxels.cols))
-            {
-                colIdx = (x - voxels.origin[0])/(voxels.voxWidth);
-            }
+        lo[d] = first[d] > 0.0f ? (s32)first[d] : 0;
+        hi[d] = last[d] < (float)sizes[d] ? (s32)last[d] : sizes[d] - 1;
+    }
 
-            if (y > (voxels.origin[1] - voxels.voxHeight*voxels.rows) && y <= voxels.origin[1])
-            {
-                rowIdx = (voxels.origin[1] - y)/(voxels.voxHeight);
-            }
+    return true;
+}
 
-            if (z >= voxels.origin[2] && z < (voxels.origin[2] + voxels.voxLength*voxels.depth))
-            {
-                depthIdx = (z - voxels.origin[2])/(voxels.voxLength);
-            }
+//Fills in the data of a voxel layout. Every triangle is stored in each voxel its bounds
+//touch, so queries walking a voxel see triangles that merely pass through it.
+static void binVoxelTriangles(
+    Voxels *voxels, 
+    const vec3 *vertices, u32 verticesCount, 
+    const u16 *indices, u32 indicesCount, 
+    mat4 transform)
+{
+    u32 numVoxels = voxels->cols*voxels->rows*voxels->depth;
+    u32 trianglesCount = indicesCount / 3;
 
-            if (colIdx >= 0 && rowIdx >= 0 && depthIdx >= 0)
-            {
-                int voxelIdx = colIdx*(voxels.rows*voxels.depth) + rowIdx*(voxels.depth) + depthIdx;
-                bool uniqueVoxel = true;
+    u32 *voxelCounters = (u32*)calloc(numVoxels, sizeof(u32));
+    vec3 *transformedVertices = (vec3*)malloc(sizeof(vec3)*(verticesCount ? verticesCount : 1));
+    if (!voxelCounters || !transformedVertices)
+    {
+        fprintf(stderr, "Failed to allocate Voxel binning memory\n");
+        abort();
+    }
 
-                for (size_t j = 0; j < vtx; j++)
-                {
-                    if (voxelIdx == prevVoxelIdxs[j])
-                        uniqueVoxel = false;
-                }
+    for (u32 i = 0; i < verticesCount; i++)
+    {
+        glm_mat4_mulv3(transform, (float*)vertices[i], 1.0f, transformedVertices[i]);
+    }
 
-                if (uniqueVoxel)
-                {
-                    voxelIndicesCounts[voxelIdx] += 3;
-                    prevVoxelIdxs[vtx] = voxelIdx;
-                }
-            }
-        }
+    for (u32 i = 0; i < trianglesCount*3; i += 3)
+    {
+        s32 lo[3], hi[3];
+        if (!getTriangleVoxelRange(voxels, transformedVertices, &indices[i], lo, hi))
+            continue;
+
+        for (s32 col = lo[0]; col <= hi[0]; col++)
+            for (s32 row = lo[1]; row <= hi[1]; row++)
+                for (s32 depth = lo[2]; depth <= hi[2]; depth++)
+                    voxelCounters[col*(voxels->rows*voxels->depth) + row*(voxels->depth) + depth] += 3;
     }
 
-    u32 voxelIndicesIdx = 0;
-    for (u64 i = 0; i < numVoxels; i++)
+    u32 storedIndicesCount = 0;
+    for (u32 i = 0; i < numVoxels; i++)
     {
-        u16 count = voxelIndicesCounts[i];
-        voxelIndicesCounts[i] = voxelIndicesIdx;//They now become absolute indices instead of relative
-        voxelIndicesIdx += count;
+        u32 count = voxelCounters[i];
+        voxelCounters[i] = storedIndicesCount;//They now become absolute indices instead of relative
+        storedIndicesCount += count;
     }
 
-    voxels.storedIndicesCount = voxelIndicesIdx;
+    voxels->storedIndicesCount = storedIndicesCount;
+    voxels->trianglesCount = trianglesCount;
 
-    u16 *voxelIndicesCounter = (u16*)(voxels.data + transformedVerticesIdx + sizeof(vec3)*verticesAccess->count);//Fit temporary counter on the end of the data buffer
-    u16 *voxelIndices = (u16*)(voxels.data + sizeof(u16)*numVoxels);//Skip past the index array
+    //Voxel start offsets, stored index triplets, transformed vertices,
+    //source triangle of every triplet, then a copy of the source indices
+    size_t storedIndicesIdx = sizeof(u32)*numVoxels;
+    voxels->transformedVerticesIdx = (storedIndicesIdx + sizeof(u16)*storedIndicesCount + alignof(vec3) - 1) & ~(alignof(vec3) - 1);
+    voxels->triangleIdsIdx = voxels->transformedVerticesIdx + sizeof(vec3)*verticesCount;
+    voxels->trianglesIdx = voxels->triangleIdsIdx + sizeof(u32)*(storedIndicesCount/3);
+    voxels->dataSize = voxels->trianglesIdx + sizeof(u16)*3*trianglesCount;
 
-    for (u64 i = 0; i < primitive.indices->count; i += 3)
+    voxels->data = (u8*)malloc(voxels->dataSize);
+    if (!voxels->data)
     {
-        int prevVoxelIdxs[3] = {-1, -1, -1};
+        fprintf(stderr, "Failed to allocate Voxel Data\n");
+        abort();
+    }
 
-        for (u64 vtx = 0; vtx < 3; vtx++)
-        {
-            float x = verticesData[indicesData[i + vtx]][0];
-            float y = verticesData[indicesData[i + vtx]][1];
-            float z = verticesData[indicesData[i + vtx]][2];
+    u32 *voxelIndexes = (u32*)voxels->data;
+    u16 *voxelIndices = (u16*)(voxels->data + storedIndicesIdx);
+    u32 *triangleIds = (u32*)(voxels->data + voxels->triangleIdsIdx);
+    memcpy(voxelIndexes, voxelCounters, sizeof(u32)*numVoxels);
+    memcpy(voxels->data + voxels->transformedVerticesIdx, transformedVertices, sizeof(vec3)*verticesCount);
+    memcpy(voxels->data + voxels->trianglesIdx, indices, sizeof(u16)*3*trianglesCount);
 
-            int colIdx = -1, rowIdx = -1, depthIdx = -1;
+    for (u32 i = 0; i < trianglesCount*3; i += 3)
+    {
+        s32 lo[3], hi[3];
+        if (!getTriangleVoxelRange(voxels, transformedVertices, &indices[i], lo, hi))
+            continue;
 
-            if (x >= voxels.origin[0] && x < (voxels.origin[0] + voxels.voxWidth*voxels.cols))
+        for (s32 col = lo[0]; col <= hi[0]; col++)
+        {
+            for (s32 row = lo[1]; row <= hi[1]; row++)
             {
-                colIdx = (x - voxels.origin[0])/(voxels.voxWidth);
+                for (s32 depth = lo[2]; depth <= hi[2]; depth++)
+                {
+                    u32 voxelIdx = col*(voxels->rows*voxels->depth) + row*(voxels->depth) + depth;
+                    u32 storedIdx = voxelCounters[voxelIdx];
+                    voxelIndices[storedIdx] = indices[i];
+                    voxelIndices[storedIdx + 1] = indices[i + 1];
+                    voxelIndices[storedIdx + 2] = indices[i + 2];
+                    triangleIds[storedIdx/3] = i/3;
+                    voxelCounters[voxelIdx] += 3;
+                }
             }
+        }
+    }
 
-            if (y > (voxels.origin[1] - voxels.voxHeight*voxels.rows) && y <= voxels.origin[1])
-            {
-                rowIdx = (voxels.origin[1] - y)/(voxels.voxHeight);
-            }
+    free(transformedVertices);
+    free(voxelCounters);
+}
 
-            if (z >= voxels.origin[2] && z < (voxels.origin[2] + voxels.voxLength*voxels.depth))
-            {
-                depthIdx = (z - voxels.origin[2])/(voxels.voxLength);
-            }
+Voxels calcMeshVoxels(cgltf_data *meshData)
+{
+    const vec3 *vertices = NULL;
+    const u16 *indices = NULL;
+    u32 verticesCount = 0, indicesCount = 0;
+    getMeshPositions(meshData, &vertices, &verticesCount, &indices, &indicesCount);
 
-            if (colIdx >= 0 && rowIdx >= 0 && depthIdx >= 0)//If it lies within the voxels
-            {
-                int voxelIdx = colIdx*(voxels.rows*voxels.depth) + rowIdx*(voxels.depth) + depthIdx;
-                bool uniqueVoxel = true;
+    vec3 boundsMin = {}, boundsMax = {};
+    if (verticesCount)
+    {
+        glm_vec3_copy((float*)vertices[0], boundsMin);
+        glm_vec3_copy((float*)vertices[0], boundsMax);
+    }
 
-                for (size_t j = 0; j < vtx; j++)
-                {
-                    if (voxelIdx == prevVoxelIdxs[j])
-                        uniqueVoxel = false;
-                }
+    for (u32 i = 1; i < verticesCount; i++)
+    {
+        glm_vec3_minv(boundsMin, (float*)vertices[i], boundsMin);
+        glm_vec3_maxv(boundsMax, (float*)vertices[i], boundsMax);
+    }
 
-                if (uniqueVoxel)
-                {
-                    size_t indicesIdx = voxelIndicesCounts[voxelIdx];
-                    voxelIndices[indicesIdx + voxelIndicesCounter[voxelIdx]] = indicesData[i];
-                    voxelIndices[indicesIdx + voxelIndicesCounter[voxelIdx] + 1] = indicesData[i + 1];
-                    voxelIndices[indicesIdx + voxelIndicesCounter[voxelIdx] + 2] = indicesData[i + 2];
-                    voxelIndicesCounter[voxelIdx] += 3;
-                }
-            }
-        }
+    vec3 extent = {};
+    glm_vec3_sub(boundsMax, boundsMin, extent);
+    float maxExtent = glm_vec3_max(extent);
+    if (maxExtent <= 0.0f)
+        maxExtent = 1.0f;
+
+    //Pad flat meshes out so every axis has some thickness, and keep the outermost
+    //vertices strictly inside the volume
+    for (int d = 0; d < 3; d++)
+    {
+        float pad = glm_max(extent[d], maxExtent*MESH_VOXELS_MIN_THICKNESS)*0.5f - extent[d]*0.5f + maxExtent*1e-4f;
+        boundsMin[d] -= pad;
+        boundsMax[d] += pad;
+        extent[d] = boundsMax[d] - boundsMin[d];
     }
 
-// #ifndef NDEBUG
-//     printf("\nStored Indices: %d\n", voxels.storedIndicesCount);
-//     printf("\tVoxel: Indices Index\n");
-//     for (int i = 0; i < numVoxels; i++)
-//     {
-//         printf("\t%d: %d\n", i, voxelIndicesCounts[i]);
-//     }
-// #endif
+    //Aim for a handful of triangles per voxel
+    float targetVoxels = glm_max(1.0f, (indicesCount/3) / (float)MESH_VOXELS_TRIANGLES_PER_VOXEL);
+    float voxSize = cbrtf(extent[0]*extent[1]*extent[2] / targetVoxels);
+    u32 counts[3] = {};
+    for (int d = 0; d < 3; d++)
+    {
+        counts[d] = (u32)glm_clamp(ceilf(extent[d] / voxSize), 1.0f, (float)MESH_VOXELS_MAX_PER_AXIS);
+    }
+
+    Voxels voxels = {
+        .cols = counts[0],
+        .rows = counts[1],
+        .depth = counts[2],
+        .origin = {boundsMin[0], boundsMax[1], boundsMin[2]},
+        .voxWidth = extent[0] / counts[0],
+        .voxHeight = extent[1] / counts[1],
+        .voxLength = extent[2] / counts[2]
+    };
+
+    mat4 identity = GLM_MAT4_IDENTITY_INIT;
+    binVoxelTriangles(&voxels, vertices, verticesCount, indices, indicesCount, identity);
 
     return voxels;
-}
\ No newline at end of file
+}
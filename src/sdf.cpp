@@ -0,0 +1,431 @@
+#include "sdf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+//A brick's run of candidate triangles, in the list of the worker that gathered it
+typedef struct {
+    u32 workerIdx;
+    u32 first;
+    u32 count;
+} BrickCandidates;
+
+typedef struct {
+    u32 *ids;
+    u32 count;
+    u32 capacity;
+} CandidateList;
+
+//Angle weighted pseudo-normals of every feature a closest point can land on, so
+//the sign agrees whichever of the triangles sharing an edge or vertex is nearest.
+//Baerentzen and Aanaes, Signed Distance Computation Using the Angle Weighted Pseudonormal
+typedef struct {
+    vec3 *faceNormals;//Per triangle
+    vec3 *edgeNormals;//Three per triangle, in TriangleFeature order
+    vec3 *vertexNormals;//Three per triangle, shared by every corner at the same position
+} PseudoNormals;
+
+typedef struct {
+    const Voxels *voxels;
+    SdfVolume *sdf;
+    PseudoNormals normals;
+    OverlapScratch scratches[MAX_JOB_WORKERS];
+    u32 *candidates[MAX_JOB_WORKERS];//Scratch for a single brick
+    CandidateList lists[MAX_JOB_WORKERS];
+    BrickCandidates *brickCandidates;//Per brick
+} SdfBake;
+
+typedef struct {
+    u64 key;//Lower then higher welded vertex
+    u32 triangleEdge;
+} EdgeEntry;
+
+static void* checkedAlloc(size_t size)
+{
+    void *mem = malloc(size ? size : 1);
+    if (!mem)
+    {
+        fprintf(stderr, "Failed to allocate SDF bake memory\n");
+        abort();
+    }
+    return mem;
+}
+
+static PseudoNormals computePseudoNormals(const Voxels *voxels)
+{
+    const vec3 *vertices = (const vec3*)(voxels->data + voxels->transformedVerticesIdx);
+    const u16 *triangles = (const u16*)(voxels->data + voxels->trianglesIdx);
+    u32 trianglesCount = voxels->trianglesCount;
+
+    u32 verticesCount = 0;
+    for (u32 i = 0; i < trianglesCount*3; i++)
+        verticesCount = triangles[i] + 1 > verticesCount ? triangles[i] + 1 : verticesCount;
+
+    //Vertices are split along attribute seams, so corners are joined by position
+    u32 *order = (u32*)checkedAlloc(sizeof(u32)*verticesCount);
+    u32 *welded = (u32*)checkedAlloc(sizeof(u32)*verticesCount);
+    for (u32 v = 0; v < verticesCount; v++)
+        order[v] = v;
+    std::sort(order, order + verticesCount, [vertices](u32 a, u32 b) {
+        return memcmp(vertices[a], vertices[b], sizeof(vec3)) < 0;
+    });
+    u32 weldedCount = 0;
+    for (u32 i = 0; i < verticesCount; i++)
+    {
+        if (i && memcmp(vertices[order[i - 1]], vertices[order[i]], sizeof(vec3)))
+            weldedCount++;
+        welded[order[i]] = weldedCount;
+    }
+    weldedCount += verticesCount ? 1 : 0;
+
+    PseudoNormals normals = {};
+    normals.faceNormals = (vec3*)checkedAlloc(sizeof(vec3)*trianglesCount);
+    normals.edgeNormals = (vec3*)checkedAlloc(sizeof(vec3)*trianglesCount*3);
+    normals.vertexNormals = (vec3*)checkedAlloc(sizeof(vec3)*trianglesCount*3);
+    vec3 *weldedNormals = (vec3*)calloc(weldedCount ? weldedCount : 1, sizeof(vec3));
+    EdgeEntry *edges = (EdgeEntry*)checkedAlloc(sizeof(EdgeEntry)*trianglesCount*3);
+    if (!weldedNormals)
+    {
+        fprintf(stderr, "Failed to allocate SDF bake memory\n");
+        abort();
+    }
+
+    for (u32 t = 0; t < trianglesCount; t++)
+    {
+        const u16 *tri = &triangles[t*3];
+        vec3 ab, ac;
+        glm_vec3_sub((float*)vertices[tri[1]], (float*)vertices[tri[0]], ab);
+        glm_vec3_sub((float*)vertices[tri[2]], (float*)vertices[tri[0]], ac);
+        glm_vec3_cross(ab, ac, normals.faceNormals[t]);
+        glm_vec3_normalize(normals.faceNormals[t]);
+
+        for (u32 corner = 0; corner < 3; corner++)
+        {
+            vec3 toNext, toPrev;
+            glm_vec3_sub((float*)vertices[tri[(corner + 1) % 3]], (float*)vertices[tri[corner]], toNext);
+            glm_vec3_sub((float*)vertices[tri[(corner + 2) % 3]], (float*)vertices[tri[corner]], toPrev);
+            glm_vec3_muladds(normals.faceNormals[t], glm_vec3_angle(toNext, toPrev), weldedNormals[welded[tri[corner]]]);
+
+            u64 from = welded[tri[corner]], to = welded[tri[(corner + 1) % 3]];
+            edges[t*3 + corner] = {.key = from < to ? from << 32 | to : to << 32 | from, .triangleEdge = t*3 + corner};
+        }
+    }
+
+    //Every triangle on an edge adds its normal, as their angles are all pi
+    std::sort(edges, edges + trianglesCount*3, [](const EdgeEntry &a, const EdgeEntry &b) {
+        return a.key < b.key;
+    });
+    for (u32 first = 0, last = 0; first < trianglesCount*3; first = last)
+    {
+        vec3 sum = GLM_VEC3_ZERO_INIT;
+        for (last = first; last < trianglesCount*3 && edges[last].key == edges[first].key; last++)
+            glm_vec3_add(sum, normals.faceNormals[edges[last].triangleEdge/3], sum);
+        for (u32 i = first; i < last; i++)
+            glm_vec3_copy(sum, normals.edgeNormals[edges[i].triangleEdge]);
+    }
+
+    for (u32 i = 0; i < trianglesCount*3; i++)
+        glm_vec3_copy(weldedNormals[welded[triangles[i]]], normals.vertexNormals[i]);
+
+    free(order);
+    free(welded);
+    free(weldedNormals);
+    free(edges);
+
+    return normals;
+}
+
+static void freePseudoNormals(PseudoNormals *normals)
+{
+    free(normals->faceNormals);
+    free(normals->edgeNormals);
+    free(normals->vertexNormals);
+    *normals = {};
+}
+
+static const float* getPseudoNormal(const PseudoNormals *normals, u32 triangle, TriangleFeature feature)
+{
+    if (feature == TRIANGLE_FEATURE_FACE)
+        return normals->faceNormals[triangle];
+    if (feature >= TRIANGLE_FEATURE_AB)
+        return normals->edgeNormals[triangle*3 + feature - TRIANGLE_FEATURE_AB];
+    return normals->vertexNormals[triangle*3 + feature];
+}
+
+static void getBrickBounds(const SdfVolume *sdf, u32 brick, float margin, Box *box)
+{
+    u32 coords[3] = {
+        brick % sdf->bricksX,
+        (brick / sdf->bricksX) % sdf->bricksY,
+        brick / (sdf->bricksX*sdf->bricksY)};
+
+    float brickWidth = sdf->cellSize * SDF_BRICK_SIZE;
+    for (int d = 0; d < 3; d++)
+    {
+        box->corners[0][d] = sdf->origin[d] + coords[d]*brickWidth - margin;
+        box->corners[1][d] = sdf->origin[d] + (coords[d] + 1)*brickWidth + margin;
+    }
+}
+
+//Triangles that could be within band of any sample in the brick
+static u32 gatherBrickTriangles(SdfBake *bake, u32 brick, u32 workerIdx)
+{
+    Box box = {};
+    getBrickBounds(bake->sdf, brick, bake->sdf->band, &box);
+
+    return overlapBox(
+        bake->voxels,
+        &bake->scratches[workerIdx],
+        &box,
+        bake->candidates[workerIdx],
+        bake->voxels->trianglesCount);
+}
+
+//Keeps each brick's candidates for the bake, so they are only gathered once
+static void markBricks(void *ctx, u32 start, u32 end, u32 workerIdx)
+{
+    SdfBake *bake = (SdfBake*)ctx;
+    CandidateList *list = &bake->lists[workerIdx];
+
+    for (u32 brick = start; brick < end; brick++)
+    {
+        u32 count = gatherBrickTriangles(bake, brick, workerIdx);
+        bake->sdf->brickIdxs[brick] = count ? 0 : SDF_EMPTY_BRICK;
+        bake->brickCandidates[brick] = {.workerIdx = workerIdx, .first = list->count, .count = count};
+        if (!count)
+            continue;
+
+        if (list->count + count > list->capacity)
+        {
+            list->capacity = list->capacity*2 > list->count + count ? list->capacity*2 : list->count + count;
+            list->ids = (u32*)realloc(list->ids, sizeof(u32)*list->capacity);
+            if (!list->ids)
+            {
+                fprintf(stderr, "Failed to grow SDF bake candidates\n");
+                abort();
+            }
+        }
+        memcpy(list->ids + list->count, bake->candidates[workerIdx], sizeof(u32)*count);
+        list->count += count;
+    }
+}
+
+static void bakeBricks(void *ctx, u32 start, u32 end, u32 workerIdx)
+{
+    SdfBake *bake = (SdfBake*)ctx;
+    SdfVolume *sdf = bake->sdf;
+    const Voxels *voxels = bake->voxels;
+    const vec3 *vertices = (const vec3*)(voxels->data + voxels->transformedVerticesIdx);
+    const u16 *triangles = (const u16*)(voxels->data + voxels->trianglesIdx);
+
+    for (u32 brick = start; brick < end; brick++)
+    {
+        if (sdf->brickIdxs[brick] == SDF_EMPTY_BRICK)
+            continue;
+
+        const BrickCandidates *brickCandidates = &bake->brickCandidates[brick];
+        const u32 *candidates = bake->lists[brickCandidates->workerIdx].ids + brickCandidates->first;
+        u32 candidatesCount = brickCandidates->count;
+        float *samples = sdf->samples + (size_t)sdf->brickIdxs[brick]*SDF_BRICK_SAMPLES_COUNT;
+
+        Box bounds = {};
+        getBrickBounds(sdf, brick, 0.0f, &bounds);
+
+        for (u32 z = 0; z < SDF_BRICK_SAMPLES; z++)
+        {
+            for (u32 y = 0; y < SDF_BRICK_SAMPLES; y++)
+            {
+                for (u32 x = 0; x < SDF_BRICK_SAMPLES; x++)
+                {
+                    vec3 p = {
+                        bounds.corners[0][0] + x*sdf->cellSize,
+                        bounds.corners[0][1] + y*sdf->cellSize,
+                        bounds.corners[0][2] + z*sdf->cellSize};
+
+                    float minDist2 = sdf->band*sdf->band;
+                    float sign = 1.0f;
+                    for (u32 i = 0; i < candidatesCount; i++)
+                    {
+                        const u16 *tri = &triangles[candidates[i]*3];
+                        vec3 closest;
+                        TriangleFeature feature = closestPointOnTriangleFeature(
+                            p, vertices[tri[0]], vertices[tri[1]], vertices[tri[2]], closest);
+
+                        vec3 diff;
+                        glm_vec3_sub(p, closest, diff);
+                        float dist2 = glm_vec3_norm2(diff);
+                        if (dist2 < minDist2)
+                        {
+                            //Inside or outside by the pseudo-normal of the feature it's nearest
+                            const float *normal = getPseudoNormal(&bake->normals, candidates[i], feature);
+                            minDist2 = dist2;
+                            sign = glm_vec3_dot(diff, (float*)normal) < 0.0f ? -1.0f : 1.0f;
+                        }
+                    }
+
+                    samples[(z*SDF_BRICK_SAMPLES + y)*SDF_BRICK_SAMPLES + x] = sign*sqrtf(minDist2);
+                }
+            }
+        }
+    }
+}
+
+SdfVolume bakeSdf(JobPool *jobs, const Voxels *voxels, float cellSize, float band)
+{
+    SdfVolume sdf = {.cellSize = cellSize, .band = band};
+
+    //The voxel grid, whose origin is its top corner, grown by band on every side.
+    //Anything outside the volume is then at least band from the surface.
+    float extent[3] = {
+        voxels->voxWidth*voxels->cols + 2.0f*band,
+        voxels->voxHeight*voxels->rows + 2.0f*band,
+        voxels->voxLength*voxels->depth + 2.0f*band};
+    sdf.origin[0] = voxels->origin[0] - band;
+    sdf.origin[1] = voxels->origin[1] - voxels->voxHeight*voxels->rows - band;
+    sdf.origin[2] = voxels->origin[2] - band;
+
+    float brickWidth = cellSize*SDF_BRICK_SIZE;
+    sdf.bricksX = (u32)ceilf(extent[0]/brickWidth);
+    sdf.bricksY = (u32)ceilf(extent[1]/brickWidth);
+    sdf.bricksZ = (u32)ceilf(extent[2]/brickWidth);
+    u32 bricksTotal = sdf.bricksX*sdf.bricksY*sdf.bricksZ;
+
+    sdf.brickIdxs = (u32*)malloc(sizeof(u32)*bricksTotal);
+    if (!sdf.brickIdxs)
+    {
+        fprintf(stderr, "Failed to allocate SDF brick indexes\n");
+        abort();
+    }
+
+    SdfBake bake = {.voxels = voxels, .sdf = &sdf};
+    bake.normals = computePseudoNormals(voxels);
+    bake.brickCandidates = (BrickCandidates*)checkedAlloc(sizeof(BrickCandidates)*bricksTotal);
+    for (u32 i = 0; i < jobs->workersCount; i++)
+    {
+        bake.scratches[i] = createOverlapScratch(voxels);
+        bake.candidates[i] = (u32*)malloc(sizeof(u32)*(voxels->trianglesCount ? voxels->trianglesCount : 1));
+        if (!bake.candidates[i])
+        {
+            fprintf(stderr, "Failed to allocate SDF bake candidates\n");
+            abort();
+        }
+    }
+
+    //Allocate storage only for bricks near triangles, then fill them
+    parallelFor(jobs, bricksTotal, 16, markBricks, &bake);
+
+    for (u32 brick = 0; brick < bricksTotal; brick++)
+    {
+        if (sdf.brickIdxs[brick] != SDF_EMPTY_BRICK)
+            sdf.brickIdxs[brick] = sdf.bricksCount++;
+    }
+
+    sdf.samples = (float*)malloc(sizeof(float)*SDF_BRICK_SAMPLES_COUNT*(sdf.bricksCount ? sdf.bricksCount : 1));
+    if (!sdf.samples)
+    {
+        fprintf(stderr, "Failed to allocate SDF bricks\n");
+        abort();
+    }
+
+    parallelFor(jobs, bricksTotal, 4, bakeBricks, &bake);
+
+    for (u32 i = 0; i < jobs->workersCount; i++)
+    {
+        destroyOverlapScratch(&bake.scratches[i]);
+        free(bake.candidates[i]);
+        free(bake.lists[i].ids);
+    }
+    free(bake.brickCandidates);
+    freePseudoNormals(&bake.normals);
+
+    return sdf;
+}
+
+void destroySdf(SdfVolume *sdf)
+{
+    free(sdf->brickIdxs);
+    free(sdf->samples);
+    *sdf = {};
+}
+
+//Finds the brick cell containing p and the trilinear weights within it.
+//Returns NULL outside the volume or in an empty brick.
+static const float* locateSdfCell(const SdfVolume *sdf, const vec3 p, u32 cell[3], float frac[3])
+{
+    u32 counts[3] = {sdf->bricksX, sdf->bricksY, sdf->bricksZ};
+    u32 brickCoords[3];
+
+    for (int d = 0; d < 3; d++)
+    {
+        float local = (p[d] - sdf->origin[d]) / sdf->cellSize;
+        if (!(local >= 0.0f && local <= (float)(counts[d]*SDF_BRICK_SIZE)))
+            return NULL;
+
+        u32 idx = (u32)local;
+        brickCoords[d] = idx / SDF_BRICK_SIZE;
+        if (brickCoords[d] >= counts[d])//On the far boundary
+            brickCoords[d] = counts[d] - 1;
+
+        cell[d] = idx - brickCoords[d]*SDF_BRICK_SIZE;
+        if (cell[d] >= SDF_BRICK_SIZE)
+            cell[d] = SDF_BRICK_SIZE - 1;
+        frac[d] = local - (float)(brickCoords[d]*SDF_BRICK_SIZE + cell[d]);
+    }
+
+    u32 brick = sdf->brickIdxs[(brickCoords[2]*sdf->bricksY + brickCoords[1])*sdf->bricksX + brickCoords[0]];
+    if (brick == SDF_EMPTY_BRICK)
+        return NULL;
+
+    const float *samples = sdf->samples + (size_t)brick*SDF_BRICK_SAMPLES_COUNT;
+    return samples + (cell[2]*SDF_BRICK_SAMPLES + cell[1])*SDF_BRICK_SAMPLES + cell[0];
+}
+
+#define SDF_SAMPLE(base, x, y, z) (base)[((z)*SDF_BRICK_SAMPLES + (y))*SDF_BRICK_SAMPLES + (x)]
+
+float sampleSdf(const SdfVolume *sdf, const vec3 p)
+{
+    u32 cell[3];
+    float f[3];
+    const float *s = locateSdfCell(sdf, p, cell, f);
+    if (!s)
+        return sdf->band;
+
+    float c00 = glm_lerp(SDF_SAMPLE(s, 0, 0, 0), SDF_SAMPLE(s, 1, 0, 0), f[0]);
+    float c10 = glm_lerp(SDF_SAMPLE(s, 0, 1, 0), SDF_SAMPLE(s, 1, 1, 0), f[0]);
+    float c01 = glm_lerp(SDF_SAMPLE(s, 0, 0, 1), SDF_SAMPLE(s, 1, 0, 1), f[0]);
+    float c11 = glm_lerp(SDF_SAMPLE(s, 0, 1, 1), SDF_SAMPLE(s, 1, 1, 1), f[0]);
+
+    return glm_lerp(glm_lerp(c00, c10, f[1]), glm_lerp(c01, c11, f[1]), f[2]);
+}
+
+float sampleSdfGradient(const SdfVolume *sdf, const vec3 p, vec3 gradient)
+{
+    u32 cell[3];
+    float f[3];
+    const float *s = locateSdfCell(sdf, p, cell, f);
+    if (!s)
+    {
+        glm_vec3_zero(gradient);
+        return sdf->band;
+    }
+
+    float c[8];
+    for (u32 i = 0; i < 8; i++)
+        c[i] = SDF_SAMPLE(s, i & 1, (i >> 1) & 1, i >> 2);
+
+    //Partial derivatives of the trilinear interpolant
+    float x00 = glm_lerp(c[0], c[1], f[0]), x10 = glm_lerp(c[2], c[3], f[0]);
+    float x01 = glm_lerp(c[4], c[5], f[0]), x11 = glm_lerp(c[6], c[7], f[0]);
+    float y0 = glm_lerp(x00, x10, f[1]), y1 = glm_lerp(x01, x11, f[1]);
+
+    float dx0 = glm_lerp(c[1] - c[0], c[3] - c[2], f[1]);
+    float dx1 = glm_lerp(c[5] - c[4], c[7] - c[6], f[1]);
+
+    gradient[0] = glm_lerp(dx0, dx1, f[2]) / sdf->cellSize;
+    gradient[1] = glm_lerp(x10 - x00, x11 - x01, f[2]) / sdf->cellSize;
+    gradient[2] = (y1 - y0) / sdf->cellSize;
+
+    return glm_lerp(y0, y1, f[2]);
+}
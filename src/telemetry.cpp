@@ -0,0 +1,132 @@
+#include "telemetry.h"
+#include <stdint.h>
+#include <assert.h>
+
+static const char *MEMORY_CATEGORY_NAMES[MEMORY_CATEGORIES_COUNT] = {
+    "mesh",
+    "texture",
+    "attachment",
+    "staging",
+    "uniform",
+    "storage"
+};
+
+//Updated atomically, as assets may be loaded off the main thread
+static u64 categoryBytes[MEMORY_CATEGORIES_COUNT] = {};
+static u32 categoryAllocations[MEMORY_CATEGORIES_COUNT] = {};
+
+void trackAllocation(VmaAllocator allocator, VmaAllocation alloc, MemoryCategory category)
+{
+    assert(category < MEMORY_CATEGORIES_COUNT);
+
+    //Offset by one so untagged allocations read back as NULL
+    vmaSetAllocationUserData(allocator, alloc, (void*)(uintptr_t)(category + 1));
+
+    VmaAllocationInfo info = {};
+    vmaGetAllocationInfo(allocator, alloc, &info);
+    __atomic_fetch_add(&categoryBytes[category], info.size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&categoryAllocations[category], 1, __ATOMIC_RELAXED);
+}
+
+void untrackAllocation(VmaAllocator allocator, VmaAllocation alloc)
+{
+    VmaAllocationInfo info = {};
+    vmaGetAllocationInfo(allocator, alloc, &info);
+
+    uintptr_t tag = (uintptr_t)info.pUserData;
+    if (!tag)
+        return;
+
+    MemoryCategory category = (MemoryCategory)(tag - 1);
+    __atomic_fetch_sub(&categoryBytes[category], info.size, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&categoryAllocations[category], 1, __ATOMIC_RELAXED);
+}
+
+float getFragmentation(const VmaDetailedStatistics *stats)
+{
+    VkDeviceSize unused = stats->statistics.blockBytes - stats->statistics.allocationBytes;
+    if (!unused || !stats->unusedRangeCount)
+        return 0.0f;
+
+    return 1.0f - (float)stats->unusedRangeSizeMax / unused;
+}
+
+MemoryTelemetry createMemoryTelemetry(FILE *out, u32 interval, bool budgetEnabled)
+{
+    MemoryTelemetry telemetry = {};
+    telemetry.out = out;
+    telemetry.interval = interval ? interval : 1;
+    telemetry.budgetEnabled = budgetEnabled;
+
+    return telemetry;
+}
+
+void updateMemoryTelemetry(MemoryTelemetry *telemetry, VmaAllocator allocator)
+{
+    vmaSetCurrentFrameIndex(allocator, (u32)telemetry->frame);//Lets VMA refresh its budget
+
+    if (telemetry->frame % telemetry->interval == 0)
+        writeMemoryTelemetry(telemetry, allocator);
+
+    telemetry->frame++;
+}
+
+void writeMemoryTelemetry(MemoryTelemetry *telemetry, VmaAllocator allocator)
+{
+    if (!telemetry->out)
+        return;
+
+    const VkPhysicalDeviceMemoryProperties *memProperties = NULL;
+    vmaGetMemoryProperties(allocator, &memProperties);
+
+    //Budgets are cheap to query, but the full statistics walk every block
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS] = {};
+    vmaGetHeapBudgets(allocator, budgets);
+
+    VmaTotalStatistics stats = {};
+    vmaCalculateStatistics(allocator, &stats);
+
+    FILE *out = telemetry->out;
+    fprintf(out, "{\"type\":\"memory\",\"frame\":%lu,\"budgetExt\":%s,\"heaps\":[", 
+        (unsigned long)telemetry->frame, 
+        telemetry->budgetEnabled ? "true" : "false");
+
+    bool overBudget = false;
+    for (u32 i = 0; i < memProperties->memoryHeapCount; i++)
+    {
+        const VmaBudget *budget = &budgets[i];
+        const VmaDetailedStatistics *heapStats = &stats.memoryHeap[i];
+        overBudget |= budget->usage > budget->budget;
+
+        fprintf(out, 
+            "%s{\"heap\":%u,\"deviceLocal\":%s,\"size\":%lu,\"usage\":%lu,\"budget\":%lu,"
+            "\"blocks\":%u,\"blockBytes\":%lu,\"allocations\":%u,\"allocationBytes\":%lu,"
+            "\"unusedRanges\":%u,\"largestUnusedRange\":%lu,\"fragmentation\":%.3f}",
+            i ? "," : "",
+            i,
+            memProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT ? "true" : "false",
+            (unsigned long)memProperties->memoryHeaps[i].size,
+            (unsigned long)budget->usage,
+            (unsigned long)budget->budget,
+            heapStats->statistics.blockCount,
+            (unsigned long)heapStats->statistics.blockBytes,
+            heapStats->statistics.allocationCount,
+            (unsigned long)heapStats->statistics.allocationBytes,
+            heapStats->unusedRangeCount,
+            (unsigned long)(heapStats->unusedRangeCount ? heapStats->unusedRangeSizeMax : 0),
+            getFragmentation(heapStats));
+    }
+
+    fprintf(out, "],\"categories\":{");
+    for (u32 i = 0; i < MEMORY_CATEGORIES_COUNT; i++)
+    {
+        fprintf(out, "%s\"%s\":{\"allocations\":%u,\"bytes\":%lu}",
+            i ? "," : "",
+            MEMORY_CATEGORY_NAMES[i],
+            __atomic_load_n(&categoryAllocations[i], __ATOMIC_RELAXED),
+            (unsigned long)__atomic_load_n(&categoryBytes[i], __ATOMIC_RELAXED));
+    }
+
+    fprintf(out, "},\"overBudget\":%s}\n", overBudget ? "true" : "false");
+    fflush(out);
+}
@@ -0,0 +1,224 @@
+#include "upload.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vkcommand.h"
+
+UploadContext createUploadContext(VkDevice device, VkQueue queue, u32 queueFamilyIndex, Buffer stagingBuffer)
+{
+    UploadContext uploads = {};
+    uploads.device = device;
+    uploads.queue = queue;
+    uploads.stagingBuffer = stagingBuffer;
+    uploads.timeline = createTimelineSemaphore(device, 0);
+    uploads.cmdPool = createCommandPool(
+        device,
+        queueFamilyIndex,
+        VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+
+    for (u32 i = 0; i < UPLOAD_CONTEXT_BATCHES; i++)
+        uploads.batches[i].cmdBuffer = createPrimaryCommandBuffer(device, uploads.cmdPool);
+
+    return uploads;
+}
+
+void destroyUploadContext(UploadContext *uploads)
+{
+    waitForUpload(uploads, submitUploads(uploads));
+
+    vkDestroySemaphore(uploads->device, uploads->timeline, NULL);
+    vkDestroyCommandPool(uploads->device, uploads->cmdPool, NULL);
+    *uploads = {};
+}
+
+bool isUploadComplete(UploadContext *uploads, UploadToken token)
+{
+    if (token <= uploads->completedToken)
+        return true;
+
+    uploads->completedToken = getTimelineValue(uploads->device, uploads->timeline);
+    return token <= uploads->completedToken;
+}
+
+void waitForUpload(UploadContext *uploads, UploadToken token)
+{
+    if (isUploadComplete(uploads, token))
+        return;
+
+    waitForTimeline(uploads->device, uploads->timeline, token);
+    uploads->completedToken = token;
+}
+
+VkCommandBuffer getUploadCommandBuffer(UploadContext *uploads)
+{
+    UploadBatch *batch = &uploads->batches[uploads->nextBatch];
+    if (uploads->recording)
+        return batch->cmdBuffer;
+
+    //Only blocks if every batch is still pending
+    waitForUpload(uploads, batch->token);
+
+    vkResetCommandBuffer(batch->cmdBuffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (vkBeginCommandBuffer(batch->cmdBuffer, &beginInfo))
+    {
+        fprintf(stderr, "Failed to begin Upload Command Buffer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uploads->recording = true;
+    return batch->cmdBuffer;
+}
+
+u8* allocateUploadStaging(UploadContext *uploads, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *stagingOffset)
+{
+    VkDeviceSize capacity = uploads->stagingBuffer.info.size;
+    if (size > capacity)
+    {
+        fprintf(stderr, "Upload of %lu bytes does not fit in the Staging Buffer\n", (unsigned long)size);
+        exit(EXIT_FAILURE);
+    }
+
+    if (!alignment)
+        alignment = 1;
+
+    if (!uploads->recording && isUploadComplete(uploads, uploads->lastToken))
+        uploads->stagingHead = 0;
+
+    VkDeviceSize offset = (uploads->stagingHead + alignment - 1) / alignment * alignment;
+    if (offset + size > capacity)
+    {
+        waitForUpload(uploads, submitUploads(uploads));
+        offset = 0;
+    }
+
+    uploads->stagingHead = offset + size;
+    *stagingOffset = offset;
+
+    return (u8*)uploads->stagingBuffer.info.pMappedData + offset;
+}
+
+void recordUploadBufferCopy(
+    UploadContext *uploads,
+    VkDeviceSize stagingOffset,
+    VkBuffer dstBuffer,
+    VkDeviceSize dstOffset,
+    VkDeviceSize size)
+{
+    VkBufferCopy copyRegion = {
+        .srcOffset = stagingOffset,
+        .dstOffset = dstOffset,
+        .size = size
+    };
+
+    vkCmdCopyBuffer(getUploadCommandBuffer(uploads), uploads->stagingBuffer.handle, dstBuffer, 1, &copyRegion);
+}
+
+void recordUploadImageCopy(
+    UploadContext *uploads,
+    VkImage image,
+    u32 mipLevels,
+    const VkBufferImageCopy *regions,
+    u32 regionsCount)
+{
+    VkCommandBuffer cmdBuffer = getUploadCommandBuffer(uploads);
+
+    VkImageMemoryBarrier2 barrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = mipLevels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE_KHR;
+    barrier.srcAccessMask = VK_ACCESS_2_NONE;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    barrier.image = image;
+
+    VkDependencyInfo dependencyInfo = {VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    dependencyInfo.imageMemoryBarrierCount = 1;
+    dependencyInfo.pImageMemoryBarriers = &barrier;
+
+    vkCmdPipelineBarrier2(cmdBuffer, &dependencyInfo);
+
+    vkCmdCopyBufferToImage(
+        cmdBuffer,
+        uploads->stagingBuffer.handle,
+        image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        regionsCount, regions);
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT;
+
+    vkCmdPipelineBarrier2(cmdBuffer, &dependencyInfo);
+}
+
+void uploadToBuffer(UploadContext *uploads, const void *data, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset)
+{
+    VkDeviceSize stagingOffset = 0;
+    u8 *staging = allocateUploadStaging(uploads, size, 4, &stagingOffset);
+    memcpy(staging, data, size);
+    recordUploadBufferCopy(uploads, stagingOffset, dstBuffer, dstOffset, size);
+}
+
+UploadToken submitUploads(UploadContext *uploads)
+{
+    if (!uploads->recording)
+        return uploads->lastToken;
+
+    UploadBatch *batch = &uploads->batches[uploads->nextBatch];
+
+    //Buffer copies become visible to whatever is submitted after them
+    VkMemoryBarrier2 barrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT;
+
+    VkDependencyInfo dependencyInfo = {VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
+    dependencyInfo.memoryBarrierCount = 1;
+    dependencyInfo.pMemoryBarriers = &barrier;
+
+    vkCmdPipelineBarrier2(batch->cmdBuffer, &dependencyInfo);
+    if (vkEndCommandBuffer(batch->cmdBuffer))
+    {
+        fprintf(stderr, "Failed to end Upload Command Buffer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    UploadToken token = uploads->lastToken + 1;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo = {VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &token;
+
+    VkSubmitInfo submitInfo = {VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch->cmdBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &uploads->timeline;
+
+    if (vkQueueSubmit(uploads->queue, 1, &submitInfo, VK_NULL_HANDLE))
+    {
+        fprintf(stderr, "Failed to submit Uploads to Queue\n");
+        exit(EXIT_FAILURE);
+    }
+
+    batch->token = uploads->lastToken = token;
+    uploads->nextBatch = (uploads->nextBatch + 1) % UPLOAD_CONTEXT_BATCHES;
+    uploads->recording = false;
+
+    return batch->token;
+}
@@ -6,13 +6,111 @@
 #include "vkmemory.h"
 #include "vkdevice.h"
 #include "int.h"
+#include "telemetry.h"
+#include "deletion.h"
+
+//Attachments are usually only written and read within the render pass, so they are
+//transient and prefer lazily allocated memory, which tilers may never back at all.
+//The memory outlives the images, so swapchain recreations that fit reuse it.
+static void bindAttachmentMemory(
+    VmaAllocator allocator,
+    VkDevice device,
+    VkImage image,
+    AttachmentMemory *memory,
+    DeletionQueue *deletions,
+    VmaAllocationInfo *outInfo)
+{
+    VkMemoryRequirements reqs = {};
+    vkGetImageMemoryRequirements(device, image, &reqs);
+
+    bool reusable = false;
+    if (memory->alloc)
+    {
+        VmaAllocationInfo info = {};
+        vmaGetAllocationInfo(allocator, memory->alloc, &info);
+        reusable = reqs.size <= info.size &&
+            (reqs.memoryTypeBits & (1u << info.memoryType)) &&
+            info.offset % reqs.alignment == 0;
+    }
+
+    if (!reusable)
+    {
+        //Frames in flight may still render to the old image
+        if (deletions && memory->alloc)
+        {
+            deferFreeAllocation(deletions, memory->alloc);
+            memory->alloc = NULL;
+        }
+        else
+            destroyAttachmentMemory(allocator, memory);
+
+        //AUTO usages need the image's create info, which allocating for an existing
+        //image doesn't pass, so the memory type is picked here. Lazily allocated
+        //types only accept transient images, so aren't in the image's bits otherwise.
+        VmaAllocationCreateInfo allocInfo = {};
+        allocInfo.usage = VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED;
+        u32 memoryTypeIdx = 0;
+        if (vmaFindMemoryTypeIndex(allocator, reqs.memoryTypeBits, &allocInfo, &memoryTypeIdx))
+        {
+            allocInfo.usage = VMA_MEMORY_USAGE_UNKNOWN;
+            allocInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+            if (vmaFindMemoryTypeIndex(allocator, reqs.memoryTypeBits, &allocInfo, &memoryTypeIdx)){
+                fprintf(stderr, "Failed to find Attachment Memory type\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        allocInfo.memoryTypeBits = 1u << memoryTypeIdx;
+        //Without CAN_ALIAS the dedicated memory would be tied to this one image
+        allocInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT | VMA_ALLOCATION_CREATE_CAN_ALIAS_BIT;
+
+        if (vmaAllocateMemoryForImage(allocator, image, &allocInfo, &memory->alloc, NULL)){
+            fprintf(stderr, "Failed to allocate Attachment Memory\n");
+            exit(EXIT_FAILURE);
+        }
+        trackAllocation(allocator, memory->alloc, MEMORY_CATEGORY_ATTACHMENT);
+    }
+
+    if (vmaBindImageMemory(allocator, memory->alloc, image)){
+        fprintf(stderr, "Failed to bind Attachment Memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    vmaGetAllocationInfo(allocator, memory->alloc, outInfo);
+}
+
+void destroyAttachmentMemory(VmaAllocator allocator, AttachmentMemory *memory)
+{
+    if (!memory->alloc)
+        return;
+
+    untrackAllocation(allocator, memory->alloc);
+    vmaFreeMemory(allocator, memory->alloc);
+    memory->alloc = NULL;
+}
+
+void destroyAttachmentImage(VkDevice device, DeviceImage *image)
+{
+    vkDestroyImageView(device, image->view, NULL);
+    vkDestroyImage(device, image->handle, NULL);
+    *image = {};
+}
+
+void retireAttachmentImage(DeletionQueue *deletions, DeviceImage *image)
+{
+    deferDestroyImageView(deletions, image->view);
+    deferDestroyUnboundImage(deletions, image->handle);
+    *image = {};
+}
 
 DeviceImage createDepthImage(
     VmaAllocator allocator,
     VkDevice device,
     VkPhysicalDevice physicalDevice,
     VkExtent2D extent,
-    VkSampleCountFlagBits samplingCount)
+    VkSampleCountFlagBits samplingCount,
+    bool transient,
+    AttachmentMemory *memory,
+    DeletionQueue *deletions)
 {
     size_t candidateFormatsCount = 3;
     VkFormat candidateFormats[candidateFormatsCount] = {
@@ -24,7 +122,7 @@ DeviceImage createDepthImage(
         candidateFormats, 
         candidateFormatsCount, 
         VK_IMAGE_TILING_OPTIMAL,
-        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | (transient ? 0 : VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT));
     if (format == VK_FORMAT_MAX_ENUM){
         fprintf(stderr, "Failed to find Depth Buffer format\n");
         exit(EXIT_FAILURE);
@@ -41,19 +139,18 @@ DeviceImage createDepthImage(
     imageInfo.format = format;
     imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | 
+        (transient ? VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : VK_IMAGE_USAGE_SAMPLED_BIT);
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     imageInfo.samples = samplingCount;
 
-    VmaAllocationCreateInfo allocInfo = {};
-    allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
-    allocInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
-
     DeviceImage depthImage = {};
-    if (vmaCreateImage(allocator, &imageInfo, &allocInfo, &depthImage.handle, &depthImage.alloc, &depthImage.info)){
-        fprintf(stderr, "Failed to allocate Image\n");
+    if (vkCreateImage(device, &imageInfo, NULL, &depthImage.handle)){
+        fprintf(stderr, "Failed to create Image\n");
         exit(EXIT_FAILURE);
     }
+    bindAttachmentMemory(allocator, device, depthImage.handle, memory, deletions, &depthImage.info);
+    depthImage.alloc = memory->alloc;
     
     VkImageViewCreateInfo viewInfo = {};
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -82,7 +179,10 @@ DeviceImage createSamplingImage(
     VkDevice device, 
     VkFormat format, 
     VkExtent2D extent,
-    VkSampleCountFlagBits samplingCount)
+    VkSampleCountFlagBits samplingCount,
+    bool transient,
+    AttachmentMemory *memory,
+    DeletionQueue *deletions)
 {
     VkImageCreateInfo imageInfo = {};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -95,19 +195,17 @@ DeviceImage createSamplingImage(
     imageInfo.format = format;
     imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | (transient ? VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : 0);
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     imageInfo.samples = samplingCount;
 
-    VmaAllocationCreateInfo allocInfo = {};
-    allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
-    allocInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
-
     DeviceImage samplingImage = {};
-    if (vmaCreateImage(allocator, &imageInfo, &allocInfo, &samplingImage.handle, &samplingImage.alloc, &samplingImage.info)){
-        fprintf(stderr, "Failed to allocate Image\n");
+    if (vkCreateImage(device, &imageInfo, NULL, &samplingImage.handle)){
+        fprintf(stderr, "Failed to create Image\n");
         exit(EXIT_FAILURE);
     }
+    bindAttachmentMemory(allocator, device, samplingImage.handle, memory, deletions, &samplingImage.info);
+    samplingImage.alloc = memory->alloc;
     
     VkImageViewCreateInfo viewInfo = {};
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -179,4 +277,12 @@ void destroyFramebuffers(VkDevice device, Framebuffers *framebuffers)
     for(size_t i = 0; i < framebuffers->count; i++)
         vkDestroyFramebuffer(device, framebuffers->handles[i], NULL);
     free(framebuffers->handles);
+}
+
+void retireFramebuffers(DeletionQueue *deletions, Framebuffers *framebuffers)
+{
+    for(size_t i = 0; i < framebuffers->count; i++)
+        deferDestroyFramebuffer(deletions, framebuffers->handles[i]);
+    free(framebuffers->handles);
+    *framebuffers = {};
 }
\ No newline at end of file
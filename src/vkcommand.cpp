@@ -103,54 +103,93 @@ VkCommandPool createCommandPool(VkDevice device, uint32_t queueIndex, VkCommandP
     }
 }*/
 
-void recordModelDrawCommand(
-    VkCommandBuffer cmdBuffer, 
-    VkRenderPass renderPass, 
-    VkFramebuffer framebuffer, 
+DrawCache* createDrawCache(
+    VkDevice device,
+    u32 queueFamilyIndex,
+    const JobPool *jobs,
+    u32 framesCount,
+    VkQueryPipelineStatisticFlags pipelineStatistics)
+{
+    //Too big for the stack
+    DrawCache *cache = (DrawCache*)calloc(1, sizeof(DrawCache));
+    if (!cache)
+    {
+        fprintf(stderr, "Failed to allocate Draw Cache\n");
+        exit(EXIT_FAILURE);
+    }
+
+    cache->framesCount = framesCount;
+    cache->pipelineStatistics = pipelineStatistics;
+    cache->workersCount = jobs->workersCount;
+    for (u32 frame = 0; frame < framesCount; frame++)
+    {
+        for (u32 worker = 0; worker < cache->workersCount; worker++)
+            cache->pools[frame][worker].cmdPool = createCommandPool(device, queueFamilyIndex, 0);
+    }
+
+    return cache;
+}
+
+void destroyDrawCache(VkDevice device, DrawCache *cache)
+{
+    for (u32 frame = 0; frame < cache->framesCount; frame++)
+    {
+        for (u32 worker = 0; worker < cache->workersCount; worker++)
+            vkDestroyCommandPool(device, cache->pools[frame][worker].cmdPool, NULL);
+    }
+
+    free(cache);
+}
+
+u32 getDrawSlicesCount(u32 batchesCount, u32 workersCount)
+{
+    //A batch is a single indirect draw of up to CULL_BATCH_MAX_COMMANDS
+    u32 slicesCount = workersCount < batchesCount ? workersCount : batchesCount;
+    if (slicesCount > DRAW_CACHE_MAX_SLICES)
+        slicesCount = DRAW_CACHE_MAX_SLICES;
+    if (!slicesCount)
+        return 0;
+
+    //Evenly sized, so none is left empty
+    u32 sliceBatches = (batchesCount + slicesCount - 1)/slicesCount;
+    return (batchesCount + sliceBatches - 1)/sliceBatches;
+}
+
+static void recordModelDraws(
+    VkCommandBuffer cmdBuffer,
+    VkRenderPass renderPass,
+    VkQueryPipelineStatisticFlags pipelineStatistics,
     PipelineDetails graphicsPipeline,
     VkExtent2D renderArea,
-    PushConstant pushConstant,
     VkDescriptorSet descriptorSet,
-    VkBuffer deviceBuffer,
-    size_t vertexBufferOffset,
-    size_t indexBufferOffset,
-    size_t drawCmdsOffset,
-    size_t drawCmdsCount)
+    u32 frameUniformsOffset,
+    VkDescriptorSet textureSet,
+    const DeviceBufferPool *devicePool,
+    const Culling *culling,
+    u32 frame,
+    CullPhase phase,
+    u32 firstBatch,
+    u32 batchesCount)
 {
+    //Any framebuffer compatible with the render pass can execute it
+    VkCommandBufferInheritanceInfo inheritanceInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO};
+    inheritanceInfo.renderPass = renderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.pipelineStatistics = pipelineStatistics;
+    inheritanceInfo.framebuffer = VK_NULL_HANDLE;
 
     VkCommandBufferBeginInfo beginInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
-    
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+
     if (vkBeginCommandBuffer(cmdBuffer, &beginInfo)){//Implicit reset of buffer
-        fprintf(stderr, "Failed to begin recording Command Buffer\n");
+        fprintf(stderr, "Failed to begin recording Secondary Command Buffer\n");
         abort();
     }
 
-    VkRenderPassBeginInfo renderPassBeginInfo = {};
-    renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderPassBeginInfo.renderPass = renderPass;
-    renderPassBeginInfo.framebuffer = framebuffer;
-    renderPassBeginInfo.renderArea.offset = {0, 0};
-    //The render area defines where shader loads and stores will take place. 
-    //The pixels outside this region will have undefined values. It should 
-    //match the size of the attachments for best performance.
-    renderPassBeginInfo.renderArea.extent = renderArea;
-    //Note that the order of clearValues should be identical to the order of your attachments.
-    VkClearValue clearValues[2] = {};
-    clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
-    clearValues[1].depthStencil = {1.0f, 0};
-    renderPassBeginInfo.clearValueCount = NUM_ELEMENTS(clearValues);
-    renderPassBeginInfo.pClearValues = clearValues;
-
-    vkCmdBeginRenderPass(cmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
     vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline.handle);
 
-    vkCmdPushConstants(cmdBuffer, graphicsPipeline.layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstant), &pushConstant);
-
-    vkCmdBindVertexBuffers(cmdBuffer, 0, 1, &deviceBuffer, &vertexBufferOffset);
-
-    vkCmdBindIndexBuffer(cmdBuffer, deviceBuffer, indexBufferOffset, VK_INDEX_TYPE_UINT16);
-
+    //Dynamic state isn't inherited from the primary
     VkViewport viewport{};
     viewport.x = 0.0f;
     viewport.y = 0.0f;
@@ -170,15 +209,242 @@ void recordModelDrawCommand(
         VK_PIPELINE_BIND_POINT_GRAPHICS, 
         graphicsPipeline.layout, 
         0, 1, &descriptorSet, 
+        1, &frameUniformsOffset
+    );
+
+    vkCmdBindDescriptorSets(
+        cmdBuffer, 
+        VK_PIPELINE_BIND_POINT_GRAPHICS, 
+        graphicsPipeline.layout, 
+        1, 1, &textureSet, 
         0, NULL
     );
     
-    vkCmdDrawIndexedIndirect(
-        cmdBuffer, 
-        deviceBuffer, 
-        drawCmdsOffset, drawCmdsCount, sizeof(VkDrawIndexedIndirectCommand));
+    //Culled draws address vertices and indices from the start of their batch's
+    //block, so buffers only get bound when the block changes
+    u32 boundBlock = UINT32_MAX;
+    for (u32 batch = firstBatch; batch < firstBatch + batchesCount; batch++)
+    {
+        u32 block = culling->batches[batch].block;
+        if (block != boundBlock)
+        {
+            VkBuffer blockBuffer = devicePool->blocks[block].buffer.handle;
+            VkDeviceSize blockStart = 0;
+            vkCmdBindVertexBuffers(cmdBuffer, 0, 1, &blockBuffer, &blockStart);
+            vkCmdBindIndexBuffer(cmdBuffer, blockBuffer, 0, VK_INDEX_TYPE_UINT16);
+            boundBlock = block;
+        }
+
+        recordCulledDraws(culling, cmdBuffer, frame, phase, batch);
+    }
+
+    if (vkEndCommandBuffer(cmdBuffer))
+    {
+        fprintf(stderr, "Failed to end recording of Secondary Command Buffer\n");
+        abort();
+    }
+}
+
+typedef struct {
+    DrawCache *cache;
+    VkDevice device;
+    u32 frame;
+    u32 sliceDraws;
+    VkRenderPass renderPass;
+    PipelineDetails graphicsPipeline;
+    VkExtent2D renderArea;
+    VkDescriptorSet descriptorSet;
+    u32 frameUniformsOffset;
+    VkDescriptorSet textureSet;
+    const DeviceBufferPool *devicePool;
+    const Culling *culling;
+    CullPhase phase;
+} DrawSliceJob;
+
+static void recordDrawSlices(void *ctx, u32 start, u32 end, u32 workerIdx)
+{
+    DrawSliceJob *job = (DrawSliceJob*)ctx;
+    DrawCachePool *pool = &job->cache->pools[job->frame][workerIdx];
+
+    for (u32 slice = start; slice < end; slice++)
+    {
+        if (pool->usedCount == pool->allocatedCount)
+        {
+            VkCommandBufferAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocInfo.commandPool = pool->cmdPool;
+            allocInfo.commandBufferCount = 1;
+
+            if (vkAllocateCommandBuffers(job->device, &allocInfo, &pool->cmdBuffers[pool->allocatedCount]))
+            {
+                fprintf(stderr, "Failed to allocate Draw Cache Command Buffer\n");
+                exit(EXIT_FAILURE);
+            }
+            pool->allocatedCount++;
+        }
+
+        VkCommandBuffer cmdBuffer = pool->cmdBuffers[pool->usedCount++];
+
+        u32 batchesCount = job->culling->batchesCount;
+        u32 first = slice*job->sliceDraws;
+        u32 count = batchesCount - first < job->sliceDraws ? batchesCount - first : job->sliceDraws;
+
+        recordModelDraws(
+            cmdBuffer, 
+            job->renderPass, 
+            job->cache->pipelineStatistics, 
+            job->graphicsPipeline, 
+            job->renderArea, 
+            job->descriptorSet, 
+            job->frameUniformsOffset, 
+            job->textureSet, 
+            job->devicePool, 
+            job->culling,
+            job->frame,
+            job->phase,
+            first, count);
+
+        //Stored by slice rather than worker, so execution order never depends on scheduling
+        job->cache->slices[job->frame][slice] = cmdBuffer;
+    }
+}
+
+u32 getModelDrawCommands(
+    DrawCache *cache,
+    JobPool *jobs,
+    VkDevice device,
+    u32 frame,
+    VkRenderPass renderPass,
+    PipelineDetails graphicsPipeline,
+    VkExtent2D renderArea,
+    VkDescriptorSet descriptorSet,
+    u32 frameUniformsOffset,
+    VkDescriptorSet textureSet,
+    const DeviceBufferPool *devicePool,
+    const Culling *culling,
+    CullPhase phase,
+    const VkCommandBuffer **drawCommands)
+{
+    *drawCommands = cache->slices[frame];
+
+    if (cache->valid[frame] &&
+        cache->extents[frame].width == renderArea.width &&
+        cache->extents[frame].height == renderArea.height &&
+        cache->frameUniformsOffsets[frame] == frameUniformsOffset &&
+        cache->poolGenerations[frame] == devicePool->generation &&
+        cache->cullGenerations[frame] == culling->drawsGenerations[frame])
+    {
+        return cache->slicesCounts[frame];
+    }
+
+    u32 slicesCount = getDrawSlicesCount(culling->batchesCount, cache->workersCount);
+    u32 sliceDraws = slicesCount ? (culling->batchesCount + slicesCount - 1)/slicesCount : 0;
+
+    //Keeps the secondaries allocated so they're reused
+    for (u32 worker = 0; worker < cache->workersCount; worker++)
+    {
+        DrawCachePool *pool = &cache->pools[frame][worker];
+        vkResetCommandPool(device, pool->cmdPool, 0);
+        pool->usedCount = 0;
+    }
+
+    DrawSliceJob job = {};
+    job.cache = cache;
+    job.device = device;
+    job.frame = frame;
+    job.sliceDraws = sliceDraws;
+    job.renderPass = renderPass;
+    job.graphicsPipeline = graphicsPipeline;
+    job.renderArea = renderArea;
+    job.descriptorSet = descriptorSet;
+    job.frameUniformsOffset = frameUniformsOffset;
+    job.textureSet = textureSet;
+    job.devicePool = devicePool;
+    job.culling = culling;
+    job.phase = phase;
+
+    parallelFor(jobs, slicesCount, 1, recordDrawSlices, &job);
+
+    cache->slicesCounts[frame] = slicesCount;
+    cache->valid[frame] = true;
+    cache->extents[frame] = renderArea;
+    cache->frameUniformsOffsets[frame] = frameUniformsOffset;
+    cache->poolGenerations[frame] = devicePool->generation;
+    cache->cullGenerations[frame] = culling->drawsGenerations[frame];
+
+    return slicesCount;
+}
+
+void recordModelDrawCommand(
+    VkCommandBuffer cmdBuffer, 
+    VkRenderPass renderPass, 
+    VkRenderPass lateRenderPass,
+    VkFramebuffer framebuffer, 
+    VkExtent2D renderArea,
+    const Culling *culling,
+    const DepthPyramid *pyramid,
+    u32 frame,
+    u32 frameUniformsOffset,
+    const VkCommandBuffer *drawCommands,
+    u32 drawCommandsCount,
+    const VkCommandBuffer *lateDrawCommands,
+    u32 lateDrawCommandsCount,
+    Profiler *profiler)
+{
+    VkCommandBufferBeginInfo beginInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    
+    if (vkBeginCommandBuffer(cmdBuffer, &beginInfo)){//Implicit reset of buffer
+        fprintf(stderr, "Failed to begin recording Command Buffer\n");
+        abort();
+    }
+
+    VkRenderPassBeginInfo renderPassBeginInfo = {};
+    renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassBeginInfo.renderPass = renderPass;
+    renderPassBeginInfo.framebuffer = framebuffer;
+    renderPassBeginInfo.renderArea.offset = {0, 0};
+    //The render area defines where shader loads and stores will take place. 
+    //The pixels outside this region will have undefined values. It should 
+    //match the size of the attachments for best performance.
+    renderPassBeginInfo.renderArea.extent = renderArea;
+    //Note that the order of clearValues should be identical to the order of your attachments.
+    VkClearValue clearValues[2] = {};
+    clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+    clearValues[1].depthStencil = {1.0f, 0};
+    renderPassBeginInfo.clearValueCount = NUM_ELEMENTS(clearValues);
+    renderPassBeginInfo.pClearValues = clearValues;
+
+    recordCulling(culling, cmdBuffer, frame, CULL_PHASE_EARLY, frameUniformsOffset, pyramid, profiler);
+
+    //Counts both passes' draws, along with the occlusion work between them
+    beginPipelineStatistics(profiler, cmdBuffer);
+    u32 scope = beginGpuScope(profiler, cmdBuffer, "mainPass");
+    vkCmdBeginRenderPass(cmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+    if (drawCommandsCount)
+        vkCmdExecuteCommands(cmdBuffer, drawCommandsCount, drawCommands);
 
     vkCmdEndRenderPass(cmdBuffer);
+    endGpuScope(profiler, cmdBuffer, scope);
+
+    //Draws whatever the early pass's depth doesn't hide, but wasn't drawn by it
+    if (culling->phasesCount > 1)
+    {
+        recordDepthPyramid(pyramid, cmdBuffer);
+        recordCulling(culling, cmdBuffer, frame, CULL_PHASE_LATE, frameUniformsOffset, pyramid, profiler);
+
+        scope = beginGpuScope(profiler, cmdBuffer, "latePass");
+        renderPassBeginInfo.renderPass = lateRenderPass;
+        vkCmdBeginRenderPass(cmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+        if (lateDrawCommandsCount)
+            vkCmdExecuteCommands(cmdBuffer, lateDrawCommandsCount, lateDrawCommands);
+
+        vkCmdEndRenderPass(cmdBuffer);
+        endGpuScope(profiler, cmdBuffer, scope);
+    }
+    endPipelineStatistics(profiler, cmdBuffer);
 
     if (vkEndCommandBuffer(cmdBuffer))
     {
@@ -192,22 +458,31 @@ void submitDrawCommand(
     VkCommandBuffer commandBuffer, 
     VkSemaphore waitSemaphore,
     VkSemaphore signalSemaphore,
-    VkFence hostFence){
+    VkSemaphore frameTimeline,
+    u64 frame){
+
+    //The binary semaphore's value is ignored
+    VkSemaphore signalSemaphores[] = {signalSemaphore, frameTimeline};
+    u64 signalValues[] = {0, frame};
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo = {VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+    timelineInfo.signalSemaphoreValueCount = NUM_ELEMENTS(signalValues);
+    timelineInfo.pSignalSemaphoreValues = signalValues;
 
     VkSubmitInfo sumbitInfo{};
     sumbitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    sumbitInfo.pNext = &timelineInfo;
     sumbitInfo.waitSemaphoreCount = 1;
     sumbitInfo.pWaitSemaphores = &waitSemaphore;
     VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
     sumbitInfo.pWaitDstStageMask = waitStages;
     sumbitInfo.commandBufferCount = 1;
     sumbitInfo.pCommandBuffers = &commandBuffer;
-    sumbitInfo.signalSemaphoreCount = 1;
-    sumbitInfo.pSignalSemaphores = &signalSemaphore;//Signalled once the command buffers have finished executing
+    //Signalled once the command buffers, and everything submitted before them, have finished executing
+    sumbitInfo.signalSemaphoreCount = NUM_ELEMENTS(signalSemaphores);
+    sumbitInfo.pSignalSemaphores = signalSemaphores;
 
-    //hostFence signals to the host that it is safe to reset the command buffer,
-    //which is an optional feature.
-    if (vkQueueSubmit(graphicsQueue, 1, &sumbitInfo, hostFence)){
+    if (vkQueueSubmit(graphicsQueue, 1, &sumbitInfo, VK_NULL_HANDLE)){
         printf("Submission of Command Buffer failed\n");
         exit(EXIT_FAILURE);
     }
@@ -230,75 +505,66 @@ VkResult presentSwapchain(
     return vkQueuePresentKHR(presentQueue, &presentInfo);
 }
 
-VkCommandBuffer beginSingleTimeCommandBuffer(VkDevice device, VkCommandPool cmdPool)
+FrameSynchroniser createFrameSynchroniser(VkDevice device)
 {
-    VkCommandBufferAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = cmdPool;
-    allocInfo.commandBufferCount = 1;
+    FrameSynchroniser frameSyncer = {};
 
-    VkCommandBuffer cmdBuffer = NULL;
-    if (vkAllocateCommandBuffers(device, &allocInfo, &cmdBuffer)){
-        fprintf(stderr, "Failed to allocated Single Use Command Buffer\n");
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    if (vkCreateSemaphore(device, &semaphoreInfo, NULL, &frameSyncer.imageAvailable) ||
+        vkCreateSemaphore(device, &semaphoreInfo, NULL, &frameSyncer.renderFinished))
+    {
+        fprintf(stderr, "Failed to create Frame Synchroniser members\n");
         exit(EXIT_FAILURE);
     }
 
-    VkCommandBufferBeginInfo beginInfo = {};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-    vkBeginCommandBuffer(cmdBuffer, &beginInfo);
-
-    return cmdBuffer;
+    return frameSyncer;
 }
 
-void submitSingleTimeCommandBuffer(
-    VkDevice device, 
-    VkCommandPool cmdPool, 
-    VkCommandBuffer cmdBuffer, 
-    VkQueue queue)
+VkSemaphore createTimelineSemaphore(VkDevice device, u64 initialValue)
 {
-    vkEndCommandBuffer(cmdBuffer);
+    VkSemaphoreTypeCreateInfo typeInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = initialValue;
 
-    VkSubmitInfo submitInfo = {};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &cmdBuffer;
+    VkSemaphoreCreateInfo semaphoreInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+    semaphoreInfo.pNext = &typeInfo;
 
-    if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE)){
-        fprintf(stderr, "Failed to submit Command Buffer to Queue\n");
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    if (vkCreateSemaphore(device, &semaphoreInfo, NULL, &semaphore))
+    {
+        fprintf(stderr, "Failed to create Timeline Semaphore\n");
         exit(EXIT_FAILURE);
     }
 
-    if (vkQueueWaitIdle(queue)){
-        fprintf(stderr, "Failure waiting for Queue to Idle\n");
+    return semaphore;
+}
+
+u64 getTimelineValue(VkDevice device, VkSemaphore timeline)
+{
+    u64 value = 0;
+    if (vkGetSemaphoreCounterValue(device, timeline, &value))
+    {
+        fprintf(stderr, "Failed to get Timeline Semaphore value\n");
         exit(EXIT_FAILURE);
     }
 
-    vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuffer);
+    return value;
 }
 
-FrameSynchroniser createFrameSynchroniser(VkDevice device)
+void waitForTimeline(VkDevice device, VkSemaphore timeline, u64 value)
 {
-    FrameSynchroniser frameSyncer = {};
-
-    VkSemaphoreCreateInfo semaphoreInfo{};
-    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    VkSemaphoreWaitInfo waitInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &timeline;
+    waitInfo.pValues = &value;
 
-    VkFenceCreateInfo fenceInfo{};
-    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;//Starts in the signalled state
-
-    if (vkCreateSemaphore(device, &semaphoreInfo, NULL, &frameSyncer.imageAvailable) ||
-        vkCreateSemaphore(device, &semaphoreInfo, NULL, &frameSyncer.renderFinished) ||
-        vkCreateFence(device, &fenceInfo, NULL, &frameSyncer.inFlight))
+    if (vkWaitSemaphores(device, &waitInfo, UINT64_MAX))
     {
-        fprintf(stderr, "Failed to create Frame Synchroniser members\n");
+        fprintf(stderr, "Failed to wait on Timeline Semaphore\n");
         exit(EXIT_FAILURE);
     }
-
-    return frameSyncer;
 }
 
 VkCommandBuffer createPrimaryCommandBuffer(VkDevice device, VkCommandPool cmdPool)
@@ -73,6 +73,23 @@ bool checkPhysicalDeviceExtensionSupport(VkPhysicalDevice device){
         return true;
 }
 
+static bool checkPhysicalDeviceOptionalExtension(VkPhysicalDevice device, const char *extensionName)
+{
+    uint32_t extCount = 0;
+    vkEnumerateDeviceExtensionProperties(device, NULL, &extCount, NULL);
+    VkExtensionProperties *extProperties = (VkExtensionProperties*)malloc(sizeof(VkExtensionProperties)*extCount);
+    vkEnumerateDeviceExtensionProperties(device, NULL, &extCount, extProperties);
+
+    bool found = false;
+    for (size_t i = 0; i < extCount && !found; i++){
+        found = !strcmp(extProperties[i].extensionName, extensionName);
+    }
+
+    free(extProperties);
+
+    return found;
+}
+
 VkFormat findSupportedFormat(
     VkPhysicalDevice device, 
     VkFormat *candidateFormats, 
@@ -117,15 +134,26 @@ bool checkPhysicalDeviceFeatureSupport(VkPhysicalDevice physicalDevice)
     // Change this to a broader feature search
     VkPhysicalDeviceSeparateDepthStencilLayoutsFeatures separateDepthStencilLayouts = {
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SEPARATE_DEPTH_STENCIL_LAYOUTS_FEATURES};
+    VkPhysicalDeviceDescriptorIndexingFeatures descriptorIndexing = {
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES};
+    separateDepthStencilLayouts.pNext = &descriptorIndexing;
     VkPhysicalDeviceFeatures2 supportedFeatures2 = {
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2};
     supportedFeatures2.pNext = &separateDepthStencilLayouts;
 
     vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures2);
+
+    //Needed by the bindless TextureTable
+    bool bindlessTextures = descriptorIndexing.shaderSampledImageArrayNonUniformIndexing &&
+        descriptorIndexing.descriptorBindingPartiallyBound &&
+        descriptorIndexing.descriptorBindingSampledImageUpdateAfterBind &&
+        descriptorIndexing.descriptorBindingUpdateUnusedWhilePending &&
+        descriptorIndexing.runtimeDescriptorArray;
     
     return supportedFeatures.samplerAnisotropy && 
         (depthBufferFormat != VK_FORMAT_MAX_ENUM) && 
-        separateDepthStencilLayouts.separateDepthStencilLayouts;
+        separateDepthStencilLayouts.separateDepthStencilLayouts &&
+        bindlessTextures;
 }
 
 VkPhysicalDevice selectFromPhysicalDevices(
@@ -188,19 +216,22 @@ PhysicalDeviceDetails selectPhysicalDevice(VkInstance instance, VkSurfaceKHR sur
     }
     #endif
     
-    VkPhysicalDevice selectedDevice = selectFromPhysicalDevices(
-        physicalDevices,
-        physicalDevicesCount,
-        surface,
-        VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU
-    );
+    //Most capable first. Virtual and software devices are a last resort, which
+    //renderer setup then culls on the host for.
+    const VkPhysicalDeviceType preferredTypes[] = {
+        VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU,
+        VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU,
+        VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU,
+        VK_PHYSICAL_DEVICE_TYPE_CPU
+    };
 
-    if (!selectedDevice){
+    VkPhysicalDevice selectedDevice = VK_NULL_HANDLE;
+    for (size_t i = 0; i < NUM_ELEMENTS(preferredTypes) && !selectedDevice; i++){
         selectedDevice = selectFromPhysicalDevices(
             physicalDevices,
             physicalDevicesCount,
             surface,
-            VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU
+            preferredTypes[i]
         );
     }
 
@@ -213,7 +244,20 @@ PhysicalDeviceDetails selectPhysicalDevice(VkInstance instance, VkSurfaceKHR sur
 
     PhysicalDeviceDetails physicalDeviceDetails = {};
     physicalDeviceDetails.handle = selectedDevice;
+    physicalDeviceDetails.memoryBudgetSupported = checkPhysicalDeviceOptionalExtension(
+        selectedDevice, 
+        VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
     vkGetPhysicalDeviceProperties(physicalDeviceDetails.handle, &physicalDeviceDetails.properties);
+    VkPhysicalDeviceFeatures selectedFeatures = {};
+    vkGetPhysicalDeviceFeatures(selectedDevice, &selectedFeatures);
+    physicalDeviceDetails.pipelineStatisticsSupported = selectedFeatures.pipelineStatisticsQuery && selectedFeatures.inheritedQueries;
+
+    //Queried on its own, as it can't share a chain with the structs selection checks
+    VkPhysicalDeviceVulkan12Features vk12Features = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES};
+    VkPhysicalDeviceFeatures2 selectedFeatures2 = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2};
+    selectedFeatures2.pNext = &vk12Features;
+    vkGetPhysicalDeviceFeatures2(selectedDevice, &selectedFeatures2);
+    physicalDeviceDetails.drawIndirectCountSupported = vk12Features.drawIndirectCount;
     physicalDeviceDetails.queueFamilyIndices = findQueueFamilyIndices(physicalDeviceDetails.handle, surface);
 
     #ifndef NDEBUG
@@ -291,12 +335,23 @@ VkDevice createLogicalDevice(const PhysicalDeviceDetails *physicalDevice)
     deviceFeatures.sampleRateShading = VK_TRUE;
     deviceFeatures.multiDrawIndirect = VK_TRUE;
     deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+    deviceFeatures.pipelineStatisticsQuery = physicalDevice->pipelineStatisticsSupported;
+    deviceFeatures.inheritedQueries = physicalDevice->pipelineStatisticsSupported;
 
     VkDeviceCreateInfo deviceInfo = {VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO};
     deviceInfo.queueCreateInfoCount = queueCreateInfoCount;
     deviceInfo.pQueueCreateInfos = queueCreateInfos;
-    deviceInfo.enabledExtensionCount = DEVICE_EXTENSIONS_COUNT;
-    deviceInfo.ppEnabledExtensionNames = DEVICE_EXTENSIONS;
+    const char *extensions[DEVICE_EXTENSIONS_COUNT + 1] = {};
+    u32 extensionsCount = 0;
+    for (size_t i = 0; i < DEVICE_EXTENSIONS_COUNT; i++){
+        extensions[extensionsCount++] = DEVICE_EXTENSIONS[i];
+    }
+    if (physicalDevice->memoryBudgetSupported){
+        extensions[extensionsCount++] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+    }
+
+    deviceInfo.enabledExtensionCount = extensionsCount;
+    deviceInfo.ppEnabledExtensionNames = extensions;
     deviceInfo.pEnabledFeatures = &deviceFeatures;
 
     VkPhysicalDeviceVulkan11Features vk11Features = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES};
@@ -304,6 +359,14 @@ VkDevice createLogicalDevice(const PhysicalDeviceDetails *physicalDevice)
 
     VkPhysicalDeviceVulkan12Features vk12Features = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES};
     vk12Features.separateDepthStencilLayouts = VK_TRUE;
+    vk12Features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+    vk12Features.descriptorBindingPartiallyBound = VK_TRUE;
+    vk12Features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    vk12Features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    vk12Features.runtimeDescriptorArray = VK_TRUE;
+    vk12Features.timelineSemaphore = VK_TRUE;
+    vk12Features.hostQueryReset = VK_TRUE;
+    vk12Features.drawIndirectCount = physicalDevice->drawIndirectCountSupported;
 
     VkPhysicalDeviceVulkan13Features vk13Features = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES};
     vk13Features.synchronization2 = VK_TRUE;
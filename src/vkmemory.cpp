@@ -7,10 +7,13 @@
 #include <string.h>
 #include "vkcommand.h"
 #include "config.h"
+#include "telemetry.h"
 
-VmaAllocator createAllocator(VkDevice device, VkInstance instance, VkPhysicalDevice physicalDevice)
+VmaAllocator createAllocator(VkDevice device, VkInstance instance, VkPhysicalDevice physicalDevice, bool memoryBudget)
 {
     VmaAllocatorCreateInfo allocatorInfo = {};
+    if (memoryBudget)
+        allocatorInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
     allocatorInfo.device = device;
     allocatorInfo.physicalDevice = physicalDevice;
     allocatorInfo.instance = instance;
@@ -24,70 +27,100 @@ VmaAllocator createAllocator(VkDevice device, VkInstance instance, VkPhysicalDev
     return allocator;
 }
 
-DeviceImage createDeviceTexture(
-    VkDevice device, 
-    VmaAllocator allocator, 
-    u32 texWidth, u32 texHeight)
+VkImageCreateInfo getDeviceTextureInfo(u32 texWidth, u32 texHeight, u32 mipLevels)
 {
     VkImageCreateInfo imageInfo = {VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
     imageInfo.imageType = VK_IMAGE_TYPE_2D;
     imageInfo.extent.width = texWidth;
     imageInfo.extent.height = texHeight;
     imageInfo.extent.depth = 1;
-    imageInfo.mipLevels = 1;
+    imageInfo.mipLevels = mipLevels;
     imageInfo.arrayLayers = 1;
     imageInfo.format = VK_FORMAT_R8G8B8A8_SRGB;
     imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    //Source for defragmentation moves
+    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
 
-    VmaAllocationCreateInfo allocInfo = {};
-    allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
-
-    DeviceImage tex = {};
-    if (vmaCreateImage(allocator, &imageInfo, &allocInfo, &tex.handle, &tex.alloc, &tex.info))
-    {
-        fprintf(stderr, "Failed to create Device Image\n");
-        exit(EXIT_FAILURE);
-    }
+    return imageInfo;
+}
 
+VkImageView createDeviceTextureView(VkDevice device, VkImage image, u32 mipLevels)
+{
     VkImageViewCreateInfo viewInfo = {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
-    viewInfo.image = tex.handle;
+    viewInfo.image = image;
     viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
     viewInfo.format = VK_FORMAT_R8G8B8A8_SRGB;
     viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.levelCount = mipLevels;
     viewInfo.subresourceRange.baseArrayLayer = 0;
     viewInfo.subresourceRange.layerCount = 1;
 
-    if (vkCreateImageView(device, &viewInfo, NULL, &tex.view))
+    VkImageView view = VK_NULL_HANDLE;
+    if (vkCreateImageView(device, &viewInfo, NULL, &view))
     {
         fprintf(stderr, "Failed to create View of Device Texture Image\n");
         exit(EXIT_FAILURE);
     }
 
+    return view;
+}
+
+DeviceImage createDeviceTexture(
+    VkDevice device, 
+    VmaAllocator allocator, 
+    u32 texWidth, u32 texHeight,
+    u32 mipLevels)
+{
+    VkImageCreateInfo imageInfo = getDeviceTextureInfo(texWidth, texHeight, mipLevels);
+
+    VmaAllocationCreateInfo allocInfo = {};
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+
+    DeviceImage tex = {};
+    if (vmaCreateImage(allocator, &imageInfo, &allocInfo, &tex.handle, &tex.alloc, &tex.info))
+    {
+        fprintf(stderr, "Failed to create Device Image\n");
+        exit(EXIT_FAILURE);
+    }
+    trackAllocation(allocator, tex.alloc, MEMORY_CATEGORY_TEXTURE);
+
+    tex.view = createDeviceTextureView(device, tex.handle, mipLevels);
     tex.format = VK_FORMAT_R8G8B8A8_SRGB;
     tex.extent = {.width = texWidth, .height = texHeight};
 
     return tex;
 }
 
-Buffer createDeviceBuffer(
-    VmaAllocator allocator,
-    VkDeviceSize bufferSize)
+VkBufferCreateInfo getDeviceBufferInfo(VkDeviceSize bufferSize)
 {
     VkBufferCreateInfo bufferInfo = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
     bufferInfo.size = bufferSize;
     bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | 
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT |//Source for defragmentation moves
         VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | 
         VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
         VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
 
+    return bufferInfo;
+}
+
+Buffer createDeviceBuffer(
+    VmaAllocator allocator,
+    VkDeviceSize bufferSize)
+{
+    VkBufferCreateInfo bufferInfo = getDeviceBufferInfo(bufferSize);
+
+    //Only gets mapped if VMA finds device local memory that is also host visible,
+    //otherwise it falls back to plain device memory written through staging copies
     VmaAllocationCreateInfo allocInfo = {};
     allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+    allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_ALLOW_TRANSFER_INSTEAD_BIT |
+        VMA_ALLOCATION_CREATE_MAPPED_BIT;
 
     Buffer deviceBuffer = {};
     if (vmaCreateBuffer(
@@ -101,10 +134,113 @@ Buffer createDeviceBuffer(
         fprintf(stderr, "Failed to allocate Device Buffer\n");
         exit(EXIT_FAILURE);
     }
+    trackAllocation(allocator, deviceBuffer.alloc, MEMORY_CATEGORY_MESH);
 
     return deviceBuffer;
 }
 
+DeviceBufferPool createDeviceBufferPool(
+    VmaAllocator allocator,
+    VkDeviceSize blockSize)
+{
+    assert(blockSize <= UINT32_MAX);//Offsets within a block are 32 bit
+
+    DeviceBufferPool pool = {};
+    pool.allocator = allocator;
+    pool.blockSize = blockSize;
+
+    return pool;
+}
+
+void destroyDeviceBufferPool(DeviceBufferPool *pool)
+{
+    for (u32 i = 0; i < pool->blocksCount; i++)
+    {
+        DeviceBufferBlock *block = &pool->blocks[i];
+        untrackAllocation(pool->allocator, block->buffer.alloc);
+        vmaDestroyBuffer(pool->allocator, block->buffer.handle, block->buffer.alloc);
+        destroyOffsetAllocator(&block->allocator);
+    }
+
+    pool->blocksCount = 0;
+}
+
+DeviceBufferRange allocateDeviceBufferRange(
+    DeviceBufferPool *pool,
+    VkDeviceSize size,
+    VkDeviceSize alignment)
+{
+    if (!alignment)
+        alignment = 1;
+
+    //Over-allocate so an aligned start always fits
+    VkDeviceSize paddedSize = size + alignment - 1;
+    if (paddedSize > UINT32_MAX)
+    {
+        fprintf(stderr, "Device Buffer range of %lu bytes is too large\n", (unsigned long)size);
+        exit(EXIT_FAILURE);
+    }
+
+    DeviceBufferRange range = {};
+    range.size = size;
+
+    for (u32 i = 0; i < pool->blocksCount; i++)
+    {
+        if (pool->blocks[i].moving)
+            continue;
+
+        range.alloc = offsetAlloc(&pool->blocks[i].allocator, (u32)paddedSize);
+        if (range.alloc.offset != OFFSET_ALLOC_NO_SPACE)
+        {
+            range.block = i;
+            range.offset = (range.alloc.offset + alignment - 1) / alignment * alignment;
+            return range;
+        }
+    }
+
+    if (pool->blocksCount == DEVICE_BUFFER_POOL_MAX_BLOCKS)
+    {
+        fprintf(stderr, "Out of Device Buffer blocks\n");
+        exit(EXIT_FAILURE);
+    }
+
+    //Grow by another block, big enough for this range if it's an oversized one
+    VkDeviceSize blockSize = paddedSize > pool->blockSize ? paddedSize : pool->blockSize;
+    DeviceBufferBlock *block = &pool->blocks[pool->blocksCount];
+    block->buffer = createDeviceBuffer(pool->allocator, blockSize);
+    block->size = blockSize;
+    block->mapped = (u8*)block->buffer.info.pMappedData;
+    block->allocator = createOffsetAllocator((u32)blockSize, DEVICE_BUFFER_BLOCK_MAX_ALLOCS);
+    range.block = pool->blocksCount++;
+    pool->generation++;
+
+    range.alloc = offsetAlloc(&block->allocator, (u32)paddedSize);
+    assert(range.alloc.offset != OFFSET_ALLOC_NO_SPACE);
+    range.offset = (range.alloc.offset + alignment - 1) / alignment * alignment;
+
+    return range;
+}
+
+void freeDeviceBufferRange(DeviceBufferPool *pool, DeviceBufferRange *range)
+{
+    offsetFree(&pool->blocks[range->block].allocator, range->alloc);
+    *range = {};
+    range->alloc.offset = OFFSET_ALLOC_NO_SPACE;
+    range->alloc.node = UINT32_MAX;
+}
+
+u8* mapDeviceBufferRange(const DeviceBufferPool *pool, const DeviceBufferRange *range)
+{
+    u8 *mapped = pool->blocks[range->block].mapped;
+    return mapped ? mapped + range->offset : NULL;
+}
+
+void flushDeviceBufferRange(const DeviceBufferPool *pool, const DeviceBufferRange *range)
+{
+    //Does nothing for host coherent memory
+    vmaFlushAllocation(pool->allocator, pool->blocks[range->block].buffer.alloc, range->offset, range->size);
+}
+
 Buffer createStagingBuffer(
     VmaAllocator allocator,
     VkDeviceSize bufferSize)
@@ -130,6 +266,7 @@ Buffer createStagingBuffer(
         fprintf(stderr, "Failed to allocate Staging Buffer\n");
         exit(EXIT_FAILURE);
     }
+    trackAllocation(allocator, stagingBuffer.alloc, MEMORY_CATEGORY_STAGING);
 
     return stagingBuffer;
 }
@@ -143,7 +280,7 @@ Buffer createUniformBuffer(
     bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
 
     VmaAllocationCreateInfo allocInfo = {};
-    allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;//Read every frame, so ReBAR memory if there is any
     allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
         VMA_ALLOCATION_CREATE_MAPPED_BIT;
 
@@ -159,100 +296,55 @@ Buffer createUniformBuffer(
         fprintf(stderr, "Failed to allocate Uniform Buffer\n");
         exit(EXIT_FAILURE);
     }
+    trackAllocation(allocator, uniformBuffer.alloc, MEMORY_CATEGORY_UNIFORM);
 
     return uniformBuffer;
 }
 
-void copyToDeviceBuffer(
-    size_t bytesCount,
-    VkBuffer srcBuffer,
-    size_t srcOffset,
-    VkBuffer dstBuffer,
-    size_t dstOffset,
-    VkDevice device,
-    VkCommandPool transferCmdPool,
-    VkQueue transferQueue)
+UniformRing createUniformRing(
+    VmaAllocator allocator,
+    VkDeviceSize frameSize,
+    u32 framesCount,
+    VkDeviceSize minOffsetAlignment)
 {
-    VkBufferCopy copyRegion = {
-        .srcOffset = srcOffset,
-        .dstOffset = dstOffset,
-        .size = bytesCount
-    };
-
-    VkCommandBuffer cmdBuffer = beginSingleTimeCommandBuffer(device, transferCmdPool);
-    vkCmdCopyBuffer(cmdBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-    submitSingleTimeCommandBuffer(device, transferCmdPool, cmdBuffer, transferQueue);
+    UniformRing ring = {};
+    ring.alignment = minOffsetAlignment ? minOffsetAlignment : 1;
+    ring.frameSize = (frameSize + ring.alignment - 1) / ring.alignment * ring.alignment;
+    ring.framesCount = framesCount;
+    ring.buffer = createUniformBuffer(allocator, ring.frameSize*framesCount);
+
+    return ring;
 }
 
-void copyToDeviceTexture(
-    VkDevice device,
-    VkImage deviceTexture,
-    VkBuffer stagingBuffer,
-    VkDeviceSize stagingBufferOffset,
-    u32 textureWidth,
-    u32 textureHeight,
-    VkCommandPool transferCmdPool,
-    VkQueue transferQueue)
+void destroyUniformRing(VmaAllocator allocator, UniformRing *ring)
 {
-    VkCommandBuffer cmdBuffer = beginSingleTimeCommandBuffer(device, transferCmdPool);
-
-    VkImageMemoryBarrier barrier = {};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.image = deviceTexture;
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = 1;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
-    barrier.srcAccessMask = 0;
-    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-    vkCmdPipelineBarrier(
-        cmdBuffer,
-        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-        VK_PIPELINE_STAGE_TRANSFER_BIT,
-        0, 
-        0, NULL,
-        0, NULL,
-        1, &barrier);
-
-    VkBufferImageCopy region = {};
-    region.bufferOffset = stagingBufferOffset;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = 1;
-    region.imageOffset = {0, 0, 0};
-    region.imageExtent = {textureWidth, textureHeight, 1};
-
-    vkCmdCopyBufferToImage(
-        cmdBuffer,
-        stagingBuffer,
-        deviceTexture,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        1, &region);
-
-    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-    vkCmdPipelineBarrier(
-        cmdBuffer,
-        VK_PIPELINE_STAGE_TRANSFER_BIT,
-        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-        0, 
-        0, NULL,
-        0, NULL,
-        1, &barrier);
-    
-    submitSingleTimeCommandBuffer(device, transferCmdPool, cmdBuffer, transferQueue);
+    untrackAllocation(allocator, ring->buffer.alloc);
+    vmaDestroyBuffer(allocator, ring->buffer.handle, ring->buffer.alloc);
+    *ring = {};
+}
+
+void beginUniformRingFrame(UniformRing *ring, u32 frame)
+{
+    assert(frame < ring->framesCount);
+    ring->frame = frame;
+    ring->head = 0;
+}
+
+void* allocateUniformRing(UniformRing *ring, VkDeviceSize size, u32 *dynamicOffset)
+{
+    VkDeviceSize start = (ring->head + ring->alignment - 1) / ring->alignment * ring->alignment;
+    if (start + size > ring->frameSize)
+    {
+        fprintf(stderr, "Uniform Ring frame overflowed with %lu bytes\n", (unsigned long)(start + size));
+        abort();
+    }
+
+    ring->head = start + size;
+
+    VkDeviceSize offset = ring->frame*ring->frameSize + start;
+    *dynamicOffset = (u32)offset;
+
+    return (u8*)ring->buffer.info.pMappedData + offset;
 }
 
 VkSampler createSampler(VkDevice device, float maxAnisotropy)
@@ -273,7 +365,7 @@ VkSampler createSampler(VkDevice device, float maxAnisotropy)
     samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
     samplerInfo.mipLodBias = 0.0f;
     samplerInfo.minLod = 0.0f;
-    samplerInfo.maxLod = 0.0f;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;//Whatever mips are resident
 
     VkSampler sampler = {};
     if (vkCreateSampler(device, &samplerInfo, NULL, &sampler))
@@ -10,17 +10,25 @@ VkRenderPass createRenderPass(
     VkFormat swapchainFormat,
     VkFormat depthImageFormat,
     VkFormat samplingImageFormat,
-    VkSampleCountFlagBits samplingCount)
+    VkSampleCountFlagBits samplingCount,
+    RenderPassOrder order)
 {
     VkAttachmentDescription samplingAttachmentDesc = {};
     samplingAttachmentDesc.format = samplingImageFormat;
     samplingAttachmentDesc.samples = samplingCount;
     samplingAttachmentDesc.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    samplingAttachmentDesc.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    samplingAttachmentDesc.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;//Only the resolve is kept
     samplingAttachmentDesc.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     samplingAttachmentDesc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     samplingAttachmentDesc.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     samplingAttachmentDesc.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    if (order != RENDER_PASS_ONLY)
+        samplingAttachmentDesc.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    if (order == RENDER_PASS_LATER)
+    {
+        samplingAttachmentDesc.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        samplingAttachmentDesc.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    }
 
     VkAttachmentDescription depthAttachmentDesc = {};
     depthAttachmentDesc.format = depthImageFormat;
@@ -31,6 +39,17 @@ VkRenderPass createRenderPass(
     depthAttachmentDesc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     depthAttachmentDesc.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     depthAttachmentDesc.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    if (order == RENDER_PASS_FIRST)
+    {
+        //Sampled by compute before the later pass loads it
+        depthAttachmentDesc.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        depthAttachmentDesc.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    }
+    else if (order == RENDER_PASS_LATER)
+    {
+        depthAttachmentDesc.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        depthAttachmentDesc.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    }
     
     VkAttachmentDescription resolveAttachmentDesc = {};
     resolveAttachmentDesc.format = swapchainFormat;
@@ -82,6 +101,26 @@ VkRenderPass createRenderPass(
     //and involve the writing of the color attachment. These settings will prevent 
     //the transition from happening until it’s actually necessary (and allowed): 
     //when we want to start writing colors to it.
+    if (order == RENDER_PASS_LATER)
+    {
+        //Also waits for compute to finish sampling the depth it is about to write
+        dependency.srcStageMask |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        dependency.dstAccessMask |= VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+    }
+
+    //Makes what the first pass kept visible to compute and the later pass
+    VkSubpassDependency outDependency{};
+    outDependency.srcSubpass = 0;
+    outDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+    outDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    outDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    outDependency.dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | 
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    outDependency.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | 
+        VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    VkSubpassDependency dependencies[] = {dependency, outDependency};
     
     u32 attachmentDescriptionsCount = 3;
     VkAttachmentDescription attachmentDescriptions[attachmentDescriptionsCount] = {
@@ -95,8 +134,8 @@ VkRenderPass createRenderPass(
     renderPassInfo.pAttachments = attachmentDescriptions;
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpassDesc;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    renderPassInfo.dependencyCount = order == RENDER_PASS_FIRST ? 2 : 1;
+    renderPassInfo.pDependencies = dependencies;
 
     VkRenderPass renderPass;
     if (vkCreateRenderPass(device, &renderPassInfo, NULL, &renderPass)){
@@ -111,19 +150,16 @@ PipelineDetails createGraphicsPipeline(
     VkDevice device, 
     VkRenderPass renderPass, 
     VkDescriptorSetLayout setLayout,
+    VkDescriptorSetLayout textureSetLayout,
     VkSampleCountFlagBits samplingCount)
 {    
-    VkPushConstantRange pushConstant = {};
-    pushConstant.offset = 0;
-    pushConstant.size = sizeof(PushConstant);
-    pushConstant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    VkDescriptorSetLayout setLayouts[] = {setLayout, textureSetLayout};
 
     VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};//For specifying uniform variables
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = &setLayout;
-    pipelineLayoutInfo.pushConstantRangeCount = 1;
-    pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
+    pipelineLayoutInfo.setLayoutCount = NUM_ELEMENTS(setLayouts);
+    pipelineLayoutInfo.pSetLayouts = setLayouts;
+    pipelineLayoutInfo.pushConstantRangeCount = 0;
 
     VkPipelineLayout pipelineLayout;
     if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL, &pipelineLayout)){
@@ -2,25 +2,28 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <assert.h>
 #include "timing.h"
 #include "int.h"
 #include "vkstate.h"
 
+//Textures live in the separate TextureTable set, as update after bind
+//layouts can't hold the dynamic uniform buffer
 VkDescriptorSetLayout createDescriptorSetLayout(VkDevice device)
 {
     VkDescriptorSetLayoutBinding ubBinding = {};
     ubBinding.binding = 0;
-    ubBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    ubBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     ubBinding.descriptorCount = 1;//Specifies num elements in array
     ubBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
-    VkDescriptorSetLayoutBinding samplerBinding = {};
-    samplerBinding.binding = 1;
-    samplerBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    samplerBinding.descriptorCount = 2;
-    samplerBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    VkDescriptorSetLayoutBinding instancesBinding = {};
+    instancesBinding.binding = 2;
+    instancesBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    instancesBinding.descriptorCount = 1;
+    instancesBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
-    VkDescriptorSetLayoutBinding bindings[] = {ubBinding, samplerBinding};
+    VkDescriptorSetLayoutBinding bindings[] = {ubBinding, instancesBinding};
 
     VkDescriptorSetLayoutCreateInfo layoutInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
     layoutInfo.bindingCount = NUM_ELEMENTS(bindings);
@@ -38,14 +41,14 @@ VkDescriptorSetLayout createDescriptorSetLayout(VkDevice device)
 VkDescriptorPool createDescriptorPool(VkDevice device)
 {
     VkDescriptorPoolSize ubPoolSize = {};
-    ubPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    ubPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     ubPoolSize.descriptorCount = MAX_FRAMES_IN_FLIGHT;//Max descriptors, distributed between the sets
 
-    VkDescriptorPoolSize samplerPoolSize = {};
-    samplerPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    samplerPoolSize.descriptorCount = 2 * MAX_FRAMES_IN_FLIGHT;
+    VkDescriptorPoolSize instancesPoolSize = {};
+    instancesPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    instancesPoolSize.descriptorCount = MAX_FRAMES_IN_FLIGHT;
 
-    VkDescriptorPoolSize poolSizes[] = {ubPoolSize, samplerPoolSize};
+    VkDescriptorPoolSize poolSizes[] = {ubPoolSize, instancesPoolSize};
 
     VkDescriptorPoolCreateInfo poolInfo = {};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -62,13 +65,16 @@ VkDescriptorPool createDescriptorPool(VkDevice device)
     return descriptorPool;
 }
 
-DescriptorSets allocateDescriptorSets(VkDevice device, VkDescriptorSetLayout layout, VkDescriptorPool pool)
+DescriptorSets allocateDescriptorSets(VkDevice device, VkDescriptorSetLayout layout, VkDescriptorPool pool, u32 count)
 {
-    VkDescriptorSetLayout layouts[MAX_FRAMES_IN_FLIGHT] = {layout, layout};
+    assert(count <= MAX_FRAMES_IN_FLIGHT);
+    VkDescriptorSetLayout layouts[MAX_FRAMES_IN_FLIGHT] = {};
+    for (u32 i = 0; i < count; i++)
+        layouts[i] = layout;
 
     VkDescriptorSetAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
     allocInfo.descriptorPool = pool;
-    allocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+    allocInfo.descriptorSetCount = count;
     allocInfo.pSetLayouts = layouts;
 
     DescriptorSets sets = {};
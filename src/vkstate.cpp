@@ -10,6 +10,7 @@
 #include "vkmemory.h"
 #include "vkattachment.h"
 #include "vkpipeline.h"
+#include "telemetry.h"
 
 VulkanState initVulkanState(Window *window, const UserConfig *config)
 {
@@ -21,26 +22,55 @@ VulkanState initVulkanState(Window *window, const UserConfig *config)
     vkGetDeviceQueue(vk.device, vk.physicalDevice.queueFamilyIndices.graphicsQueue, 0, &vk.graphicsQueue);
     vkGetDeviceQueue(vk.device, vk.physicalDevice.queueFamilyIndices.presentQueue, 0, &vk.presentQueue);
     vkGetDeviceQueue(vk.device, vk.physicalDevice.queueFamilyIndices.transferQueue, 0, &vk.transferQueue);
-    vk.swapchain = createSwapchain(vk.device, &vk.physicalDevice, vk.surface, window->handle);
-    vk.allocator = createAllocator(vk.device, vk.instance, vk.physicalDevice.handle);
+    vk.swapchain = createSwapchain(vk.device, &vk.physicalDevice, vk.surface, window->handle, VK_NULL_HANDLE);
+    vk.allocator = createAllocator(vk.device, vk.instance, vk.physicalDevice.handle, vk.physicalDevice.memoryBudgetSupported);
+
+    //Software and weak devices do better culling on the host than in a compute pass, and
+    //GPU culling can only be drawn from with indirect counts
+    vk.cpuCulling = config->renderer.cpuCulling || 
+        vk.physicalDevice.properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU ||
+        !vk.physicalDevice.drawIndirectCountSupported;
+    //The depth pyramid is built from multisampled depth in compute
+    vk.occlusionCulling = config->renderer.occlusionCulling && 
+        !vk.cpuCulling && vk.physicalDevice.maxSamplingCount != VK_SAMPLE_COUNT_1_BIT;
+    if (config->renderer.occlusionCulling && !vk.occlusionCulling)
+        fprintf(stderr, "Occlusion culling needs GPU culling and multisampling, so is disabled\n");
+
     vk.depthImage = createDepthImage(
         vk.allocator, 
         vk.device, 
         vk.physicalDevice.handle, 
         vk.swapchain.extent, 
-        vk.physicalDevice.maxSamplingCount);
+        vk.physicalDevice.maxSamplingCount,
+        !vk.occlusionCulling,
+        &vk.depthMemory,
+        NULL);
     vk.samplingImage = createSamplingImage(
         vk.allocator,
         vk.device,
         vk.swapchain.format,
         vk.swapchain.extent,
-        vk.physicalDevice.maxSamplingCount);
+        vk.physicalDevice.maxSamplingCount,
+        !vk.occlusionCulling,
+        &vk.samplingMemory,
+        NULL);
     vk.renderPass = createRenderPass(
         vk.device,
         vk.swapchain.format,
         vk.depthImage.format,
         vk.samplingImage.format,
-        vk.physicalDevice.maxSamplingCount);
+        vk.physicalDevice.maxSamplingCount,
+        vk.occlusionCulling ? RENDER_PASS_FIRST : RENDER_PASS_ONLY);
+    if (vk.occlusionCulling)
+    {
+        vk.lateRenderPass = createRenderPass(
+            vk.device,
+            vk.swapchain.format,
+            vk.depthImage.format,
+            vk.samplingImage.format,
+            vk.physicalDevice.maxSamplingCount,
+            RENDER_PASS_LATER);
+    }
     vk.framebuffers = createFramebuffers(
         vk.device,
         vk.renderPass,
@@ -49,19 +79,31 @@ VulkanState initVulkanState(Window *window, const UserConfig *config)
         vk.samplingImage.view);
     vk.descriptorSetLayout = createDescriptorSetLayout(vk.device);
     vk.descriptorPool = createDescriptorPool(vk.device);
+    vk.sampler = createSampler(vk.device, vk.physicalDevice.properties.limits.maxSamplerAnisotropy);
+    vk.textures = createTextureTable(vk.device, vk.sampler, TEXTURE_TABLE_CAPACITY);
     vk.graphicsPipeline = createGraphicsPipeline(
         vk.device,
         vk.renderPass,
         vk.descriptorSetLayout,
+        vk.textures.layout,
         vk.physicalDevice.maxSamplingCount);
 
-    vk.deviceBuffer = createDeviceBuffer(vk.allocator, 1 << 26);
+    vk.devicePool = createDeviceBufferPool(vk.allocator, 1 << 26);
     vk.stagingBuffer = createStagingBuffer(vk.allocator, 1 << 26);
-    vk.uniformBuffer = createUniformBuffer(vk.allocator, 1 << 26);
-
-    vk.sampler = createSampler(vk.device, vk.physicalDevice.properties.limits.maxSamplerAnisotropy);
+    vk.uploads = createUploadContext(
+        vk.device, 
+        vk.graphicsQueue, 
+        vk.physicalDevice.queueFamilyIndices.graphicsQueue, 
+        vk.stagingBuffer);
+    vk.framesInFlight = config->renderer.framesInFlight;
+    vk.uniformRing = createUniformRing(
+        vk.allocator, 
+        UNIFORM_RING_FRAME_SIZE, 
+        vk.framesInFlight, 
+        vk.physicalDevice.properties.limits.minUniformBufferOffsetAlignment);
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++){
+    vk.frameTimeline = createTimelineSemaphore(vk.device, 0);
+    for (size_t i = 0; i < vk.framesInFlight; i++){
         vk.frameSyncers[i] = createFrameSynchroniser(vk.device);
         vk.graphicsCmdPools[i] = createCommandPool(
             vk.device, 
@@ -69,29 +111,26 @@ VulkanState initVulkanState(Window *window, const UserConfig *config)
             VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
     }
 
-    vk.transferCommandPool = createCommandPool(
-        vk.device, 
-        vk.physicalDevice.queueFamilyIndices.transferQueue, 
-        VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
-
     return vk;
 }
 
 void destroyVulkanState(VulkanState *vk)
 {
-    vmaDestroyBuffer(vk->allocator, vk->uniformBuffer.handle, vk->uniformBuffer.alloc);
+    destroyUniformRing(vk->allocator, &vk->uniformRing);
+    destroyUploadContext(&vk->uploads);
+    untrackAllocation(vk->allocator, vk->stagingBuffer.alloc);
     vmaDestroyBuffer(vk->allocator, vk->stagingBuffer.handle, vk->stagingBuffer.alloc);
-    vmaDestroyBuffer(vk->allocator, vk->deviceBuffer.handle, vk->deviceBuffer.alloc);
+    destroyDeviceBufferPool(&vk->devicePool);
 
+    destroyTextureTable(vk->device, &vk->textures);
     vkDestroySampler(vk->device, vk->sampler, NULL);
 
-    vkDestroyCommandPool(vk->device, vk->transferCommandPool, NULL);
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++){
+    for (size_t i = 0; i < vk->framesInFlight; i++){
         vkDestroyCommandPool(vk->device, vk->graphicsCmdPools[i], NULL);
         vkDestroySemaphore(vk->device, vk->frameSyncers[i].imageAvailable, NULL);
         vkDestroySemaphore(vk->device, vk->frameSyncers[i].renderFinished, NULL);
-        vkDestroyFence(vk->device, vk->frameSyncers[i].inFlight, NULL);
     }
+    vkDestroySemaphore(vk->device, vk->frameTimeline, NULL);
 
     vkDestroyPipeline(vk->device, vk->graphicsPipeline.handle, NULL);
     vkDestroyPipelineLayout(vk->device, vk->graphicsPipeline.layout, NULL);
@@ -102,12 +141,14 @@ void destroyVulkanState(VulkanState *vk)
     destroyFramebuffers(vk->device, &vk->framebuffers);
 
     vkDestroyRenderPass(vk->device, vk->renderPass, NULL);
+    if (vk->lateRenderPass)
+        vkDestroyRenderPass(vk->device, vk->lateRenderPass, NULL);
 
-    vkDestroyImageView(vk->device, vk->samplingImage.view, NULL);
-    vmaDestroyImage(vk->allocator, vk->samplingImage.handle, vk->samplingImage.alloc);
+    destroyAttachmentImage(vk->device, &vk->samplingImage);
+    destroyAttachmentMemory(vk->allocator, &vk->samplingMemory);
 
-    vkDestroyImageView(vk->device, vk->depthImage.view, NULL);
-    vmaDestroyImage(vk->allocator, vk->depthImage.handle, vk->depthImage.alloc);
+    destroyAttachmentImage(vk->device, &vk->depthImage);
+    destroyAttachmentMemory(vk->allocator, &vk->depthMemory);
 
     destroySwapchain(vk->device, &vk->swapchain);
     vmaDestroyAllocator(vk->allocator);
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <algorithm>
 #include "vkattachment.h"
+#include "deletion.h"
 #include "vk_mem_alloc.h"
 
 VkSurfaceKHR createSurface(VkInstance instance, GLFWwindow *window)
@@ -84,7 +85,8 @@ SwapchainDetails createSwapchain(
     VkDevice device, 
     const PhysicalDeviceDetails *physicalDevice, 
     VkSurfaceKHR surface, 
-    GLFWwindow *window)
+    GLFWwindow *window,
+    VkSwapchainKHR oldSwapchain)
 {
     SwapchainSupportDetails supportDetails = querySwapchainSupportDetails(physicalDevice->handle, surface);
     VkSurfaceFormatKHR surfaceFormat = selectSurfaceFormat(supportDetails.formatsCount, supportDetails.formats);
@@ -108,7 +110,7 @@ SwapchainDetails createSwapchain(
     createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     createInfo.presentMode = presentMode;
     createInfo.clipped = VK_TRUE;
-    createInfo.oldSwapchain = VK_NULL_HANDLE;
+    createInfo.oldSwapchain = oldSwapchain;
 
     u32 indicesCount = 2;
     uint32_t indices[indicesCount] = {physicalDevice->queueFamilyIndices.graphicsQueue, physicalDevice->queueFamilyIndices.presentQueue};
@@ -171,6 +173,17 @@ void destroySwapchain(VkDevice device, SwapchainDetails *swapchain)
     vkDestroySwapchainKHR(device, swapchain->handle, NULL);
 }
 
+void retireSwapchain(DeletionQueue *deletions, SwapchainDetails *swapchain)
+{
+    for (size_t i = 0; i < swapchain->imagesCount; i++){
+        deferDestroyImageView(deletions, swapchain->imageViews[i]);
+    }
+    free(swapchain->imageViews);
+    free(swapchain->images);
+    deferDestroySwapchain(deletions, swapchain->handle);
+    *swapchain = {};
+}
+
 void recreateSwapchain(
     VmaAllocator allocator,
     VkDevice device,
@@ -179,10 +192,14 @@ void recreateSwapchain(
     GLFWwindow *window,
     VkRenderPass renderPass,
     VkSampleCountFlagBits samplingCount,
+    bool transientAttachments,
     SwapchainDetails *swapchain,
     DeviceImage *depthImage,
     DeviceImage *samplingImage,
-    Framebuffers *framebuffers)
+    AttachmentMemory *depthMemory,
+    AttachmentMemory *samplingMemory,
+    Framebuffers *framebuffers,
+    DeletionQueue *deletions)
 {
     int width = 0, height = 0;
     glfwGetFramebufferSize(window, &width, &height);
@@ -191,19 +208,18 @@ void recreateSwapchain(
         glfwWaitEvents();
     }
 
-    vkDeviceWaitIdle(device);
-
-    destroySwapchain(device, swapchain);
-    *swapchain = createSwapchain(device, physicalDevice, surface, window);
+    //Frames in flight may still be rendering to or presenting the old objects,
+    //so they are left to the deletion queue instead of idling the device
+    SwapchainDetails oldSwapchain = *swapchain;
+    *swapchain = createSwapchain(device, physicalDevice, surface, window, oldSwapchain.handle);
+    retireSwapchain(deletions, &oldSwapchain);
 
-    vkDestroyImageView(device, samplingImage->view, NULL);
-    vmaDestroyImage(allocator, samplingImage->handle, samplingImage->alloc);
-    *samplingImage = createSamplingImage(allocator, device, swapchain->format, swapchain->extent, samplingCount);
+    retireAttachmentImage(deletions, samplingImage);
+    *samplingImage = createSamplingImage(allocator, device, swapchain->format, swapchain->extent, samplingCount, transientAttachments, samplingMemory, deletions);
 
-    vkDestroyImageView(device, depthImage->view, NULL);
-    vmaDestroyImage(allocator, depthImage->handle, depthImage->alloc);
-    *depthImage = createDepthImage(allocator, device, physicalDevice->handle, swapchain->extent, samplingCount);
+    retireAttachmentImage(deletions, depthImage);
+    *depthImage = createDepthImage(allocator, device, physicalDevice->handle, swapchain->extent, samplingCount, transientAttachments, depthMemory, deletions);
 
-    destroyFramebuffers(device, framebuffers);
+    retireFramebuffers(deletions, framebuffers);
     *framebuffers = createFramebuffers(device, renderPass, swapchain, depthImage->view, samplingImage->view);
 }
\ No newline at end of file
@@ -0,0 +1,121 @@
+#include "vktextures.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+TextureTable createTextureTable(VkDevice device, VkSampler sampler, u32 capacity)
+{
+    TextureTable table = {};
+    table.sampler = sampler;
+    table.capacity = capacity;
+
+    VkDescriptorSetLayoutBinding texturesBinding = {};
+    texturesBinding.binding = 0;
+    texturesBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    texturesBinding.descriptorCount = capacity;
+    texturesBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    //Unused slots are never written, and new textures can be written to slots
+    //no frame reads while the set is bound or frames using it are in flight
+    VkDescriptorBindingFlags texturesBindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+        VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO};
+    bindingFlagsInfo.bindingCount = 1;
+    bindingFlagsInfo.pBindingFlags = &texturesBindingFlags;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+    layoutInfo.pNext = &bindingFlagsInfo;
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layoutInfo.bindingCount = 1;
+    layoutInfo.pBindings = &texturesBinding;
+
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, NULL, &table.layout)){
+        fprintf(stderr, "Failed to create Texture Table Descriptor Set Layout\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkDescriptorPoolSize poolSize = {};
+    poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSize.descriptorCount = capacity;
+
+    VkDescriptorPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = 1;
+
+    if (vkCreateDescriptorPool(device, &poolInfo, NULL, &table.pool)){
+        fprintf(stderr, "Failed to create Texture Table Descriptor Pool\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+    allocInfo.descriptorPool = table.pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &table.layout;
+
+    if (vkAllocateDescriptorSets(device, &allocInfo, &table.set)){
+        fprintf(stderr, "Failed to allocate Texture Table Descriptor Set\n");
+        exit(EXIT_FAILURE);
+    }
+
+    table.freeSlots = (u32*)malloc(sizeof(u32)*capacity);
+    if (!table.freeSlots)
+    {
+        fprintf(stderr, "Failed to allocate Texture Table slots\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (u32 i = 0; i < capacity; i++)
+    {
+        table.freeSlots[i] = capacity - 1 - i;//Slot 0 on top
+    }
+    table.freeCount = capacity;
+
+    return table;
+}
+
+void destroyTextureTable(VkDevice device, TextureTable *table)
+{
+    vkDestroyDescriptorPool(device, table->pool, NULL);
+    vkDestroyDescriptorSetLayout(device, table->layout, NULL);
+    free(table->freeSlots);
+    *table = {};
+}
+
+u32 addTableTexture(VkDevice device, TextureTable *table, VkImageView view)
+{
+    if (!table->freeCount)
+    {
+        fprintf(stderr, "Texture Table is full\n");
+        abort();
+    }
+
+    u32 slot = table->freeSlots[--table->freeCount];
+
+    VkDescriptorImageInfo imageInfo = {};
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfo.imageView = view;
+    imageInfo.sampler = table->sampler;
+
+    VkWriteDescriptorSet write = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+    write.dstSet = table->set;
+    write.dstBinding = 0;
+    write.dstArrayElement = slot;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.descriptorCount = 1;
+    write.pImageInfo = &imageInfo;
+
+    vkUpdateDescriptorSets(device, 1, &write, 0, NULL);
+
+    return slot;
+}
+
+void removeTableTexture(TextureTable *table, u32 slot)
+{
+    assert(slot < table->capacity);
+    assert(table->freeCount < table->capacity);
+    table->freeSlots[table->freeCount++] = slot;
+}